@@ -82,6 +82,7 @@
 #include "distributed/remote_transaction.h"
 #include "distributed/resource_lock.h"
 #include "distributed/shard_pruning.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_protocol.h"
 #include "executor/executor.h"
@@ -1830,6 +1831,9 @@ CitusCopyDestReceiverStartup(DestReceiver *dest, int operation,
 	/* Citus currently doesn't know how to handle COPY command locally */
 	ErrorIfTransactionAccessedPlacementsLocally();
 
+	/* cached subplan results that read the table become outdated on commit */
+	InvalidateSubPlanResultsOnCommit(tableId);
+
 	/* look up table properties */
 	Relation distributedRelation = heap_open(tableId, RowExclusiveLock);
 	DistTableCacheEntry *cacheEntry = DistributedTableCacheEntry(tableId);
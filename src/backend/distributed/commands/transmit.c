@@ -119,6 +119,34 @@ SendRegularFile(const char *filename)
 }
 
 
+/*
+ * SendBufferViaCopy sends the given data to stdout using the standard copy
+ * protocol, in the same sized chunks as SendRegularFile, and then ends the
+ * copy protocol.
+ */
+void
+SendBufferViaCopy(StringInfo buffer)
+{
+	const int chunkSize = 32768; /* 32 KB */
+	StringInfoData chunk;
+
+	SendCopyOutStart();
+
+	for (int offset = 0; offset < buffer->len; offset += chunkSize)
+	{
+		/* point into the buffer rather than copying each chunk */
+		chunk.data = buffer->data + offset;
+		chunk.len = Min(chunkSize, buffer->len - offset);
+		chunk.maxlen = chunk.len;
+		chunk.cursor = 0;
+
+		SendCopyData(&chunk);
+	}
+
+	SendCopyDone();
+}
+
+
 /* Helper function that deallocates string info object. */
 void
 FreeStringInfo(StringInfo stringInfo)
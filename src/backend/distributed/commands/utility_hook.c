@@ -52,6 +52,7 @@
 #include "distributed/multi_executor.h"
 #include "distributed/multi_explain.h"
 #include "distributed/resource_lock.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/transmit.h"
 #include "distributed/version_compat.h"
 #include "distributed/worker_transaction.h"
@@ -686,6 +687,9 @@ ExecuteDistributedDDLJob(DDLJob *ddlJob)
 		 */
 		shouldSyncMetadata = ShouldSyncTableMetadata(ddlJob->targetRelationId);
 		EnsurePartitionTableNotReplicated(ddlJob->targetRelationId);
+
+		/* the result of queries on the table may change with its definition */
+		InvalidateSubPlanResultsOnCommit(ddlJob->targetRelationId);
 	}
 
 
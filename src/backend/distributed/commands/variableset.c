@@ -19,6 +19,7 @@
 #include "distributed/transaction_management.h"
 #include "distributed/version_compat.h"
 #include "storage/lmgr.h"
+#include "tcop/tcopprot.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "lib/ilist.h"
@@ -129,6 +130,7 @@ PostprocessVariableSetStmt(VariableSetStmt *setStmt, const char *setStmtString)
 	{
 		MemoryContext old_context = MemoryContextSwitchTo(CurTransactionContext);
 		activeSetStmts = makeStringInfo();
+		activeSetStmtCount = 0;
 		MemoryContextSwitchTo(old_context);
 	}
 
@@ -174,6 +176,12 @@ PostprocessVariableSetStmt(VariableSetStmt *setStmt, const char *setStmtString)
 	/* SET propagation successful: add to active SET stmt string */
 	appendStringInfoString(activeSetStmts, setStmtString);
 
+	/*
+	 * The string might contain several statements, count them such that the
+	 * results can be told apart when it is replayed along with BEGIN.
+	 */
+	activeSetStmtCount += list_length(pg_parse_query(setStmtString));
+
 	/* ensure semicolon on end to allow appending future SET stmts */
 	if (!pg_str_endswith(setStmtString, ";"))
 	{
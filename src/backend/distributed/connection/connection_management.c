@@ -23,23 +23,44 @@
 #include "distributed/memutils.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/hash_helpers.h"
+#include "distributed/listutils.h"
 #include "distributed/placement_connection.h"
 #include "distributed/run_from_same_connection.h"
 #include "distributed/cancel_utils.h"
 #include "distributed/remote_commands.h"
+#include "distributed/shared_connection_stats.h"
 #include "distributed/version_compat.h"
+#include "distributed/worker_manager.h"
 #include "mb/pg_wchar.h"
+#include "storage/ipc.h"
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 
 
+/* backoff of connection prewarming after failures, doubling up to the maximum */
+#define PREWARM_MIN_BACKOFF_MS 1000
+#define PREWARM_MAX_BACKOFF_MS (60 * 1000)
+#define MAX_PREWARM_BACKOFF_SHIFT 6
+
+
 int NodeConnectionTimeout = 5000;
 int MaxCachedConnectionsPerWorker = 1;
+int PrewarmConnectionsPerWorker = 0;
 
 HTAB *ConnectionHash = NULL;
 HTAB *ConnParamsHash = NULL;
 MemoryContext ConnectionContext = NULL;
 
+/* whether the next PrewarmConnections call should top up the connection cache */
+static bool PrewarmConnectionsPending = false;
+
+/* whether some prewarmed connections may still be establishing */
+static bool PrewarmedConnectionsEstablishing = false;
+
+/* consecutive failures of prewarmed connections, and when to try again */
+static int PrewarmFailureCount = 0;
+static TimestampTz PrewarmRetryTime = 0;
+
 static uint32 ConnectionHashHash(const void *key, Size keysize);
 static int ConnectionHashCompare(const void *a, const void *b, Size keysize);
 static MultiConnection * StartConnectionEstablishment(ConnectionHashKey *key);
@@ -53,6 +74,15 @@ static MultiConnection * FindAvailableConnection(dlist_head *connections, uint32
 static void GivePurposeToConnection(MultiConnection *connection, int flags);
 static bool RemoteTransactionIdle(MultiConnection *connection);
 static int EventSetSizeForConnectionList(List *connections);
+static bool ReserveSharedConnection(uint32 flags, ConnectionHashKey *key,
+									dlist_head *connections,
+									bool *sharedCounterIncremented);
+static bool HoldsSharedConnection(dlist_head *connections);
+static void ReleaseSharedConnection(MultiConnection *connection);
+static void ReleaseSharedConnectionsAtExit(int code, Datum arg);
+static void PollPrewarmedConnections(void);
+static bool PrewarmedConnectionEstablishing(MultiConnection *connection);
+static bool IsCitusInitiatedBackend(void);
 
 /* types for async connection management */
 enum MultiConnectionPhase
@@ -165,6 +195,259 @@ AfterXactConnectionHandling(bool isCommit)
 }
 
 
+/*
+ * RequestConnectionPrewarming makes the next PrewarmConnections call top up the
+ * connection cache, i.e. once Citus is first used in the session and after
+ * the set of workers or citus.prewarm_connections_per_worker changed.
+ */
+void
+RequestConnectionPrewarming(void)
+{
+	PrewarmConnectionsPending = true;
+}
+
+
+/*
+ * PrewarmConnections starts establishing connections to the workers, such that
+ * the connection cache holds citus.prewarm_connections_per_worker connections
+ * per worker for the current user and database. This only initiates the
+ * connections; they are progressed by later PrewarmConnections calls, and the
+ * executor picks them up in whatever state they are. New client sessions thus
+ * do not pay connection establishment (and TLS handshakes) on their first
+ * multi-shard query.
+ *
+ * Prewarming only happens when requested through RequestConnectionPrewarming,
+ * such that most calls return right away. Connections that are closed later
+ * on are not replaced. When prewarmed connections fail, we try again after a
+ * backoff that doubles with every consecutive failure.
+ *
+ * Prewarmed connections do not wait for the shared connection budget and are
+ * skipped when it is exhausted.
+ */
+void
+PrewarmConnections(void)
+{
+	if (PrewarmedConnectionsEstablishing)
+	{
+		PollPrewarmedConnections();
+	}
+
+	if (!PrewarmConnectionsPending || PrewarmConnectionsPerWorker <= 0)
+	{
+		return;
+	}
+
+	if (PrewarmFailureCount > 0 && GetCurrentTimestamp() < PrewarmRetryTime)
+	{
+		/* a worker could not be reached recently, do not hammer it */
+		return;
+	}
+
+	PrewarmConnectionsPending = false;
+
+	if (IsCitusInitiatedBackend())
+	{
+		/* internal backends do not cache connections */
+		return;
+	}
+
+	int32 localGroupId = GetLocalGroupId();
+	List *workerNodeList = ActivePrimaryWorkerNodeList(NoLock);
+
+	WorkerNode *workerNode = NULL;
+	foreach_ptr(workerNode, workerNodeList)
+	{
+		ConnectionHashKey key;
+		bool found = false;
+		int cachedConnectionCount = 0;
+		dlist_iter iter;
+
+		if (workerNode->groupId == localGroupId)
+		{
+			continue;
+		}
+
+		memset(&key, 0, sizeof(ConnectionHashKey));
+		strlcpy(key.hostname, workerNode->workerName, MAX_NODE_LENGTH);
+		key.port = workerNode->workerPort;
+		strlcpy(key.user, CurrentUserName(), NAMEDATALEN);
+		strlcpy(key.database, CurrentDatabaseName(), NAMEDATALEN);
+
+		ConnectionHashEntry *entry = hash_search(ConnectionHash, &key, HASH_FIND,
+												 &found);
+		if (found)
+		{
+			dlist_foreach(iter, entry->connections)
+			{
+				cachedConnectionCount++;
+			}
+		}
+
+		for (; cachedConnectionCount < PrewarmConnectionsPerWorker;
+			 cachedConnectionCount++)
+		{
+			int connectionFlags = FORCE_NEW_CONNECTION | OPTIONAL_CONNECTION;
+
+			MultiConnection *connection =
+				StartNodeUserDatabaseConnection(connectionFlags, workerNode->workerName,
+												workerNode->workerPort, NULL, NULL);
+			if (connection == NULL)
+			{
+				/* shared connection budget is exhausted */
+				break;
+			}
+
+			/* libpq expects the socket to become writable first */
+			connection->prewarmed = true;
+			connection->waitFlags = WL_SOCKET_WRITEABLE;
+			PrewarmedConnectionsEstablishing = true;
+		}
+	}
+}
+
+
+/*
+ * PollPrewarmedConnections progresses the establishment of the prewarmed
+ * connections that are not in use. Only connections whose socket is ready are
+ * polled, which we check without waiting for the network.
+ */
+static void
+PollPrewarmedConnections(void)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry;
+	List *establishingConnectionList = NIL;
+	bool establishing = false;
+	bool failed = false;
+	bool succeeded = false;
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			if (!PrewarmedConnectionEstablishing(connection) ||
+				connection->claimedExclusively)
+			{
+				continue;
+			}
+
+			establishingConnectionList = lappend(establishingConnectionList,
+												 connection);
+		}
+	}
+
+	int connectionCount = list_length(establishingConnectionList);
+	if (connectionCount == 0)
+	{
+		PrewarmedConnectionsEstablishing = false;
+		return;
+	}
+
+	/* the wait event set is freed along with the temporary context */
+	MemoryContext pollContext =
+		AllocSetContextCreate(CurrentMemoryContext, "prewarmed connection poll context",
+							  ALLOCSET_SMALL_SIZES);
+	MemoryContext oldContext = MemoryContextSwitchTo(pollContext);
+
+	WaitEventSet *waitEventSet = CreateWaitEventSet(pollContext, connectionCount);
+	EnsureReleaseResource((MemoryContextCallbackFunction) (&FreeWaitEventSet),
+						  waitEventSet);
+
+	MultiConnection *connection = NULL;
+	foreach_ptr(connection, establishingConnectionList)
+	{
+		AddWaitEventToSet(waitEventSet, connection->waitFlags,
+						  PQsocket(connection->pgConn), NULL, connection);
+	}
+
+	WaitEvent *events = palloc0(connectionCount * sizeof(WaitEvent));
+	int eventCount = WaitEventSetWait(waitEventSet, 0, events, connectionCount,
+									  WAIT_EVENT_CLIENT_READ);
+
+	for (int eventIndex = 0; eventIndex < eventCount; eventIndex++)
+	{
+		connection = (MultiConnection *) events[eventIndex].user_data;
+
+		/* a failed connection is closed when it is found or at transaction end */
+		PostgresPollingStatusType pollStatus = PQconnectPoll(connection->pgConn);
+
+		if (pollStatus == PGRES_POLLING_FAILED)
+		{
+			failed = true;
+		}
+		else if (pollStatus == PGRES_POLLING_OK)
+		{
+			succeeded = true;
+		}
+		else if (pollStatus == PGRES_POLLING_READING)
+		{
+			connection->waitFlags = WL_SOCKET_READABLE;
+		}
+		else
+		{
+			connection->waitFlags = WL_SOCKET_WRITEABLE;
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+	MemoryContextDelete(pollContext);
+
+	foreach_ptr(connection, establishingConnectionList)
+	{
+		if (PrewarmedConnectionEstablishing(connection))
+		{
+			establishing = true;
+			break;
+		}
+	}
+
+	list_free(establishingConnectionList);
+
+	PrewarmedConnectionsEstablishing = establishing;
+
+	if (failed)
+	{
+		int shift = Min(PrewarmFailureCount, MAX_PREWARM_BACKOFF_SHIFT);
+		int backoffMs = Min(PREWARM_MIN_BACKOFF_MS << shift, PREWARM_MAX_BACKOFF_MS);
+
+		PrewarmFailureCount++;
+		PrewarmRetryTime = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+													   backoffMs);
+
+		/* replace the failed connections once the backoff passed */
+		PrewarmConnectionsPending = true;
+	}
+	else if (succeeded)
+	{
+		PrewarmFailureCount = 0;
+	}
+}
+
+
+/*
+ * PrewarmedConnectionEstablishing returns whether the connection is opened by
+ * PrewarmConnections and is neither established nor failed yet.
+ */
+static bool
+PrewarmedConnectionEstablishing(MultiConnection *connection)
+{
+	if (!connection->prewarmed || connection->pgConn == NULL)
+	{
+		return false;
+	}
+
+	ConnStatusType status = PQstatus(connection->pgConn);
+
+	return status != CONNECTION_OK && status != CONNECTION_BAD;
+}
+
+
 /*
  * GetNodeConnection() establishes a connection to remote node, using default
  * user and database.
@@ -244,6 +527,8 @@ StartWorkerListConnections(List *workerNodeList, uint32 flags, const char *user,
  * If user or database are NULL, the current session's defaults are used. The
  * following flags influence connection establishment behaviour:
  * - FORCE_NEW_CONNECTION - a new connection is required
+ * - OPTIONAL_CONNECTION - return NULL rather than waiting if a new connection
+ *   would exceed the shared connection budget of the node
  *
  * The returned connection has only been initiated, not fully
  * established. That's useful to allow parallel connection establishment. If
@@ -310,6 +595,17 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 		connection = FindAvailableConnection(entry->connections, flags);
 		if (connection)
 		{
+			/*
+			 * Cached connections keep their slot in the shared connection
+			 * budget, unless they were opened while the budget was disabled.
+			 */
+			if (!connection->sharedCounterIncremented &&
+				!ReserveSharedConnection(flags, &key, entry->connections,
+										 &connection->sharedCounterIncremented))
+			{
+				return NULL;
+			}
+
 			GivePurposeToConnection(connection, flags);
 
 			return connection;
@@ -318,10 +614,18 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 
 	/*
 	 * Either no caching desired, or no pre-established, non-claimed,
-	 * connection present. Initiate connection establishment.
+	 * connection present. Initiate connection establishment, once there
+	 * is room for another connection to the node.
 	 */
+	bool sharedCounterIncremented = false;
+	if (!ReserveSharedConnection(flags, &key, entry->connections,
+								 &sharedCounterIncremented))
+	{
+		return NULL;
+	}
 
 	connection = StartConnectionEstablishment(&key);
+	connection->sharedCounterIncremented = sharedCounterIncremented;
 
 	dlist_push_tail(entry->connections, &connection->connectionNode);
 
@@ -332,6 +636,122 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 }
 
 
+/*
+ * ReserveSharedConnection reserves a slot in the shared connection budget of
+ * the node for a new or reused connection. With OPTIONAL_CONNECTION, false is
+ * returned if the budget is exhausted, otherwise we wait for other backends to
+ * finish using their connections to the node. sharedCounterIncremented is set
+ * to whether the connection was actually counted, which is not the case when
+ * the budget is disabled or the node cannot be tracked.
+ */
+static bool
+ReserveSharedConnection(uint32 flags, ConnectionHashKey *key, dlist_head *connections,
+						bool *sharedCounterIncremented)
+{
+	static bool registeredExitCallback = false;
+
+	if (flags & OPTIONAL_CONNECTION)
+	{
+		if (!TryToIncrementSharedConnectionCounter(key->hostname, key->port,
+												   sharedCounterIncremented))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		bool holdsConnection = HoldsSharedConnection(connections);
+
+		*sharedCounterIncremented =
+			WaitLoopForSharedConnection(key->hostname, key->port, holdsConnection);
+	}
+
+	if (!registeredExitCallback)
+	{
+		/* release the slots of connections that are still open at exit */
+		before_shmem_exit(ReleaseSharedConnectionsAtExit, 0);
+		registeredExitCallback = true;
+	}
+
+	return true;
+}
+
+
+/*
+ * HoldsSharedConnection returns whether any of the given connections holds a
+ * slot in the shared connection budget.
+ */
+static bool
+HoldsSharedConnection(dlist_head *connections)
+{
+	dlist_iter iter;
+
+	dlist_foreach(iter, connections)
+	{
+		MultiConnection *connection =
+			dlist_container(MultiConnection, connectionNode, iter.cur);
+
+		if (connection->sharedCounterIncremented)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * ReleaseSharedConnection returns the slot of the connection in the shared
+ * connection budget, if it holds one. The connection no longer runs a task
+ * at that point either.
+ */
+static void
+ReleaseSharedConnection(MultiConnection *connection)
+{
+	FinishSharedRunningTask(connection);
+
+	if (!connection->sharedCounterIncremented)
+	{
+		return;
+	}
+
+	DecrementSharedConnectionCounter(connection->hostname, connection->port);
+	connection->sharedCounterIncremented = false;
+}
+
+
+/*
+ * ReleaseSharedConnectionsAtExit returns the slots of all connections that are
+ * still open when the backend exits.
+ */
+static void
+ReleaseSharedConnectionsAtExit(int code, Datum arg)
+{
+	HASH_SEQ_STATUS status;
+	ConnectionHashEntry *entry;
+
+	if (ConnectionHash == NULL)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, ConnectionHash);
+	while ((entry = (ConnectionHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		dlist_iter iter;
+
+		dlist_foreach(iter, entry->connections)
+		{
+			MultiConnection *connection =
+				dlist_container(MultiConnection, connectionNode, iter.cur);
+
+			ReleaseSharedConnection(connection);
+		}
+	}
+}
+
+
 /*
  * FindAvailableConnection searches the given list of connections for one that
  * is not claimed exclusively or marked as a side channel. If the caller passed
@@ -344,13 +764,23 @@ StartNodeUserDatabaseConnection(uint32 flags, const char *hostname, int32 port,
 static MultiConnection *
 FindAvailableConnection(dlist_head *connections, uint32 flags)
 {
-	dlist_iter iter;
+	dlist_mutable_iter iter;
 
-	dlist_foreach(iter, connections)
+	dlist_foreach_modify(iter, connections)
 	{
 		MultiConnection *connection =
 			dlist_container(MultiConnection, connectionNode, iter.cur);
 
+		if (connection->prewarmed && !connection->claimedExclusively &&
+			PQstatus(connection->pgConn) == CONNECTION_BAD &&
+			connection->remoteTransaction.transactionState ==
+			REMOTE_TRANS_NOT_STARTED)
+		{
+			/* prewarmed connection failed before its first use, do not hand it out */
+			CloseConnection(connection);
+			continue;
+		}
+
 		if (flags & OUTSIDE_TRANSACTION)
 		{
 			/* don't return connections that are used in transactions */
@@ -463,6 +893,7 @@ CloseConnection(MultiConnection *connection)
 	/* close connection */
 	PQfinish(connection->pgConn);
 	connection->pgConn = NULL;
+	ReleaseSharedConnection(connection);
 
 	strlcpy(key.hostname, connection->hostname, MAX_NODE_LENGTH);
 	key.port = connection->port;
@@ -513,6 +944,7 @@ ShutdownConnection(MultiConnection *connection)
 	}
 	PQfinish(connection->pgConn);
 	connection->pgConn = NULL;
+	ReleaseSharedConnection(connection);
 }
 
 
@@ -876,6 +1308,7 @@ CloseNotReadyMultiConnectionStates(List *connectionStates)
 		/* close connection, otherwise we take up resource on the other side */
 		PQfinish(connection->pgConn);
 		connection->pgConn = NULL;
+		ReleaseSharedConnection(connection);
 	}
 }
 
@@ -1107,32 +1540,52 @@ AfterXactHostConnectionHandling(ConnectionHashEntry *entry, bool isCommit)
 /*
  * ShouldShutdownConnection returns true if either one of the followings is true:
  * - The connection is citus initiated.
- * - Current cached connections is already at MaxCachedConnectionPerWorker
+ * - Current cached connections is already at MaxCachedConnectionPerWorker (or
+ *   PrewarmConnectionsPerWorker, if higher)
  * - Connection is forced to close at the end of transaction
- * - Connection is not in OK state
+ * - The shared connection budget of the node is used up or awaited by others
+ * - Connection is not in OK state, unless it is a prewarmed connection that is
+ *   still being established
  * - A transaction is still in progress (usually because we are cancelling a distributed transaction)
  */
 static bool
 ShouldShutdownConnection(MultiConnection *connection, const int cachedConnectionCount)
 {
-	bool isCitusInitiatedBackend = false;
+	bool connectionUsable = false;
 
-	/*
-	 * When we are in a backend that was created to serve an internal connection
-	 * from the coordinator or another worker, we disable connection caching to avoid
-	 * escalating the number of cached connections. We can recognize such backends
-	 * from their application name.
-	 */
-	if (application_name != NULL && strcmp(application_name, CITUS_APPLICATION_NAME) == 0)
+	if (PrewarmedConnectionEstablishing(connection))
+	{
+		/* prewarmed connections are kept while they are being established */
+		connectionUsable = true;
+	}
+	else
 	{
-		isCitusInitiatedBackend = true;
+		connectionUsable = PQstatus(connection->pgConn) == CONNECTION_OK &&
+						   RemoteTransactionIdle(connection);
 	}
 
-	return isCitusInitiatedBackend ||
-		   cachedConnectionCount >= MaxCachedConnectionsPerWorker ||
+	return IsCitusInitiatedBackend() ||
+		   cachedConnectionCount >= Max(MaxCachedConnectionsPerWorker,
+										PrewarmConnectionsPerWorker) ||
 		   connection->forceCloseAtTransactionEnd ||
-		   PQstatus(connection->pgConn) != CONNECTION_OK ||
-		   !RemoteTransactionIdle(connection);
+		   (connection->sharedCounterIncremented &&
+			SharedConnectionBudgetExhausted(connection->hostname, connection->port)) ||
+		   !connectionUsable;
+}
+
+
+/*
+ * IsCitusInitiatedBackend returns whether we are in a backend that was created
+ * to serve an internal connection from the coordinator or another worker, in
+ * which case we disable connection caching to avoid escalating the number of
+ * cached connections. We can recognize such backends from their application
+ * name.
+ */
+static bool
+IsCitusInitiatedBackend(void)
+{
+	return application_name != NULL &&
+		   strcmp(application_name, CITUS_APPLICATION_NAME) == 0;
 }
 
 
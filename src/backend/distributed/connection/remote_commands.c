@@ -459,11 +459,14 @@ ExecuteOptionalRemoteCommand(MultiConnection *connection, const char *command,
  * send commands asynchronously without blocking (at the potential expense of
  * an additional memory allocation). The command string can only include a single
  * command since PQsendQueryParams() supports only that.
+ *
+ * When binaryResults is true, the remote node is asked to return the result
+ * columns in binary format instead of text.
  */
 int
 SendRemoteCommandParams(MultiConnection *connection, const char *command,
 						int parameterCount, const Oid *parameterTypes,
-						const char *const *parameterValues)
+						const char *const *parameterValues, bool binaryResults)
 {
 	PGconn *pgConn = connection->pgConn;
 
@@ -480,8 +483,10 @@ SendRemoteCommandParams(MultiConnection *connection, const char *command,
 
 	Assert(PQisnonblocking(pgConn));
 
+	int resultFormat = binaryResults ? 1 : 0;
+
 	int rc = PQsendQueryParams(pgConn, command, parameterCount, parameterTypes,
-							   parameterValues, NULL, NULL, 0);
+							   parameterValues, NULL, NULL, resultFormat);
 
 	return rc;
 }
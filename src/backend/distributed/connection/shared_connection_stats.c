@@ -0,0 +1,656 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.c
+ *   Keeps track of the number of connections from this node to each worker,
+ *   across all backends.
+ *
+ * Every backend independently opens connections to the workers, which means
+ * that with many concurrent client sessions the total number of connections
+ * to a worker easily exceeds its max_connections. Connection establishment
+ * therefore first reserves a slot in a shared counter per worker, and waits
+ * for a slot to be released by another backend if all citus.max_shared_pool_size
+ * slots are taken. Connections that are only nice to have (e.g. additional
+ * connections of the adaptive executor) are not established at all when the
+ * budget is exhausted.
+ *
+ * Together this multiplexes the sessions of all backends onto a bounded number
+ * of connections per worker at transaction granularity: a backend normally
+ * keeps (caches) its connections after a transaction, and they keep counting
+ * towards the budget, but they are closed instead when other backends are
+ * waiting for the budget of the worker or the budget is used up, such that
+ * the slots go to whoever runs the next transaction. Backends do not wait
+ * longer than citus.node_connection_timeout for a slot.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+#include "pgstat.h"
+
+#include "miscadmin.h"
+
+#include "distributed/connection_management.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/tuplestore.h"
+#include "distributed/worker_manager.h"
+#include "storage/condition_variable.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+
+
+#define REMOTE_CONNECTION_STATS_COLUMNS 3
+
+/* sentinel value of citus.max_shared_pool_size to disable the budget */
+#define DISABLE_SHARED_POOL_SIZE -1
+
+
+/*
+ * SharedConnStatsHashKey identifies a worker in SharedConnStatsHash.
+ */
+typedef struct SharedConnStatsHashKey
+{
+	char hostname[MAX_NODE_LENGTH];
+	int32 port;
+} SharedConnStatsHashKey;
+
+
+/*
+ * SharedConnStatsHashEntry holds the number of connections from all backends
+ * of this node to a worker.
+ */
+typedef struct SharedConnStatsHashEntry
+{
+	SharedConnStatsHashKey key;
+	int connectionCount;
+
+	/* number of backends waiting in WaitLoopForSharedConnection */
+	int waitingBackendCount;
+
+	/* number of connections currently running a task, see StartSharedRunningTask */
+	int runningTaskCount;
+} SharedConnStatsHashEntry;
+
+
+/*
+ * SharedConnStatsControlData holds the lock that protects SharedConnStatsHash
+ * and the condition variable on which backends wait for connection slots.
+ */
+typedef struct SharedConnStatsControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+	ConditionVariable waitersConditionVariable;
+} SharedConnStatsControlData;
+
+
+/*
+ * GUC, maximum number of connections from this node to a single worker. 0
+ * means max_connections of this node, -1 disables the budget.
+ */
+int MaxSharedPoolSize = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static SharedConnStatsControlData *SharedConnStatsControl = NULL;
+static HTAB *SharedConnStatsHash = NULL;
+
+
+static size_t SharedConnectionStatsShmemSize(void);
+static void SharedConnectionStatsShmemInit(void);
+static void BuildSharedConnStatsHashKey(SharedConnStatsHashKey *key,
+										const char *hostname, int port);
+static void AdjustWaitingBackendCount(const char *hostname, int port, int delta);
+
+
+PG_FUNCTION_INFO_V1(citus_remote_connection_stats);
+
+
+/*
+ * citus_remote_connection_stats returns the number of connections from all
+ * backends of this node to each worker.
+ */
+Datum
+citus_remote_connection_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	HASH_SEQ_STATUS status;
+	SharedConnStatsHashEntry *entry = NULL;
+
+	CheckCitusVersion(ERROR);
+
+	Tuplestorestate *tupleStore = SetupTuplestore(fcinfo, &tupleDescriptor);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_SHARED);
+
+	hash_seq_init(&status, SharedConnStatsHash);
+	while ((entry = (SharedConnStatsHashEntry *) hash_seq_search(&status)) != 0)
+	{
+		Datum values[REMOTE_CONNECTION_STATS_COLUMNS];
+		bool isNulls[REMOTE_CONNECTION_STATS_COLUMNS];
+
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[0] = PointerGetDatum(cstring_to_text(entry->key.hostname));
+		values[1] = Int32GetDatum(entry->key.port);
+		values[2] = Int32GetDatum(entry->connectionCount);
+
+		tuplestore_putvalues(tupleStore, tupleDescriptor, values, isNulls);
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+
+	tuplestore_donestoring(tupleStore);
+
+	PG_RETURN_VOID();
+}
+
+
+/*
+ * InitializeSharedConnectionStats, called at server start, requests the shared
+ * memory for the connection counters.
+ */
+void
+InitializeSharedConnectionStats(void)
+{
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedConnectionStatsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedConnectionStatsShmemInit;
+}
+
+
+/*
+ * SharedConnectionStatsShmemSize computes the size of the shared memory for the
+ * connection counters.
+ */
+static size_t
+SharedConnectionStatsShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(SharedConnStatsControlData));
+	size = add_size(size, hash_estimate_size(MaxWorkerNodesTracked,
+											 sizeof(SharedConnStatsHashEntry)));
+
+	return size;
+}
+
+
+/*
+ * SharedConnectionStatsShmemInit initializes the shared memory for the
+ * connection counters.
+ */
+static void
+SharedConnectionStatsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedConnStatsControl =
+		(SharedConnStatsControlData *) ShmemInitStruct(
+			"Citus Shared Connection Stats",
+			sizeof(SharedConnStatsControlData),
+			&alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		SharedConnStatsControl->trancheId = LWLockNewTrancheId();
+		SharedConnStatsControl->lockTrancheName = "Citus Shared Connection Stats";
+		LWLockRegisterTranche(SharedConnStatsControl->trancheId,
+							  SharedConnStatsControl->lockTrancheName);
+
+		LWLockInitialize(&SharedConnStatsControl->lock,
+						 SharedConnStatsControl->trancheId);
+
+		ConditionVariableInit(&SharedConnStatsControl->waitersConditionVariable);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(SharedConnStatsHashKey);
+	hashInfo.entrysize = sizeof(SharedConnStatsHashEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	SharedConnStatsHash = ShmemInitHash("Citus Shared Connection Stats Hash",
+										MaxWorkerNodesTracked,
+										MaxWorkerNodesTracked,
+										&hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * GetMaxSharedPoolSize returns the maximum number of connections from this
+ * node to a single worker, or DISABLE_SHARED_POOL_SIZE if there is no limit.
+ */
+int
+GetMaxSharedPoolSize(void)
+{
+	if (MaxSharedPoolSize == 0)
+	{
+		return MaxConnections;
+	}
+
+	return MaxSharedPoolSize;
+}
+
+
+/*
+ * TryToIncrementSharedConnectionCounter reserves a connection slot for the
+ * given worker, and returns false if all slots are taken.
+ *
+ * Connections are always allowed when the budget is disabled, or when the
+ * worker cannot be tracked because the hash is full. In those cases the
+ * connection is not counted and counterIncremented is set to false. Only if
+ * it is set to true, the caller should call DecrementSharedConnectionCounter
+ * once the connection is closed.
+ */
+bool
+TryToIncrementSharedConnectionCounter(const char *hostname, int port,
+									  bool *counterIncremented)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+	bool connectionAllowed = false;
+	int maxSharedPoolSize = GetMaxSharedPoolSize();
+
+	*counterIncremented = false;
+
+	if (maxSharedPoolSize == DISABLE_SHARED_POOL_SIZE || SharedConnStatsHash == NULL)
+	{
+		return true;
+	}
+
+	BuildSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_ENTER_NULL, &found);
+	if (entry == NULL)
+	{
+		LWLockRelease(&SharedConnStatsControl->lock);
+
+		ereport(DEBUG4, (errmsg("could not track the connections to %s:%d",
+								hostname, port)));
+		return true;
+	}
+
+	if (!found)
+	{
+		entry->connectionCount = 0;
+		entry->waitingBackendCount = 0;
+		entry->runningTaskCount = 0;
+	}
+
+	if (entry->connectionCount < maxSharedPoolSize)
+	{
+		entry->connectionCount++;
+		connectionAllowed = true;
+		*counterIncremented = true;
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+
+	return connectionAllowed;
+}
+
+
+/*
+ * WaitLoopForSharedConnection reserves a connection slot for the given worker,
+ * waiting for other backends to release theirs if all slots are taken.
+ *
+ * A backend that already holds connections to the worker might be the one
+ * everyone else is waiting for (e.g. in a multi-statement transaction), so in
+ * that case the slot is taken regardless of the budget rather than risking a
+ * self-deadlock.
+ *
+ * Otherwise the wait is bounded by citus.node_connection_timeout, after which
+ * we error out rather than hang behind long-running transactions of other
+ * backends.
+ *
+ * The function returns whether the connection was counted, see
+ * TryToIncrementSharedConnectionCounter.
+ */
+bool
+WaitLoopForSharedConnection(const char *hostname, int port, bool holdsConnection)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+	bool counterIncremented = false;
+
+	if (TryToIncrementSharedConnectionCounter(hostname, port, &counterIncremented))
+	{
+		return counterIncremented;
+	}
+
+	if (holdsConnection)
+	{
+		BuildSharedConnStatsHashKey(&key, hostname, port);
+
+		LWLockAcquire(&SharedConnStatsControl->lock, LW_EXCLUSIVE);
+
+		/* the entry exists, otherwise the increment above would have succeeded */
+		SharedConnStatsHashEntry *entry =
+			(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+													 HASH_FIND, &found);
+		Assert(found);
+		entry->connectionCount++;
+
+		LWLockRelease(&SharedConnStatsControl->lock);
+
+		return true;
+	}
+
+	/* signal to the other backends that they should not cache connections */
+	AdjustWaitingBackendCount(hostname, port, 1);
+
+	PG_TRY();
+	{
+		TimestampTz waitStartTime = GetCurrentTimestamp();
+
+		/*
+		 * ConditionVariableSleep does not take a timeout, so we wait on our
+		 * latch ourselves. ConditionVariableBroadcast removes us from the
+		 * wakeup list when it sets the latch, hence we prepare to sleep again
+		 * before every attempt.
+		 */
+		ConditionVariablePrepareToSleep(
+			&SharedConnStatsControl->waitersConditionVariable);
+
+		while (!TryToIncrementSharedConnectionCounter(hostname, port,
+													  &counterIncremented))
+		{
+			long secs = 0;
+			int microsecs = 0;
+
+			TimestampDifference(waitStartTime, GetCurrentTimestamp(), &secs,
+								&microsecs);
+
+			long remainingMillis = NodeConnectionTimeout -
+								   (secs * 1000 + microsecs / 1000);
+			if (remainingMillis <= 0)
+			{
+				ereport(ERROR, (errcode(ERRCODE_TOO_MANY_CONNECTIONS),
+								errmsg("could not reserve a connection to %s:%d "
+									   "within %d ms", hostname, port,
+									   NodeConnectionTimeout),
+								errdetail("All citus.max_shared_pool_size "
+										  "connections to the node are in use "
+										  "by other transactions."),
+								errhint("Consider increasing "
+										"citus.max_shared_pool_size or "
+										"citus.node_connection_timeout.")));
+			}
+
+			int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT |
+							   WL_POSTMASTER_DEATH, remainingMillis,
+							   PG_WAIT_EXTENSION);
+			if (rc & WL_POSTMASTER_DEATH)
+			{
+				ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+			}
+
+			ResetLatch(MyLatch);
+
+			/* the wait can be cancelled */
+			CHECK_FOR_INTERRUPTS();
+
+			ConditionVariablePrepareToSleep(
+				&SharedConnStatsControl->waitersConditionVariable);
+		}
+
+		ConditionVariableCancelSleep();
+	}
+	PG_CATCH();
+	{
+		AdjustWaitingBackendCount(hostname, port, -1);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	AdjustWaitingBackendCount(hostname, port, -1);
+
+	return counterIncremented;
+}
+
+
+/*
+ * SharedConnectionBudgetExhausted returns whether all connection slots for the
+ * given worker are taken or other backends are waiting for one, in which case
+ * connections to the worker should not be kept open beyond the transaction.
+ */
+bool
+SharedConnectionBudgetExhausted(const char *hostname, int port)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+	bool budgetExhausted = false;
+	int maxSharedPoolSize = GetMaxSharedPoolSize();
+
+	if (maxSharedPoolSize == DISABLE_SHARED_POOL_SIZE || SharedConnStatsHash == NULL)
+	{
+		return false;
+	}
+
+	BuildSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_SHARED);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_FIND, &found);
+	if (found)
+	{
+		budgetExhausted = entry->waitingBackendCount > 0 ||
+						  entry->connectionCount >= maxSharedPoolSize;
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+
+	return budgetExhausted;
+}
+
+
+/*
+ * StartSharedRunningTask counts the given connection as running a task on its
+ * worker until FinishSharedRunningTask is called for it, which happens at the
+ * latest when the connection is reset at the end of the transaction or closed.
+ * Unlike the connection counters, this only counts connections that are busy,
+ * which lets the least-latency task assignment policy avoid workers that are
+ * loaded by other backends.
+ */
+void
+StartSharedRunningTask(MultiConnection *connection)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+
+	if (connection->runningTaskCounted || SharedConnStatsHash == NULL)
+	{
+		return;
+	}
+
+	BuildSharedConnStatsHashKey(&key, connection->hostname, connection->port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_ENTER_NULL, &found);
+	if (entry != NULL)
+	{
+		if (!found)
+		{
+			entry->connectionCount = 0;
+			entry->waitingBackendCount = 0;
+			entry->runningTaskCount = 0;
+		}
+
+		entry->runningTaskCount++;
+		connection->runningTaskCounted = true;
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+}
+
+
+/*
+ * FinishSharedRunningTask stops counting the given connection as running a
+ * task, if it was counted.
+ */
+void
+FinishSharedRunningTask(MultiConnection *connection)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+
+	if (!connection->runningTaskCounted)
+	{
+		return;
+	}
+
+	BuildSharedConnStatsHashKey(&key, connection->hostname, connection->port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_FIND, &found);
+	if (found && entry->runningTaskCount > 0)
+	{
+		entry->runningTaskCount--;
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+
+	connection->runningTaskCounted = false;
+}
+
+
+/*
+ * GetSharedRunningTaskCount returns the number of connections of all backends
+ * of this node that currently run a task on the given worker.
+ */
+int
+GetSharedRunningTaskCount(const char *hostname, int port)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+	int runningTaskCount = 0;
+
+	if (SharedConnStatsHash == NULL)
+	{
+		return 0;
+	}
+
+	BuildSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_SHARED);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_FIND, &found);
+	if (found)
+	{
+		runningTaskCount = entry->runningTaskCount;
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+
+	return runningTaskCount;
+}
+
+
+/*
+ * AdjustWaitingBackendCount adds delta to the number of backends waiting for a
+ * connection slot for the given worker.
+ */
+static void
+AdjustWaitingBackendCount(const char *hostname, int port, int delta)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+
+	BuildSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_FIND, &found);
+	if (found)
+	{
+		entry->waitingBackendCount = Max(entry->waitingBackendCount + delta, 0);
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+}
+
+
+/*
+ * DecrementSharedConnectionCounter releases a connection slot for the given
+ * worker that was reserved earlier and wakes up the backends waiting for one.
+ */
+void
+DecrementSharedConnectionCounter(const char *hostname, int port)
+{
+	SharedConnStatsHashKey key;
+	bool found = false;
+
+	if (SharedConnStatsHash == NULL)
+	{
+		return;
+	}
+
+	BuildSharedConnStatsHashKey(&key, hostname, port);
+
+	LWLockAcquire(&SharedConnStatsControl->lock, LW_EXCLUSIVE);
+
+	SharedConnStatsHashEntry *entry =
+		(SharedConnStatsHashEntry *) hash_search(SharedConnStatsHash, &key,
+												 HASH_FIND, &found);
+	if (found && entry->connectionCount > 0)
+	{
+		entry->connectionCount--;
+	}
+
+	LWLockRelease(&SharedConnStatsControl->lock);
+
+	ConditionVariableBroadcast(&SharedConnStatsControl->waitersConditionVariable);
+}
+
+
+/*
+ * BuildSharedConnStatsHashKey fills the hash key for the given worker.
+ */
+static void
+BuildSharedConnStatsHashKey(SharedConnStatsHashKey *key, const char *hostname,
+							int port)
+{
+	/* the key is hashed as a whole, so also clear the bytes after the name */
+	memset(key, 0, sizeof(SharedConnStatsHashKey));
+	strlcpy(key->hostname, hostname, MAX_NODE_LENGTH);
+	key->port = port;
+}
@@ -135,6 +135,7 @@
 #include "distributed/adaptive_executor.h"
 #include "distributed/cancel_utils.h"
 #include "distributed/citus_custom_scan.h"
+#include "distributed/commands/multi_copy.h"
 #include "distributed/connection_management.h"
 #include "distributed/deparse_shard_query.h"
 #include "distributed/distributed_execution_locks.h"
@@ -146,25 +147,53 @@
 #include "distributed/multi_physical_planner.h"
 #include "distributed/multi_resowner.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/node_health.h"
 #include "distributed/placement_access.h"
 #include "distributed/placement_connection.h"
+#include "distributed/query_utils.h"
 #include "distributed/relation_access_tracking.h"
 #include "distributed/remote_commands.h"
 #include "distributed/repartition_join_execution.h"
 #include "distributed/resource_lock.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/sorted_merge.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/task_bundling.h"
 #include "distributed/transaction_management.h"
 #include "distributed/version_compat.h"
+#include "distributed/worker_latency.h"
 #include "distributed/worker_protocol.h"
+#include "executor/executor.h"
 #include "lib/ilist.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#endif
+#include "optimizer/clauses.h"
 #include "storage/fd.h"
 #include "storage/latch.h"
+#include "tcop/tcopprot.h"
 #include "utils/int8.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/timestamp.h"
 
 
+/* reads are hedged once they take this many times longer than usual on a worker */
+#define HEDGED_READ_LATENCY_FACTOR 3.0
+
+
+/*
+ * PlacementLatencyCost is used to order the placements of a task by the
+ * expected latency of reading from them under the least-latency policy.
+ */
+typedef struct PlacementLatencyCost
+{
+	ShardPlacement *placement;
+	double cost;
+	int placementIndex;
+} PlacementLatencyCost;
+
+
 /*
  * DistributedExecution represents the execution of a distributed query
  * plan.
@@ -183,6 +212,14 @@ typedef struct DistributedExecution
 	List *remoteTaskList;
 	List *localTaskList;
 
+	/*
+	 * For read-only executions, the local tasks that are not yet executed.
+	 * They run whenever no remote connection is ready while waiting for the
+	 * remote tasks, and store their results via localScanState.
+	 */
+	List *pendingLocalTaskList;
+	CitusScanState *localScanState;
+
 	/* the corresponding distributed plan has RETURNING */
 	bool hasReturning;
 
@@ -193,6 +230,15 @@ typedef struct DistributedExecution
 	TupleDesc tupleDescriptor;
 	Tuplestorestate *tupleStore;
 
+	/*
+	 * When taskTupleStores is set, the rows of the i-th task in tasksToExecute
+	 * are written to taskTupleStores[i] instead of tupleStore, such that the
+	 * sorted results of the tasks can be merged (see sorted_merge.c). The
+	 * corresponding ShardCommandExecutions are in shardCommandExecutions.
+	 */
+	Tuplestorestate **taskTupleStores;
+	struct ShardCommandExecution **shardCommandExecutions;
+
 
 	/* list of workers involved in the execution */
 	List *workerList;
@@ -229,6 +275,10 @@ typedef struct DistributedExecution
 	 */
 	WaitEventSet *waitEventSet;
 
+	/* events array for WaitEventSetWait() and its size */
+	WaitEvent *events;
+	int eventSetSize;
+
 	/*
 	 * The number of connections we aim to open per worker.
 	 *
@@ -266,6 +316,27 @@ typedef struct DistributedExecution
 	 */
 	uint64 rowsProcessed;
 
+	/*
+	 * If rowLimit is set, the execution stops the remaining tasks once
+	 * rowsProcessed reaches it (see DistributedPlan->scanRowLimit).
+	 */
+	uint64 rowLimit;
+
+	/*
+	 * Whether read-only tasks that are slow on a placement are also started
+	 * on the next placement (see StartHedgedReads), and how often that
+	 * happened in the execution.
+	 */
+	bool hedgeReads;
+	int hedgedReadCount;
+
+	/*
+	 * Whether the tasks are known not to write anything. Remote transactions
+	 * that only ran such tasks can be left out of 2PC (see
+	 * RemoteTransactionIsReadOnly).
+	 */
+	bool tasksOnlyRead;
+
 	/* statistics on distributed execution */
 	DistributedExecutionStats *executionStats;
 
@@ -280,11 +351,35 @@ typedef struct DistributedExecution
 	AttInMetadata *attributeInputMetadata;
 	char **columnArray;
 
+	/*
+	 * When binaryResults is set, the workers send the rows in binary format
+	 * and we decode the columns using the binary receive functions of the
+	 * column types instead of the text input functions. The remaining fields
+	 * are only allocated in that case.
+	 */
+	bool binaryResults;
+	FmgrInfo *receiveFunctionArray;
+	Oid *typeIOParamArray;
+	Datum *columnValues;
+	bool *columnNulls;
+	StringInfo binaryColumnBuffer;
+
 	/*
 	 * jobIdList contains all jobs in the job tree, this is used to
 	 * do cleanup for repartition queries.
 	 */
 	List *jobIdList;
+
+	/*
+	 * When streamResults is set, the event loop is driven from CitusExecScan
+	 * via ContinueStreamingExecution() and the tuple store only holds the rows
+	 * received since the scan last ran out of rows. streamingActive is set
+	 * until all tasks are finished, during which the execution is linked into
+	 * ActiveStreamingExecutions via streamingNode.
+	 */
+	bool streamResults;
+	bool streamingActive;
+	dlist_node streamingNode;
 } DistributedExecution;
 
 
@@ -373,6 +468,25 @@ typedef struct WorkerPool
 	/* maximum number of connections we are allowed to open at once */
 	uint32 maxNewConnectionsPerCycle;
 
+	/*
+	 * Time spent on the tasks that finished on the worker and on establishing
+	 * new connections to it during the execution, and the latencies observed
+	 * by earlier executions. These are only tracked when
+	 * citus.enable_latency_aware_pool_sizing is enabled (see ManageWorkerPool),
+	 * in microseconds.
+	 */
+	double totalTaskDurationUs;
+	int finishedTaskCount;
+	double totalConnectionTimeUs;
+	int establishedConnectionCount;
+	WorkerLatency historicLatency;
+
+	/*
+	 * Whether the worker failed recently, in which case read-only tasks try
+	 * placements on other workers first (see node_health.c).
+	 */
+	bool avoidNode;
+
 	/*
 	 * This is only set in WorkerPoolFailed() function. Once a pool fails, we do not
 	 * use it anymore.
@@ -414,6 +528,22 @@ typedef struct WorkerSession
 	/* task the worker should work on or NULL */
 	struct TaskPlacementExecution *currentTask;
 
+	/*
+	 * When several tasks are sent over the session as a single batch, the
+	 * tasks following currentTask in the batch, in order. pendingResultCount
+	 * is the number of results that currentTask still produces, since a task
+	 * may consist of multiple statements.
+	 */
+	List *batchedTaskList;
+	int pendingResultCount;
+
+	/*
+	 * Number of results of the transaction block preamble (BEGIN etc.) that
+	 * precede the results of currentTask, when the preamble was sent as part
+	 * of the same query.
+	 */
+	int pendingBeginResultCount;
+
 	/*
 	 * The number of commands sent to the worker over the session. Excludes
 	 * distributed transaction related commands such as BEGIN/COMMIT etc.
@@ -437,6 +567,42 @@ int MaxAdaptiveExecutorPoolSize = 16;
 /* GUC, number of ms to wait between opening connections to the same worker */
 int ExecutorSlowStartInterval = 10;
 
+/* GUC, determining whether workers are asked to send results in binary format */
+bool EnableBinaryProtocol = false;
+
+/* GUC, determining whether SELECT results are streamed instead of materialized */
+bool EnableResultStreaming = false;
+
+/* GUC, maximum number of tasks that are sent over a session at once */
+int ExecutorCommandBatchSize = 1;
+
+/* GUC, determining whether BEGIN is sent together with the first task */
+bool EnablePiggybackedBegin = false;
+
+/* GUC, time after which a slow read is also started on another placement */
+int HedgedReadDelay = 0;
+
+/* executions whose results are currently being streamed to a Citus scan */
+static dlist_head ActiveStreamingExecutions =
+	DLIST_STATIC_INIT(ActiveStreamingExecutions);
+
+/*
+ * PrefetchedResult holds the rows of a distributed plan of which the tasks ran
+ * before the plan itself was executed (see PrefetchDistributedPlanResults).
+ */
+typedef struct PrefetchedResult
+{
+	uint64 planId;
+	Tuplestorestate *tupleStore;
+
+	/* node in PrefetchedResults, prefetchActive is set while it is linked */
+	dlist_node prefetchNode;
+	bool prefetchActive;
+} PrefetchedResult;
+
+/* results of distributed plans that were executed ahead of their scan */
+static dlist_head PrefetchedResults = DLIST_STATIC_INIT(PrefetchedResults);
+
 
 /*
  * TaskExecutionState indicates whether or not a command on a shard
@@ -487,6 +653,26 @@ typedef struct ShardCommandExecution
 	 */
 	bool gotResults;
 
+	/* destination for the rows of the task and the number of rows stored */
+	Tuplestorestate *tupleStore;
+	uint64 rowsReceived;
+
+	/*
+	 * For commands that can run on any placement, the placement execution
+	 * that returned results first. The results of other placement executions
+	 * that run concurrently as hedged reads are discarded.
+	 */
+	struct TaskPlacementExecution *resultPlacementExecution;
+
+	/* whether the command was also started on another placement */
+	bool hedged;
+
+	/*
+	 * Number of statements in the query of the task, which is the number of
+	 * results it produces when batched, or 0 if not counted yet.
+	 */
+	int statementCount;
+
 	TaskExecutionState executionState;
 } ShardCommandExecution;
 
@@ -538,6 +724,15 @@ typedef struct TaskPlacementExecution
 
 	/* index in array of placement executions in a ShardCommandExecution */
 	int placementExecutionIndex;
+
+	/* time at which the command was sent, if latencies are tracked */
+	TimestampTz startTime;
+
+	/* whether the format and types of the binary result were checked */
+	bool binaryResultValidated;
+
+	/* whether the command was cancelled, since a hedged read on another replica won */
+	bool cancelled;
 } TaskPlacementExecution;
 
 
@@ -560,7 +755,38 @@ static TransactionProperties DecideTransactionPropertiesForTaskList(RowModifyLev
 static void StartDistributedExecution(DistributedExecution *execution);
 static void RunLocalExecution(CitusScanState *scanState, DistributedExecution *execution);
 static void RunDistributedExecution(DistributedExecution *execution);
+static bool RunDistributedExecutionCycle(List *executionList);
+static bool DistributedExecutionsRunning(List *executionList);
+static void FreeExecutionWaitEvents(DistributedExecution *execution);
+static void HandleDistributedExecutionError(DistributedExecution *execution);
+static bool DistributedPlanOnlyReads(DistributedPlan *distributedPlan);
+static bool ShouldStreamResults(CitusScanState *scanState,
+								DistributedExecution *execution,
+								bool hasDependentJobs);
+static bool ShouldMergeSortedTaskResults(CitusScanState *scanState,
+										 DistributedExecution *execution,
+										 bool hasDependentJobs);
+static bool ResultsAreReadOnce(CitusScanState *scanState,
+							   DistributedExecution *execution,
+							   bool hasDependentJobs);
+static void StartStreamingExecution(DistributedExecution *execution);
+static void RunStreamingExecution(DistributedExecution *execution,
+								  ShardCommandExecution *targetExecution,
+								  bool runToCompletion);
+static uint64 StreamingExecutionRowCount(DistributedExecution *execution,
+										 ShardCommandExecution *targetExecution);
+static void StopTrackingStreamingExecution(DistributedExecution *execution);
+static void RunConcurrentDistributedExecutions(List *executionList);
+static Tuplestorestate * TakePrefetchedResult(uint64 planId);
+static void StopTrackingPrefetchedResult(PrefetchedResult *prefetchedResult);
+static void PrefetchedResultContextReset(void *arg);
+static bool RowLimitReached(DistributedExecution *execution);
+static void StopUnfinishedSessions(DistributedExecution *execution);
+static void StreamingExecutionContextReset(void *arg);
+static void DiscardSessionResults(WorkerSession *session);
 static bool ShouldRunTasksSequentially(List *taskList);
+static bool ShouldInterleaveLocalExecution(DistributedExecution *execution);
+static void RunNextLocalTask(DistributedExecution *execution);
 static void SequentialRunDistributedExecution(DistributedExecution *execution);
 
 static void FinishDistributedExecution(DistributedExecution *execution);
@@ -580,6 +806,11 @@ static void AssignTasksToConnections(DistributedExecution *execution);
 static void UnclaimAllSessionConnections(List *sessionList);
 static bool UseConnectionPerPlacement(void);
 static PlacementExecutionOrder ExecutionOrderForTask(RowModifyLevel modLevel, Task *task);
+static List * PlacementListWithHealthyNodesFirst(DistributedExecution *execution,
+												List *placementList);
+static List * PlacementListOrderedByLatency(DistributedExecution *execution,
+											List *placementList);
+static int ComparePlacementLatencyCost(const void *leftElement, const void *rightElement);
 static WorkerPool * FindOrCreateWorkerPool(DistributedExecution *execution,
 										   char *nodeName, int nodePort);
 static WorkerSession * FindOrCreateWorkerSession(WorkerPool *workerPool,
@@ -587,8 +818,14 @@ static WorkerSession * FindOrCreateWorkerSession(WorkerPool *workerPool,
 static void ManageWorkerPool(WorkerPool *workerPool);
 static void CheckConnectionTimeout(WorkerPool *workerPool);
 static int UsableConnectionCount(WorkerPool *workerPool);
+static bool ShouldTrackWorkerLatencies(void);
+static bool WorkerPoolLatencyKnown(WorkerPool *workerPool);
+static bool NewConnectionsShortenExecution(WorkerPool *workerPool);
+static WorkerLatency WorkerPoolLatency(WorkerPool *workerPool);
+static void RecordWorkerPoolLatencies(DistributedExecution *execution);
 static long NextEventTimeout(DistributedExecution *execution);
 static long MillisecondsBetweenTimestamps(TimestampTz startTime, TimestampTz endTime);
+static double MicrosecondsBetweenTimestamps(TimestampTz startTime, TimestampTz endTime);
 static WaitEventSet * BuildWaitEventSet(List *sessionList);
 static void UpdateWaitEventSetFlags(WaitEventSet *waitEventSet, List *sessionList);
 static TaskPlacementExecution * PopPlacementExecution(WorkerSession *session);
@@ -596,6 +833,20 @@ static TaskPlacementExecution * PopAssignedPlacementExecution(WorkerSession *ses
 static TaskPlacementExecution * PopUnassignedPlacementExecution(WorkerPool *workerPool);
 static bool StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 											 WorkerSession *session);
+static bool ShouldBatchPlacementExecutions(WorkerSession *session);
+static bool CanPiggybackTransactionBegin(WorkerSession *session);
+static bool StartPlacementExecutionWithBeginOnSession(TaskPlacementExecution *
+													  placementExecution,
+													  WorkerSession *session);
+static bool ReceiveBeginResults(WorkerSession *session);
+static bool StartPlacementExecutionBatchOnSession(TaskPlacementExecution *
+												  placementExecution,
+												  WorkerSession *session);
+static char * StartPlacementExecution(TaskPlacementExecution *placementExecution,
+									  WorkerSession *session);
+static char * PlacementExecutionQueryString(TaskPlacementExecution *placementExecution);
+static int PlacementExecutionStatementCount(TaskPlacementExecution *placementExecution);
+static bool AdvanceBatchedPlacementExecution(WorkerSession *session);
 static void ConnectionStateMachine(WorkerSession *session);
 static void HandleMultiConnectionSuccess(WorkerSession *session);
 static void Activate2PCIfModifyingTransactionExpandsToNewNode(WorkerSession *session);
@@ -608,6 +859,14 @@ static void WorkerSessionFailed(WorkerSession *session);
 static void WorkerPoolFailed(WorkerPool *workerPool);
 static void PlacementExecutionDone(TaskPlacementExecution *placementExecution,
 								   bool succeeded);
+static void StartHedgedReads(DistributedExecution *execution);
+static void CancelLosingHedgedReads(DistributedExecution *execution,
+									TaskPlacementExecution *resultPlacementExecution);
+static bool IsQueryCanceledResult(PGresult *result);
+static long HedgedReadDelayMs(WorkerPool *workerPool);
+static TaskPlacementExecution * NextNotReadyPlacementExecution(
+	ShardCommandExecution *shardCommandExecution);
+static bool PlacementExecutionInProgress(ShardCommandExecution *shardCommandExecution);
 static void ScheduleNextPlacementExecution(TaskPlacementExecution *placementExecution,
 										   bool succeeded);
 static bool ShouldMarkPlacementsInvalidOnFailure(DistributedExecution *execution);
@@ -615,6 +874,13 @@ static void PlacementExecutionReady(TaskPlacementExecution *placementExecution);
 static TaskExecutionState TaskExecutionStateMachine(ShardCommandExecution *
 													shardCommandExecution);
 static bool HasDependentJobs(Job *mainJob);
+static void PrepareBinaryResultReception(DistributedExecution *execution);
+static bool CanUseBinaryProtocol(TupleDesc tupleDescriptor);
+static bool BinaryProtocolBeneficial(TupleDesc tupleDescriptor);
+static void ValidateBinaryResult(DistributedExecution *execution,
+								 MultiConnection *connection, PGresult *result);
+static void ReadBinaryRow(DistributedExecution *execution, MultiConnection *connection,
+						  PGresult *result, int rowIndex);
 static void ExtractParametersForRemoteExecution(ParamListInfo paramListInfo,
 												Oid **parameterTypes,
 												const char ***parameterValues);
@@ -622,7 +888,8 @@ static void ExtractParametersForRemoteExecution(ParamListInfo paramListInfo,
 /*
  * AdaptiveExecutor is called via CitusExecScan on the
  * first call of CitusExecScan. The function fills the tupleStore
- * of the input scanScate.
+ * of the input scanScate, unless the results are streamed in which
+ * case it only starts the execution (see ContinueStreamingExecution).
  */
 TupleTableSlot *
 AdaptiveExecutor(CitusScanState *scanState)
@@ -651,6 +918,21 @@ AdaptiveExecutor(CitusScanState *scanState)
 	 */
 	LockPartitionsForDistributedPlan(distributedPlan);
 
+	Tuplestorestate *prefetchedResult = TakePrefetchedResult(distributedPlan->planId);
+	if (prefetchedResult != NULL)
+	{
+		/* the tasks already ran along with the tasks of other subplans */
+		scanState->tuplestorestate = prefetchedResult;
+
+		if (distributedPlan->mergeSortClauseList != NIL)
+		{
+			/* the plan relies on the scan to return sorted rows */
+			SortTupleStoreByMergeKeys(scanState);
+		}
+
+		return resultSlot;
+	}
+
 	ExecuteSubPlans(distributedPlan);
 
 	bool hasDependentJobs = HasDependentJobs(job);
@@ -665,8 +947,11 @@ AdaptiveExecutor(CitusScanState *scanState)
 		targetPoolSize = 1;
 	}
 
-	scanState->tuplestorestate =
-		tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+	if (ShouldBundleTasksPerNode(distributedPlan))
+	{
+		/* send a single UNION ALL query to each worker node */
+		taskList = BundleTasksPerNode(taskList);
+	}
 
 	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
 		distributedPlan->modLevel, taskList,
@@ -679,21 +964,72 @@ AdaptiveExecutor(CitusScanState *scanState)
 		distributedPlan->hasReturning,
 		paramListInfo,
 		tupleDescriptor,
-		scanState->tuplestorestate,
+		NULL,
 		targetPoolSize,
 		&xactProperties,
 		jobIdList);
 
+	execution->tasksOnlyRead = DistributedPlanOnlyReads(distributedPlan);
+
+	if (ShouldStreamResults(scanState, execution, hasDependentJobs))
+	{
+		/* rows are only read once, which allows us to discard them afterwards */
+		execution->streamResults = true;
+		randomAccess = false;
+	}
+
+	if (list_length(execution->localTaskList) == 0)
+	{
+		/* rows of local tasks are not counted in rowsProcessed */
+		execution->rowLimit = distributedPlan->scanRowLimit;
+	}
+
+	scanState->tuplestorestate =
+		tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+	execution->tupleStore = scanState->tuplestorestate;
+
+	if (ShouldMergeSortedTaskResults(scanState, execution, hasDependentJobs))
+	{
+		/* receive the rows of each task separately and merge them in the scan */
+		scanState->sortedMerge =
+			BeginSortedMerge(scanState, list_length(execution->tasksToExecute));
+		execution->taskTupleStores = scanState->sortedMerge->taskTupleStores;
+	}
+
+	if (EnableBinaryProtocol && distributedPlan->modLevel == ROW_MODIFY_READONLY)
+	{
+		/* only multi-shard and router SELECTs go through the binary path */
+		PrepareBinaryResultReception(execution);
+	}
+
 	/*
 	 * Make sure that we acquire the appropriate locks even if the local tasks
 	 * are going to be executed with local execution.
 	 */
 	StartDistributedExecution(execution);
 
+	if (execution->streamResults)
+	{
+		/* rows are received on demand in ContinueStreamingExecution() */
+		StartStreamingExecution(execution);
+		scanState->streamingExecution = execution;
+
+		return resultSlot;
+	}
+
 	/* execute tasks local to the node (if any) */
 	if (list_length(execution->localTaskList) > 0)
 	{
-		RunLocalExecution(scanState, execution);
+		if (ShouldInterleaveLocalExecution(execution))
+		{
+			/* run the local tasks while waiting for the remote tasks */
+			execution->pendingLocalTaskList = list_copy(execution->localTaskList);
+			execution->localScanState = scanState;
+		}
+		else
+		{
+			RunLocalExecution(scanState, execution);
+		}
 
 		/* make sure that we only execute remoteTaskList afterwards */
 		AdjustDistributedExecutionAfterLocalExecution(execution);
@@ -740,149 +1076,449 @@ AdaptiveExecutor(CitusScanState *scanState)
 		SortTupleStore(scanState);
 	}
 
+	if (distributedPlan->mergeSortClauseList != NIL && scanState->sortedMerge == NULL)
+	{
+		/* the plan relies on the scan to return sorted rows */
+		SortTupleStoreByMergeKeys(scanState);
+	}
+
 	return resultSlot;
 }
 
 
 /*
- * HasDependentJobs returns true if there is any dependent job
- * for the mainjob(top level) job.
+ * DistributedPlanOnlyReads returns true if the worker tasks of the given plan
+ * are known not to write anything. Read-only plans do not qualify when they
+ * are delegated function calls, which are planned as a SELECT of the function
+ * without any relations, or when they contain volatile functions, since only
+ * those are allowed to write. Neither do SELECT .. FOR UPDATE/SHARE, since the
+ * row locks have to be held until the distributed transaction commits.
  */
 static bool
-HasDependentJobs(Job *mainJob)
+DistributedPlanOnlyReads(DistributedPlan *distributedPlan)
 {
-	return list_length(mainJob->dependentJobList) > 0;
-}
+	Job *job = distributedPlan->workerJob;
+	List *relationRangeTableList = NIL;
 
+	if (distributedPlan->modLevel != ROW_MODIFY_READONLY || job->jobQuery == NULL)
+	{
+		return false;
+	}
 
-/*
- * RunLocalExecution runs the localTaskList in the execution, fills the tuplestore
- * and sets the es_processed if necessary.
- *
- * It also sorts the tuplestore if there are no remote tasks remaining.
- */
-static void
-RunLocalExecution(CitusScanState *scanState, DistributedExecution *execution)
-{
-	uint64 rowsProcessed = ExecuteLocalTaskList(scanState, execution->localTaskList);
+	if (job->jobQuery->rowMarks != NIL)
+	{
+		/* row locks need to be held until the end of the transaction */
+		return false;
+	}
 
-	/*
-	 * We're deliberately not setting execution->rowsProceessed here. The main reason
-	 * is that modifications to reference tables would end-up setting it both here
-	 * and in AdaptiveExecutor. Instead, we set executorState here and skip updating it
-	 * for reference table modifications in AdaptiveExecutor.
-	 */
-	EState *executorState = ScanStateGetExecutorState(scanState);
-	executorState->es_processed = rowsProcessed;
+	ExtractRangeTableRelationWalker((Node *) job->jobQuery, &relationRangeTableList);
+	if (relationRangeTableList == NIL)
+	{
+		/* delegated function calls may run arbitrary commands on the worker */
+		return false;
+	}
+
+	return !contain_volatile_functions((Node *) job->jobQuery);
 }
 
 
 /*
- * AdjustDistributedExecutionAfterLocalExecution simply updates the necessary fields of
- * the distributed execution.
+ * ShouldStreamResults returns true if the results of the given execution can be
+ * streamed to the scan, rather than received in full before returning the
+ * first row. That is the case for read-only executions whose scan is only read
+ * once in forward direction and that do not need to do any work after all
+ * tasks finished, either because citus.enable_result_streaming is on or the
+ * planner decided to stream the results into the master aggregate.
  */
-static void
-AdjustDistributedExecutionAfterLocalExecution(DistributedExecution *execution)
+static bool
+ShouldStreamResults(CitusScanState *scanState, DistributedExecution *execution,
+					bool hasDependentJobs)
 {
-	/* we only need to execute the remote tasks */
-	execution->tasksToExecute = execution->remoteTaskList;
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
 
-	execution->totalTaskCount = list_length(execution->remoteTaskList);
-	execution->unfinishedTaskCount = list_length(execution->remoteTaskList);
+	if (!EnableResultStreaming && !distributedPlan->streamIntoAggregate)
+	{
+		return false;
+	}
+
+	if (execution->modLevel != ROW_MODIFY_READONLY)
+	{
+		return false;
+	}
+
+	return ResultsAreReadOnce(scanState, execution, hasDependentJobs);
 }
 
 
 /*
- * ExecuteUtilityTaskListWithoutResults is a wrapper around executing task
- * list for utility commands. It simply calls in adaptive executor's task
- * execution function.
+ * ShouldMergeSortedTaskResults returns true if the planner decided to merge
+ * the sorted results of the tasks (see CanMergeSortedTaskResults) and the
+ * rows of each task can be received into a separate tuple store, from which
+ * they are read in the order of the merge.
  */
-void
-ExecuteUtilityTaskListWithoutResults(List *taskList)
+static bool
+ShouldMergeSortedTaskResults(CitusScanState *scanState,
+							 DistributedExecution *execution, bool hasDependentJobs)
 {
-	ExecuteTaskList(ROW_MODIFY_NONE, taskList, MaxAdaptiveExecutorPoolSize);
+	if (scanState->distributedPlan->mergeSortClauseList == NIL)
+	{
+		return false;
+	}
+
+	return ResultsAreReadOnce(scanState, execution, hasDependentJobs);
 }
 
 
 /*
- * ExecuteTaskListOutsideTransaction is a proxy to ExecuteTaskListExtended
- * with defaults for some of the arguments.
+ * ResultsAreReadOnce returns true if the scan reads the rows of the execution
+ * only once in forward direction and the execution does not need to do any
+ * work after all tasks finished, such that the rows do not need to be kept
+ * in the tuple store of the scan.
  */
-uint64
-ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList,
-								  int targetPoolSize, List *jobIdList)
+static bool
+ResultsAreReadOnce(CitusScanState *scanState, DistributedExecution *execution,
+				   bool hasDependentJobs)
 {
-	TupleDesc tupleDescriptor = NULL;
-	Tuplestorestate *tupleStore = NULL;
-	bool hasReturning = false;
+	/* repartition jobs are cleaned up after the execution */
+	if (hasDependentJobs)
+	{
+		return false;
+	}
 
-	TransactionProperties xactProperties =
-		DecideTransactionPropertiesForTaskList(modLevel, taskList, true);
+	/* local execution writes all rows into the tuple store at once */
+	if (list_length(execution->localTaskList) > 0)
+	{
+		return false;
+	}
 
+	/* the rows are discarded once read, so we cannot go back to them */
+	if (scanState->eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK | EXEC_FLAG_REWIND))
+	{
+		return false;
+	}
 
-	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
-								   tupleStore, hasReturning, targetPoolSize,
-								   &xactProperties, jobIdList);
+	return true;
 }
 
 
 /*
- * ExecuteTaskList is a proxy to ExecuteTaskListExtended() with defaults
- * for some of the arguments.
+ * HasDependentJobs returns true if there is any dependent job
+ * for the mainjob(top level) job.
  */
-uint64
-ExecuteTaskList(RowModifyLevel modLevel, List *taskList, int targetPoolSize)
+static bool
+HasDependentJobs(Job *mainJob)
 {
-	TupleDesc tupleDescriptor = NULL;
-	Tuplestorestate *tupleStore = NULL;
-	bool hasReturning = false;
-
-	TransactionProperties xactProperties =
-		DecideTransactionPropertiesForTaskList(modLevel, taskList, false);
-
-	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
-								   tupleStore, hasReturning, targetPoolSize,
-								   &xactProperties, NIL);
+	return list_length(mainJob->dependentJobList) > 0;
 }
 
 
 /*
- * ExecuteTaskListIntoTupleStore is a proxy to ExecuteTaskListExtended() with defaults
- * for some of the arguments.
+ * PrepareBinaryResultReception decides whether the rows of a read-only
+ * execution are transferred in binary format and, if so, looks up the binary
+ * receive functions of the result columns once for the whole execution.
  */
-uint64
-ExecuteTaskListIntoTupleStore(RowModifyLevel modLevel, List *taskList,
-							  TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
-							  bool hasReturning)
+static void
+PrepareBinaryResultReception(DistributedExecution *execution)
 {
-	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
 
-	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
-		modLevel, taskList, false);
+	if (tupleDescriptor == NULL || tupleDescriptor->natts == 0)
+	{
+		return;
+	}
 
-	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
-								   tupleStore, hasReturning, targetPoolSize,
-								   &xactProperties, NIL);
+	if (!CanUseBinaryProtocol(tupleDescriptor) ||
+		!BinaryProtocolBeneficial(tupleDescriptor))
+	{
+		return;
+	}
+
+	int columnCount = tupleDescriptor->natts;
+
+	execution->receiveFunctionArray =
+		(FmgrInfo *) palloc0(columnCount * sizeof(FmgrInfo));
+	execution->typeIOParamArray = (Oid *) palloc0(columnCount * sizeof(Oid));
+	execution->columnValues = (Datum *) palloc0(columnCount * sizeof(Datum));
+	execution->columnNulls = (bool *) palloc0(columnCount * sizeof(bool));
+	execution->binaryColumnBuffer = makeStringInfo();
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid receiveFunctionId = InvalidOid;
+
+		getTypeBinaryInputInfo(attribute->atttypid, &receiveFunctionId,
+							   &execution->typeIOParamArray[columnIndex]);
+		fmgr_info(receiveFunctionId, &execution->receiveFunctionArray[columnIndex]);
+	}
+
+	execution->binaryResults = true;
 }
 
 
 /*
- * ExecuteTaskListExtended sets up the execution for given task list and
- * runs it.
+ * CanUseBinaryProtocol returns true if all the columns of the given tuple
+ * descriptor can be sent by the workers and received on this node in binary
+ * format. We apply the same restrictions as for binary COPY, and additionally
+ * require a binary receive function. Composite types are never transferred
+ * in binary since record_recv cannot handle anonymous records.
  */
-uint64
-ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
-						TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
-						bool hasReturning, int targetPoolSize,
-						TransactionProperties *xactProperties, List *jobIdList)
+static bool
+CanUseBinaryProtocol(TupleDesc tupleDescriptor)
 {
-	ParamListInfo paramListInfo = NULL;
-
-	/*
-	 * The code-paths that rely on this function do not know how execute
-	 * commands locally.
-	 */
-	ErrorIfTransactionAccessedPlacementsLocally();
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		Oid typeId = attribute->atttypid;
+		char typeCategory = '\0';
+		bool typePreferred = false;
+
+		if (attribute->attisdropped)
+		{
+			return false;
+		}
+
+		if (!CanUseBinaryCopyFormatForType(typeId))
+		{
+			return false;
+		}
+
+		get_type_category_preferred(getBaseType(typeId), &typeCategory,
+									&typePreferred);
+		if (typeCategory == TYPCATEGORY_COMPOSITE)
+		{
+			return false;
+		}
+
+		Oid receiveFunctionId = InvalidOid;
+		Oid typeIOParam = InvalidOid;
+		int16 typeLength = 0;
+		bool typeByVal = false;
+		char typeAlign = 0;
+		char typeDelim = 0;
+
+		get_type_io_data(typeId, IOFunc_receive, &typeLength, &typeByVal,
+						 &typeAlign, &typeDelim, &typeIOParam, &receiveFunctionId);
+		if (!OidIsValid(receiveFunctionId))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * BinaryProtocolBeneficial is the heuristic that decides whether the binary
+ * format is worth using. For string types the text and binary representations
+ * are identical and the input functions are cheap, so we only switch over when
+ * at least one of the columns has a non-string type (e.g. numeric, timestamp,
+ * jsonb, arrays), for which parsing the text representation dominates the
+ * cost of receiving rows.
+ */
+static bool
+BinaryProtocolBeneficial(TupleDesc tupleDescriptor)
+{
+	for (int columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+		char typeCategory = '\0';
+		bool typePreferred = false;
+
+		get_type_category_preferred(getBaseType(attribute->atttypid), &typeCategory,
+									&typePreferred);
+		if (typeCategory != TYPCATEGORY_STRING)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * RunLocalExecution runs the localTaskList in the execution, fills the tuplestore
+ * and sets the es_processed if necessary.
+ *
+ * It also sorts the tuplestore if there are no remote tasks remaining.
+ */
+static void
+RunLocalExecution(CitusScanState *scanState, DistributedExecution *execution)
+{
+	uint64 rowsProcessed = ExecuteLocalTaskList(scanState, execution->localTaskList);
+
+	/*
+	 * We're deliberately not setting execution->rowsProceessed here. The main reason
+	 * is that modifications to reference tables would end-up setting it both here
+	 * and in AdaptiveExecutor. Instead, we set executorState here and skip updating it
+	 * for reference table modifications in AdaptiveExecutor.
+	 */
+	EState *executorState = ScanStateGetExecutorState(scanState);
+	executorState->es_processed = rowsProcessed;
+}
+
+
+/*
+ * ShouldInterleaveLocalExecution returns true if the local tasks of the given
+ * execution can be executed in between waiting for its remote tasks, rather
+ * than before starting the remote tasks. We only do that for read-only
+ * executions, for which the order in which the shards are accessed does not
+ * matter.
+ */
+static bool
+ShouldInterleaveLocalExecution(DistributedExecution *execution)
+{
+	if (execution->modLevel != ROW_MODIFY_READONLY)
+	{
+		return false;
+	}
+
+	/* nothing to wait for */
+	if (list_length(execution->remoteTaskList) == 0)
+	{
+		return false;
+	}
+
+	return !ShouldRunTasksSequentially(execution->remoteTaskList);
+}
+
+
+/*
+ * RunNextLocalTask executes the first of the pending local tasks of the given
+ * execution, or all of them if they can be executed using parallel workers.
+ */
+static void
+RunNextLocalTask(DistributedExecution *execution)
+{
+	CitusScanState *scanState = execution->localScanState;
+
+	if (ShouldExecuteLocalTasksInParallel(scanState->distributedPlan,
+										  execution->pendingLocalTaskList))
+	{
+		List *localTaskList = execution->pendingLocalTaskList;
+
+		execution->pendingLocalTaskList = NIL;
+
+		ExecuteLocalTaskList(scanState, localTaskList);
+		return;
+	}
+
+	Task *task = (Task *) linitial(execution->pendingLocalTaskList);
+
+	execution->pendingLocalTaskList = list_delete_first(execution->pendingLocalTaskList);
+
+	ExecuteLocalTaskList(scanState, list_make1(task));
+}
+
+
+/*
+ * AdjustDistributedExecutionAfterLocalExecution simply updates the necessary fields of
+ * the distributed execution.
+ */
+static void
+AdjustDistributedExecutionAfterLocalExecution(DistributedExecution *execution)
+{
+	/* we only need to execute the remote tasks */
+	execution->tasksToExecute = execution->remoteTaskList;
+
+	execution->totalTaskCount = list_length(execution->remoteTaskList);
+	execution->unfinishedTaskCount = list_length(execution->remoteTaskList);
+}
+
+
+/*
+ * ExecuteUtilityTaskListWithoutResults is a wrapper around executing task
+ * list for utility commands. It simply calls in adaptive executor's task
+ * execution function.
+ */
+void
+ExecuteUtilityTaskListWithoutResults(List *taskList)
+{
+	ExecuteTaskList(ROW_MODIFY_NONE, taskList, MaxAdaptiveExecutorPoolSize);
+}
+
+
+/*
+ * ExecuteTaskListOutsideTransaction is a proxy to ExecuteTaskListExtended
+ * with defaults for some of the arguments.
+ */
+uint64
+ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList,
+								  int targetPoolSize, List *jobIdList)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+
+	TransactionProperties xactProperties =
+		DecideTransactionPropertiesForTaskList(modLevel, taskList, true);
+
+
+	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
+								   tupleStore, hasReturning, targetPoolSize,
+								   &xactProperties, jobIdList);
+}
+
+
+/*
+ * ExecuteTaskList is a proxy to ExecuteTaskListExtended() with defaults
+ * for some of the arguments.
+ */
+uint64
+ExecuteTaskList(RowModifyLevel modLevel, List *taskList, int targetPoolSize)
+{
+	TupleDesc tupleDescriptor = NULL;
+	Tuplestorestate *tupleStore = NULL;
+	bool hasReturning = false;
+
+	TransactionProperties xactProperties =
+		DecideTransactionPropertiesForTaskList(modLevel, taskList, false);
+
+	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
+								   tupleStore, hasReturning, targetPoolSize,
+								   &xactProperties, NIL);
+}
+
+
+/*
+ * ExecuteTaskListIntoTupleStore is a proxy to ExecuteTaskListExtended() with defaults
+ * for some of the arguments.
+ */
+uint64
+ExecuteTaskListIntoTupleStore(RowModifyLevel modLevel, List *taskList,
+							  TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
+							  bool hasReturning)
+{
+	int targetPoolSize = MaxAdaptiveExecutorPoolSize;
+
+	TransactionProperties xactProperties = DecideTransactionPropertiesForTaskList(
+		modLevel, taskList, false);
+
+	return ExecuteTaskListExtended(modLevel, taskList, tupleDescriptor,
+								   tupleStore, hasReturning, targetPoolSize,
+								   &xactProperties, NIL);
+}
+
+
+/*
+ * ExecuteTaskListExtended sets up the execution for given task list and
+ * runs it.
+ */
+uint64
+ExecuteTaskListExtended(RowModifyLevel modLevel, List *taskList,
+						TupleDesc tupleDescriptor, Tuplestorestate *tupleStore,
+						bool hasReturning, int targetPoolSize,
+						TransactionProperties *xactProperties, List *jobIdList)
+{
+	ParamListInfo paramListInfo = NULL;
+
+	/*
+	 * The code-paths that rely on this function do not know how execute
+	 * commands locally.
+	 */
+	ErrorIfTransactionAccessedPlacementsLocally();
 
 	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION)
 	{
@@ -913,6 +1549,12 @@ CreateDistributedExecution(RowModifyLevel modLevel, List *taskList,
 						   Tuplestorestate *tupleStore, int targetPoolSize,
 						   TransactionProperties *xactProperties, List *jobIdList)
 {
+	/*
+	 * Streaming executions hold on to their connections, finish them before
+	 * starting a new execution that might need the same connections.
+	 */
+	FinishActiveStreamingExecutions();
+
 	DistributedExecution *execution =
 		(DistributedExecution *) palloc0(sizeof(DistributedExecution));
 
@@ -1467,6 +2109,11 @@ FinishDistributedExecution(DistributedExecution *execution)
 {
 	UnsetCitusNoticeLevel();
 
+	if (ShouldTrackWorkerLatencies())
+	{
+		RecordWorkerPoolLatencies(execution);
+	}
+
 	if (DistributedExecutionModifiesDatabase(execution))
 	{
 		/* prevent copying shards in same transaction */
@@ -1590,6 +2237,22 @@ AssignTasksToConnections(DistributedExecution *execution)
 	RowModifyLevel modLevel = execution->modLevel;
 	List *taskList = execution->tasksToExecute;
 	bool hasReturning = execution->hasReturning;
+	int taskIndex = 0;
+
+	if (execution->taskTupleStores != NULL)
+	{
+		execution->shardCommandExecutions = (ShardCommandExecution **)
+											palloc0(list_length(taskList) *
+													sizeof(ShardCommandExecution *));
+	}
+
+	/*
+	 * Reading from an additional placement in a transaction block would
+	 * leave a command in progress in the remote transaction, so we only
+	 * hedge reads outside of transaction blocks.
+	 */
+	execution->hedgeReads = HedgedReadDelay > 0 && modLevel == ROW_MODIFY_READONLY &&
+							!IsMultiStatementTransaction();
 
 	Task *task = NULL;
 	foreach_ptr(task, taskList)
@@ -1615,8 +2278,34 @@ AssignTasksToConnections(DistributedExecution *execution)
 			(hasReturning && !task->partiallyLocalOrRemote) ||
 			modLevel == ROW_MODIFY_READONLY;
 
+		if (execution->taskTupleStores != NULL)
+		{
+			shardCommandExecution->tupleStore = execution->taskTupleStores[taskIndex];
+			execution->shardCommandExecutions[taskIndex] = shardCommandExecution;
+		}
+		else
+		{
+			shardCommandExecution->tupleStore = execution->tupleStore;
+		}
+
+		taskIndex++;
+
+		List *placementList = task->taskPlacementList;
+		if (shardCommandExecution->executionOrder == EXECUTION_ORDER_ANY &&
+			placementExecutionCount > 1 && task->perPlacementQueryStrings == NIL &&
+			!IsMultiStatementTransaction())
+		{
+			if (TaskAssignmentPolicy == TASK_ASSIGNMENT_LEAST_LATENCY)
+			{
+				placementList = PlacementListOrderedByLatency(execution, placementList);
+			}
+
+			/* read from placements on workers that did not fail recently first */
+			placementList = PlacementListWithHealthyNodesFirst(execution, placementList);
+		}
+
 		ShardPlacement *taskPlacement = NULL;
-		foreach_ptr(taskPlacement, task->taskPlacementList)
+		foreach_ptr(taskPlacement, placementList)
 		{
 			int connectionFlags = 0;
 			char *nodeName = taskPlacement->nodeName;
@@ -1823,47 +2512,167 @@ ExecutionOrderForTask(RowModifyLevel modLevel, Task *task)
 
 
 /*
- * FindOrCreateWorkerPool gets the pool of connections for a particular worker.
+ * PlacementListWithHealthyNodesFirst returns the given placement list, with
+ * the placements on workers that should be avoided moved to the end.
  */
-static WorkerPool *
-FindOrCreateWorkerPool(DistributedExecution *execution, char *nodeName, int nodePort)
+static List *
+PlacementListWithHealthyNodesFirst(DistributedExecution *execution,
+								   List *placementList)
 {
-	WorkerPool *workerPool = NULL;
-	foreach_ptr(workerPool, execution->workerList)
+	List *healthyPlacementList = NIL;
+	List *avoidedPlacementList = NIL;
+
+	ShardPlacement *placement = NULL;
+	foreach_ptr(placement, placementList)
 	{
-		if (strncmp(nodeName, workerPool->nodeName, WORKER_LENGTH) == 0 &&
-			nodePort == workerPool->nodePort)
+		WorkerPool *workerPool = FindOrCreateWorkerPool(execution, placement->nodeName,
+														placement->nodePort);
+		if (workerPool->avoidNode)
 		{
-			return workerPool;
+			avoidedPlacementList = lappend(avoidedPlacementList, placement);
+		}
+		else
+		{
+			healthyPlacementList = lappend(healthyPlacementList, placement);
 		}
 	}
 
-	workerPool = (WorkerPool *) palloc0(sizeof(WorkerPool));
-	workerPool->nodeName = pstrdup(nodeName);
-	workerPool->nodePort = nodePort;
-	workerPool->poolStartTime = 0;
-	workerPool->distributedExecution = execution;
-
-	/* "open" connections aggressively when there are cached connections */
-	int nodeConnectionCount = MaxCachedConnectionsPerWorker;
-	workerPool->maxNewConnectionsPerCycle = Max(1, nodeConnectionCount);
-
-	dlist_init(&workerPool->pendingTaskQueue);
-	dlist_init(&workerPool->readyTaskQueue);
-
-	execution->workerList = lappend(execution->workerList, workerPool);
+	if (avoidedPlacementList == NIL)
+	{
+		return placementList;
+	}
 
-	return workerPool;
+	return list_concat(healthyPlacementList, avoidedPlacementList);
 }
 
 
 /*
- * FindOrCreateWorkerSession returns a session with the given connection,
- * either existing or new. New sessions are added to the worker pool and
- * the distributed execution.
+ * PlacementListOrderedByLatency returns the given placement list ordered by
+ * the expected latency of reading from each placement, which we estimate as
+ * the average task duration on its worker weighted by the number of tasks
+ * that backends on this node currently run on the worker. Idle connections
+ * are not counted, since they do not slow down the worker. Placements with
+ * equal costs keep their original order.
  */
-static WorkerSession *
-FindOrCreateWorkerSession(WorkerPool *workerPool, MultiConnection *connection)
+static List *
+PlacementListOrderedByLatency(DistributedExecution *execution, List *placementList)
+{
+	int placementCount = list_length(placementList);
+	PlacementLatencyCost *costArray =
+		palloc0(placementCount * sizeof(PlacementLatencyCost));
+	int placementIndex = 0;
+
+	ShardPlacement *placement = NULL;
+	foreach_ptr(placement, placementList)
+	{
+		WorkerPool *workerPool = FindOrCreateWorkerPool(execution, placement->nodeName,
+														placement->nodePort);
+		WorkerLatency latency = WorkerPoolLatency(workerPool);
+		int runningTaskCount = GetSharedRunningTaskCount(placement->nodeName,
+														 placement->nodePort);
+
+		/* workers without observations are assumed to be fast, to observe them */
+		double taskDurationUs = Max(latency.taskDurationUs, 0.0) + 1000.0;
+
+		costArray[placementIndex].placement = placement;
+		costArray[placementIndex].cost = taskDurationUs * (1 + runningTaskCount);
+		costArray[placementIndex].placementIndex = placementIndex;
+		placementIndex++;
+	}
+
+	qsort(costArray, placementCount, sizeof(PlacementLatencyCost),
+		  ComparePlacementLatencyCost);
+
+	List *orderedPlacementList = NIL;
+	for (placementIndex = 0; placementIndex < placementCount; placementIndex++)
+	{
+		orderedPlacementList = lappend(orderedPlacementList,
+									   costArray[placementIndex].placement);
+	}
+
+	pfree(costArray);
+
+	return orderedPlacementList;
+}
+
+
+/*
+ * ComparePlacementLatencyCost orders placements by ascending cost, and by
+ * their original position when the costs are equal.
+ */
+static int
+ComparePlacementLatencyCost(const void *leftElement, const void *rightElement)
+{
+	const PlacementLatencyCost *left = (const PlacementLatencyCost *) leftElement;
+	const PlacementLatencyCost *right = (const PlacementLatencyCost *) rightElement;
+
+	if (left->cost < right->cost)
+	{
+		return -1;
+	}
+	else if (left->cost > right->cost)
+	{
+		return 1;
+	}
+
+	return left->placementIndex - right->placementIndex;
+}
+
+
+/*
+ * FindOrCreateWorkerPool gets the pool of connections for a particular worker.
+ */
+static WorkerPool *
+FindOrCreateWorkerPool(DistributedExecution *execution, char *nodeName, int nodePort)
+{
+	WorkerPool *workerPool = NULL;
+	foreach_ptr(workerPool, execution->workerList)
+	{
+		if (strncmp(nodeName, workerPool->nodeName, WORKER_LENGTH) == 0 &&
+			nodePort == workerPool->nodePort)
+		{
+			return workerPool;
+		}
+	}
+
+	workerPool = (WorkerPool *) palloc0(sizeof(WorkerPool));
+	workerPool->nodeName = pstrdup(nodeName);
+	workerPool->nodePort = nodePort;
+	workerPool->poolStartTime = 0;
+	workerPool->distributedExecution = execution;
+
+	/* "open" connections aggressively when there are cached connections */
+	int nodeConnectionCount = MaxCachedConnectionsPerWorker;
+	workerPool->maxNewConnectionsPerCycle = Max(1, nodeConnectionCount);
+
+	if (ShouldTrackWorkerLatencies())
+	{
+		workerPool->historicLatency = GetWorkerLatency(nodeName, nodePort);
+	}
+	else
+	{
+		workerPool->historicLatency.taskDurationUs = -1.0;
+		workerPool->historicLatency.connectionTimeUs = -1.0;
+	}
+
+	workerPool->avoidNode = ShouldAvoidNode(nodeName, nodePort);
+
+	dlist_init(&workerPool->pendingTaskQueue);
+	dlist_init(&workerPool->readyTaskQueue);
+
+	execution->workerList = lappend(execution->workerList, workerPool);
+
+	return workerPool;
+}
+
+
+/*
+ * FindOrCreateWorkerSession returns a session with the given connection,
+ * either existing or new. New sessions are added to the worker pool and
+ * the distributed execution.
+ */
+static WorkerSession *
+FindOrCreateWorkerSession(WorkerPool *workerPool, MultiConnection *connection)
 {
 	DistributedExecution *execution = workerPool->distributedExecution;
 	static uint64 sessionId = 1;
@@ -1999,7 +2808,7 @@ SequentialRunDistributedExecution(DistributedExecution *execution)
 void
 RunDistributedExecution(DistributedExecution *execution)
 {
-	WaitEvent *events = NULL;
+	List *executionList = list_make1(execution);
 
 	AssignTasksToConnections(execution);
 
@@ -2007,133 +2816,40 @@ RunDistributedExecution(DistributedExecution *execution)
 	{
 		bool cancellationReceived = false;
 
-		/* additional 2 is for postmaster and latch */
-		int eventSetSize = list_length(execution->sessionList) + 2;
-
 		/* always (re)build the wait event set the first time */
 		execution->connectionSetChanged = true;
 
-		while (execution->unfinishedTaskCount > 0 && !cancellationReceived)
-		{
-			int eventIndex = 0;
-			long timeout = NextEventTimeout(execution);
-
-			WorkerPool *workerPool = NULL;
-			foreach_ptr(workerPool, execution->workerList)
-			{
-				ManageWorkerPool(workerPool);
-			}
-
-			if (execution->connectionSetChanged)
-			{
-				if (execution->waitEventSet != NULL)
-				{
-					FreeWaitEventSet(execution->waitEventSet);
-					execution->waitEventSet = NULL;
-				}
-
-				if (events != NULL)
-				{
-					/*
-					 * The execution might take a while, so explicitly free at this point
-					 * because we don't need anymore.
-					 */
-					pfree(events);
-					events = NULL;
-				}
-
-				execution->waitEventSet = BuildWaitEventSet(execution->sessionList);
-
-				/* recalculate (and allocate) since the sessions have changed */
-				eventSetSize = list_length(execution->sessionList) + 2;
-
-				events = palloc0(eventSetSize * sizeof(WaitEvent));
-
-				execution->connectionSetChanged = false;
-				execution->waitFlagsChanged = false;
-			}
-			else if (execution->waitFlagsChanged)
-			{
-				UpdateWaitEventSetFlags(execution->waitEventSet, execution->sessionList);
-				execution->waitFlagsChanged = false;
-			}
-
-			/* wait for I/O events */
-			int eventCount = WaitEventSetWait(execution->waitEventSet, timeout, events,
-											  eventSetSize, WAIT_EVENT_CLIENT_READ);
-
-			/* process I/O events */
-			for (; eventIndex < eventCount; eventIndex++)
-			{
-				WaitEvent *event = &events[eventIndex];
-
-				if (event->events & WL_POSTMASTER_DEATH)
-				{
-					ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
-				}
-
-				if (event->events & WL_LATCH_SET)
-				{
-					ResetLatch(MyLatch);
-
-					if (execution->raiseInterrupts)
-					{
-						CHECK_FOR_INTERRUPTS();
-					}
-
-					if (IsHoldOffCancellationReceived())
-					{
-						/*
-						 * Break out of event loop immediately in case of cancellation.
-						 * We cannot use "return" here inside a PG_TRY() block since
-						 * then the exception stack won't be reset.
-						 */
-						cancellationReceived = true;
-						break;
-					}
-
-					continue;
-				}
-
-				WorkerSession *session = (WorkerSession *) event->user_data;
-				session->latestUnconsumedWaitEvents = event->events;
-
-				ConnectionStateMachine(session);
-			}
-		}
-
-		if (events != NULL)
+		while (execution->unfinishedTaskCount > 0 && !cancellationReceived &&
+			   !RowLimitReached(execution))
 		{
-			pfree(events);
+			cancellationReceived = RunDistributedExecutionCycle(executionList);
 		}
 
-		if (execution->waitEventSet != NULL)
+		/* the remote tasks finished first, run the remaining local tasks */
+		while (execution->pendingLocalTaskList != NIL && !cancellationReceived)
 		{
-			FreeWaitEventSet(execution->waitEventSet);
-			execution->waitEventSet = NULL;
+			RunNextLocalTask(execution);
 		}
 
-		CleanUpSessions(execution);
-	}
-	PG_CATCH();
-	{
-		/*
-		 * We can still recover from error using ROLLBACK TO SAVEPOINT,
-		 * unclaim all connections to allow that.
-		 */
-		UnclaimAllSessionConnections(execution->sessionList);
+		FreeExecutionWaitEvents(execution);
 
-		/* do repartition cleanup if this is a repartition query*/
-		if (list_length(execution->jobIdList) > 0)
+		if ((execution->unfinishedTaskCount > 0 || execution->hedgedReadCount > 0) &&
+			!cancellationReceived)
 		{
-			DoRepartitionCleanup(execution->jobIdList);
+			/*
+			 * We have all the rows we need, stop the remaining tasks and the
+			 * hedged reads that lost.
+			 */
+			StopUnfinishedSessions(execution);
 		}
-
-		if (execution->waitEventSet != NULL)
+		else
 		{
-			FreeWaitEventSet(execution->waitEventSet);
-			execution->waitEventSet = NULL;
+			CleanUpSessions(execution);
 		}
+	}
+	PG_CATCH();
+	{
+		HandleDistributedExecutionError(execution);
 
 		PG_RE_THROW();
 	}
@@ -2142,127 +2858,997 @@ RunDistributedExecution(DistributedExecution *execution)
 
 
 /*
- * ManageWorkerPool ensures the worker pool has the appropriate number of connections
- * based on the number of pending tasks.
+ * RunDistributedExecutionCycle performs a single iteration of the event loop of
+ * the given executions: it manages the worker pools of the executions that are
+ * still running, (re)builds the wait event set if necessary, waits for I/O
+ * events and runs the connection state machine for the sessions that have an
+ * event. If none of the sessions is ready, it runs one of the pending local
+ * tasks instead of waiting. The function returns true if the execution was
+ * cancelled.
+ *
+ * A single wait event set covers the sessions of all executions. It is kept in
+ * the first execution, such that it is freed by HandleDistributedExecutionError.
  */
-static void
-ManageWorkerPool(WorkerPool *workerPool)
+static bool
+RunDistributedExecutionCycle(List *executionList)
 {
-	DistributedExecution *execution = workerPool->distributedExecution;
-	int targetPoolSize = execution->targetPoolSize;
-	int initiatedConnectionCount = list_length(workerPool->sessionList);
-	int activeConnectionCount PG_USED_FOR_ASSERTS_ONLY =
-		workerPool->activeConnectionCount;
-	int idleConnectionCount PG_USED_FOR_ASSERTS_ONLY =
-		workerPool->idleConnectionCount;
-	int failedConnectionCount = workerPool->failedConnectionCount;
-	int readyTaskCount = workerPool->readyTaskCount;
-	int newConnectionCount = 0;
+	DistributedExecution *firstExecution =
+		(DistributedExecution *) linitial(executionList);
+	DistributedExecution *localTaskExecution = NULL;
+	bool connectionSetChanged = false;
+	bool waitFlagsChanged = false;
+	bool timeoutSet = false;
+	long timeout = 0;
+	int eventIndex = 0;
+
+	DistributedExecution *execution = NULL;
+	foreach_ptr(execution, executionList)
+	{
+		if (execution->unfinishedTaskCount > 0 && !RowLimitReached(execution))
+		{
+			/* wake up in time for the execution that needs it first */
+			long executionTimeout = NextEventTimeout(execution);
+			if (!timeoutSet || executionTimeout < timeout)
+			{
+				timeout = executionTimeout;
+				timeoutSet = true;
+			}
 
-	/* we should always have more (or equal) active connections than idle connections */
-	Assert(activeConnectionCount >= idleConnectionCount);
+			if (execution->hedgeReads)
+			{
+				StartHedgedReads(execution);
+			}
 
-	/* we should always have more (or equal) initiated connections than active connections */
-	Assert(initiatedConnectionCount >= activeConnectionCount);
+			WorkerPool *workerPool = NULL;
+			foreach_ptr(workerPool, execution->workerList)
+			{
+				ManageWorkerPool(workerPool);
+			}
+		}
 
-	/* we should never have less than 0 connections ever */
-	Assert(activeConnectionCount >= 0 && idleConnectionCount >= 0);
+		if (execution->pendingLocalTaskList != NIL && localTaskExecution == NULL)
+		{
+			localTaskExecution = execution;
+		}
 
-	if (workerPool->failed)
-	{
-		/* connection pool failed */
-		return;
-	}
+		connectionSetChanged |= execution->connectionSetChanged;
+		waitFlagsChanged |= execution->waitFlagsChanged;
 
-	/* we might fail the execution or warn the user about connection timeouts */
-	if (workerPool->checkForPoolTimeout)
-	{
-		CheckConnectionTimeout(workerPool);
+		execution->connectionSetChanged = false;
+		execution->waitFlagsChanged = false;
 	}
 
-	if (failedConnectionCount >= 1)
+	if (localTaskExecution != NULL)
 	{
-		/* do not attempt to open more connections after one failed */
-		return;
+		/* do not block, we rather run a local task if no connection is ready */
+		timeout = 0;
 	}
 
-	if (UseConnectionPerPlacement())
+	if (connectionSetChanged)
 	{
-		int unusedConnectionCount = workerPool->unusedConnectionCount;
+		List *sessionList = NIL;
+
+		foreach_ptr(execution, executionList)
+		{
+			sessionList = list_concat(sessionList, list_copy(execution->sessionList));
+		}
 
 		/*
-		 * If force_max_query_parallelization is enabled then we ignore pool size
-		 * and idle connections. Instead, we open new connections as long as there
-		 * are more tasks than unused connections.
+		 * The execution might take a while, so explicitly free the old wait
+		 * event set and events at this point because we don't need them anymore.
 		 */
+		FreeExecutionWaitEvents(firstExecution);
 
-		newConnectionCount = Max(readyTaskCount - unusedConnectionCount, 0);
+		firstExecution->waitEventSet = BuildWaitEventSet(sessionList);
+
+		/* recalculate (and allocate) since the sessions have changed */
+		firstExecution->eventSetSize = list_length(sessionList) + 2;
+		firstExecution->events =
+			palloc0(firstExecution->eventSetSize * sizeof(WaitEvent));
+
+		list_free(sessionList);
 	}
-	else
+	else if (waitFlagsChanged)
 	{
-		/* cannot open more than targetPoolSize connections */
-		int maxNewConnectionCount = targetPoolSize - initiatedConnectionCount;
+		foreach_ptr(execution, executionList)
+		{
+			UpdateWaitEventSetFlags(firstExecution->waitEventSet,
+									execution->sessionList);
+		}
+	}
 
-		/* total number of connections that are (almost) available for tasks */
-		int usableConnectionCount = UsableConnectionCount(workerPool);
+	/* wait for I/O events */
+	int eventCount = WaitEventSetWait(firstExecution->waitEventSet, timeout,
+									  firstExecution->events,
+									  firstExecution->eventSetSize,
+									  WAIT_EVENT_CLIENT_READ);
 
-		/*
-		 * Number of additional connections we would need to run all ready tasks in
-		 * parallel.
-		 */
-		int newConnectionsForReadyTasks = readyTaskCount - usableConnectionCount;
+	/* process I/O events */
+	for (; eventIndex < eventCount; eventIndex++)
+	{
+		WaitEvent *event = &firstExecution->events[eventIndex];
 
-		/*
-		 * Open enough connections to handle all tasks that are ready, but no more
-		 * than the target pool size.
-		 */
-		newConnectionCount = Min(newConnectionsForReadyTasks, maxNewConnectionCount);
+		if (event->events & WL_POSTMASTER_DEATH)
+		{
+			ereport(ERROR, (errmsg("postmaster was shut down, exiting")));
+		}
 
-		if (newConnectionCount > 0 && ExecutorSlowStartInterval > 0)
+		if (event->events & WL_LATCH_SET)
 		{
-			TimestampTz now = GetCurrentTimestamp();
+			ResetLatch(MyLatch);
 
-			if (TimestampDifferenceExceeds(workerPool->lastConnectionOpenTime, now,
-										   ExecutorSlowStartInterval))
+			if (firstExecution->raiseInterrupts)
 			{
-				newConnectionCount = Min(newConnectionCount,
-										 workerPool->maxNewConnectionsPerCycle);
-
-				/* increase the open rate every cycle (like TCP slow start) */
-				workerPool->maxNewConnectionsPerCycle += 1;
+				CHECK_FOR_INTERRUPTS();
 			}
-			else
+
+			if (IsHoldOffCancellationReceived())
 			{
-				/* wait a bit until opening more connections */
-				return;
+				/* break out of event loop immediately in case of cancellation */
+				return true;
 			}
+
+			continue;
 		}
+
+		WorkerSession *session = (WorkerSession *) event->user_data;
+		session->latestUnconsumedWaitEvents = event->events;
+
+		ConnectionStateMachine(session);
 	}
 
-	if (newConnectionCount <= 0)
+	if (eventCount == 0 && localTaskExecution != NULL)
 	{
-		return;
+		/* the workers are busy with the remote tasks, do some work in the meantime */
+		RunNextLocalTask(localTaskExecution);
 	}
 
-	ereport(DEBUG4, (errmsg("opening %d new connections to %s:%d", newConnectionCount,
-							workerPool->nodeName, workerPool->nodePort)));
+	return false;
+}
 
-	for (int connectionIndex = 0; connectionIndex < newConnectionCount; connectionIndex++)
-	{
-		/* experimental: just to see the perf benefits of caching connections */
-		int connectionFlags = 0;
 
-		if (execution->transactionProperties->useRemoteTransactionBlocks ==
-			TRANSACTION_BLOCKS_DISALLOWED)
+/*
+ * DistributedExecutionsRunning returns whether any of the given executions
+ * still has tasks to run and can use more rows.
+ */
+static bool
+DistributedExecutionsRunning(List *executionList)
+{
+	DistributedExecution *execution = NULL;
+	foreach_ptr(execution, executionList)
+	{
+		if (execution->unfinishedTaskCount > 0 && !RowLimitReached(execution))
 		{
-			connectionFlags |= OUTSIDE_TRANSACTION;
+			return true;
 		}
+	}
 
-		/* open a new connection to the worker */
-		MultiConnection *connection = StartNodeUserDatabaseConnection(connectionFlags,
-																	  workerPool->nodeName,
-																	  workerPool->nodePort,
+	return false;
+}
+
+
+/*
+ * FreeExecutionWaitEvents frees the wait event set and the events array of the
+ * given execution, if any.
+ */
+static void
+FreeExecutionWaitEvents(DistributedExecution *execution)
+{
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+
+	if (execution->events != NULL)
+	{
+		pfree(execution->events);
+		execution->events = NULL;
+		execution->eventSetSize = 0;
+	}
+}
+
+
+/*
+ * HandleDistributedExecutionError releases the resources of an execution that
+ * failed with an error, before the error is re-thrown.
+ */
+static void
+HandleDistributedExecutionError(DistributedExecution *execution)
+{
+	/*
+	 * We can still recover from error using ROLLBACK TO SAVEPOINT,
+	 * unclaim all connections to allow that.
+	 */
+	UnclaimAllSessionConnections(execution->sessionList);
+
+	/* do repartition cleanup if this is a repartition query*/
+	if (list_length(execution->jobIdList) > 0)
+	{
+		DoRepartitionCleanup(execution->jobIdList);
+	}
+
+	/* the events array is freed along with the memory context */
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+}
+
+
+/*
+ * StartStreamingExecution starts an execution of which the results are streamed
+ * to the scan. It only assigns the tasks to connections, the event loop is run
+ * whenever the scan needs more rows.
+ */
+static void
+StartStreamingExecution(DistributedExecution *execution)
+{
+	AssignTasksToConnections(execution);
+
+	/* always (re)build the wait event set the first time */
+	execution->connectionSetChanged = true;
+
+	execution->streamingActive = true;
+	dlist_push_tail(&ActiveStreamingExecutions, &execution->streamingNode);
+
+	/*
+	 * Make sure we stop tracking the execution and close the wait event set
+	 * when the executor state goes away, including on errors.
+	 */
+	MemoryContext executionContext = GetMemoryChunkContext(execution);
+	MemoryContextCallback *resetCallback =
+		MemoryContextAllocZero(executionContext, sizeof(MemoryContextCallback));
+
+	resetCallback->func = StreamingExecutionContextReset;
+	resetCallback->arg = execution;
+	MemoryContextRegisterResetCallback(executionContext, resetCallback);
+}
+
+
+/*
+ * ContinueStreamingExecution is called when the scan consumed all rows in the
+ * tuple store of a streaming execution. It discards those rows and runs the
+ * event loop until new rows arrive or all tasks are finished. Since we only
+ * read from the connections when the scan asks for more rows, a slow consumer
+ * causes the workers to block on sending rather than us buffering the whole
+ * result.
+ *
+ * The function returns false if the execution had already finished and
+ * hence no new rows could be added to the tuple store.
+ */
+bool
+ContinueStreamingExecution(DistributedExecution *execution)
+{
+	if (!execution->streamingActive)
+	{
+		return false;
+	}
+
+	tuplestore_clear(execution->tupleStore);
+
+	bool runToCompletion = false;
+	RunStreamingExecution(execution, NULL, runToCompletion);
+
+	return true;
+}
+
+
+/*
+ * ContinueStreamingExecutionForTask is the equivalent of
+ * ContinueStreamingExecution for executions that write the rows of each task
+ * into a separate tuple store. It is called when the rows in the tuple store of
+ * the task at taskIndex are consumed and runs the event loop until new rows for
+ * that task arrive or the task finished.
+ *
+ * The function returns false if no new rows can be added to the tuple store of
+ * the task anymore.
+ */
+bool
+ContinueStreamingExecutionForTask(DistributedExecution *execution, int taskIndex)
+{
+	if (!execution->streamingActive)
+	{
+		return false;
+	}
+
+	Assert(execution->taskTupleStores != NULL);
+
+	ShardCommandExecution *shardCommandExecution =
+		execution->shardCommandExecutions[taskIndex];
+	if (shardCommandExecution->executionState != TASK_EXECUTION_NOT_FINISHED)
+	{
+		return false;
+	}
+
+	tuplestore_clear(shardCommandExecution->tupleStore);
+
+	bool runToCompletion = false;
+	RunStreamingExecution(execution, shardCommandExecution, runToCompletion);
+
+	return true;
+}
+
+
+/*
+ * FinishActiveStreamingExecutions receives all remaining rows of the streaming
+ * executions that are in progress into their tuple stores, after which their
+ * connections can be used for other commands. The scans then continue reading
+ * from the (materialized) tuple stores.
+ */
+void
+FinishActiveStreamingExecutions(void)
+{
+	while (!dlist_is_empty(&ActiveStreamingExecutions))
+	{
+		DistributedExecution *execution =
+			dlist_head_element(DistributedExecution, streamingNode,
+							   &ActiveStreamingExecutions);
+
+		bool runToCompletion = true;
+		RunStreamingExecution(execution, NULL, runToCompletion);
+	}
+}
+
+
+/*
+ * RunStreamingExecution runs the event loop of a streaming execution until new
+ * rows were received or, if runToCompletion is set, until all tasks are
+ * finished. If targetExecution is given, only new rows of that task count
+ * and we also stop once the task is finished. Once all tasks are finished the
+ * sessions are cleaned up in the same way as for regular executions.
+ */
+static void
+RunStreamingExecution(DistributedExecution *execution,
+					  ShardCommandExecution *targetExecution, bool runToCompletion)
+{
+	uint64 previousRowCount = StreamingExecutionRowCount(execution, targetExecution);
+
+	/*
+	 * Sessions and other execution state may get allocated while running the
+	 * event loop, make sure they live as long as the execution.
+	 */
+	MemoryContext oldContext =
+		MemoryContextSwitchTo(GetMemoryChunkContext(execution));
+	List *executionList = list_make1(execution);
+
+	PG_TRY();
+	{
+		bool cancellationReceived = false;
+
+		while (execution->unfinishedTaskCount > 0 && !cancellationReceived &&
+			   !RowLimitReached(execution))
+		{
+			if (!runToCompletion &&
+				(StreamingExecutionRowCount(execution, targetExecution) !=
+				 previousRowCount ||
+				 (targetExecution != NULL &&
+				  targetExecution->executionState != TASK_EXECUTION_NOT_FINISHED)))
+			{
+				/* the scan can continue */
+				break;
+			}
+
+			cancellationReceived = RunDistributedExecutionCycle(executionList);
+		}
+
+		if (cancellationReceived ||
+			(execution->unfinishedTaskCount == 0 && execution->hedgedReadCount == 0))
+		{
+			StopTrackingStreamingExecution(execution);
+			FreeExecutionWaitEvents(execution);
+
+			CleanUpSessions(execution);
+			FinishDistributedExecution(execution);
+		}
+		else if (execution->unfinishedTaskCount == 0 || RowLimitReached(execution))
+		{
+			StopTrackingStreamingExecution(execution);
+			FreeExecutionWaitEvents(execution);
+
+			StopUnfinishedSessions(execution);
+			FinishDistributedExecution(execution);
+		}
+	}
+	PG_CATCH();
+	{
+		StopTrackingStreamingExecution(execution);
+		HandleDistributedExecutionError(execution);
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * StreamingExecutionRowCount returns the number of rows received for the
+ * given task, or for the whole execution if targetExecution is NULL.
+ */
+static uint64
+StreamingExecutionRowCount(DistributedExecution *execution,
+						   ShardCommandExecution *targetExecution)
+{
+	if (targetExecution != NULL)
+	{
+		return targetExecution->rowsReceived;
+	}
+
+	return execution->rowsProcessed;
+}
+
+
+/*
+ * EndStreamingExecution is called when a scan ends before all rows of its
+ * streaming execution were received, for instance due to a LIMIT.
+ */
+void
+EndStreamingExecution(DistributedExecution *execution)
+{
+	if (!execution->streamingActive)
+	{
+		return;
+	}
+
+	StopTrackingStreamingExecution(execution);
+	FreeExecutionWaitEvents(execution);
+
+	StopUnfinishedSessions(execution);
+	FinishDistributedExecution(execution);
+}
+
+
+/*
+ * RowLimitReached returns true if the execution received all the rows that
+ * are needed by the scan.
+ */
+static bool
+RowLimitReached(DistributedExecution *execution)
+{
+	return execution->rowLimit > 0 && execution->rowsProcessed >= execution->rowLimit;
+}
+
+
+/*
+ * StopUnfinishedSessions is the equivalent of CleanUpSessions for executions
+ * that stop before all tasks are finished. Tasks that were not yet sent to a
+ * worker are skipped. Commands that run outside of a transaction block are
+ * cancelled. Commands that run in a transaction block cannot be cancelled
+ * without aborting the remote transaction, so we discard their remaining rows
+ * instead. Either way, the connections can be used by subsequent commands
+ * afterwards.
+ */
+static void
+StopUnfinishedSessions(DistributedExecution *execution)
+{
+	WorkerSession *session = NULL;
+	foreach_ptr(session, execution->sessionList)
+	{
+		MultiConnection *connection = session->connection;
+
+		UnclaimConnection(connection);
+
+		if (connection->connectionState == MULTI_CONNECTION_CONNECTED)
+		{
+			DiscardSessionResults(session);
+		}
+
+		if (connection->connectionState != MULTI_CONNECTION_CONNECTED)
+		{
+			/* same as in CleanUpSessions(), unusable connections go away */
+			CloseConnection(connection);
+		}
+		else
+		{
+			/* get ready for the next executions if we need use the same connection */
+			connection->waitFlags = WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE;
+		}
+	}
+}
+
+
+/*
+ * DiscardSessionResults brings the connection of a session of an unfinished
+ * execution back into an idle state by cancelling or draining the command in
+ * progress, if any.
+ */
+static void
+DiscardSessionResults(WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+	RemoteTransaction *transaction = &(connection->remoteTransaction);
+	RemoteTransactionState transactionState = transaction->transactionState;
+	bool commandFailed = false;
+
+	if (transactionState == REMOTE_TRANS_NOT_STARTED ||
+		transactionState == REMOTE_TRANS_STARTED)
+	{
+		/* no command in progress */
+		return;
+	}
+
+	if (transactionState == REMOTE_TRANS_SENT_COMMAND && !transaction->beginSent)
+	{
+		/* we do not need the remaining rows and no transaction is affected */
+		SendCancelationRequest(connection);
+	}
+
+	while (true)
+	{
+		bool raiseInterrupts = true;
+		PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+		if (result == NULL)
+		{
+			break;
+		}
+
+		if (!IsResponseOK(result))
+		{
+			commandFailed = true;
+		}
+
+		PQclear(result);
+
+		if (PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			break;
+		}
+	}
+
+	session->currentTask = NULL;
+	session->batchedTaskList = NIL;
+	session->pendingResultCount = 0;
+	session->pendingBeginResultCount = 0;
+	FinishSharedRunningTask(connection);
+
+	if (PQstatus(connection->pgConn) != CONNECTION_OK)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+	}
+
+	if (transaction->beginSent)
+	{
+		if (commandFailed || connection->connectionState != MULTI_CONNECTION_CONNECTED)
+		{
+			/* the remote transaction can no longer commit */
+			MarkRemoteTransactionFailed(connection, true);
+		}
+
+		transaction->transactionState = REMOTE_TRANS_STARTED;
+	}
+	else
+	{
+		transaction->transactionState = REMOTE_TRANS_NOT_STARTED;
+	}
+}
+
+
+/*
+ * StopTrackingStreamingExecution removes the execution from the list of
+ * active streaming executions.
+ */
+static void
+StopTrackingStreamingExecution(DistributedExecution *execution)
+{
+	if (execution->streamingActive)
+	{
+		dlist_delete(&execution->streamingNode);
+		execution->streamingActive = false;
+	}
+}
+
+
+/*
+ * StreamingExecutionContextReset is a memory context reset callback for the
+ * context of a streaming execution. It makes sure that executions that did
+ * not finish, for instance due to an error in the consumer, are no longer
+ * tracked and do not leak their wait event set.
+ */
+static void
+StreamingExecutionContextReset(void *arg)
+{
+	DistributedExecution *execution = (DistributedExecution *) arg;
+
+	StopTrackingStreamingExecution(execution);
+
+	if (execution->waitEventSet != NULL)
+	{
+		FreeWaitEventSet(execution->waitEventSet);
+		execution->waitEventSet = NULL;
+	}
+}
+
+
+/*
+ * PrefetchDistributedPlanResults executes the tasks of the given Citus scans,
+ * which belong to separate read-only plans, concurrently and keeps the rows of
+ * each plan. Once a plan itself is executed, AdaptiveExecutor returns the kept
+ * rows instead of going to the workers again. This way independent subplans
+ * take roughly the time of the slowest one rather than the sum of all of them.
+ *
+ * Rows that are never asked for are removed by DiscardPrefetchedResult or when
+ * the current memory context goes away.
+ */
+void
+PrefetchDistributedPlanResults(List *customScanList)
+{
+	List *executionList = NIL;
+	List *planIdList = NIL;
+
+	/* the plans share the connections that a single plan would use */
+	int targetPoolSize = Max(MaxAdaptiveExecutorPoolSize / list_length(customScanList),
+							 1);
+
+	CustomScan *customScan = NULL;
+	foreach_ptr(customScan, customScanList)
+	{
+		DistributedPlan *distributedPlan = GetDistributedPlan(customScan);
+		List *taskList = distributedPlan->workerJob->taskList;
+		TupleDesc tupleDescriptor =
+			ExecTypeFromTLCompat(customScan->scan.plan.targetlist);
+		bool randomAccess = true;
+		bool interTransactions = false;
+
+		Assert(distributedPlan->modLevel == ROW_MODIFY_READONLY);
+
+		LockPartitionsForDistributedPlan(distributedPlan);
+
+		if (ShouldBundleTasksPerNode(distributedPlan))
+		{
+			/* send a single UNION ALL query to each worker node */
+			taskList = BundleTasksPerNode(taskList);
+		}
+
+		/* the execution keeps a pointer, so allocate it for each plan */
+		TransactionProperties *xactProperties =
+			(TransactionProperties *) palloc0(sizeof(TransactionProperties));
+		*xactProperties = DecideTransactionPropertiesForTaskList(ROW_MODIFY_READONLY,
+																 taskList, false);
+
+		Tuplestorestate *tupleStore =
+			tuplestore_begin_heap(randomAccess, interTransactions, work_mem);
+
+		DistributedExecution *execution = CreateDistributedExecution(
+			ROW_MODIFY_READONLY,
+			taskList,
+			false,
+			NULL,
+			tupleDescriptor,
+			tupleStore,
+			targetPoolSize,
+			xactProperties,
+			NIL);
+
+		execution->rowLimit = distributedPlan->scanRowLimit;
+
+		if (EnableBinaryProtocol)
+		{
+			PrepareBinaryResultReception(execution);
+		}
+
+		StartDistributedExecution(execution);
+
+		executionList = lappend(executionList, execution);
+		planIdList = lappend(planIdList, &distributedPlan->planId);
+	}
+
+	RunConcurrentDistributedExecutions(executionList);
+
+	MemoryContext prefetchContext = CurrentMemoryContext;
+	ListCell *executionCell = NULL;
+	ListCell *planIdCell = NULL;
+
+	forboth(executionCell, executionList, planIdCell, planIdList)
+	{
+		DistributedExecution *execution = (DistributedExecution *) lfirst(executionCell);
+		uint64 *planId = (uint64 *) lfirst(planIdCell);
+
+		FinishDistributedExecution(execution);
+
+		PrefetchedResult *prefetchedResult =
+			(PrefetchedResult *) palloc0(sizeof(PrefetchedResult));
+		prefetchedResult->planId = *planId;
+		prefetchedResult->tupleStore = execution->tupleStore;
+
+		prefetchedResult->prefetchActive = true;
+		dlist_push_tail(&PrefetchedResults, &prefetchedResult->prefetchNode);
+
+		/* stop tracking the result when the rows go away, including on errors */
+		MemoryContextCallback *resetCallback =
+			MemoryContextAllocZero(prefetchContext, sizeof(MemoryContextCallback));
+
+		resetCallback->func = PrefetchedResultContextReset;
+		resetCallback->arg = prefetchedResult;
+		MemoryContextRegisterResetCallback(prefetchContext, resetCallback);
+	}
+}
+
+
+/*
+ * RunConcurrentDistributedExecutions runs the given executions, none of which
+ * has local tasks, to completion in a single event loop, in the same way as
+ * RunDistributedExecution runs a single execution.
+ */
+static void
+RunConcurrentDistributedExecutions(List *executionList)
+{
+	DistributedExecution *firstExecution =
+		(DistributedExecution *) linitial(executionList);
+	DistributedExecution *execution = NULL;
+
+	foreach_ptr(execution, executionList)
+	{
+		Assert(execution->localTaskList == NIL);
+
+		AssignTasksToConnections(execution);
+	}
+
+	PG_TRY();
+	{
+		bool cancellationReceived = false;
+
+		/* always (re)build the wait event set the first time */
+		firstExecution->connectionSetChanged = true;
+
+		while (DistributedExecutionsRunning(executionList) && !cancellationReceived)
+		{
+			cancellationReceived = RunDistributedExecutionCycle(executionList);
+		}
+
+		FreeExecutionWaitEvents(firstExecution);
+
+		foreach_ptr(execution, executionList)
+		{
+			if ((execution->unfinishedTaskCount > 0 ||
+				 execution->hedgedReadCount > 0) && !cancellationReceived)
+			{
+				/* stop the remaining tasks and the hedged reads that lost */
+				StopUnfinishedSessions(execution);
+			}
+			else
+			{
+				CleanUpSessions(execution);
+			}
+		}
+	}
+	PG_CATCH();
+	{
+		foreach_ptr(execution, executionList)
+		{
+			HandleDistributedExecutionError(execution);
+		}
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+}
+
+
+/*
+ * DiscardPrefetchedResult removes the prefetched rows of the given plan, if
+ * they were not returned by its scan.
+ */
+void
+DiscardPrefetchedResult(uint64 planId)
+{
+	Tuplestorestate *tupleStore = TakePrefetchedResult(planId);
+	if (tupleStore != NULL)
+	{
+		tuplestore_end(tupleStore);
+	}
+}
+
+
+/*
+ * TakePrefetchedResult returns the prefetched rows of the given plan and stops
+ * tracking them, or returns NULL if the tasks of the plan did not run yet.
+ */
+static Tuplestorestate *
+TakePrefetchedResult(uint64 planId)
+{
+	dlist_iter iter;
+
+	dlist_foreach(iter, &PrefetchedResults)
+	{
+		PrefetchedResult *prefetchedResult =
+			dlist_container(PrefetchedResult, prefetchNode, iter.cur);
+
+		if (prefetchedResult->planId == planId)
+		{
+			StopTrackingPrefetchedResult(prefetchedResult);
+
+			return prefetchedResult->tupleStore;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * StopTrackingPrefetchedResult removes the given result from PrefetchedResults
+ * if it is still in there.
+ */
+static void
+StopTrackingPrefetchedResult(PrefetchedResult *prefetchedResult)
+{
+	if (prefetchedResult->prefetchActive)
+	{
+		dlist_delete(&prefetchedResult->prefetchNode);
+		prefetchedResult->prefetchActive = false;
+	}
+}
+
+
+/*
+ * PrefetchedResultContextReset is a memory context reset callback for the
+ * context of a prefetched result. It makes sure that rows that were not taken,
+ * for instance due to an error, are no longer tracked.
+ */
+static void
+PrefetchedResultContextReset(void *arg)
+{
+	PrefetchedResult *prefetchedResult = (PrefetchedResult *) arg;
+
+	StopTrackingPrefetchedResult(prefetchedResult);
+}
+
+
+/*
+ * ManageWorkerPool ensures the worker pool has the appropriate number of connections
+ * based on the number of pending tasks.
+ */
+static void
+ManageWorkerPool(WorkerPool *workerPool)
+{
+	DistributedExecution *execution = workerPool->distributedExecution;
+	int targetPoolSize = execution->targetPoolSize;
+	int initiatedConnectionCount = list_length(workerPool->sessionList);
+	int activeConnectionCount PG_USED_FOR_ASSERTS_ONLY =
+		workerPool->activeConnectionCount;
+	int idleConnectionCount PG_USED_FOR_ASSERTS_ONLY =
+		workerPool->idleConnectionCount;
+	int failedConnectionCount = workerPool->failedConnectionCount;
+	int readyTaskCount = workerPool->readyTaskCount;
+	int newConnectionCount = 0;
+
+	/* we should always have more (or equal) active connections than idle connections */
+	Assert(activeConnectionCount >= idleConnectionCount);
+
+	/* we should always have more (or equal) initiated connections than active connections */
+	Assert(initiatedConnectionCount >= activeConnectionCount);
+
+	/* we should never have less than 0 connections ever */
+	Assert(activeConnectionCount >= 0 && idleConnectionCount >= 0);
+
+	if (workerPool->failed)
+	{
+		/* connection pool failed */
+		return;
+	}
+
+	/* we might fail the execution or warn the user about connection timeouts */
+	if (workerPool->checkForPoolTimeout)
+	{
+		CheckConnectionTimeout(workerPool);
+	}
+
+	if (failedConnectionCount >= 1)
+	{
+		/* do not attempt to open more connections after one failed */
+		return;
+	}
+
+	if (UseConnectionPerPlacement())
+	{
+		int unusedConnectionCount = workerPool->unusedConnectionCount;
+
+		/*
+		 * If force_max_query_parallelization is enabled then we ignore pool size
+		 * and idle connections. Instead, we open new connections as long as there
+		 * are more tasks than unused connections.
+		 */
+
+		newConnectionCount = Max(readyTaskCount - unusedConnectionCount, 0);
+	}
+	else
+	{
+		/* cannot open more than targetPoolSize connections */
+		int maxNewConnectionCount = targetPoolSize - initiatedConnectionCount;
+
+		/* total number of connections that are (almost) available for tasks */
+		int usableConnectionCount = UsableConnectionCount(workerPool);
+
+		/*
+		 * Number of additional connections we would need to run all ready tasks in
+		 * parallel.
+		 */
+		int newConnectionsForReadyTasks = readyTaskCount - usableConnectionCount;
+
+		/*
+		 * Open enough connections to handle all tasks that are ready, but no more
+		 * than the target pool size.
+		 */
+		newConnectionCount = Min(newConnectionsForReadyTasks, maxNewConnectionCount);
+
+		if (newConnectionCount > 0 && initiatedConnectionCount > 0 &&
+			WorkerPoolLatencyKnown(workerPool))
+		{
+			/*
+			 * When we know how long tasks and connection establishment take on
+			 * this worker, we either do not open new connections at all or open
+			 * them without slow start.
+			 */
+			if (!NewConnectionsShortenExecution(workerPool))
+			{
+				return;
+			}
+		}
+		else if (newConnectionCount > 0 && ExecutorSlowStartInterval > 0)
+		{
+			TimestampTz now = GetCurrentTimestamp();
+
+			if (TimestampDifferenceExceeds(workerPool->lastConnectionOpenTime, now,
+										   ExecutorSlowStartInterval))
+			{
+				newConnectionCount = Min(newConnectionCount,
+										 workerPool->maxNewConnectionsPerCycle);
+
+				/* increase the open rate every cycle (like TCP slow start) */
+				workerPool->maxNewConnectionsPerCycle += 1;
+			}
+			else
+			{
+				/* wait a bit until opening more connections */
+				return;
+			}
+		}
+	}
+
+	if (newConnectionCount <= 0)
+	{
+		return;
+	}
+
+	ereport(DEBUG4, (errmsg("opening %d new connections to %s:%d", newConnectionCount,
+							workerPool->nodeName, workerPool->nodePort)));
+
+	for (int connectionIndex = 0; connectionIndex < newConnectionCount; connectionIndex++)
+	{
+		/* experimental: just to see the perf benefits of caching connections */
+		int connectionFlags = 0;
+
+		if (execution->transactionProperties->useRemoteTransactionBlocks ==
+			TRANSACTION_BLOCKS_DISALLOWED)
+		{
+			connectionFlags |= OUTSIDE_TRANSACTION;
+		}
+
+		if (initiatedConnectionCount + connectionIndex > 0 &&
+			!UseConnectionPerPlacement())
+		{
+			/*
+			 * We can always run the tasks over the connections we already have,
+			 * so do not wait for the shared connection budget of the worker.
+			 */
+			connectionFlags |= OPTIONAL_CONNECTION;
+		}
+
+		/* open a new connection to the worker */
+		MultiConnection *connection = StartNodeUserDatabaseConnection(connectionFlags,
+																	  workerPool->nodeName,
+																	  workerPool->nodePort,
 																	  NULL, NULL);
+		if (connection == NULL)
+		{
+			/* other backends use all connections to the worker, make do with ours */
+			ereport(DEBUG4, (errmsg("shared connection budget of %s:%d is exhausted",
+									workerPool->nodeName, workerPool->nodePort)));
+			break;
+		}
 
 		/*
 		 * Assign the initial state in the connection state machine. The connection
@@ -2391,6 +3977,128 @@ UsableConnectionCount(WorkerPool *workerPool)
 }
 
 
+/*
+ * ShouldTrackWorkerLatencies returns whether the execution should observe task
+ * durations and connection establishment times of the workers, which is the
+ * case when either pool sizing or task assignment is based on them.
+ */
+static bool
+ShouldTrackWorkerLatencies(void)
+{
+	return EnableLatencyAwarePoolSizing ||
+		   TaskAssignmentPolicy == TASK_ASSIGNMENT_LEAST_LATENCY;
+}
+
+
+/*
+ * WorkerPoolLatencyKnown returns whether latency-aware pool sizing is enabled
+ * and both the task duration and the connection establishment time of the
+ * worker of the pool were observed.
+ */
+static bool
+WorkerPoolLatencyKnown(WorkerPool *workerPool)
+{
+	if (!EnableLatencyAwarePoolSizing)
+	{
+		return false;
+	}
+
+	WorkerLatency latency = WorkerPoolLatency(workerPool);
+
+	return latency.taskDurationUs >= 0 && latency.connectionTimeUs >= 0;
+}
+
+
+/*
+ * NewConnectionsShortenExecution returns whether opening new connections to
+ * the worker of the pool is expected to finish its ready tasks sooner, based
+ * on the observed latencies of the worker.
+ *
+ * A new connection only starts executing tasks once it is established, while
+ * the existing connections continue executing them in the meantime. Hence, if
+ * the existing connections finish the ready tasks within the connection
+ * establishment time, new connections only add overhead. Otherwise, every
+ * additional connection shortens the execution, so we open them right away
+ * rather than gradually, which matters most for slow workers with long queues.
+ *
+ */
+static bool
+NewConnectionsShortenExecution(WorkerPool *workerPool)
+{
+	WorkerLatency latency = WorkerPoolLatency(workerPool);
+	int connectionCount = list_length(workerPool->sessionList);
+
+	Assert(connectionCount > 0);
+
+	double queueDurationUs =
+		workerPool->readyTaskCount * latency.taskDurationUs / connectionCount;
+
+	return queueDurationUs > latency.connectionTimeUs;
+}
+
+
+/*
+ * WorkerPoolLatency returns the average task duration and connection
+ * establishment time observed for the worker of the pool in the current
+ * execution, or in earlier executions if there are no observations yet.
+ */
+static WorkerLatency
+WorkerPoolLatency(WorkerPool *workerPool)
+{
+	WorkerLatency latency = workerPool->historicLatency;
+
+	if (workerPool->finishedTaskCount > 0)
+	{
+		latency.taskDurationUs =
+			workerPool->totalTaskDurationUs / workerPool->finishedTaskCount;
+	}
+
+	if (workerPool->establishedConnectionCount > 0)
+	{
+		latency.connectionTimeUs =
+			workerPool->totalConnectionTimeUs / workerPool->establishedConnectionCount;
+	}
+
+	return latency;
+}
+
+
+/*
+ * RecordWorkerPoolLatencies adds the latencies observed by the execution to
+ * the shared history of the workers.
+ */
+static void
+RecordWorkerPoolLatencies(DistributedExecution *execution)
+{
+	WorkerPool *workerPool = NULL;
+	foreach_ptr(workerPool, execution->workerList)
+	{
+		WorkerLatency latency = { -1.0, -1.0 };
+
+		if (workerPool->finishedTaskCount == 0 &&
+			workerPool->establishedConnectionCount == 0)
+		{
+			continue;
+		}
+
+		if (workerPool->finishedTaskCount > 0)
+		{
+			latency.taskDurationUs =
+				workerPool->totalTaskDurationUs / workerPool->finishedTaskCount;
+		}
+
+		if (workerPool->establishedConnectionCount > 0)
+		{
+			latency.connectionTimeUs =
+				workerPool->totalConnectionTimeUs /
+				workerPool->establishedConnectionCount;
+		}
+
+		RecordWorkerLatency(workerPool->nodeName, workerPool->nodePort, latency);
+	}
+}
+
+
 /*
  * NextEventTimeout finds the earliest time at which we need to interrupt
  * WaitEventSetWait because of a timeout and returns the number of milliseconds
@@ -2455,6 +4163,30 @@ NextEventTimeout(DistributedExecution *execution)
 		}
 	}
 
+	if (execution->hedgeReads)
+	{
+		/* wake up in time to hedge reads that are still running then */
+		WorkerSession *session = NULL;
+		foreach_ptr(session, execution->sessionList)
+		{
+			TaskPlacementExecution *placementExecution = session->currentTask;
+			if (placementExecution == NULL || placementExecution->startTime == 0 ||
+				placementExecution->shardCommandExecution->hedged)
+			{
+				continue;
+			}
+
+			long timeUntilHedgedReadMs =
+				HedgedReadDelayMs(session->workerPool) -
+				MillisecondsBetweenTimestamps(placementExecution->startTime, now);
+
+			if (timeUntilHedgedReadMs < eventTimeout)
+			{
+				eventTimeout = timeUntilHedgedReadMs;
+			}
+		}
+	}
+
 	return Max(1, eventTimeout);
 }
 
@@ -2476,6 +4208,22 @@ MillisecondsBetweenTimestamps(TimestampTz startTime, TimestampTz endTime)
 }
 
 
+/*
+ * MicrosecondsBetweenTimestamps returns the number of microseconds between
+ * timestamps, such that short latencies are not truncated to 0.
+ */
+static double
+MicrosecondsBetweenTimestamps(TimestampTz startTime, TimestampTz endTime)
+{
+	long secs = 0;
+	int micros = 0;
+
+	TimestampDifference(startTime, endTime, &secs, &micros);
+
+	return (double) secs * USECS_PER_SEC + micros;
+}
+
+
 /*
  * ConnectionStateMachine opens a connection and descends into the transaction
  * state machine when ready.
@@ -2539,6 +4287,17 @@ ConnectionStateMachine(WorkerSession *session)
 											  WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE);
 
 					connection->connectionState = MULTI_CONNECTION_CONNECTED;
+
+					if (ShouldTrackWorkerLatencies())
+					{
+						/* a new connection was established, track how long it took */
+						TimestampTz now = GetCurrentTimestamp();
+
+						workerPool->totalConnectionTimeUs +=
+							MicrosecondsBetweenTimestamps(connection->connectionStart,
+														  now);
+						workerPool->establishedConnectionCount++;
+					}
 				}
 
 				break;
@@ -2664,6 +4423,12 @@ HandleMultiConnectionSuccess(WorkerSession *session)
 
 	workerPool->activeConnectionCount++;
 	workerPool->idleConnectionCount++;
+
+	if (workerPool->activeConnectionCount == 1)
+	{
+		/* the worker is reachable (again) */
+		RecordNodeSuccess(workerPool->nodeName, workerPool->nodePort);
+	}
 }
 
 
@@ -2777,10 +4542,36 @@ TransactionStateMachine(WorkerSession *session)
 					/* if we're expanding the nodes in a transaction, use 2PC */
 					Activate2PCIfModifyingTransactionExpandsToNewNode(session);
 
-					/* need to open a transaction block first */
-					StartRemoteTransactionBegin(connection);
+					TaskPlacementExecution *placementExecution = NULL;
+					if (CanPiggybackTransactionBegin(session))
+					{
+						placementExecution = PopPlacementExecution(session);
+					}
+
+					if (placementExecution != NULL)
+					{
+						/* open the transaction block in the same query as the task */
+						bool placementExecutionStarted =
+							StartPlacementExecutionWithBeginOnSession(placementExecution,
+																	  session);
+						if (!placementExecutionStarted)
+						{
+							/* no need to continue, connection is lost */
+							Assert(session->connection->connectionState ==
+								   MULTI_CONNECTION_LOST);
+
+							return;
+						}
+
+						transaction->transactionState = REMOTE_TRANS_SENT_COMMAND;
+					}
+					else
+					{
+						/* need to open a transaction block first */
+						StartRemoteTransactionBegin(connection);
 
-					transaction->transactionState = REMOTE_TRANS_CLEARING_RESULTS;
+						transaction->transactionState = REMOTE_TRANS_CLEARING_RESULTS;
+					}
 				}
 				else
 				{
@@ -2849,6 +4640,7 @@ TransactionStateMachine(WorkerSession *session)
 					MarkRemoteTransactionCritical(connection);
 
 					session->currentTask = NULL;
+					FinishSharedRunningTask(connection);
 
 					PlacementExecutionDone(placementExecution, succeeded);
 
@@ -2882,8 +4674,20 @@ TransactionStateMachine(WorkerSession *session)
 					break;
 				}
 
-				bool placementExecutionStarted =
-					StartPlacementExecutionOnSession(placementExecution, session);
+				bool placementExecutionStarted = false;
+				if (ShouldBatchPlacementExecutions(session))
+				{
+					/* send the queued tasks of the session at once */
+					placementExecutionStarted =
+						StartPlacementExecutionBatchOnSession(placementExecution,
+															  session);
+				}
+				else
+				{
+					placementExecutionStarted =
+						StartPlacementExecutionOnSession(placementExecution, session);
+				}
+
 				if (!placementExecutionStarted)
 				{
 					/* no need to continue, connection is lost */
@@ -2898,233 +4702,552 @@ TransactionStateMachine(WorkerSession *session)
 
 			case REMOTE_TRANS_SENT_COMMAND:
 			{
-				TaskPlacementExecution *placementExecution = session->currentTask;
-				ShardCommandExecution *shardCommandExecution =
-					placementExecution->shardCommandExecution;
-				bool storeRows = shardCommandExecution->expectResults;
+				bool fetchDone = false;
 
-				if (shardCommandExecution->gotResults)
+				if (session->pendingBeginResultCount > 0 &&
+					!ReceiveBeginResults(session))
 				{
-					/* already received results from another replica */
-					storeRows = false;
+					/* results of the transaction block preamble are not all there */
+					break;
 				}
 
-				bool fetchDone = ReceiveResults(session, storeRows);
+				/* receive the results of all tasks in the batch, if any */
+				do {
+					TaskPlacementExecution *placementExecution = session->currentTask;
+					ShardCommandExecution *shardCommandExecution =
+						placementExecution->shardCommandExecution;
+					bool storeRows = shardCommandExecution->expectResults;
+
+					if (shardCommandExecution->gotResults)
+					{
+						/* already received results from another replica */
+						storeRows = false;
+					}
+					else if (shardCommandExecution->resultPlacementExecution != NULL &&
+							 shardCommandExecution->resultPlacementExecution !=
+							 placementExecution)
+					{
+						/* a hedged read on another replica returned results first */
+						storeRows = false;
+					}
+
+					fetchDone = ReceiveResults(session, storeRows);
+					if (!fetchDone)
+					{
+						break;
+					}
+
+					shardCommandExecution->gotResults = true;
+				} while (AdvanceBatchedPlacementExecution(session));
+
 				if (!fetchDone)
 				{
 					break;
 				}
 
-				shardCommandExecution->gotResults = true;
 				transaction->transactionState = REMOTE_TRANS_CLEARING_RESULTS;
 				break;
 			}
 
-			default:
-			{
-				break;
-			}
-		}
+			default:
+			{
+				break;
+			}
+		}
+	}
+	/* iterate in case we can perform multiple transitions at once */
+	while (transaction->transactionState != currentState);
+}
+
+
+/*
+ * UpdateConnectionWaitFlags is a wrapper around setting waitFlags of the connection.
+ *
+ * This function might further improved in a sense that to use use ModifyWaitEvent on
+ * waitFlag changes as opposed to what we do now: always rebuild the wait event sets.
+ * Our initial benchmarks didn't show any significant performance improvements, but
+ * good to keep in mind the potential improvements.
+ */
+static void
+UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags)
+{
+	MultiConnection *connection = session->connection;
+	DistributedExecution *execution = session->workerPool->distributedExecution;
+
+	/* do not take any actions if the flags not changed */
+	if (connection->waitFlags == waitFlags)
+	{
+		return;
+	}
+
+	connection->waitFlags = waitFlags;
+
+	/* without signalling the execution, the flag changes won't be reflected */
+	execution->waitFlagsChanged = true;
+}
+
+
+/*
+ * CheckConnectionReady returns true if the connection is ready to
+ * read or write, or false if it still has bytes to send/receive.
+ */
+static bool
+CheckConnectionReady(WorkerSession *session)
+{
+	MultiConnection *connection = session->connection;
+	int waitFlags = WL_SOCKET_READABLE;
+	bool connectionReady = false;
+
+	ConnStatusType status = PQstatus(connection->pgConn);
+	if (status == CONNECTION_BAD)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
+	}
+
+	/* try to send all pending data */
+	int sendStatus = PQflush(connection->pgConn);
+	if (sendStatus == -1)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
+	}
+	else if (sendStatus == 1)
+	{
+		/* more data to send, wait for socket to become writable */
+		waitFlags = waitFlags | WL_SOCKET_WRITEABLE;
+	}
+
+	if ((session->latestUnconsumedWaitEvents & WL_SOCKET_READABLE) != 0)
+	{
+		if (PQconsumeInput(connection->pgConn) == 0)
+		{
+			connection->connectionState = MULTI_CONNECTION_LOST;
+			return false;
+		}
+	}
+
+	if (!PQisBusy(connection->pgConn))
+	{
+		connectionReady = true;
+	}
+
+	UpdateConnectionWaitFlags(session, waitFlags);
+
+	/* don't consume input redundantly if we cycle back into CheckConnectionReady */
+	session->latestUnconsumedWaitEvents = 0;
+
+	return connectionReady;
+}
+
+
+/*
+ * PopPlacementExecution returns the next available assigned or unassigned
+ * placement execution for the given session.
+ */
+static TaskPlacementExecution *
+PopPlacementExecution(WorkerSession *session)
+{
+	WorkerPool *workerPool = session->workerPool;
+
+	TaskPlacementExecution *placementExecution = PopAssignedPlacementExecution(session);
+	if (placementExecution == NULL)
+	{
+		if (session->commandsSent > 0 && UseConnectionPerPlacement())
+		{
+			/*
+			 * Only send one command per connection if force_max_query_parallelisation
+			 * is enabled, unless it's an assigned placement execution.
+			 */
+			return NULL;
+		}
+
+		/* no more assigned tasks, pick an unassigned task */
+		placementExecution = PopUnassignedPlacementExecution(workerPool);
+	}
+
+	return placementExecution;
+}
+
+
+/*
+ * PopAssignedPlacementExecution finds an executable task from the queue of assigned tasks.
+ */
+static TaskPlacementExecution *
+PopAssignedPlacementExecution(WorkerSession *session)
+{
+	dlist_head *readyTaskQueue = &(session->readyTaskQueue);
+
+	if (dlist_is_empty(readyTaskQueue))
+	{
+		return NULL;
+	}
+
+	TaskPlacementExecution *placementExecution = dlist_container(TaskPlacementExecution,
+																 sessionReadyQueueNode,
+																 dlist_pop_head_node(
+																	 readyTaskQueue));
+
+	return placementExecution;
+}
+
+
+/*
+ * PopAssignedPlacementExecution finds an executable task from the queue of assigned tasks.
+ */
+static TaskPlacementExecution *
+PopUnassignedPlacementExecution(WorkerPool *workerPool)
+{
+	dlist_head *readyTaskQueue = &(workerPool->readyTaskQueue);
+
+	while (!dlist_is_empty(readyTaskQueue))
+	{
+		TaskPlacementExecution *placementExecution =
+			dlist_container(TaskPlacementExecution, workerReadyQueueNode,
+							dlist_pop_head_node(readyTaskQueue));
+
+		workerPool->readyTaskCount--;
+
+		ShardCommandExecution *shardCommandExecution =
+			placementExecution->shardCommandExecution;
+		if (shardCommandExecution->hedged &&
+			shardCommandExecution->executionState != TASK_EXECUTION_NOT_FINISHED)
+		{
+			/* hedged read that is no longer needed */
+			continue;
+		}
+
+		return placementExecution;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * StartPlacementExecutionOnSession gets a TaskPlacementExecition and
+ * WorkerSession, the task's query is sent to the worker via the session.
+ *
+ * The function does some bookkeeping such as associating the placement
+ * accesses with the connection and updating session's local variables. For
+ * details read the comments in the function.
+ *
+ * The function returns true if the query is successfully sent over the
+ * connection, otherwise false.
+ */
+static bool
+StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
+								 WorkerSession *session)
+{
+	WorkerPool *workerPool = session->workerPool;
+	DistributedExecution *execution = workerPool->distributedExecution;
+	ParamListInfo paramListInfo = execution->paramListInfo;
+	MultiConnection *connection = session->connection;
+	int querySent = 0;
+
+	char *queryString = StartPlacementExecution(placementExecution, session);
+
+	/* connection is going to be in use */
+	workerPool->idleConnectionCount--;
+	session->currentTask = placementExecution;
+
+	if (paramListInfo != NULL)
+	{
+		int parameterCount = paramListInfo->numParams;
+		Oid *parameterTypes = NULL;
+		const char **parameterValues = NULL;
+
+		/* force evaluation of bound params */
+		paramListInfo = copyParamList(paramListInfo);
+
+		ExtractParametersForRemoteExecution(paramListInfo, &parameterTypes,
+											&parameterValues);
+		querySent = SendRemoteCommandParams(connection, queryString, parameterCount,
+											parameterTypes, parameterValues,
+											execution->binaryResults);
+	}
+	else if (execution->binaryResults)
+	{
+		/* the result format can only be chosen in the extended protocol */
+		querySent = SendRemoteCommandParams(connection, queryString, 0, NULL, NULL,
+											true);
+	}
+	else
+	{
+		querySent = SendRemoteCommand(connection, queryString);
+	}
+
+	if (querySent == 0)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
 	}
-	/* iterate in case we can perform multiple transitions at once */
-	while (transaction->transactionState != currentState);
+
+	int singleRowMode = PQsetSingleRowMode(connection->pgConn);
+	if (singleRowMode == 0)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
+	}
+
+	return true;
 }
 
 
 /*
- * UpdateConnectionWaitFlags is a wrapper around setting waitFlags of the connection.
+ * ShouldBatchPlacementExecutions returns whether the session can send several
+ * of its queued tasks at once as a multi-statement query, such that the tasks
+ * only take a single round-trip.
  *
- * This function might further improved in a sense that to use use ModifyWaitEvent on
- * waitFlag changes as opposed to what we do now: always rebuild the wait event sets.
- * Our initial benchmarks didn't show any significant performance improvements, but
- * good to keep in mind the potential improvements.
+ * The statements of a multi-statement query run in a single (implicit)
+ * transaction, so we only batch within remote transaction blocks, where that
+ * does not change the outcome. Since the results of the tasks are demultiplexed
+ * by counting the results, we only batch tasks that do not return rows and do
+ * not need the extended protocol.
  */
-static void
-UpdateConnectionWaitFlags(WorkerSession *session, int waitFlags)
+static bool
+ShouldBatchPlacementExecutions(WorkerSession *session)
 {
-	MultiConnection *connection = session->connection;
 	DistributedExecution *execution = session->workerPool->distributedExecution;
+	RemoteTransaction *transaction = &(session->connection->remoteTransaction);
 
-	/* do not take any actions if the flags not changed */
-	if (connection->waitFlags == waitFlags)
+	if (ExecutorCommandBatchSize <= 1)
 	{
-		return;
+		return false;
 	}
 
-	connection->waitFlags = waitFlags;
+	if (!transaction->beginSent)
+	{
+		return false;
+	}
 
-	/* without signalling the execution, the flag changes won't be reflected */
-	execution->waitFlagsChanged = true;
+	if (execution->paramListInfo != NULL || execution->binaryResults)
+	{
+		return false;
+	}
+
+	if (execution->modLevel == ROW_MODIFY_READONLY || execution->hasReturning)
+	{
+		return false;
+	}
+
+	return true;
 }
 
 
 /*
- * CheckConnectionReady returns true if the connection is ready to
- * read or write, or false if it still has bytes to send/receive.
+ * StartPlacementExecutionBatchOnSession sends the given placement execution
+ * together with the next placement executions that are ready to run on the
+ * session as a single multi-statement query. The results are received in
+ * order, see AdvanceBatchedPlacementExecution.
+ *
+ * Tasks that are not assigned to the session could also run on other sessions
+ * of the pool, so we only take a fair share of them into the batch.
+ *
+ * The function returns true if the query is successfully sent over the
+ * connection, otherwise false.
  */
 static bool
-CheckConnectionReady(WorkerSession *session)
+StartPlacementExecutionBatchOnSession(TaskPlacementExecution *placementExecution,
+									  WorkerSession *session)
 {
+	WorkerPool *workerPool = session->workerPool;
+	DistributedExecution *execution = workerPool->distributedExecution;
 	MultiConnection *connection = session->connection;
-	int waitFlags = WL_SOCKET_READABLE;
-	bool connectionReady = false;
+	int maxBatchSize = ExecutorCommandBatchSize;
+	List *batchedTaskList = NIL;
 
-	ConnStatusType status = PQstatus(connection->pgConn);
-	if (status == CONNECTION_BAD)
+	if (dlist_is_empty(&session->readyTaskQueue))
 	{
-		connection->connectionState = MULTI_CONNECTION_LOST;
-		return false;
-	}
+		/* leave a share of the unassigned tasks to the other sessions */
+		int sessionCount = Max(list_length(workerPool->sessionList),
+							   execution->targetPoolSize);
 
-	/* try to send all pending data */
-	int sendStatus = PQflush(connection->pgConn);
-	if (sendStatus == -1)
-	{
-		connection->connectionState = MULTI_CONNECTION_LOST;
-		return false;
-	}
-	else if (sendStatus == 1)
-	{
-		/* more data to send, wait for socket to become writable */
-		waitFlags = waitFlags | WL_SOCKET_WRITEABLE;
+		maxBatchSize = Min(maxBatchSize,
+						   1 + workerPool->readyTaskCount / Max(sessionCount, 1));
 	}
 
-	if ((session->latestUnconsumedWaitEvents & WL_SOCKET_READABLE) != 0)
+	StringInfo queryString = makeStringInfo();
+	appendStringInfoString(queryString,
+						   StartPlacementExecution(placementExecution, session));
+
+	session->pendingResultCount = PlacementExecutionStatementCount(placementExecution);
+
+	while (list_length(batchedTaskList) + 1 < maxBatchSize)
 	{
-		if (PQconsumeInput(connection->pgConn) == 0)
+		TaskPlacementExecution *nextPlacementExecution =
+			PopPlacementExecution(session);
+		if (nextPlacementExecution == NULL)
 		{
-			connection->connectionState = MULTI_CONNECTION_LOST;
-			return false;
+			break;
 		}
+
+		char *nextQueryString = StartPlacementExecution(nextPlacementExecution,
+														session);
+
+		appendStringInfo(queryString, ";%s", nextQueryString);
+		batchedTaskList = lappend(batchedTaskList, nextPlacementExecution);
 	}
 
-	if (!PQisBusy(connection->pgConn))
+	/* connection is going to be in use */
+	workerPool->idleConnectionCount--;
+	session->currentTask = placementExecution;
+	session->batchedTaskList = batchedTaskList;
+
+	int querySent = SendRemoteCommand(connection, queryString->data);
+	if (querySent == 0)
 	{
-		connectionReady = true;
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
 	}
 
-	UpdateConnectionWaitFlags(session, waitFlags);
-
-	/* don't consume input redundantly if we cycle back into CheckConnectionReady */
-	session->latestUnconsumedWaitEvents = 0;
+	/* the mode applies to all statements of the batch */
+	int singleRowMode = PQsetSingleRowMode(connection->pgConn);
+	if (singleRowMode == 0)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
+	}
 
-	return connectionReady;
+	return true;
 }
 
 
 /*
- * PopPlacementExecution returns the next available assigned or unassigned
- * placement execution for the given session.
+ * CanPiggybackTransactionBegin returns whether the statements that open the
+ * remote transaction block can be sent in the same query as the first task of
+ * the session, which saves a round-trip per connection in coordinated
+ * transactions. Multi-statement queries require the simple query protocol, so
+ * this is not possible for tasks with parameters or binary results.
  */
-static TaskPlacementExecution *
-PopPlacementExecution(WorkerSession *session)
+static bool
+CanPiggybackTransactionBegin(WorkerSession *session)
 {
-	WorkerPool *workerPool = session->workerPool;
+	DistributedExecution *execution = session->workerPool->distributedExecution;
 
-	TaskPlacementExecution *placementExecution = PopAssignedPlacementExecution(session);
-	if (placementExecution == NULL)
+	if (!EnablePiggybackedBegin)
 	{
-		if (session->commandsSent > 0 && UseConnectionPerPlacement())
-		{
-			/*
-			 * Only send one command per connection if force_max_query_parallelisation
-			 * is enabled, unless it's an assigned placement execution.
-			 */
-			return NULL;
-		}
+		return false;
+	}
 
-		/* no more assigned tasks, pick an unassigned task */
-		placementExecution = PopUnassignedPlacementExecution(workerPool);
+	if (execution->paramListInfo != NULL || execution->binaryResults)
+	{
+		return false;
 	}
 
-	return placementExecution;
+	return true;
 }
 
 
 /*
- * PopAssignedPlacementExecution finds an executable task from the queue of assigned tasks.
+ * StartPlacementExecutionWithBeginOnSession sends the statements that open the
+ * remote transaction block followed by the query of the given placement
+ * execution as a single query. The results of the former are discarded by
+ * ReceiveBeginResults before the results of the task are received.
+ *
+ * The function returns true if the query is successfully sent over the
+ * connection, otherwise false.
  */
-static TaskPlacementExecution *
-PopAssignedPlacementExecution(WorkerSession *session)
+static bool
+StartPlacementExecutionWithBeginOnSession(TaskPlacementExecution *placementExecution,
+										  WorkerSession *session)
 {
-	dlist_head *readyTaskQueue = &(session->readyTaskQueue);
+	WorkerPool *workerPool = session->workerPool;
+	MultiConnection *connection = session->connection;
+	RemoteTransaction *transaction = &(connection->remoteTransaction);
 
-	if (dlist_is_empty(readyTaskQueue))
+	/* every statement of the preamble produces a single result */
+	StringInfo queryString =
+		StartRemoteTransactionBeginCommand(connection,
+										   &session->pendingBeginResultCount);
+
+	appendStringInfoString(queryString,
+						   StartPlacementExecution(placementExecution, session));
+
+	/* connection is going to be in use */
+	workerPool->idleConnectionCount--;
+	session->currentTask = placementExecution;
+
+	int querySent = SendRemoteCommand(connection, queryString->data);
+	if (querySent == 0)
 	{
-		return NULL;
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
 	}
 
-	TaskPlacementExecution *placementExecution = dlist_container(TaskPlacementExecution,
-																 sessionReadyQueueNode,
-																 dlist_pop_head_node(
-																	 readyTaskQueue));
+	transaction->beginSent = true;
 
-	return placementExecution;
+	int singleRowMode = PQsetSingleRowMode(connection->pgConn);
+	if (singleRowMode == 0)
+	{
+		connection->connectionState = MULTI_CONNECTION_LOST;
+		return false;
+	}
+
+	return true;
 }
 
 
 /*
- * PopAssignedPlacementExecution finds an executable task from the queue of assigned tasks.
+ * ReceiveBeginResults discards the results of the transaction block preamble
+ * that was sent together with the current task of the session. It returns
+ * whether all of them were received. Since the preamble only fails in case of
+ * severe problems, failures are hard errors, as when it is sent on its own.
  */
-static TaskPlacementExecution *
-PopUnassignedPlacementExecution(WorkerPool *workerPool)
+static bool
+ReceiveBeginResults(WorkerSession *session)
 {
-	dlist_head *readyTaskQueue = &(workerPool->readyTaskQueue);
+	MultiConnection *connection = session->connection;
 
-	if (dlist_is_empty(readyTaskQueue))
+	while (session->pendingBeginResultCount > 0 && !PQisBusy(connection->pgConn))
 	{
-		return NULL;
-	}
+		PGresult *result = PQgetResult(connection->pgConn);
+		if (result == NULL)
+		{
+			/* the query ended before the task ran, which cannot happen normally */
+			ereport(ERROR, (errmsg("unexpected end of results from %s:%d",
+								   connection->hostname, connection->port)));
+		}
 
-	TaskPlacementExecution *placementExecution = dlist_container(TaskPlacementExecution,
-																 workerReadyQueueNode,
-																 dlist_pop_head_node(
-																	 readyTaskQueue));
+		ExecStatusType resultStatus = PQresultStatus(result);
+		if (resultStatus == PGRES_SINGLE_TUPLE)
+		{
+			/* rows of assign_distributed_transaction_id(), in single-row mode */
+			PQclear(result);
+			continue;
+		}
+
+		if (!IsResponseOK(result))
+		{
+			ReportResultError(connection, result, ERROR);
+		}
 
-	workerPool->readyTaskCount--;
+		PQclear(result);
 
-	return placementExecution;
+		session->pendingBeginResultCount--;
+	}
+
+	return session->pendingBeginResultCount == 0;
 }
 
 
 /*
- * StartPlacementExecutionOnSession gets a TaskPlacementExecition and
- * WorkerSession, the task's query is sent to the worker via the session.
- *
- * The function does some bookkeeping such as associating the placement
- * accesses with the connection and updating session's local variables. For
- * details read the comments in the function.
- *
- * The function returns true if the query is successfully sent over the
- * connection, otherwise false.
+ * StartPlacementExecution does the bookkeeping for sending the query of a
+ * placement execution over the session and returns the query string.
  */
-static bool
-StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
-								 WorkerSession *session)
+static char *
+StartPlacementExecution(TaskPlacementExecution *placementExecution,
+						WorkerSession *session)
 {
 	WorkerPool *workerPool = session->workerPool;
 	DistributedExecution *execution = workerPool->distributedExecution;
-	ParamListInfo paramListInfo = execution->paramListInfo;
 	MultiConnection *connection = session->connection;
 	ShardCommandExecution *shardCommandExecution =
 		placementExecution->shardCommandExecution;
 	Task *task = shardCommandExecution->task;
 	ShardPlacement *taskPlacement = placementExecution->shardPlacement;
 	List *placementAccessList = PlacementAccessListForTask(task, taskPlacement);
-	int querySent = 0;
-
-	char *queryString = NULL;
-	if (list_length(task->perPlacementQueryStrings) == 0)
-	{
-		queryString = TaskQueryString(task);
-	}
-	else
-	{
-		Assert(list_length(task->taskPlacementList) == list_length(
-				   task->perPlacementQueryStrings));
-		queryString = list_nth(task->perPlacementQueryStrings,
-							   placementExecution->placementExecutionIndex);
-	}
+	char *queryString = PlacementExecutionQueryString(placementExecution);
 
 	if (execution->transactionProperties->useRemoteTransactionBlocks !=
 		TRANSACTION_BLOCKS_DISALLOWED)
@@ -3136,53 +5259,135 @@ StartPlacementExecutionOnSession(TaskPlacementExecution *placementExecution,
 		AssignPlacementListToConnection(placementAccessList, connection);
 	}
 
-
 	/* one more command is sent over the session */
 	session->commandsSent++;
 
-	if (session->commandsSent == 1)
+	if (session->commandsSent == 1)
+	{
+		/* first time we send a command, consider the connection used (not unused) */
+		workerPool->unusedConnectionCount--;
+	}
+
+	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
+
+	if (!execution->tasksOnlyRead || task->relationRowLockList != NIL)
+	{
+		/* the remote transaction now has to be committed with 2PC if needed */
+		connection->remoteTransaction.mayHaveWritten = true;
+	}
+
+	if (ShouldTrackWorkerLatencies())
+	{
+		/* let the least-latency policy of all backends know the worker is busy */
+		StartSharedRunningTask(connection);
+	}
+
+	if (ShouldTrackWorkerLatencies() || execution->hedgeReads)
+	{
+		placementExecution->startTime = GetCurrentTimestamp();
+	}
+
+	return queryString;
+}
+
+
+/*
+ * PlacementExecutionQueryString returns the query string to send for the
+ * given placement execution.
+ */
+static char *
+PlacementExecutionQueryString(TaskPlacementExecution *placementExecution)
+{
+	Task *task = placementExecution->shardCommandExecution->task;
+
+	if (list_length(task->perPlacementQueryStrings) == 0)
+	{
+		return TaskQueryString(task);
+	}
+
+	Assert(list_length(task->taskPlacementList) == list_length(
+			   task->perPlacementQueryStrings));
+
+	return list_nth(task->perPlacementQueryStrings,
+					placementExecution->placementExecutionIndex);
+}
+
+
+/*
+ * PlacementExecutionStatementCount returns the number of statements in the
+ * query string of a placement execution, which is the number of results it
+ * produces. Queries of modification tasks are deparsed from a single
+ * statement, while utility tasks, such as those of TRUNCATE and DDL commands,
+ * may combine several commands. Those are parsed once per task, since all
+ * placements run the same commands.
+ */
+static int
+PlacementExecutionStatementCount(TaskPlacementExecution *placementExecution)
+{
+	ShardCommandExecution *shardCommandExecution =
+		placementExecution->shardCommandExecution;
+	Task *task = shardCommandExecution->task;
+
+	if (task->taskType != DDL_TASK)
 	{
-		/* first time we send a command, consider the connection used (not unused) */
-		workerPool->unusedConnectionCount--;
+		return 1;
 	}
 
-	/* connection is going to be in use */
-	workerPool->idleConnectionCount--;
-	session->currentTask = placementExecution;
-	placementExecution->executionState = PLACEMENT_EXECUTION_RUNNING;
-
-	if (paramListInfo != NULL)
+	if (shardCommandExecution->statementCount == 0)
 	{
-		int parameterCount = paramListInfo->numParams;
-		Oid *parameterTypes = NULL;
-		const char **parameterValues = NULL;
+		char *queryString = PlacementExecutionQueryString(placementExecution);
 
-		/* force evaluation of bound params */
-		paramListInfo = copyParamList(paramListInfo);
-
-		ExtractParametersForRemoteExecution(paramListInfo, &parameterTypes,
-											&parameterValues);
-		querySent = SendRemoteCommandParams(connection, queryString, parameterCount,
-											parameterTypes, parameterValues);
-	}
-	else
-	{
-		querySent = SendRemoteCommand(connection, queryString);
+		shardCommandExecution->statementCount =
+			Max(list_length(pg_parse_query(queryString)), 1);
 	}
 
-	if (querySent == 0)
+	return shardCommandExecution->statementCount;
+}
+
+
+/*
+ * AdvanceBatchedPlacementExecution is called after a result of the current
+ * task of the session was received. If the current task or the batch it is
+ * part of produces more results, it finishes the current task if needed and
+ * makes the next task of the batch the current task, and returns true.
+ * Otherwise, it returns false and the current task is finished once the
+ * remaining (empty) results are cleared.
+ */
+static bool
+AdvanceBatchedPlacementExecution(WorkerSession *session)
+{
+	if (session->pendingResultCount > 1)
 	{
-		connection->connectionState = MULTI_CONNECTION_LOST;
-		return false;
+		/* the current task consists of multiple statements */
+		session->pendingResultCount--;
+		return true;
 	}
 
-	int singleRowMode = PQsetSingleRowMode(connection->pgConn);
-	if (singleRowMode == 0)
+	session->pendingResultCount = 0;
+
+	if (session->batchedTaskList == NIL)
 	{
-		connection->connectionState = MULTI_CONNECTION_LOST;
 		return false;
 	}
 
+	TaskPlacementExecution *placementExecution = session->currentTask;
+	TaskPlacementExecution *nextPlacementExecution =
+		(TaskPlacementExecution *) linitial(session->batchedTaskList);
+	bool succeeded = true;
+
+	/*
+	 * Once we finished a task on a connection, we no longer allow that
+	 * connection to fail.
+	 */
+	MarkRemoteTransactionCritical(session->connection);
+
+	session->currentTask = nextPlacementExecution;
+	session->batchedTaskList = list_delete_first(session->batchedTaskList);
+	session->pendingResultCount =
+		PlacementExecutionStatementCount(nextPlacementExecution);
+
+	PlacementExecutionDone(placementExecution, succeeded);
+
 	return true;
 }
 
@@ -3204,7 +5409,9 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 	AttInMetadata *attributeInputMetadata = execution->attributeInputMetadata;
 	uint32 expectedColumnCount = 0;
 	char **columnArray = execution->columnArray;
-	Tuplestorestate *tupleStore = execution->tupleStore;
+	ShardCommandExecution *shardCommandExecution =
+		session->currentTask->shardCommandExecution;
+	Tuplestorestate *tupleStore = shardCommandExecution->tupleStore;
 
 	if (tupleDescriptor != NULL)
 	{
@@ -3235,13 +5442,17 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 			break;
 		}
 
+		if (storeRows && shardCommandExecution->executionOrder == EXECUTION_ORDER_ANY)
+		{
+			/* from now on, results of hedged reads on other replicas are discarded */
+			shardCommandExecution->resultPlacementExecution = session->currentTask;
+		}
+
 		ExecStatusType resultStatus = PQresultStatus(result);
 		if (resultStatus == PGRES_COMMAND_OK)
 		{
 			char *currentAffectedTupleString = PQcmdTuples(result);
 			int64 currentAffectedTupleCount = 0;
-			ShardCommandExecution *shardCommandExecution =
-				session->currentTask->shardCommandExecution;
 
 			/* if there are multiple replicas, make sure to consider only one */
 			if (!shardCommandExecution->gotResults && *currentAffectedTupleString != '\0')
@@ -3272,6 +5483,13 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 		}
 		else if (resultStatus != PGRES_SINGLE_TUPLE)
 		{
+			if (session->currentTask->cancelled && IsQueryCanceledResult(result))
+			{
+				/* a hedged read that lost was cancelled, as we asked for */
+				PQclear(result);
+				continue;
+			}
+
 			/* query failures are always hard errors */
 			ReportResultError(connection, result, ERROR);
 		}
@@ -3295,8 +5513,37 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 								   columnCount, expectedColumnCount)));
 		}
 
+		if (execution->binaryResults && !session->currentTask->binaryResultValidated)
+		{
+			/* all rows of a query have the same format, check it once */
+			ValidateBinaryResult(execution, connection, result);
+			session->currentTask->binaryResultValidated = true;
+		}
+
 		for (uint32 rowIndex = 0; rowIndex < rowsProcessed; rowIndex++)
 		{
+			if (execution->binaryResults)
+			{
+				/*
+				 * Decode the columns with the receive functions in the temporary
+				 * memory context, tuplestore_putvalues copies the tuple into the
+				 * tuple store's own context.
+				 */
+				MemoryContext oldContextPerRow = MemoryContextSwitchTo(ioContext);
+
+				ReadBinaryRow(execution, connection, result, rowIndex);
+
+				MemoryContextSwitchTo(oldContextPerRow);
+
+				tuplestore_putvalues(tupleStore, tupleDescriptor,
+									 execution->columnValues, execution->columnNulls);
+				MemoryContextReset(ioContext);
+
+				execution->rowsProcessed++;
+				shardCommandExecution->rowsReceived++;
+				continue;
+			}
+
 			memset(columnArray, 0, columnCount * sizeof(char *));
 
 			for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
@@ -3333,6 +5580,7 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 			MemoryContextReset(ioContext);
 
 			execution->rowsProcessed++;
+			shardCommandExecution->rowsReceived++;
 		}
 
 		PQclear(result);
@@ -3350,6 +5598,107 @@ ReceiveResults(WorkerSession *session, bool storeRows)
 }
 
 
+/*
+ * ValidateBinaryResult checks that the columns of a result are in binary format
+ * and, where we can tell, of the types that the receive functions expect.
+ */
+static void
+ValidateBinaryResult(DistributedExecution *execution, MultiConnection *connection,
+					 PGresult *result)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	int columnCount = tupleDescriptor->natts;
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (PQfformat(result, columnIndex) != 1)
+		{
+			ereport(ERROR, (errmsg("unexpected text result from %s:%d for a query "
+								   "that requested binary results",
+								   connection->hostname, connection->port)));
+		}
+
+		/*
+		 * The binary representation of a value does not say what type it has, so
+		 * make sure the worker returned the type we expect. Type OIDs of user-defined
+		 * types may differ across nodes, so we can only check built-in types.
+		 */
+		Oid expectedTypeId = getBaseType(attribute->atttypid);
+		if (expectedTypeId < FirstNormalObjectId &&
+			PQftype(result, columnIndex) != expectedTypeId)
+		{
+			ereport(ERROR, (errmsg("unexpected type %u for column %d in binary result "
+								   "from %s:%d, expected %u",
+								   PQftype(result, columnIndex), columnIndex + 1,
+								   connection->hostname, connection->port,
+								   expectedTypeId),
+							errhint("Set citus.enable_binary_protocol to off to "
+									"receive results in text format.")));
+		}
+	}
+}
+
+
+/*
+ * ReadBinaryRow decodes the row at rowIndex of a result in binary format into
+ * the columnValues and columnNulls arrays of the execution. The format of the
+ * result should have been checked by ValidateBinaryResult.
+ */
+static void
+ReadBinaryRow(DistributedExecution *execution, MultiConnection *connection,
+			  PGresult *result, int rowIndex)
+{
+	TupleDesc tupleDescriptor = execution->tupleDescriptor;
+	DistributedExecutionStats *executionStats = execution->executionStats;
+	StringInfo columnBuffer = execution->binaryColumnBuffer;
+	int columnCount = tupleDescriptor->natts;
+
+	for (int columnIndex = 0; columnIndex < columnCount; columnIndex++)
+	{
+		Form_pg_attribute attribute = TupleDescAttr(tupleDescriptor, columnIndex);
+
+		if (PQgetisnull(result, rowIndex, columnIndex))
+		{
+			execution->columnValues[columnIndex] = (Datum) 0;
+			execution->columnNulls[columnIndex] = true;
+			continue;
+		}
+
+		int valueLength = PQgetlength(result, rowIndex, columnIndex);
+
+		/*
+		 * Some receive functions temporarily modify the buffer, so we copy the
+		 * value out of the PGresult similar to what COPY does.
+		 */
+		resetStringInfo(columnBuffer);
+		appendBinaryStringInfo(columnBuffer, PQgetvalue(result, rowIndex, columnIndex),
+							   valueLength);
+
+		execution->columnValues[columnIndex] =
+			ReceiveFunctionCall(&execution->receiveFunctionArray[columnIndex],
+								columnBuffer,
+								execution->typeIOParamArray[columnIndex],
+								attribute->atttypmod);
+		execution->columnNulls[columnIndex] = false;
+
+		if (columnBuffer->cursor != columnBuffer->len)
+		{
+			ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							errmsg("incorrect binary data format in column %d of "
+								   "result from %s:%d", columnIndex + 1,
+								   connection->hostname, connection->port)));
+		}
+
+		if (SubPlanLevel > 0 && executionStats != NULL)
+		{
+			executionStats->totalIntermediateResultSize += valueLength;
+		}
+	}
+}
+
+
 /*
  * WorkerPoolFailed marks a worker pool and all the placement executions scheduled
  * on it as failed.
@@ -3389,6 +5738,9 @@ WorkerPoolFailed(WorkerPool *workerPool)
 	workerPool->readyTaskCount = 0;
 	workerPool->failed = true;
 
+	/* let other executions try placements on other workers first */
+	RecordNodeFailure(workerPool->nodeName, workerPool->nodePort);
+
 	/*
 	 * The reason is that when replication factor is > 1 and we are performing
 	 * a SELECT, then we only establish connections for the specific placements
@@ -3437,6 +5789,15 @@ WorkerSessionFailed(WorkerSession *session)
 		PlacementExecutionDone(placementExecution, succeeded);
 	}
 
+	foreach_ptr(placementExecution, session->batchedTaskList)
+	{
+		/* tasks that were sent in the same batch */
+		PlacementExecutionDone(placementExecution, succeeded);
+	}
+
+	session->batchedTaskList = NIL;
+	session->pendingBeginResultCount = 0;
+
 	dlist_foreach(iter, &session->pendingTaskQueue)
 	{
 		placementExecution =
@@ -3480,10 +5841,42 @@ PlacementExecutionDone(TaskPlacementExecution *placementExecution, bool succeede
 		return;
 	}
 
+	if (shardCommandExecution->resultPlacementExecution != NULL &&
+		shardCommandExecution->resultPlacementExecution != placementExecution)
+	{
+		/*
+		 * A hedged read whose results were discarded in favour of another
+		 * replica, which determines the outcome of the task.
+		 */
+		placementExecution->executionState = PLACEMENT_EXECUTION_FAILED;
+		return;
+	}
+
+	if (!succeeded && shardCommandExecution->resultPlacementExecution != NULL)
+	{
+		/* let the next replica return the results instead */
+		shardCommandExecution->resultPlacementExecution = NULL;
+	}
+
 	/* mark the placement execution as finished */
 	if (succeeded)
 	{
 		placementExecution->executionState = PLACEMENT_EXECUTION_FINISHED;
+
+		if (shardCommandExecution->hedged)
+		{
+			/* the other replicas no longer need to read */
+			CancelLosingHedgedReads(execution, placementExecution);
+		}
+
+		if (placementExecution->startTime != 0)
+		{
+			TimestampTz now = GetCurrentTimestamp();
+
+			workerPool->totalTaskDurationUs +=
+				MicrosecondsBetweenTimestamps(placementExecution->startTime, now);
+			workerPool->finishedTaskCount++;
+		}
 	}
 	else
 	{
@@ -3546,6 +5939,12 @@ PlacementExecutionDone(TaskPlacementExecution *placementExecution, bool succeede
 		execution->failed = true;
 		return;
 	}
+	else if (shardCommandExecution->hedged &&
+			 PlacementExecutionInProgress(shardCommandExecution))
+	{
+		/* a hedged read is still running on another replica */
+		return;
+	}
 	else if (!failedPlacementExecutionIsOnPendingQueue)
 	{
 		ScheduleNextPlacementExecution(placementExecution, succeeded);
@@ -3553,6 +5952,218 @@ PlacementExecutionDone(TaskPlacementExecution *placementExecution, bool succeede
 }
 
 
+/*
+ * StartHedgedReads makes the next placement execution ready for read-only
+ * tasks that have been running on a placement for longer than the hedged
+ * read delay, such that a single busy worker does not hold up the execution.
+ * Whichever placement returns results first determines the outcome of the
+ * task, and the other one is cancelled once it finished (see
+ * CancelLosingHedgedReads).
+ */
+static void
+StartHedgedReads(DistributedExecution *execution)
+{
+	TimestampTz now = GetCurrentTimestamp();
+
+	WorkerSession *session = NULL;
+	foreach_ptr(session, execution->sessionList)
+	{
+		TaskPlacementExecution *placementExecution = session->currentTask;
+		if (placementExecution == NULL ||
+			placementExecution->executionState != PLACEMENT_EXECUTION_RUNNING ||
+			placementExecution->startTime == 0)
+		{
+			continue;
+		}
+
+		ShardCommandExecution *shardCommandExecution =
+			placementExecution->shardCommandExecution;
+		if (shardCommandExecution->hedged ||
+			shardCommandExecution->executionOrder != EXECUTION_ORDER_ANY ||
+			shardCommandExecution->executionState != TASK_EXECUTION_NOT_FINISHED ||
+			shardCommandExecution->task->relationRowLockList != NIL)
+		{
+			continue;
+		}
+
+		long runningTimeMs =
+			MillisecondsBetweenTimestamps(placementExecution->startTime, now);
+		if (runningTimeMs < HedgedReadDelayMs(session->workerPool))
+		{
+			continue;
+		}
+
+		/* a task is hedged at most once */
+		shardCommandExecution->hedged = true;
+
+		TaskPlacementExecution *nextPlacementExecution =
+			NextNotReadyPlacementExecution(shardCommandExecution);
+		if (nextPlacementExecution == NULL)
+		{
+			/* no other replica to read from */
+			continue;
+		}
+
+		ereport(DEBUG1, (errmsg("starting hedged read for shard " UINT64_FORMAT
+								" on %s:%d",
+								nextPlacementExecution->shardPlacement->shardId,
+								nextPlacementExecution->workerPool->nodeName,
+								nextPlacementExecution->workerPool->nodePort)));
+
+		execution->hedgedReadCount++;
+
+		PlacementExecutionReady(nextPlacementExecution);
+	}
+}
+
+
+/*
+ * CancelLosingHedgedReads cancels the commands of a hedged read that still run
+ * on other replicas after the given placement execution finished the task,
+ * such that their sessions can move on to other tasks rather than receive rows
+ * that are discarded. The error of the cancelled command is then ignored in
+ * ReceiveResults.
+ *
+ * Commands that are part of a batch or of a transaction block are left to
+ * finish, since cancelling them would also affect the other commands.
+ */
+static void
+CancelLosingHedgedReads(DistributedExecution *execution,
+						TaskPlacementExecution *resultPlacementExecution)
+{
+	ShardCommandExecution *shardCommandExecution =
+		resultPlacementExecution->shardCommandExecution;
+
+	WorkerSession *session = NULL;
+	foreach_ptr(session, execution->sessionList)
+	{
+		TaskPlacementExecution *placementExecution = session->currentTask;
+		if (placementExecution == NULL ||
+			placementExecution == resultPlacementExecution ||
+			placementExecution->shardCommandExecution != shardCommandExecution ||
+			placementExecution->executionState != PLACEMENT_EXECUTION_RUNNING ||
+			placementExecution->cancelled ||
+			session->batchedTaskList != NIL)
+		{
+			continue;
+		}
+
+		MultiConnection *connection = session->connection;
+		RemoteTransaction *transaction = &(connection->remoteTransaction);
+		if (transaction->transactionState != REMOTE_TRANS_SENT_COMMAND ||
+			transaction->beginSent)
+		{
+			continue;
+		}
+
+		if (SendCancelationRequest(connection))
+		{
+			placementExecution->cancelled = true;
+		}
+	}
+}
+
+
+/*
+ * IsQueryCanceledResult returns whether the given result is the error of a
+ * cancelled command.
+ */
+static bool
+IsQueryCanceledResult(PGresult *result)
+{
+	char *sqlStateString = PQresultErrorField(result, PG_DIAG_SQLSTATE);
+
+	if (PQresultStatus(result) != PGRES_FATAL_ERROR || sqlStateString == NULL)
+	{
+		return false;
+	}
+
+	int sqlState = MAKE_SQLSTATE(sqlStateString[0], sqlStateString[1],
+								 sqlStateString[2], sqlStateString[3],
+								 sqlStateString[4]);
+
+	return sqlState == ERRCODE_QUERY_CANCELED;
+}
+
+
+/*
+ * HedgedReadDelayMs returns the time after which a read on the given worker
+ * is also started on another placement. When the latencies of the worker are
+ * tracked, reads are hedged only once they take considerably longer than
+ * usual, to avoid duplicating work on a uniformly slow cluster.
+ */
+static long
+HedgedReadDelayMs(WorkerPool *workerPool)
+{
+	long hedgedReadDelayMs = HedgedReadDelay;
+
+	if (ShouldTrackWorkerLatencies())
+	{
+		WorkerLatency latency = WorkerPoolLatency(workerPool);
+
+		if (latency.taskDurationUs > 0)
+		{
+			long slowTaskDurationMs =
+				(long) (HEDGED_READ_LATENCY_FACTOR * latency.taskDurationUs / 1000.0);
+
+			hedgedReadDelayMs = Max(hedgedReadDelayMs, slowTaskDurationMs);
+		}
+	}
+
+	return hedgedReadDelayMs;
+}
+
+
+/*
+ * NextNotReadyPlacementExecution returns the first placement execution of
+ * the shard command execution that was not yet made ready, or NULL if there
+ * is none.
+ */
+static TaskPlacementExecution *
+NextNotReadyPlacementExecution(ShardCommandExecution *shardCommandExecution)
+{
+	for (int placementExecutionIndex = 0;
+		 placementExecutionIndex < shardCommandExecution->placementExecutionCount;
+		 placementExecutionIndex++)
+	{
+		TaskPlacementExecution *placementExecution =
+			shardCommandExecution->placementExecutions[placementExecutionIndex];
+
+		if (placementExecution->executionState == PLACEMENT_EXECUTION_NOT_READY)
+		{
+			return placementExecution;
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * PlacementExecutionInProgress returns whether any of the placement
+ * executions of the shard command execution is ready or running.
+ */
+static bool
+PlacementExecutionInProgress(ShardCommandExecution *shardCommandExecution)
+{
+	for (int placementExecutionIndex = 0;
+		 placementExecutionIndex < shardCommandExecution->placementExecutionCount;
+		 placementExecutionIndex++)
+	{
+		TaskPlacementExecution *placementExecution =
+			shardCommandExecution->placementExecutions[placementExecutionIndex];
+
+		if (placementExecution->executionState == PLACEMENT_EXECUTION_READY ||
+			placementExecution->executionState == PLACEMENT_EXECUTION_RUNNING)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 /*
  * ScheduleNextPlacementExecution is triggered if the query needs to be
  * executed on any or all placements in order and there is a placement on
@@ -12,6 +12,7 @@
 #include "miscadmin.h"
 
 #include "commands/copy.h"
+#include "distributed/adaptive_executor.h"
 #include "distributed/backend_data.h"
 #include "distributed/citus_clauses.h"
 #include "distributed/citus_custom_scan.h"
@@ -25,7 +26,9 @@
 #include "distributed/multi_server_executor.h"
 #include "distributed/multi_router_planner.h"
 #include "distributed/query_stats.h"
+#include "distributed/sorted_merge.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/worker_protocol.h"
 #include "executor/executor.h"
 #include "nodes/makefuncs.h"
@@ -140,11 +143,21 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
 
 	CitusScanState *scanState = (CitusScanState *) node;
 
+	/* remember whether the scan needs to support going back to earlier rows */
+	scanState->eflags = eflags;
+
 #if PG_VERSION_NUM >= 120000
 	ExecInitResultSlot(&scanState->customScanState.ss.ps, &TTSOpsMinimalTuple);
 #endif
 
 	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	if (distributedPlan->modLevel > ROW_MODIFY_READONLY &&
+		OidIsValid(distributedPlan->targetRelationId))
+	{
+		/* cached subplan results that read the table become outdated on commit */
+		InvalidateSubPlanResultsOnCommit(distributedPlan->targetRelationId);
+	}
+
 	Job *workerJob = distributedPlan->workerJob;
 	if (workerJob &&
 		(workerJob->requiresMasterEvaluation || workerJob->deferredPruning))
@@ -162,7 +175,8 @@ CitusBeginScan(CustomScanState *node, EState *estate, int eflags)
  * CitusExecScan is called when a tuple is pulled from a custom scan.
  * On the first call, it executes the distributed query and writes the
  * results to a tuple store. The postgres executor calls this function
- * repeatedly to read tuples from the tuple store.
+ * repeatedly to read tuples from the tuple store. When the results are
+ * streamed, the tuple store is refilled each time all tuples have been read.
  */
 TupleTableSlot *
 CitusExecScan(CustomScanState *node)
@@ -176,8 +190,21 @@ CitusExecScan(CustomScanState *node)
 		scanState->finishedRemoteScan = true;
 	}
 
+	if (scanState->sortedMerge != NULL)
+	{
+		/* the merge receives more rows of streamed results by itself */
+		return ReturnTupleFromSortedMerge(scanState);
+	}
+
 	TupleTableSlot *resultSlot = ReturnTupleFromTuplestore(scanState);
 
+	/* when streaming results, receive more rows once we read all of them */
+	while (TupIsNull(resultSlot) && scanState->streamingExecution != NULL &&
+		   ContinueStreamingExecution(scanState->streamingExecution))
+	{
+		resultSlot = ReturnTupleFromTuplestore(scanState);
+	}
+
 	return resultSlot;
 }
 
@@ -691,6 +718,19 @@ CitusEndScan(CustomScanState *node)
 		CitusQueryStatsExecutorsEntry(queryId, executorType, partitionKeyString);
 	}
 
+	if (scanState->streamingExecution != NULL)
+	{
+		/* the scan might end before all rows are received, e.g. due to LIMIT */
+		EndStreamingExecution(scanState->streamingExecution);
+		scanState->streamingExecution = NULL;
+	}
+
+	if (scanState->sortedMerge != NULL)
+	{
+		EndSortedMerge(scanState->sortedMerge);
+		scanState->sortedMerge = NULL;
+	}
+
 	if (scanState->tuplestorestate)
 	{
 		tuplestore_end(scanState->tuplestorestate);
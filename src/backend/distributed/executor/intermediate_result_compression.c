@@ -0,0 +1,644 @@
+/*-------------------------------------------------------------------------
+ *
+ * intermediate_result_compression.c
+ *   Functions for compressing intermediate result files and reading them
+ *   back.
+ *
+ * A compressed intermediate result file starts with a signature followed by
+ * the compression method, and then contains the COPY data as a series of
+ * blocks. Each block has a header with the uncompressed and the stored
+ * length of the block in network byte order, followed by the stored data.
+ * Blocks that do not compress well are stored as is, which is indicated by
+ * equal lengths.
+ *
+ * Since the compressed stream is just the content of the result file, it is
+ * sent to workers and fetched from them without decompressing it. Files that
+ * do not start with the signature are read as regular COPY files.
+ *
+ * Small results may be kept in shared memory instead of in a file, in which
+ * case the same content is read from a copy of the shared memory segment.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "citus_version.h"
+
+#include "common/pg_lzcompress.h"
+#include "distributed/intermediate_result_compression.h"
+#include "distributed/shared_intermediate_results.h"
+#include "distributed/version_compat.h"
+#include "port/pg_bswap.h"
+#include "storage/fd.h"
+#include "utils/memutils.h"
+
+#ifdef HAVE_LIBLZ4
+#include <lz4.h>
+#endif
+
+#ifdef HAVE_LIBZSTD
+#include <zstd.h>
+#endif
+
+
+/* zstd compression level, favouring speed over compression ratio */
+#define ZSTD_COMPRESSION_LEVEL 1
+
+/* length of the signature and of the file header including the method */
+#define COMPRESSED_RESULT_SIGNATURE_LENGTH 13
+#define COMPRESSED_RESULT_HEADER_LENGTH (COMPRESSED_RESULT_SIGNATURE_LENGTH + 1)
+
+/* length of the header of each block */
+#define COMPRESSED_BLOCK_HEADER_LENGTH (2 * sizeof(uint32))
+
+
+/*
+ * CompressedResultSignature cannot occur at the start of a text or csv COPY
+ * file since those cannot contain null bytes, and differs from the binary
+ * COPY signature.
+ */
+static const char CompressedResultSignature[COMPRESSED_RESULT_SIGNATURE_LENGTH] =
+	"CITUSCMP\n\377\r\n\0";
+
+
+/*
+ * CompressedResultReader holds the state of reading a compressed result file,
+ * or a result kept in shared memory, through COPY.
+ */
+typedef struct CompressedResultReader
+{
+	char *fileName;
+	ResultCompressionMethod method;
+
+	/* the result file, or the result copied from shared memory */
+	FILE *file;
+	StringInfo sharedData;
+	int sharedDataOffset;
+
+	/* stored data of the current block */
+	StringInfo storedBlock;
+
+	/* decompressed data of the current block, and how much of it was read */
+	StringInfo block;
+	int blockOffset;
+} CompressedResultReader;
+
+
+/* GUC, compression method for intermediate results written by this node */
+int IntermediateResultCompression = RESULT_COMPRESSION_NONE;
+
+/*
+ * COPY data source callbacks do not take an argument, so the reader of the
+ * file that is currently being read is kept in a static variable.
+ */
+static CompressedResultReader *CurrentResultReader = NULL;
+
+
+static bool ResultCompressionMethodSupported(ResultCompressionMethod method);
+static int CompressedLengthBound(ResultCompressionMethod method, int dataLength);
+static int CompressData(ResultCompressionMethod method, const char *data,
+						int dataLength, char *destination, int destinationLength);
+static bool DecompressData(ResultCompressionMethod method, const char *data,
+						   int dataLength, char *destination, int rawLength);
+static CopyState BeginCopyFromSharedResult(Relation relation, char *fileName,
+										   StringInfo sharedData, List *copyOptions);
+static int ReadDecompressedResultData(void *outbuf, int minread, int maxread);
+static bool ReadNextCompressedBlock(CompressedResultReader *reader);
+static size_t ReadRawResultData(CompressedResultReader *reader, char *buffer,
+								size_t length);
+
+
+/*
+ * AppendCompressedResultHeader appends the header of a compressed result file
+ * to the given buffer.
+ */
+void
+AppendCompressedResultHeader(StringInfo buffer, ResultCompressionMethod method)
+{
+	appendBinaryStringInfo(buffer, CompressedResultSignature,
+						   COMPRESSED_RESULT_SIGNATURE_LENGTH);
+	appendStringInfoChar(buffer, (char) method);
+}
+
+
+/*
+ * AppendCompressedResultBlock compresses the given data using the given method
+ * and appends it to the buffer as a single block.
+ */
+void
+AppendCompressedResultBlock(StringInfo buffer, ResultCompressionMethod method,
+							const char *data, int dataLength)
+{
+	int maxStoredLength = CompressedLengthBound(method, dataLength);
+
+	enlargeStringInfo(buffer, COMPRESSED_BLOCK_HEADER_LENGTH + maxStoredLength);
+
+	char *blockHeader = buffer->data + buffer->len;
+	char *blockData = blockHeader + COMPRESSED_BLOCK_HEADER_LENGTH;
+
+	int storedLength = CompressData(method, data, dataLength, blockData,
+									maxStoredLength);
+	if (storedLength < 0 || storedLength >= dataLength)
+	{
+		/* store data that does not compress well as is */
+		memcpy(blockData, data, dataLength);
+		storedLength = dataLength;
+	}
+
+	uint32 rawLengthNetwork = pg_hton32((uint32) dataLength);
+	uint32 storedLengthNetwork = pg_hton32((uint32) storedLength);
+
+	memcpy(blockHeader, &rawLengthNetwork, sizeof(uint32));
+	memcpy(blockHeader + sizeof(uint32), &storedLengthNetwork, sizeof(uint32));
+
+	buffer->len += COMPRESSED_BLOCK_HEADER_LENGTH + storedLength;
+	buffer->data[buffer->len] = '\0';
+}
+
+
+/*
+ * BeginCopyFromResultFile starts a COPY from the given intermediate result
+ * file, decompressing it on the fly if it was written in compressed format.
+ * Results that are kept in shared memory are read from there instead. The
+ * COPY should be ended with EndCopyFromResultFile.
+ */
+CopyState
+BeginCopyFromResultFile(Relation relation, char *fileName, List *copyOptions)
+{
+	char header[COMPRESSED_RESULT_HEADER_LENGTH];
+
+	/* a reader left behind by an earlier error was cleaned up on abort */
+	CurrentResultReader = NULL;
+
+	StringInfo sharedData = ReadSharedIntermediateResult(fileName);
+	if (sharedData != NULL)
+	{
+		return BeginCopyFromSharedResult(relation, fileName, sharedData,
+										 copyOptions);
+	}
+
+	FILE *file = AllocateFile(fileName, PG_BINARY_R);
+	if (file == NULL)
+	{
+		ereport(ERROR, (errcode_for_file_access(),
+						errmsg("could not open file \"%s\": %m", fileName)));
+	}
+
+	size_t headerLength = fread(header, 1, COMPRESSED_RESULT_HEADER_LENGTH, file);
+	if (headerLength < COMPRESSED_RESULT_HEADER_LENGTH ||
+		memcmp(header, CompressedResultSignature,
+			   COMPRESSED_RESULT_SIGNATURE_LENGTH) != 0)
+	{
+		/* not a compressed result, let COPY read the file as usual */
+		FreeFile(file);
+
+		return BeginCopyFrom(NULL, relation, fileName, false, NULL, NIL,
+							 copyOptions);
+	}
+
+	ResultCompressionMethod method =
+		(ResultCompressionMethod) header[COMPRESSED_RESULT_SIGNATURE_LENGTH];
+	if (!ResultCompressionMethodSupported(method))
+	{
+		FreeFile(file);
+
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("intermediate result file \"%s\" uses compression "
+							   "method %d, which is not supported by this build",
+							   fileName, (int) method)));
+	}
+
+	CompressedResultReader *reader = palloc0(sizeof(CompressedResultReader));
+	reader->fileName = pstrdup(fileName);
+	reader->file = file;
+	reader->method = method;
+	reader->storedBlock = makeStringInfo();
+	reader->block = makeStringInfo();
+	reader->blockOffset = 0;
+
+	CurrentResultReader = reader;
+
+	return BeginCopyFrom(NULL, relation, NULL, false, ReadDecompressedResultData,
+						 NIL, copyOptions);
+}
+
+
+/*
+ * BeginCopyFromSharedResult starts a COPY from the contents of a result that
+ * was kept in shared memory, decompressing it on the fly if needed.
+ */
+static CopyState
+BeginCopyFromSharedResult(Relation relation, char *fileName, StringInfo sharedData,
+						  List *copyOptions)
+{
+	CompressedResultReader *reader = palloc0(sizeof(CompressedResultReader));
+	reader->fileName = pstrdup(fileName);
+	reader->sharedData = sharedData;
+	reader->sharedDataOffset = 0;
+	reader->storedBlock = makeStringInfo();
+	reader->blockOffset = 0;
+
+	if (sharedData->len >= COMPRESSED_RESULT_HEADER_LENGTH &&
+		memcmp(sharedData->data, CompressedResultSignature,
+			   COMPRESSED_RESULT_SIGNATURE_LENGTH) == 0)
+	{
+		reader->method = (ResultCompressionMethod)
+						 sharedData->data[COMPRESSED_RESULT_SIGNATURE_LENGTH];
+		if (!ResultCompressionMethodSupported(reader->method))
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("intermediate result file \"%s\" uses compression "
+								   "method %d, which is not supported by this build",
+								   fileName, (int) reader->method)));
+		}
+
+		reader->sharedDataOffset = COMPRESSED_RESULT_HEADER_LENGTH;
+		reader->block = makeStringInfo();
+	}
+	else
+	{
+		/* uncompressed data is served as a single block */
+		reader->method = RESULT_COMPRESSION_NONE;
+		reader->sharedDataOffset = sharedData->len;
+		reader->block = sharedData;
+	}
+
+	CurrentResultReader = reader;
+
+	return BeginCopyFrom(NULL, relation, NULL, false, ReadDecompressedResultData,
+						 NIL, copyOptions);
+}
+
+
+/*
+ * EndCopyFromResultFile ends a COPY started by BeginCopyFromResultFile and
+ * closes the compressed result file or frees the shared result, if any.
+ */
+void
+EndCopyFromResultFile(CopyState copyState)
+{
+	EndCopyFrom(copyState);
+
+	CompressedResultReader *reader = CurrentResultReader;
+	if (reader == NULL)
+	{
+		return;
+	}
+
+	if (reader->file != NULL)
+	{
+		FreeFile(reader->file);
+	}
+
+	if (reader->sharedData != NULL && reader->sharedData != reader->block)
+	{
+		pfree(reader->sharedData->data);
+	}
+
+	pfree(reader->storedBlock->data);
+	pfree(reader->block->data);
+	pfree(reader->fileName);
+	pfree(reader);
+
+	CurrentResultReader = NULL;
+}
+
+
+/*
+ * ResultCompressionMethodSupported returns whether this build can compress
+ * and decompress results using the given method.
+ */
+static bool
+ResultCompressionMethodSupported(ResultCompressionMethod method)
+{
+	switch (method)
+	{
+		case RESULT_COMPRESSION_PGLZ:
+		{
+			return true;
+		}
+
+#ifdef HAVE_LIBLZ4
+		case RESULT_COMPRESSION_LZ4:
+		{
+			return true;
+		}
+
+#endif
+
+#ifdef HAVE_LIBZSTD
+		case RESULT_COMPRESSION_ZSTD:
+		{
+			return true;
+		}
+
+#endif
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+/*
+ * CompressedLengthBound returns the maximum number of bytes needed to store a
+ * block of the given length.
+ */
+static int
+CompressedLengthBound(ResultCompressionMethod method, int dataLength)
+{
+	int compressedLengthBound = dataLength;
+
+	switch (method)
+	{
+		case RESULT_COMPRESSION_PGLZ:
+		{
+			compressedLengthBound = PGLZ_MAX_OUTPUT(dataLength);
+			break;
+		}
+
+#ifdef HAVE_LIBLZ4
+		case RESULT_COMPRESSION_LZ4:
+		{
+			compressedLengthBound = LZ4_compressBound(dataLength);
+			break;
+		}
+
+#endif
+
+#ifdef HAVE_LIBZSTD
+		case RESULT_COMPRESSION_ZSTD:
+		{
+			compressedLengthBound = (int) ZSTD_compressBound(dataLength);
+			break;
+		}
+
+#endif
+
+		default:
+		{
+			break;
+		}
+	}
+
+	return Max(compressedLengthBound, dataLength);
+}
+
+
+/*
+ * CompressData compresses the given data into the destination buffer using the
+ * given method, and returns the compressed length or -1 if the data could not
+ * be compressed.
+ */
+static int
+CompressData(ResultCompressionMethod method, const char *data, int dataLength,
+			 char *destination, int destinationLength)
+{
+	switch (method)
+	{
+		case RESULT_COMPRESSION_PGLZ:
+		{
+			return pglz_compress(data, dataLength, destination,
+								 PGLZ_strategy_default);
+		}
+
+#ifdef HAVE_LIBLZ4
+		case RESULT_COMPRESSION_LZ4:
+		{
+			int compressedLength = LZ4_compress_default(data, destination, dataLength,
+														destinationLength);
+
+			return compressedLength > 0 ? compressedLength : -1;
+		}
+
+#endif
+
+#ifdef HAVE_LIBZSTD
+		case RESULT_COMPRESSION_ZSTD:
+		{
+			size_t compressedLength = ZSTD_compress(destination, destinationLength,
+													data, dataLength,
+													ZSTD_COMPRESSION_LEVEL);
+
+			return ZSTD_isError(compressedLength) ? -1 : (int) compressedLength;
+		}
+
+#endif
+
+		default:
+		{
+			ereport(ERROR, (errmsg("intermediate result compression method %d is "
+								   "not supported by this build", (int) method)));
+		}
+	}
+}
+
+
+/*
+ * DecompressData decompresses the given data into the destination buffer,
+ * which should be able to hold rawLength bytes, and returns whether the data
+ * decompressed to exactly that many bytes.
+ */
+static bool
+DecompressData(ResultCompressionMethod method, const char *data, int dataLength,
+			   char *destination, int rawLength)
+{
+	switch (method)
+	{
+		case RESULT_COMPRESSION_PGLZ:
+		{
+			return PglzDecompressCompat(data, dataLength, destination,
+										rawLength) == rawLength;
+		}
+
+#ifdef HAVE_LIBLZ4
+		case RESULT_COMPRESSION_LZ4:
+		{
+			return LZ4_decompress_safe(data, destination, dataLength,
+									   rawLength) == rawLength;
+		}
+
+#endif
+
+#ifdef HAVE_LIBZSTD
+		case RESULT_COMPRESSION_ZSTD:
+		{
+			size_t decompressedLength = ZSTD_decompress(destination, rawLength,
+														data, dataLength);
+
+			return !ZSTD_isError(decompressedLength) &&
+				   decompressedLength == (size_t) rawLength;
+		}
+
+#endif
+
+		default:
+		{
+			return false;
+		}
+	}
+}
+
+
+/*
+ * ReadDecompressedResultData is the COPY data source callback for compressed
+ * result files. It copies at least minread and at most maxread bytes of
+ * decompressed data into outbuf, unless the end of the file is reached, and
+ * returns the number of bytes copied.
+ */
+static int
+ReadDecompressedResultData(void *outbuf, int minread, int maxread)
+{
+	CompressedResultReader *reader = CurrentResultReader;
+	char *outputBuffer = (char *) outbuf;
+	int bytesRead = 0;
+
+	Assert(reader != NULL);
+
+	while (bytesRead < maxread)
+	{
+		int bytesAvailable = reader->block->len - reader->blockOffset;
+		if (bytesAvailable == 0)
+		{
+			if (bytesRead >= minread || !ReadNextCompressedBlock(reader))
+			{
+				break;
+			}
+
+			continue;
+		}
+
+		int bytesToCopy = Min(bytesAvailable, maxread - bytesRead);
+
+		memcpy(outputBuffer + bytesRead, reader->block->data + reader->blockOffset,
+			   bytesToCopy);
+
+		reader->blockOffset += bytesToCopy;
+		bytesRead += bytesToCopy;
+	}
+
+	return bytesRead;
+}
+
+
+/*
+ * ReadNextCompressedBlock reads and decompresses the next block of the file.
+ * It returns false when the end of the file is reached.
+ */
+static bool
+ReadNextCompressedBlock(CompressedResultReader *reader)
+{
+	char blockHeader[COMPRESSED_BLOCK_HEADER_LENGTH];
+	uint32 rawLengthNetwork = 0;
+	uint32 storedLengthNetwork = 0;
+
+	if (reader->method == RESULT_COMPRESSION_NONE)
+	{
+		/* uncompressed shared results consist of a single block */
+		return false;
+	}
+
+	size_t headerLength = ReadRawResultData(reader, blockHeader,
+											COMPRESSED_BLOCK_HEADER_LENGTH);
+	if (headerLength == 0)
+	{
+		return false;
+	}
+	else if (headerLength < COMPRESSED_BLOCK_HEADER_LENGTH)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("unexpected end of intermediate result file \"%s\"",
+							   reader->fileName)));
+	}
+
+	memcpy(&rawLengthNetwork, blockHeader, sizeof(uint32));
+	memcpy(&storedLengthNetwork, blockHeader + sizeof(uint32), sizeof(uint32));
+
+	uint32 rawLength = pg_ntoh32(rawLengthNetwork);
+	uint32 storedLength = pg_ntoh32(storedLengthNetwork);
+
+	if (rawLength >= MaxAllocSize || storedLength > rawLength)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("invalid block in intermediate result file \"%s\"",
+							   reader->fileName)));
+	}
+
+	StringInfo storedBlock = reader->storedBlock;
+	StringInfo block = reader->block;
+
+	resetStringInfo(storedBlock);
+	enlargeStringInfo(storedBlock, storedLength);
+
+	if (ReadRawResultData(reader, storedBlock->data, storedLength) != storedLength)
+	{
+		ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+						errmsg("unexpected end of intermediate result file \"%s\"",
+							   reader->fileName)));
+	}
+
+	storedBlock->len = storedLength;
+
+	resetStringInfo(block);
+
+	if (storedLength == rawLength)
+	{
+		/* the block was stored as is */
+		appendBinaryStringInfo(block, storedBlock->data, storedBlock->len);
+	}
+	else
+	{
+		enlargeStringInfo(block, rawLength);
+
+		if (!DecompressData(reader->method, storedBlock->data, storedBlock->len,
+							block->data, rawLength))
+		{
+			ereport(ERROR, (errcode(ERRCODE_DATA_CORRUPTED),
+							errmsg("could not decompress intermediate result "
+								   "file \"%s\"", reader->fileName)));
+		}
+
+		block->len = rawLength;
+		block->data[block->len] = '\0';
+	}
+
+	reader->blockOffset = 0;
+
+	return true;
+}
+
+
+/*
+ * ReadRawResultData reads up to the given number of bytes of the stored result
+ * into the buffer, either from the result file or from the copy of the shared
+ * memory segment, and returns the number of bytes read.
+ */
+static size_t
+ReadRawResultData(CompressedResultReader *reader, char *buffer, size_t length)
+{
+	if (reader->file != NULL)
+	{
+		size_t bytesRead = fread(buffer, 1, length, reader->file);
+		if (bytesRead < length && ferror(reader->file))
+		{
+			ereport(ERROR, (errcode_for_file_access(),
+							errmsg("could not read file \"%s\": %m",
+								   reader->fileName)));
+		}
+
+		return bytesRead;
+	}
+
+	size_t bytesAvailable = reader->sharedData->len - reader->sharedDataOffset;
+	size_t bytesRead = Min(length, bytesAvailable);
+
+	memcpy(buffer, reader->sharedData->data + reader->sharedDataOffset, bytesRead);
+	reader->sharedDataOffset += bytesRead;
+
+	return bytesRead;
+}
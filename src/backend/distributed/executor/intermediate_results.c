@@ -20,12 +20,14 @@
 #include "commands/copy.h"
 #include "distributed/commands/multi_copy.h"
 #include "distributed/connection_management.h"
+#include "distributed/intermediate_result_compression.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/master_metadata_utility.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/multi_client_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/remote_commands.h"
+#include "distributed/shared_intermediate_results.h"
 #include "distributed/transmit.h"
 #include "distributed/transaction_identifier.h"
 #include "distributed/tuplestore.h"
@@ -69,11 +71,24 @@ typedef struct RemoteFileDestReceiver
 	/* whether to write to a local file */
 	bool writeLocalFile;
 	FileCompat fileCompat;
+	bool localFileOpened;
+
+	/* local result data that may still be kept in shared memory */
+	StringInfo localData;
 
 	/* state on how to copy out data types */
 	CopyOutState copyOutState;
 	FmgrInfo *columnOutputFunctions;
 
+	/* compression method, and COPY data that is not yet compressed */
+	ResultCompressionMethod compressionMethod;
+	StringInfo uncompressedData;
+	StringInfo compressedData;
+
+	/* copy of the result data for the subplan result cache, if requested */
+	StringInfo capturedData;
+	int64 maxCapturedDataSize;
+
 	/* number of tuples sent */
 	uint64 tuplesSent;
 } RemoteFileDestReceiver;
@@ -81,8 +96,15 @@ typedef struct RemoteFileDestReceiver
 
 static void RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 										  TupleDesc inputTupleDescriptor);
+static void StartResultCopy(RemoteFileDestReceiver *resultDest);
+static void EndResultCopy(RemoteFileDestReceiver *resultDest);
 static StringInfo ConstructCopyResultStatement(const char *resultId);
+static void OpenLocalResultFile(RemoteFileDestReceiver *resultDest);
+static void WriteToLocalResult(RemoteFileDestReceiver *resultDest, StringInfo data);
 static void WriteToLocalFile(StringInfo copyData, FileCompat *fileCompat);
+static void WriteResultData(RemoteFileDestReceiver *resultDest, StringInfo copyData);
+static void FlushCompressedResultData(RemoteFileDestReceiver *resultDest);
+static void SendResultData(RemoteFileDestReceiver *resultDest, StringInfo data);
 static bool RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest);
 static void BroadcastCopyData(StringInfo dataBuffer, List *connectionList);
 static void SendCopyDataOverConnection(StringInfo dataBuffer,
@@ -221,6 +243,58 @@ CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 }
 
 
+/*
+ * CaptureIntermediateResultData makes the given RemoteFileDestReceiver keep a
+ * copy of the result data it sends, as long as the data is not larger than
+ * maxSize bytes. The copy can be obtained with CapturedIntermediateResultData
+ * after the result is written.
+ */
+void
+CaptureIntermediateResultData(DestReceiver *destReceiver, int64 maxSize)
+{
+	RemoteFileDestReceiver *resultDest = (RemoteFileDestReceiver *) destReceiver;
+
+	resultDest->capturedData = makeStringInfo();
+	resultDest->maxCapturedDataSize = maxSize;
+}
+
+
+/*
+ * CapturedIntermediateResultData returns the copy of the result data that was
+ * sent by the given RemoteFileDestReceiver, or NULL if the data was too large
+ * or not captured.
+ */
+StringInfo
+CapturedIntermediateResultData(DestReceiver *destReceiver)
+{
+	RemoteFileDestReceiver *resultDest = (RemoteFileDestReceiver *) destReceiver;
+
+	return resultDest->capturedData;
+}
+
+
+/*
+ * WriteIntermediateResultData writes result data that was captured earlier by
+ * a RemoteFileDestReceiver to the given nodes and the local file (if
+ * applicable), without executing a query.
+ */
+void
+WriteIntermediateResultData(char *resultId, StringInfo resultData,
+							List *initialNodeList, bool writeLocalFile)
+{
+	RemoteFileDestReceiver *resultDest =
+		(RemoteFileDestReceiver *) CreateRemoteFileDestReceiver(resultId, NULL,
+																initialNodeList,
+																writeLocalFile);
+
+	StartResultCopy(resultDest);
+	SendResultData(resultDest, resultData);
+	EndResultCopy(resultDest);
+
+	RemoteFileDestReceiverDestroy((DestReceiver *) resultDest);
+}
+
+
 /*
  * RemoteFileDestReceiverStartup implements the rStartup interface of
  * RemoteFileDestReceiver. It opens connections to the nodes in initialNodeList,
@@ -232,16 +306,9 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 {
 	RemoteFileDestReceiver *resultDest = (RemoteFileDestReceiver *) dest;
 
-	const char *resultId = resultDest->resultId;
-
 	const char *delimiterCharacter = "\t";
 	const char *nullPrintCharacter = "\\N";
 
-	List *initialNodeList = resultDest->initialNodeList;
-	ListCell *initialNodeCell = NULL;
-	List *connectionList = NIL;
-	ListCell *connectionCell = NULL;
-
 	resultDest->tupleDescriptor = inputTupleDescriptor;
 
 	/* define how tuples will be serialised */
@@ -257,19 +324,59 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 	resultDest->columnOutputFunctions = ColumnOutputFunctions(inputTupleDescriptor,
 															  copyOutState->binary);
 
-	if (resultDest->writeLocalFile)
+	StartResultCopy(resultDest);
+
+	resultDest->compressionMethod = IntermediateResultCompression;
+	if (resultDest->compressionMethod != RESULT_COMPRESSION_NONE)
 	{
-		const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
-		const int fileMode = (S_IRUSR | S_IWUSR);
+		/* the header tells readers how to decompress the result */
+		StringInfo compressionHeader = makeStringInfo();
+		AppendCompressedResultHeader(compressionHeader, resultDest->compressionMethod);
+		SendResultData(resultDest, compressionHeader);
 
+		resultDest->uncompressedData = makeStringInfo();
+		resultDest->compressedData = makeStringInfo();
+	}
+
+	if (copyOutState->binary)
+	{
+		/* send headers when using binary encoding */
+		resetStringInfo(copyOutState->fe_msgbuf);
+		AppendCopyBinaryHeaders(copyOutState);
+		WriteResultData(resultDest, copyOutState->fe_msgbuf);
+	}
+}
+
+
+/*
+ * StartResultCopy prepares the local result (if applicable), opens connections
+ * to the nodes in initialNodeList, and sends the COPY command on all
+ * connections.
+ */
+static void
+StartResultCopy(RemoteFileDestReceiver *resultDest)
+{
+	const char *resultId = resultDest->resultId;
+
+	List *initialNodeList = resultDest->initialNodeList;
+	ListCell *initialNodeCell = NULL;
+	List *connectionList = NIL;
+	ListCell *connectionCell = NULL;
+
+	if (resultDest->writeLocalFile)
+	{
 		/* make sure the directory exists */
 		CreateIntermediateResultsDirectory();
 
-		const char *fileName = QueryResultFileName(resultId);
-
-		resultDest->fileCompat = FileCompatFromFileStart(FileOpenForTransmit(fileName,
-																			 fileFlags,
-																			 fileMode));
+		if (MaxSharedMemoryIntermediateResultSize > 0)
+		{
+			/* buffer the result until we know whether it fits in shared memory */
+			resultDest->localData = makeStringInfo();
+		}
+		else
+		{
+			OpenLocalResultFile(resultDest);
+		}
 	}
 
 	foreach(initialNodeCell, initialNodeList)
@@ -325,19 +432,6 @@ RemoteFileDestReceiverStartup(DestReceiver *dest, int operation,
 		PQclear(result);
 	}
 
-	if (copyOutState->binary)
-	{
-		/* send headers when using binary encoding */
-		resetStringInfo(copyOutState->fe_msgbuf);
-		AppendCopyBinaryHeaders(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
-
-		if (resultDest->writeLocalFile)
-		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
-		}
-	}
-
 	resultDest->connectionList = connectionList;
 }
 
@@ -370,7 +464,6 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 
 	TupleDesc tupleDescriptor = resultDest->tupleDescriptor;
 
-	List *connectionList = resultDest->connectionList;
 	CopyOutState copyOutState = resultDest->copyOutState;
 	FmgrInfo *columnOutputFunctions = resultDest->columnOutputFunctions;
 
@@ -391,14 +484,8 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 	AppendCopyRowData(columnValues, columnNulls, tupleDescriptor,
 					  copyOutState, columnOutputFunctions, NULL);
 
-	/* send row to nodes */
-	BroadcastCopyData(copyData, connectionList);
-
-	/* write to local file (if applicable) */
-	if (resultDest->writeLocalFile)
-	{
-		WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
-	}
+	/* send row to nodes and write it to the local file (if applicable) */
+	WriteResultData(resultDest, copyData);
 
 	MemoryContextSwitchTo(oldContext);
 
@@ -410,6 +497,58 @@ RemoteFileDestReceiverReceive(TupleTableSlot *slot, DestReceiver *dest)
 }
 
 
+/*
+ * OpenLocalResultFile opens the local file of the intermediate result for
+ * writing, and releases any copy of the result that this backend kept in
+ * shared memory earlier, since it would take precedence over the file.
+ */
+static void
+OpenLocalResultFile(RemoteFileDestReceiver *resultDest)
+{
+	const int fileFlags = (O_APPEND | O_CREAT | O_RDWR | O_TRUNC | PG_BINARY);
+	const int fileMode = (S_IRUSR | S_IWUSR);
+
+	const char *fileName = QueryResultFileName(resultDest->resultId);
+
+	RemoveSharedIntermediateResult(fileName);
+
+	resultDest->fileCompat = FileCompatFromFileStart(FileOpenForTransmit(fileName,
+																		 fileFlags,
+																		 fileMode));
+	resultDest->localFileOpened = true;
+}
+
+
+/*
+ * WriteToLocalResult writes the given bytes of the result file to the local
+ * buffer, or to the local file once the result has become too large to keep
+ * in shared memory.
+ */
+static void
+WriteToLocalResult(RemoteFileDestReceiver *resultDest, StringInfo data)
+{
+	StringInfo localData = resultDest->localData;
+
+	if (localData == NULL)
+	{
+		WriteToLocalFile(data, &resultDest->fileCompat);
+		return;
+	}
+
+	appendBinaryStringInfo(localData, data->data, data->len);
+
+	if (localData->len > MaxSharedMemoryIntermediateResultSize * 1024L)
+	{
+		OpenLocalResultFile(resultDest);
+		WriteToLocalFile(localData, &resultDest->fileCompat);
+
+		pfree(localData->data);
+		pfree(localData);
+		resultDest->localData = NULL;
+	}
+}
+
+
 /*
  * WriteToLocalResultsFile writes the bytes in a StringInfo to a local file.
  */
@@ -427,6 +566,87 @@ WriteToLocalFile(StringInfo copyData, FileCompat *fileCompat)
 }
 
 
+/*
+ * WriteResultData sends COPY data to all nodes and writes it to the local file
+ * (if applicable). When the result is compressed, the data is buffered until
+ * there is enough of it to compress as a block.
+ */
+static void
+WriteResultData(RemoteFileDestReceiver *resultDest, StringInfo copyData)
+{
+	if (resultDest->compressionMethod == RESULT_COMPRESSION_NONE)
+	{
+		SendResultData(resultDest, copyData);
+		return;
+	}
+
+	appendBinaryStringInfo(resultDest->uncompressedData, copyData->data,
+						   copyData->len);
+
+	if (resultDest->uncompressedData->len >= RESULT_COMPRESSION_BLOCK_SIZE)
+	{
+		FlushCompressedResultData(resultDest);
+	}
+}
+
+
+/*
+ * FlushCompressedResultData compresses the buffered COPY data as a block and
+ * sends it to all nodes and the local file (if applicable).
+ */
+static void
+FlushCompressedResultData(RemoteFileDestReceiver *resultDest)
+{
+	StringInfo uncompressedData = resultDest->uncompressedData;
+	StringInfo compressedData = resultDest->compressedData;
+
+	if (uncompressedData->len == 0)
+	{
+		return;
+	}
+
+	resetStringInfo(compressedData);
+	AppendCompressedResultBlock(compressedData, resultDest->compressionMethod,
+								uncompressedData->data, uncompressedData->len);
+
+	SendResultData(resultDest, compressedData);
+
+	resetStringInfo(uncompressedData);
+}
+
+
+/*
+ * SendResultData sends the given bytes of the result file to all nodes and
+ * writes them to the local file (if applicable).
+ */
+static void
+SendResultData(RemoteFileDestReceiver *resultDest, StringInfo data)
+{
+	BroadcastCopyData(data, resultDest->connectionList);
+
+	StringInfo capturedData = resultDest->capturedData;
+	if (capturedData != NULL)
+	{
+		if (capturedData->len + (int64) data->len > resultDest->maxCapturedDataSize)
+		{
+			/* the result is too large to keep a copy of */
+			pfree(capturedData->data);
+			pfree(capturedData);
+			resultDest->capturedData = NULL;
+		}
+		else
+		{
+			appendBinaryStringInfo(capturedData, data->data, data->len);
+		}
+	}
+
+	if (resultDest->writeLocalFile)
+	{
+		WriteToLocalResult(resultDest, data);
+	}
+}
+
+
 /*
  * RemoteFileDestReceiverShutdown implements the rShutdown interface of
  * RemoteFileDestReceiver. It ends the COPY on all the open connections and closes
@@ -437,7 +657,6 @@ RemoteFileDestReceiverShutdown(DestReceiver *destReceiver)
 {
 	RemoteFileDestReceiver *resultDest = (RemoteFileDestReceiver *) destReceiver;
 
-	List *connectionList = resultDest->connectionList;
 	CopyOutState copyOutState = resultDest->copyOutState;
 
 	if (copyOutState->binary)
@@ -445,18 +664,41 @@ RemoteFileDestReceiverShutdown(DestReceiver *destReceiver)
 		/* send footers when using binary encoding */
 		resetStringInfo(copyOutState->fe_msgbuf);
 		AppendCopyBinaryFooters(copyOutState);
-		BroadcastCopyData(copyOutState->fe_msgbuf, connectionList);
+		WriteResultData(resultDest, copyOutState->fe_msgbuf);
+	}
 
-		if (resultDest->writeLocalFile)
-		{
-			WriteToLocalFile(copyOutState->fe_msgbuf, &resultDest->fileCompat);
-		}
+	if (resultDest->compressionMethod != RESULT_COMPRESSION_NONE)
+	{
+		FlushCompressedResultData(resultDest);
 	}
 
+	EndResultCopy(resultDest);
+}
+
+
+/*
+ * EndResultCopy ends the COPY on all the open connections and stores or
+ * closes the local result (if applicable).
+ */
+static void
+EndResultCopy(RemoteFileDestReceiver *resultDest)
+{
 	/* close the COPY input */
-	EndRemoteCopy(0, connectionList);
+	EndRemoteCopy(0, resultDest->connectionList);
 
-	if (resultDest->writeLocalFile)
+	if (resultDest->localData != NULL)
+	{
+		const char *fileName = QueryResultFileName(resultDest->resultId);
+
+		/* fall back to the file if there is no room in shared memory */
+		if (!StoreSharedIntermediateResult(fileName, resultDest->localData))
+		{
+			OpenLocalResultFile(resultDest);
+			WriteToLocalFile(resultDest->localData, &resultDest->fileCompat);
+		}
+	}
+
+	if (resultDest->localFileOpened)
 	{
 		FileClose(resultDest->fileCompat.fd);
 	}
@@ -518,13 +760,21 @@ RemoteFileDestReceiverDestroy(DestReceiver *destReceiver)
 /*
  * SendQueryResultViaCopy is called when a COPY "resultid" TO STDOUT
  * WITH (format result) command is received from the client. The
- * contents of the file are sent directly to the client.
+ * contents of the file, or of its copy in shared memory, are sent
+ * directly to the client.
  */
 void
 SendQueryResultViaCopy(const char *resultId)
 {
 	const char *resultFileName = QueryResultFileName(resultId);
 
+	StringInfo sharedData = ReadSharedIntermediateResult(resultFileName);
+	if (sharedData != NULL)
+	{
+		SendBufferViaCopy(sharedData);
+		return;
+	}
+
 	SendRegularFile(resultFileName);
 }
 
@@ -660,11 +910,14 @@ IntermediateResultsDirectory(void)
 
 /*
  * RemoveIntermediateResultsDirectory removes the intermediate result directory
- * for the current distributed transaction, if any was created.
+ * for the current distributed transaction, if any was created, as well as the
+ * results that this backend kept in shared memory.
  */
 void
 RemoveIntermediateResultsDirectory(void)
 {
+	RemoveSharedIntermediateResults();
+
 	if (CreatedResultsDirectory)
 	{
 		CitusRemoveDirectory(IntermediateResultsDirectory());
@@ -676,7 +929,8 @@ RemoveIntermediateResultsDirectory(void)
 
 /*
  * IntermediateResultSize returns the file size of the intermediate result
- * or -1 if the file does not exist.
+ * or -1 if the file does not exist. Results kept in shared memory are
+ * treated as files of the same size.
  */
 int64
 IntermediateResultSize(char *resultId)
@@ -684,6 +938,13 @@ IntermediateResultSize(char *resultId)
 	struct stat fileStat;
 
 	char *resultFileName = QueryResultFileName(resultId);
+
+	int64 sharedResultSize = SharedIntermediateResultSize(resultFileName);
+	if (sharedResultSize >= 0)
+	{
+		return sharedResultSize;
+	}
+
 	int statOK = stat(resultFileName, &fileStat);
 	if (statOK < 0)
 	{
@@ -770,10 +1031,8 @@ ReadIntermediateResultsIntoFuncOutput(FunctionCallInfo fcinfo, char *copyFormat,
 	{
 		char *resultId = TextDatumGetCString(resultIdArray[resultIndex]);
 		char *resultFileName = QueryResultFileName(resultId);
-		struct stat fileStat;
 
-		int statOK = stat(resultFileName, &fileStat);
-		if (statOK != 0)
+		if (IntermediateResultSize(resultId) < 0)
 		{
 			ereport(ERROR, (errcode_for_file_access(),
 							errmsg("result \"%s\" does not exist", resultId)));
@@ -75,6 +75,7 @@
 #include "distributed/citus_custom_scan.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/deparse_shard_query.h"
+#include "distributed/listutils.h"
 #include "distributed/local_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/master_protocol.h"
@@ -90,12 +91,14 @@
 #include "optimizer/planner.h"
 #endif
 #include "nodes/params.h"
+#include "utils/guc.h"
 #include "utils/snapmgr.h"
 
 
 /* controlled via a GUC */
 bool EnableLocalExecution = true;
 bool LogLocalCommands = false;
+int MaxLocalExecutionParallelWorkers = 0;
 
 bool TransactionAccessedLocalPlacement = false;
 bool TransactionConnectedToLocalGroup = false;
@@ -106,7 +109,10 @@ static void SplitLocalAndRemotePlacements(List *taskPlacementList,
 										  List **remoteTaskPlacementList);
 static uint64 ExecuteLocalTaskPlan(CitusScanState *scanState, PlannedStmt *taskPlan,
 								   char *queryString);
-static void LogLocalCommand(Task *task);
+static uint64 ExecuteLocalTaskListInParallel(CitusScanState *scanState, List *taskList,
+											 ParamListInfo paramListInfo,
+											 Oid *parameterTypes, int numParams);
+static void LogLocalCommand(const char *command);
 static void ExtractParametersForLocalExecution(ParamListInfo paramListInfo,
 											   Oid **parameterTypes,
 											   const char ***parameterValues);
@@ -141,6 +147,12 @@ ExecuteLocalTaskList(CitusScanState *scanState, List *taskList)
 		numParams = paramListInfo->numParams;
 	}
 
+	if (ShouldExecuteLocalTasksInParallel(distributedPlan, taskList))
+	{
+		return ExecuteLocalTaskListInParallel(scanState, taskList, paramListInfo,
+											  parameterTypes, numParams);
+	}
+
 	foreach(taskCell, taskList)
 	{
 		Task *task = (Task *) lfirst(taskCell);
@@ -200,7 +212,7 @@ ExecuteLocalTaskList(CitusScanState *scanState, List *taskList)
 			localPlan = planner(shardQuery, cursorOptions, paramListInfo);
 		}
 
-		LogLocalCommand(task);
+		LogLocalCommand(TaskQueryString(task));
 
 		char *shardQueryString = task->queryStringLazy
 								 ? task->queryStringLazy
@@ -214,6 +226,104 @@ ExecuteLocalTaskList(CitusScanState *scanState, List *taskList)
 }
 
 
+/*
+ * ShouldExecuteLocalTasksInParallel returns true if the given local tasks can
+ * be combined into a single query that is executed using parallel workers.
+ */
+bool
+ShouldExecuteLocalTasksInParallel(DistributedPlan *distributedPlan, List *taskList)
+{
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (MaxLocalExecutionParallelWorkers == 0)
+	{
+		return false;
+	}
+
+	if (list_length(taskList) < 2)
+	{
+		return false;
+	}
+
+	/* parallel workers cannot modify data */
+	if (distributedPlan->modLevel != ROW_MODIFY_READONLY)
+	{
+		return false;
+	}
+
+	/* UNION ALL does not allow FOR UPDATE */
+	if (workerJob->jobQuery->hasForUpdate)
+	{
+		return false;
+	}
+
+	/* we'd rather use the cached plans of the tasks */
+	if (workerJob->localPlannedStatements != NIL)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * ExecuteLocalTaskListInParallel executes the given read-only local tasks as a
+ * single UNION ALL query. Since none of the tasks can be parallelized by itself
+ * in general (e.g., they compute partial aggregates), the planner can choose a
+ * Parallel Append over the tasks, in which case the parallel workers execute
+ * different tasks concurrently. We limit the number of parallel workers via
+ * max_parallel_workers_per_gather while planning the query.
+ *
+ * The parallel workers share the transaction of the current backend, so they
+ * see the same data as the tasks would when executed one at a time.
+ */
+static uint64
+ExecuteLocalTaskListInParallel(CitusScanState *scanState, List *taskList,
+							   ParamListInfo paramListInfo, Oid *parameterTypes,
+							   int numParams)
+{
+	StringInfo unionQueryString = makeStringInfo();
+
+	Task *task = NULL;
+	foreach_ptr(task, taskList)
+	{
+		if (!TransactionAccessedLocalPlacement &&
+			task->anchorShardId != INVALID_SHARD_ID)
+		{
+			TransactionAccessedLocalPlacement = true;
+		}
+
+		if (unionQueryString->len > 0)
+		{
+			appendStringInfoString(unionQueryString, " UNION ALL ");
+		}
+
+		appendStringInfo(unionQueryString, "(%s)", TaskQueryString(task));
+	}
+
+	/* log the query that actually runs, which shows that the tasks were combined */
+	LogLocalCommand(unionQueryString->data);
+
+	Query *unionQuery = ParseQueryString(unionQueryString->data, parameterTypes,
+										 numParams);
+
+	int gucNestLevel = NewGUCNestLevel();
+	char *parallelWorkerCountString = psprintf("%d", MaxLocalExecutionParallelWorkers);
+
+	(void) set_config_option("max_parallel_workers_per_gather",
+							 parallelWorkerCountString,
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_LOCAL, true, 0, false);
+
+	PlannedStmt *localPlan = planner(unionQuery, CURSOR_OPT_PARALLEL_OK, paramListInfo);
+
+	AtEOXact_GUC(true, gucNestLevel);
+
+	return ExecuteLocalTaskPlan(scanState, localPlan, unionQueryString->data);
+}
+
+
 /*
  * ExtractParametersForLocalExecution extracts parameter types and values from
  * the given ParamListInfo structure, and fills parameter type and value arrays.
@@ -522,7 +632,7 @@ ErrorIfTransactionAccessedPlacementsLocally(void)
  * meaning it is part of distributed execution.
  */
 static void
-LogLocalCommand(Task *task)
+LogLocalCommand(const char *command)
 {
 	if (!(LogRemoteCommands || LogLocalCommands))
 	{
@@ -530,7 +640,7 @@ LogLocalCommand(Task *task)
 	}
 
 	ereport(NOTICE, (errmsg("executing the command locally: %s",
-							ApplyLogRedaction(TaskQueryString(task)))));
+							ApplyLogRedaction(command))));
 }
 
 
@@ -21,6 +21,7 @@
 #include "distributed/commands/utility_hook.h"
 #include "distributed/insert_select_executor.h"
 #include "distributed/insert_select_planner.h"
+#include "distributed/intermediate_result_compression.h"
 #include "distributed/master_protocol.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_master_planner.h"
@@ -267,7 +268,7 @@ LoadTuplesIntoTupleStore(CitusScanState *citusScanState, Job *workerJob)
 /*
  * ReadFileIntoTupleStore parses the records in a COPY-formatted file according
  * according to the given tuple descriptor and stores the records in a tuple
- * store.
+ * store. Compressed intermediate result files are decompressed on the fly.
  */
 void
 ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescriptor,
@@ -294,8 +295,7 @@ ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescript
 									  location);
 	copyOptions = lappend(copyOptions, copyOption);
 
-	CopyState copyState = BeginCopyFrom(NULL, stubRelation, fileName, false, NULL,
-										NULL, copyOptions);
+	CopyState copyState = BeginCopyFromResultFile(stubRelation, fileName, copyOptions);
 
 	while (true)
 	{
@@ -314,7 +314,7 @@ ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescript
 		MemoryContextSwitchTo(oldContext);
 	}
 
-	EndCopyFrom(copyState);
+	EndCopyFromResultFile(copyState);
 	pfree(columnValues);
 	pfree(columnNulls);
 }
@@ -330,9 +330,6 @@ ReadFileIntoTupleStore(char *fileName, char *copyFormat, TupleDesc tupleDescript
 void
 SortTupleStore(CitusScanState *scanState)
 {
-	TupleDesc tupleDescriptor = ScanStateGetTupleDescriptor(scanState);
-	Tuplestorestate *tupleStore = scanState->tuplestorestate;
-
 	List *targetList = scanState->customScanState.ss.ps.plan->targetlist;
 	uint32 expectedColumnCount = list_length(targetList);
 
@@ -370,6 +367,23 @@ SortTupleStore(CitusScanState *scanState)
 		sortKeyIndex++;
 	}
 
+	SortTupleStoreByKeys(scanState, numberOfSortKeys, sortColIdx, sortOperators,
+						 collations, nullsFirst);
+}
+
+
+/*
+ * SortTupleStoreByKeys sorts the tuplestore of the given CitusScanState using
+ * the given sort keys, which are specified in the same way as for a Sort plan.
+ */
+void
+SortTupleStoreByKeys(CitusScanState *scanState, int numberOfSortKeys,
+					 AttrNumber *sortColIdx, Oid *sortOperators, Oid *collations,
+					 bool *nullsFirst)
+{
+	TupleDesc tupleDescriptor = ScanStateGetTupleDescriptor(scanState);
+	Tuplestorestate *tupleStore = scanState->tuplestorestate;
+
 	Tuplesortstate *tuplesortstate =
 		tuplesort_begin_heap(tupleDescriptor, numberOfSortKeys, sortColIdx, sortOperators,
 							 collations, nullsFirst, work_mem, NULL, false);
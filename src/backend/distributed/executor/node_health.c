@@ -0,0 +1,335 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_health.c
+ *    Connection failures per worker, shared across backends.
+ *
+ * When the adaptive executor fails to reach a worker, every subsequent
+ * execution would otherwise wait for citus.node_connection_timeout before
+ * failing over to another placement. We therefore remember failed workers in
+ * shared memory, such that executions of read-only tasks try the placements
+ * on other workers first. The time a worker is avoided doubles with each
+ * consecutive failure, up to citus.max_node_failure_backoff. Once it passes,
+ * a single execution is allowed to probe the worker again, and the first
+ * connection that is established to the worker clears its failures.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "distributed/node_health.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/timestamp.h"
+
+
+/* maximum number of workers for which we track failures */
+#define MAX_NODE_HEALTH_ENTRIES 1024
+
+/* upper bound on the exponent of the backoff, to avoid overflows */
+#define MAX_NODE_FAILURE_BACKOFF_SHIFT 20
+
+
+/*
+ * NodeHealthHashKey identifies a worker in NodeHealthHash.
+ */
+typedef struct NodeHealthHashKey
+{
+	char nodeName[WORKER_LENGTH];
+	int32 nodePort;
+} NodeHealthHashKey;
+
+
+/*
+ * NodeHealthHashEntry holds the consecutive failures of a worker and the time
+ * until which executions avoid it.
+ */
+typedef struct NodeHealthHashEntry
+{
+	NodeHealthHashKey key;
+	int failureCount;
+	TimestampTz retryTime;
+} NodeHealthHashEntry;
+
+
+/*
+ * NodeHealthControlData holds the lock that protects NodeHealthHash.
+ */
+typedef struct NodeHealthControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+} NodeHealthControlData;
+
+
+/* GUCs, determining how long executions avoid workers after failures */
+int NodeFailureBackoff = 0;
+int MaxNodeFailureBackoff = 60 * 1000;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static NodeHealthControlData *NodeHealthControl = NULL;
+static HTAB *NodeHealthHash = NULL;
+
+
+static size_t NodeHealthShmemSize(void);
+static void NodeHealthShmemInit(void);
+static void BuildNodeHealthHashKey(NodeHealthHashKey *key, char *nodeName,
+								   int nodePort);
+static int NodeFailureBackoffMs(int failureCount);
+
+
+/*
+ * InitializeNodeHealth, called at server start, requests the shared memory
+ * for the node health state.
+ */
+void
+InitializeNodeHealth(void)
+{
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(NodeHealthShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = NodeHealthShmemInit;
+}
+
+
+/*
+ * NodeHealthShmemSize computes the size of the shared memory for the node
+ * health state.
+ */
+static size_t
+NodeHealthShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(NodeHealthControlData));
+	size = add_size(size, hash_estimate_size(MAX_NODE_HEALTH_ENTRIES,
+											 sizeof(NodeHealthHashEntry)));
+
+	return size;
+}
+
+
+/*
+ * NodeHealthShmemInit initializes the shared memory for the node health
+ * state.
+ */
+static void
+NodeHealthShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	NodeHealthControl =
+		(NodeHealthControlData *) ShmemInitStruct("Citus Node Health",
+												  sizeof(NodeHealthControlData),
+												  &alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		NodeHealthControl->trancheId = LWLockNewTrancheId();
+		NodeHealthControl->lockTrancheName = "Citus Node Health";
+		LWLockRegisterTranche(NodeHealthControl->trancheId,
+							  NodeHealthControl->lockTrancheName);
+
+		LWLockInitialize(&NodeHealthControl->lock, NodeHealthControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(NodeHealthHashKey);
+	hashInfo.entrysize = sizeof(NodeHealthHashEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	NodeHealthHash = ShmemInitHash("Citus Node Health Hash",
+								   MAX_NODE_HEALTH_ENTRIES,
+								   MAX_NODE_HEALTH_ENTRIES,
+								   &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * ShouldAvoidNode returns whether executions should prefer placements on
+ * other workers over the given worker, because it failed recently.
+ *
+ * When the backoff of a failed worker has passed, the first caller gets false
+ * and thereby probes the worker, while the backoff is extended for the other
+ * callers until the probe finishes.
+ */
+bool
+ShouldAvoidNode(char *nodeName, int nodePort)
+{
+	NodeHealthHashKey key;
+	bool found = false;
+	bool shouldAvoidNode = false;
+
+	if (NodeHealthHash == NULL || NodeFailureBackoff <= 0)
+	{
+		return false;
+	}
+
+	BuildNodeHealthHashKey(&key, nodeName, nodePort);
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_SHARED);
+
+	NodeHealthHashEntry *entry =
+		(NodeHealthHashEntry *) hash_search(NodeHealthHash, &key, HASH_FIND, &found);
+	if (!found)
+	{
+		LWLockRelease(&NodeHealthControl->lock);
+		return false;
+	}
+
+	TimestampTz now = GetCurrentTimestamp();
+	if (now < entry->retryTime)
+	{
+		LWLockRelease(&NodeHealthControl->lock);
+		return true;
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+
+	/* backoff passed, claim the probe unless another backend beat us to it */
+	LWLockAcquire(&NodeHealthControl->lock, LW_EXCLUSIVE);
+
+	entry = (NodeHealthHashEntry *) hash_search(NodeHealthHash, &key, HASH_FIND,
+												&found);
+	if (found)
+	{
+		if (now < entry->retryTime)
+		{
+			shouldAvoidNode = true;
+		}
+		else
+		{
+			entry->retryTime =
+				TimestampTzPlusMilliseconds(now,
+											NodeFailureBackoffMs(entry->failureCount));
+		}
+	}
+
+	LWLockRelease(&NodeHealthControl->lock);
+
+	return shouldAvoidNode;
+}
+
+
+/*
+ * RecordNodeFailure records that the given worker could not be reached and
+ * extends the time during which executions avoid it.
+ */
+void
+RecordNodeFailure(char *nodeName, int nodePort)
+{
+	NodeHealthHashKey key;
+	bool found = false;
+
+	if (NodeHealthHash == NULL || NodeFailureBackoff <= 0)
+	{
+		return;
+	}
+
+	BuildNodeHealthHashKey(&key, nodeName, nodePort);
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_EXCLUSIVE);
+
+	NodeHealthHashEntry *entry =
+		(NodeHealthHashEntry *) hash_search(NodeHealthHash, &key, HASH_ENTER_NULL,
+											&found);
+	if (entry == NULL)
+	{
+		/* no space left for new workers, the worker is not avoided */
+		LWLockRelease(&NodeHealthControl->lock);
+		return;
+	}
+
+	if (!found)
+	{
+		entry->failureCount = 0;
+	}
+
+	entry->failureCount++;
+	entry->retryTime =
+		TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+									NodeFailureBackoffMs(entry->failureCount));
+
+	LWLockRelease(&NodeHealthControl->lock);
+}
+
+
+/*
+ * RecordNodeSuccess records that a connection to the given worker was
+ * established, which clears its failures.
+ */
+void
+RecordNodeSuccess(char *nodeName, int nodePort)
+{
+	NodeHealthHashKey key;
+	bool found = false;
+
+	if (NodeHealthHash == NULL || NodeFailureBackoff <= 0)
+	{
+		return;
+	}
+
+	BuildNodeHealthHashKey(&key, nodeName, nodePort);
+
+	/* most workers are healthy, so avoid the exclusive lock when possible */
+	LWLockAcquire(&NodeHealthControl->lock, LW_SHARED);
+	hash_search(NodeHealthHash, &key, HASH_FIND, &found);
+	LWLockRelease(&NodeHealthControl->lock);
+
+	if (!found)
+	{
+		return;
+	}
+
+	LWLockAcquire(&NodeHealthControl->lock, LW_EXCLUSIVE);
+	hash_search(NodeHealthHash, &key, HASH_REMOVE, NULL);
+	LWLockRelease(&NodeHealthControl->lock);
+}
+
+
+/*
+ * BuildNodeHealthHashKey fills the hash key for the given worker.
+ */
+static void
+BuildNodeHealthHashKey(NodeHealthHashKey *key, char *nodeName, int nodePort)
+{
+	/* the key is hashed as a whole, so also clear the bytes after the name */
+	memset(key, 0, sizeof(NodeHealthHashKey));
+	strlcpy(key->nodeName, nodeName, WORKER_LENGTH);
+	key->nodePort = nodePort;
+}
+
+
+/*
+ * NodeFailureBackoffMs returns the time in milliseconds during which a worker
+ * with the given number of consecutive failures is avoided.
+ */
+static int
+NodeFailureBackoffMs(int failureCount)
+{
+	int shift = Min(Max(failureCount - 1, 0), MAX_NODE_FAILURE_BACKOFF_SHIFT);
+	int64 backoffMs = ((int64) NodeFailureBackoff) << shift;
+
+	return (int) Min(backoffMs, Max(MaxNodeFailureBackoff, NodeFailureBackoff));
+}
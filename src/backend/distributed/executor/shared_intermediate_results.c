@@ -0,0 +1,511 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_intermediate_results.c
+ *    Small intermediate results that are kept in shared memory instead of
+ *    in files.
+ *
+ * Intermediate results are normally written to a file in the result directory
+ * of the distributed transaction, which every backend participating in the
+ * transaction can read. Results that are smaller than
+ * citus.max_shared_memory_intermediate_result_size are instead copied into a
+ * dynamic shared memory segment, which is registered in a shared hash under
+ * the name of the file the result would otherwise be written to. Readers look
+ * up the file name in the hash before falling back to the file, so both local
+ * reads and local execution bypass the file system for small results. The
+ * total size of the results in shared memory is capped by
+ * citus.max_shared_memory_intermediate_results_total_size.
+ *
+ * The segments are pinned, such that they outlive the writing query, and are
+ * released by the backend that stored them at the end of the transaction,
+ * along with the result directory. Readers attach to a segment without
+ * holding the lock, so a segment starts with the key of the result it holds,
+ * which readers check in case the segment was released in the meantime.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "distributed/shared_intermediate_results.h"
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* maximum number of intermediate results kept in shared memory at a time */
+#define MAX_SHARED_INTERMEDIATE_RESULTS 1024
+
+/* results whose file name is longer than this are always written to a file */
+#define SHARED_RESULT_KEY_LENGTH 128
+
+
+/*
+ * SharedResultHashKey identifies an intermediate result by its file name, which
+ * includes the user and the distributed transaction.
+ */
+typedef struct SharedResultHashKey
+{
+	char fileName[SHARED_RESULT_KEY_LENGTH];
+} SharedResultHashKey;
+
+
+/*
+ * SharedResultHashEntry points to the segment that holds an intermediate
+ * result.
+ */
+typedef struct SharedResultHashEntry
+{
+	SharedResultHashKey key;
+	dsm_handle segmentHandle;
+	Size resultSize;
+} SharedResultHashEntry;
+
+
+/*
+ * SharedResultSegmentHeader is at the start of every segment, followed by the
+ * contents of the result.
+ */
+typedef struct SharedResultSegmentHeader
+{
+	SharedResultHashKey key;
+	Size resultSize;
+} SharedResultSegmentHeader;
+
+#define SHARED_RESULT_HEADER_SIZE MAXALIGN(sizeof(SharedResultSegmentHeader))
+
+
+/*
+ * SharedResultControlData holds the lock that protects SharedResultHash and
+ * the total size of the results in it.
+ */
+typedef struct SharedResultControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+	Size totalResultSize;
+} SharedResultControlData;
+
+
+/*
+ * StoredSharedResult is a result this backend stored in shared memory, which
+ * it should release at the end of the transaction.
+ */
+typedef struct StoredSharedResult
+{
+	SharedResultHashKey key;
+	dsm_handle segmentHandle;
+} StoredSharedResult;
+
+
+/* GUC, maximum size in KB of an intermediate result kept in shared memory */
+int MaxSharedMemoryIntermediateResultSize = 0;
+
+/* GUC, maximum total size in KB of intermediate results kept in shared memory */
+int MaxSharedMemoryIntermediateResultsTotalSize = 65536;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static SharedResultControlData *SharedResultControl = NULL;
+static HTAB *SharedResultHash = NULL;
+
+/* results stored by this backend in the current transaction */
+static List *StoredSharedResultList = NIL;
+
+
+static size_t SharedIntermediateResultsShmemSize(void);
+static void SharedIntermediateResultsShmemInit(void);
+static bool BuildSharedResultHashKey(SharedResultHashKey *key, const char *fileName);
+static void ReleaseSharedResult(SharedResultHashKey *key, dsm_handle segmentHandle);
+
+
+/*
+ * InitializeSharedIntermediateResults, called at server start, requests the
+ * shared memory for the hash of intermediate results.
+ */
+void
+InitializeSharedIntermediateResults(void)
+{
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(SharedIntermediateResultsShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = SharedIntermediateResultsShmemInit;
+}
+
+
+/*
+ * SharedIntermediateResultsShmemSize computes the size of the shared memory
+ * for the hash of intermediate results.
+ */
+static size_t
+SharedIntermediateResultsShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(SharedResultControlData));
+	size = add_size(size, hash_estimate_size(MAX_SHARED_INTERMEDIATE_RESULTS,
+											 sizeof(SharedResultHashEntry)));
+
+	return size;
+}
+
+
+/*
+ * SharedIntermediateResultsShmemInit initializes the shared memory for the
+ * hash of intermediate results.
+ */
+static void
+SharedIntermediateResultsShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	SharedResultControl =
+		(SharedResultControlData *) ShmemInitStruct("Citus Shared Intermediate Results",
+													sizeof(SharedResultControlData),
+													&alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		SharedResultControl->trancheId = LWLockNewTrancheId();
+		SharedResultControl->lockTrancheName = "Citus Shared Intermediate Results";
+		LWLockRegisterTranche(SharedResultControl->trancheId,
+							  SharedResultControl->lockTrancheName);
+
+		LWLockInitialize(&SharedResultControl->lock,
+						 SharedResultControl->trancheId);
+
+		SharedResultControl->totalResultSize = 0;
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(SharedResultHashKey);
+	hashInfo.entrysize = sizeof(SharedResultHashEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	SharedResultHash = ShmemInitHash("Citus Shared Intermediate Results Hash",
+									 MAX_SHARED_INTERMEDIATE_RESULTS,
+									 MAX_SHARED_INTERMEDIATE_RESULTS,
+									 &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * StoreSharedIntermediateResult copies the given contents of the result file
+ * with the given name into shared memory. It returns false if the result is
+ * too large or there is no space left, in which case the caller should write
+ * the file instead.
+ */
+bool
+StoreSharedIntermediateResult(const char *fileName, StringInfo data)
+{
+	SharedResultHashKey key;
+	bool found = false;
+	Size maxTotalResultSize = MaxSharedMemoryIntermediateResultsTotalSize * 1024L;
+
+	if (SharedResultHash == NULL ||
+		data->len > MaxSharedMemoryIntermediateResultSize * 1024L ||
+		data->len > maxTotalResultSize ||
+		!BuildSharedResultHashKey(&key, fileName))
+	{
+		return false;
+	}
+
+	dsm_segment *segment = dsm_create(SHARED_RESULT_HEADER_SIZE + data->len,
+									  DSM_CREATE_NULL_IF_MAXSEGMENTS);
+	if (segment == NULL)
+	{
+		return false;
+	}
+
+	SharedResultSegmentHeader *header = dsm_segment_address(segment);
+	header->key = key;
+	header->resultSize = data->len;
+
+	memcpy((char *) header + SHARED_RESULT_HEADER_SIZE, data->data, data->len);
+
+	/* keep the segment around after we detach, until we unpin it */
+	dsm_handle segmentHandle = dsm_segment_handle(segment);
+	dsm_pin_segment(segment);
+	dsm_detach(segment);
+
+	LWLockAcquire(&SharedResultControl->lock, LW_EXCLUSIVE);
+
+	SharedResultHashEntry *entry =
+		(SharedResultHashEntry *) hash_search(SharedResultHash, &key, HASH_FIND,
+											  &found);
+
+	/* a result that is written again replaces the old one */
+	Size replacedResultSize = found ? entry->resultSize : 0;
+	Size totalResultSize =
+		SharedResultControl->totalResultSize - replacedResultSize + data->len;
+
+	if (totalResultSize > maxTotalResultSize)
+	{
+		LWLockRelease(&SharedResultControl->lock);
+
+		/* shared memory budget exhausted, fall back to a file */
+		dsm_unpin_segment(segmentHandle);
+		return false;
+	}
+
+	if (!found)
+	{
+		entry = (SharedResultHashEntry *) hash_search(SharedResultHash, &key,
+													  HASH_ENTER_NULL, &found);
+		if (entry == NULL)
+		{
+			LWLockRelease(&SharedResultControl->lock);
+
+			/* no space left, fall back to a file */
+			dsm_unpin_segment(segmentHandle);
+			return false;
+		}
+	}
+	else
+	{
+		/* the result was written before, release the old segment */
+		dsm_unpin_segment(entry->segmentHandle);
+	}
+
+	entry->segmentHandle = segmentHandle;
+	entry->resultSize = data->len;
+	SharedResultControl->totalResultSize = totalResultSize;
+
+	LWLockRelease(&SharedResultControl->lock);
+
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	StoredSharedResult *storedResult = palloc0(sizeof(StoredSharedResult));
+	storedResult->key = key;
+	storedResult->segmentHandle = segmentHandle;
+
+	StoredSharedResultList = lappend(StoredSharedResultList, storedResult);
+
+	MemoryContextSwitchTo(oldContext);
+
+	return true;
+}
+
+
+/*
+ * ReadSharedIntermediateResult returns a copy of the contents of the result
+ * file with the given name if it is kept in shared memory, or NULL otherwise.
+ */
+StringInfo
+ReadSharedIntermediateResult(const char *fileName)
+{
+	SharedResultHashKey key;
+	bool found = false;
+	dsm_handle segmentHandle = 0;
+	StringInfo data = NULL;
+
+	if (SharedResultHash == NULL || !BuildSharedResultHashKey(&key, fileName))
+	{
+		return NULL;
+	}
+
+	LWLockAcquire(&SharedResultControl->lock, LW_SHARED);
+
+	SharedResultHashEntry *entry =
+		(SharedResultHashEntry *) hash_search(SharedResultHash, &key, HASH_FIND,
+											  &found);
+	if (found)
+	{
+		segmentHandle = entry->segmentHandle;
+	}
+
+	LWLockRelease(&SharedResultControl->lock);
+
+	if (!found)
+	{
+		return NULL;
+	}
+
+	/*
+	 * Attaching maps the segment, which we do not want to do under the lock.
+	 * Once attached, the segment cannot be freed, but it may have been
+	 * released before, in which case attaching fails or, if the handle was
+	 * reused, the header holds another key.
+	 */
+	dsm_segment *segment = dsm_attach(segmentHandle);
+	if (segment == NULL)
+	{
+		return NULL;
+	}
+
+	SharedResultSegmentHeader *header = dsm_segment_address(segment);
+	if (dsm_segment_map_length(segment) >= SHARED_RESULT_HEADER_SIZE &&
+		memcmp(&header->key, &key, sizeof(SharedResultHashKey)) == 0 &&
+		dsm_segment_map_length(segment) >= SHARED_RESULT_HEADER_SIZE +
+		header->resultSize)
+	{
+		data = makeStringInfo();
+		appendBinaryStringInfo(data, (char *) header + SHARED_RESULT_HEADER_SIZE,
+							   header->resultSize);
+	}
+
+	dsm_detach(segment);
+
+	return data;
+}
+
+
+/*
+ * SharedIntermediateResultSize returns the size of the result file with the
+ * given name if it is kept in shared memory, or -1 otherwise.
+ */
+int64
+SharedIntermediateResultSize(const char *fileName)
+{
+	SharedResultHashKey key;
+	bool found = false;
+	int64 resultSize = -1;
+
+	if (SharedResultHash == NULL || !BuildSharedResultHashKey(&key, fileName))
+	{
+		return -1;
+	}
+
+	LWLockAcquire(&SharedResultControl->lock, LW_SHARED);
+
+	SharedResultHashEntry *entry =
+		(SharedResultHashEntry *) hash_search(SharedResultHash, &key, HASH_FIND,
+											  &found);
+	if (found)
+	{
+		resultSize = (int64) entry->resultSize;
+	}
+
+	LWLockRelease(&SharedResultControl->lock);
+
+	return resultSize;
+}
+
+
+/*
+ * RemoveSharedIntermediateResult releases the result with the given file name
+ * if this backend stored it in shared memory, which is needed when the result
+ * is written to a file instead. A result that was written several times in
+ * the transaction has several entries in StoredSharedResultList, which are
+ * all removed.
+ */
+void
+RemoveSharedIntermediateResult(const char *fileName)
+{
+	SharedResultHashKey key;
+	List *remainingResultList = NIL;
+
+	if (StoredSharedResultList == NIL || !BuildSharedResultHashKey(&key, fileName))
+	{
+		return;
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	ListCell *storedResultCell = NULL;
+	foreach(storedResultCell, StoredSharedResultList)
+	{
+		StoredSharedResult *storedResult = lfirst(storedResultCell);
+
+		if (memcmp(&storedResult->key, &key, sizeof(SharedResultHashKey)) == 0)
+		{
+			ReleaseSharedResult(&storedResult->key, storedResult->segmentHandle);
+			pfree(storedResult);
+		}
+		else
+		{
+			remainingResultList = lappend(remainingResultList, storedResult);
+		}
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	list_free(StoredSharedResultList);
+	StoredSharedResultList = remainingResultList;
+}
+
+
+/*
+ * RemoveSharedIntermediateResults releases all results that this backend
+ * stored in shared memory. It is called at the end of the transaction.
+ */
+void
+RemoveSharedIntermediateResults(void)
+{
+	ListCell *storedResultCell = NULL;
+	foreach(storedResultCell, StoredSharedResultList)
+	{
+		StoredSharedResult *storedResult = lfirst(storedResultCell);
+
+		ReleaseSharedResult(&storedResult->key, storedResult->segmentHandle);
+	}
+
+	list_free_deep(StoredSharedResultList);
+	StoredSharedResultList = NIL;
+}
+
+
+/*
+ * BuildSharedResultHashKey fills the hash key for the given file name, and
+ * returns false if the name does not fit in the key.
+ */
+static bool
+BuildSharedResultHashKey(SharedResultHashKey *key, const char *fileName)
+{
+	if (strlen(fileName) >= SHARED_RESULT_KEY_LENGTH)
+	{
+		return false;
+	}
+
+	/* the key is hashed as a whole, so also clear the bytes after the name */
+	memset(key, 0, sizeof(SharedResultHashKey));
+	strlcpy(key->fileName, fileName, SHARED_RESULT_KEY_LENGTH);
+
+	return true;
+}
+
+
+/*
+ * ReleaseSharedResult removes the hash entry for the given key if it still
+ * points to the given segment, and unpins the segment, which is freed once
+ * no backend is attached to it anymore.
+ */
+static void
+ReleaseSharedResult(SharedResultHashKey *key, dsm_handle segmentHandle)
+{
+	bool found = false;
+
+	LWLockAcquire(&SharedResultControl->lock, LW_EXCLUSIVE);
+
+	SharedResultHashEntry *entry =
+		(SharedResultHashEntry *) hash_search(SharedResultHash, key, HASH_FIND,
+											  &found);
+	if (found && entry->segmentHandle == segmentHandle)
+	{
+		SharedResultControl->totalResultSize -= entry->resultSize;
+
+		hash_search(SharedResultHash, key, HASH_REMOVE, NULL);
+		dsm_unpin_segment(segmentHandle);
+	}
+
+	LWLockRelease(&SharedResultControl->lock);
+}
@@ -0,0 +1,294 @@
+/*
+ * sorted_merge.c
+ *
+ * When the worker queries of a multi-shard SELECT already sort their results
+ * in the order of the ORDER BY of the query, which happens when the ORDER BY
+ * is pushed down along with a LIMIT, the coordinator does not need to sort all
+ * rows again. Instead, the adaptive executor receives the rows of each task
+ * into a separate tuple store and the scan merges them, similar to how
+ * PostgreSQL's MergeAppend merges its sorted subplans.
+ *
+ * Together with result streaming, the merge only needs to hold a few rows per
+ * task in memory and can return the first rows before all tasks finished.
+ *
+ * Copyright (c) Citus Data, Inc.
+ */
+
+#include "postgres.h"
+#include "miscadmin.h"
+
+#include "distributed/adaptive_executor.h"
+#include "distributed/citus_custom_scan.h"
+#include "distributed/listutils.h"
+#include "distributed/multi_executor.h"
+#include "distributed/sorted_merge.h"
+#include "distributed/version_compat.h"
+#include "executor/tuptable.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/primnodes.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#else
+#include "optimizer/tlist.h"
+#endif
+
+
+/* minimum amount of memory (in kB) for the tuple store of a single task */
+#define MIN_TASK_TUPLE_STORE_KB 64
+
+
+static Var * MergeSortColumn(List *targetList, SortGroupClause *sortClause);
+static bool ReadNextTaskTuple(CitusScanState *scanState, int taskIndex);
+static int CompareTaskSlots(Datum left, Datum right, void *arg);
+
+
+/*
+ * BeginSortedMerge creates the tuple stores for the results of taskCount tasks
+ * and prepares the sort keys of the merge based on the merge sort clauses of
+ * the distributed plan.
+ */
+SortedMergeState *
+BeginSortedMerge(CitusScanState *scanState, int taskCount)
+{
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	List *sortClauseList = distributedPlan->mergeSortClauseList;
+	List *targetList = scanState->customScanState.ss.ps.plan->targetlist;
+	TupleDesc tupleDescriptor = ScanStateGetTupleDescriptor(scanState);
+	bool randomAccess = false;
+	bool interTransactions = false;
+	int taskTupleStoreKBytes = Max(work_mem / Max(taskCount, 1),
+								   MIN_TASK_TUPLE_STORE_KB);
+
+	SortedMergeState *mergeState = palloc0(sizeof(SortedMergeState));
+	mergeState->taskCount = taskCount;
+	mergeState->taskTupleStores =
+		(Tuplestorestate **) palloc0(taskCount * sizeof(Tuplestorestate *));
+	mergeState->taskSlots =
+		(TupleTableSlot **) palloc0(taskCount * sizeof(TupleTableSlot *));
+
+	for (int taskIndex = 0; taskIndex < taskCount; taskIndex++)
+	{
+		mergeState->taskTupleStores[taskIndex] =
+			tuplestore_begin_heap(randomAccess, interTransactions,
+								  taskTupleStoreKBytes);
+		mergeState->taskSlots[taskIndex] =
+			MakeSingleTupleTableSlotCompat(tupleDescriptor, &TTSOpsMinimalTuple);
+	}
+
+	mergeState->sortKeyCount = list_length(sortClauseList);
+	mergeState->sortKeys =
+		(SortSupport) palloc0(mergeState->sortKeyCount * sizeof(SortSupportData));
+
+	int sortKeyIndex = 0;
+	SortGroupClause *sortClause = NULL;
+	foreach_ptr(sortClause, sortClauseList)
+	{
+		SortSupport sortKey = &(mergeState->sortKeys[sortKeyIndex]);
+		Var *column = MergeSortColumn(targetList, sortClause);
+
+		sortKey->ssup_cxt = CurrentMemoryContext;
+		sortKey->ssup_collation = column->varcollid;
+		sortKey->ssup_nulls_first = sortClause->nulls_first;
+		sortKey->ssup_attno = column->varattno;
+
+		/* abbreviated keys are only useful for sorting many values at once */
+		sortKey->abbreviate = false;
+
+		PrepareSortSupportFromOrderingOp(sortClause->sortop, sortKey);
+
+		sortKeyIndex++;
+	}
+
+	mergeState->heap = binaryheap_allocate(Max(taskCount, 1), CompareTaskSlots,
+										   mergeState);
+
+	return mergeState;
+}
+
+
+/*
+ * ReturnTupleFromSortedMerge returns the next row of the merge of the task
+ * results, or an empty slot once all rows are returned.
+ */
+TupleTableSlot *
+ReturnTupleFromSortedMerge(CitusScanState *scanState)
+{
+	SortedMergeState *mergeState = scanState->sortedMerge;
+	binaryheap *heap = mergeState->heap;
+
+	if (!mergeState->initialized)
+	{
+		/* read the first row of every task and build the heap */
+		for (int taskIndex = 0; taskIndex < mergeState->taskCount; taskIndex++)
+		{
+			if (ReadNextTaskTuple(scanState, taskIndex))
+			{
+				binaryheap_add_unordered(heap, Int32GetDatum(taskIndex));
+			}
+		}
+
+		binaryheap_build(heap);
+		mergeState->initialized = true;
+	}
+	else if (!binaryheap_empty(heap))
+	{
+		/* replace the row we returned last with the next row of the same task */
+		int taskIndex = DatumGetInt32(binaryheap_first(heap));
+
+		if (ReadNextTaskTuple(scanState, taskIndex))
+		{
+			binaryheap_replace_first(heap, Int32GetDatum(taskIndex));
+		}
+		else
+		{
+			(void) binaryheap_remove_first(heap);
+		}
+	}
+
+	if (binaryheap_empty(heap))
+	{
+		TupleTableSlot *resultSlot = scanState->customScanState.ss.ps.ps_ResultTupleSlot;
+
+		return ExecClearTuple(resultSlot);
+	}
+
+	int taskIndex = DatumGetInt32(binaryheap_first(heap));
+
+	return mergeState->taskSlots[taskIndex];
+}
+
+
+/*
+ * EndSortedMerge releases the tuple stores and slots of the merge.
+ */
+void
+EndSortedMerge(SortedMergeState *mergeState)
+{
+	for (int taskIndex = 0; taskIndex < mergeState->taskCount; taskIndex++)
+	{
+		tuplestore_end(mergeState->taskTupleStores[taskIndex]);
+		ExecDropSingleTupleTableSlot(mergeState->taskSlots[taskIndex]);
+	}
+
+	binaryheap_free(mergeState->heap);
+}
+
+
+/*
+ * SortTupleStoreByMergeKeys sorts the tuple store of the scan by the merge sort
+ * clauses of the distributed plan. It is used when the plan relies on the scan
+ * to return the rows in order, but the rows of the tasks could not be received
+ * separately, for instance because some of them were executed locally.
+ */
+void
+SortTupleStoreByMergeKeys(CitusScanState *scanState)
+{
+	List *sortClauseList = scanState->distributedPlan->mergeSortClauseList;
+	List *targetList = scanState->customScanState.ss.ps.plan->targetlist;
+
+	/* convert list-ish representation to arrays wanted by executor */
+	int numberOfSortKeys = list_length(sortClauseList);
+	AttrNumber *sortColIdx = (AttrNumber *) palloc(numberOfSortKeys * sizeof(AttrNumber));
+	Oid *sortOperators = (Oid *) palloc(numberOfSortKeys * sizeof(Oid));
+	Oid *collations = (Oid *) palloc(numberOfSortKeys * sizeof(Oid));
+	bool *nullsFirst = (bool *) palloc(numberOfSortKeys * sizeof(bool));
+
+	int sortKeyIndex = 0;
+	SortGroupClause *sortClause = NULL;
+	foreach_ptr(sortClause, sortClauseList)
+	{
+		Var *column = MergeSortColumn(targetList, sortClause);
+
+		sortColIdx[sortKeyIndex] = column->varattno;
+		sortOperators[sortKeyIndex] = sortClause->sortop;
+		collations[sortKeyIndex] = column->varcollid;
+		nullsFirst[sortKeyIndex] = sortClause->nulls_first;
+
+		sortKeyIndex++;
+	}
+
+	SortTupleStoreByKeys(scanState, numberOfSortKeys, sortColIdx, sortOperators,
+						 collations, nullsFirst);
+}
+
+
+/*
+ * MergeSortColumn returns the column of the scan's rows that the given sort
+ * clause refers to. The planner only merges when all sort clauses refer to
+ * plain columns of the rows returned by the workers.
+ */
+static Var *
+MergeSortColumn(List *targetList, SortGroupClause *sortClause)
+{
+	TargetEntry *targetEntry = get_sortgroupclause_tle(sortClause, targetList);
+
+	Assert(IsA(targetEntry->expr, Var));
+
+	return (Var *) targetEntry->expr;
+}
+
+
+/*
+ * ReadNextTaskTuple reads the next row of the task at taskIndex into its slot.
+ * When the results are streamed, more rows of the task are received once its
+ * tuple store is exhausted. The function returns false if the task has no more
+ * rows.
+ */
+static bool
+ReadNextTaskTuple(CitusScanState *scanState, int taskIndex)
+{
+	SortedMergeState *mergeState = scanState->sortedMerge;
+	Tuplestorestate *tupleStore = mergeState->taskTupleStores[taskIndex];
+	TupleTableSlot *taskSlot = mergeState->taskSlots[taskIndex];
+	bool forwardScanDirection = true;
+
+	/* the slot keeps the row after the tuple store is cleared for new rows */
+	bool copyTuple = true;
+
+	while (!tuplestore_gettupleslot(tupleStore, forwardScanDirection, copyTuple,
+									taskSlot))
+	{
+		if (scanState->streamingExecution == NULL ||
+			!ContinueStreamingExecutionForTask(scanState->streamingExecution,
+											   taskIndex))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * CompareTaskSlots compares the current rows of two tasks by the sort keys of
+ * the merge. The result is inverted, since binaryheap is a max-heap and we
+ * want to return the smallest row first.
+ */
+static int
+CompareTaskSlots(Datum left, Datum right, void *arg)
+{
+	SortedMergeState *mergeState = (SortedMergeState *) arg;
+	TupleTableSlot *leftSlot = mergeState->taskSlots[DatumGetInt32(left)];
+	TupleTableSlot *rightSlot = mergeState->taskSlots[DatumGetInt32(right)];
+
+	for (int sortKeyIndex = 0; sortKeyIndex < mergeState->sortKeyCount; sortKeyIndex++)
+	{
+		SortSupport sortKey = &(mergeState->sortKeys[sortKeyIndex]);
+		AttrNumber attributeNumber = sortKey->ssup_attno;
+		bool leftIsNull = false;
+		bool rightIsNull = false;
+
+		Datum leftValue = slot_getattr(leftSlot, attributeNumber, &leftIsNull);
+		Datum rightValue = slot_getattr(rightSlot, attributeNumber, &rightIsNull);
+
+		int compare = ApplySortComparator(leftValue, leftIsNull, rightValue,
+										  rightIsNull, sortKey);
+		if (compare != 0)
+		{
+			return (compare > 0) ? -1 : 1;
+		}
+	}
+
+	return 0;
+}
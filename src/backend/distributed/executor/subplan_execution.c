@@ -10,25 +10,47 @@
 
 #include "postgres.h"
 
+#include "distributed/adaptive_executor.h"
+#include "distributed/citus_custom_scan.h"
 #include "distributed/intermediate_result_pruning.h"
 #include "distributed/intermediate_results.h"
+#include "distributed/listutils.h"
+#include "distributed/local_executor.h"
 #include "distributed/multi_executor.h"
 #include "distributed/multi_physical_planner.h"
 #include "distributed/recursive_planning.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/transaction_management.h"
 #include "distributed/worker_manager.h"
 #include "executor/executor.h"
+#include "nodes/bitmapset.h"
 
 
 int MaxIntermediateResult = 1048576; /* maximum size in KB the intermediate result can grow to */
 /* when this is true, we enforce intermediate result size limit in all executors */
 int SubPlanLevel = 0;
 
+/* GUC, determining whether independent subplans run their tasks concurrently */
+bool EnableConcurrentSubPlanExecution = false;
+
+
+static Bitmapset * PrefetchIndependentSubPlans(uint64 planId, List *subPlanList,
+											   int firstSubPlanIndex,
+											   Bitmapset *prefetchedSubPlans);
+static DistributedPlan * SubPlanDistributedPlan(DistributedSubPlan *subPlan);
+static bool SubPlanMayModify(DistributedSubPlan *subPlan);
+static bool CanPrefetchSubPlan(DistributedSubPlan *subPlan);
+static bool SubPlanUsesResults(DistributedSubPlan *subPlan, List *resultIdList);
+static bool SubPlanResultIsCached(DistributedSubPlan *subPlan);
+
 
 /*
  * ExecuteSubPlans executes a list of subplans from a distributed plan
- * by sequentially executing each plan from the top.
+ * by sequentially executing each plan from the top. When concurrent subplan
+ * execution is enabled, the tasks of subplans that do not depend on each
+ * other run ahead of time in a single execution (see
+ * PrefetchIndependentSubPlans).
  */
 void
 ExecuteSubPlans(DistributedPlan *distributedPlan)
@@ -36,6 +58,8 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 	uint64 planId = distributedPlan->planId;
 	List *subPlanList = distributedPlan->subPlanList;
 	ListCell *subPlanCell = NULL;
+	Bitmapset *prefetchedSubPlans = NULL;
+	int subPlanIndex = -1;
 
 	if (subPlanList == NIL)
 	{
@@ -57,6 +81,7 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 	foreach(subPlanCell, subPlanList)
 	{
 		DistributedSubPlan *subPlan = (DistributedSubPlan *) lfirst(subPlanCell);
+		DistributedPlan *subPlanDistributedPlan = SubPlanDistributedPlan(subPlan);
 		PlannedStmt *plannedStmt = subPlan->plan;
 		uint32 subPlanId = subPlan->subPlanId;
 		ParamListInfo params = NULL;
@@ -67,15 +92,300 @@ ExecuteSubPlans(DistributedPlan *distributedPlan)
 		IntermediateResultsHashEntry *entry =
 			SearchIntermediateResult(intermediateResultsHash, resultId);
 
+		char *cacheKey = subPlan->cacheKey;
+		List *relationIdList = subPlan->relationIdList;
+		uint64 *relationVersions = NULL;
+		bool useResultCache = cacheKey != NULL && SubPlanResultCacheUsable();
+
+		subPlanIndex++;
+
+		if (useResultCache)
+		{
+			relationVersions = CurrentRelationVersions(relationIdList);
+
+			StringInfo cachedResultData =
+				LookupCachedSubPlanResult(cacheKey, relationIdList, relationVersions);
+			if (cachedResultData != NULL)
+			{
+				ereport(DEBUG1, (errmsg("reusing the cached result of subplan %s",
+										resultId)));
+
+				/* send the result of an earlier execution instead of recomputing it */
+				WriteIntermediateResultData(resultId, cachedResultData,
+											remoteWorkerNodeList,
+											entry->writeLocalFile);
+
+				if (subPlanDistributedPlan != NULL)
+				{
+					DiscardPrefetchedResult(subPlanDistributedPlan->planId);
+				}
+
+				continue;
+			}
+		}
+
 		SubPlanLevel++;
+
+		if (EnableConcurrentSubPlanExecution &&
+			!bms_is_member(subPlanIndex, prefetchedSubPlans))
+		{
+			prefetchedSubPlans = PrefetchIndependentSubPlans(planId, subPlanList,
+															 subPlanIndex,
+															 prefetchedSubPlans);
+		}
+
 		EState *estate = CreateExecutorState();
 		DestReceiver *copyDest =
 			CreateRemoteFileDestReceiver(resultId, estate, remoteWorkerNodeList,
 										 entry->writeLocalFile);
 
+		if (useResultCache)
+		{
+			CaptureIntermediateResultData(copyDest, SubPlanResultCacheSize * 1024L);
+		}
+
 		ExecutePlanIntoDestReceiver(plannedStmt, params, copyDest);
 
+		if (subPlanDistributedPlan != NULL)
+		{
+			/* the scan might not have asked for the prefetched rows */
+			DiscardPrefetchedResult(subPlanDistributedPlan->planId);
+		}
+
+		if (useResultCache)
+		{
+			StringInfo resultData = CapturedIntermediateResultData(copyDest);
+			if (resultData != NULL)
+			{
+				StoreCachedSubPlanResult(cacheKey, relationIdList, relationVersions,
+										 resultData);
+			}
+		}
+
 		SubPlanLevel--;
 		FreeExecutorState(estate);
 	}
 }
+
+
+/*
+ * PrefetchIndependentSubPlans is called before the subplan at firstSubPlanIndex
+ * is executed. It looks for the subplans from that one onwards that only read
+ * the results of subplans that were already executed, and runs their tasks
+ * concurrently. The subplans themselves are still executed in order by
+ * ExecuteSubPlans, at which point their scans return the prefetched rows.
+ *
+ * Subplans that read the result of a pending subplan have to wait for it and
+ * are prefetched along with a later subplan, if at all. We do not look beyond
+ * a subplan that might modify data, since the subplans after it might read
+ * those modifications. The function returns prefetchedSubPlans extended with
+ * the indexes of the subplans that were prefetched.
+ */
+static Bitmapset *
+PrefetchIndependentSubPlans(uint64 planId, List *subPlanList, int firstSubPlanIndex,
+							Bitmapset *prefetchedSubPlans)
+{
+	List *pendingResultIdList = NIL;
+	List *customScanList = NIL;
+	List *prefetchedResultIdList = NIL;
+	Bitmapset *candidateSubPlans = NULL;
+	int subPlanIndex = 0;
+
+	if (MultiShardConnectionType == SEQUENTIAL_CONNECTION ||
+		XactModificationLevel != XACT_MODIFICATION_NONE)
+	{
+		/* tasks have to reuse connections, which cannot be shared concurrently */
+		return prefetchedSubPlans;
+	}
+
+	DistributedSubPlan *firstSubPlan =
+		(DistributedSubPlan *) list_nth(subPlanList, firstSubPlanIndex);
+	if (!CanPrefetchSubPlan(firstSubPlan))
+	{
+		return prefetchedSubPlans;
+	}
+
+	DistributedSubPlan *subPlan = NULL;
+	foreach_ptr(subPlan, subPlanList)
+	{
+		if (subPlanIndex >= firstSubPlanIndex)
+		{
+			char *resultId = GenerateResultId(planId, subPlan->subPlanId);
+
+			pendingResultIdList = lappend(pendingResultIdList, resultId);
+		}
+
+		subPlanIndex++;
+	}
+
+	subPlanIndex = 0;
+	foreach_ptr(subPlan, subPlanList)
+	{
+		int currentSubPlanIndex = subPlanIndex++;
+
+		if (currentSubPlanIndex < firstSubPlanIndex ||
+			bms_is_member(currentSubPlanIndex, prefetchedSubPlans))
+		{
+			continue;
+		}
+
+		if (SubPlanMayModify(subPlan))
+		{
+			break;
+		}
+
+		if (!CanPrefetchSubPlan(subPlan) ||
+			SubPlanUsesResults(subPlan, pendingResultIdList) ||
+			SubPlanResultIsCached(subPlan))
+		{
+			continue;
+		}
+
+		CustomScan *customScan = FetchCitusCustomScanIfExists(subPlan->plan->planTree);
+		customScanList = lappend(customScanList, customScan);
+		prefetchedResultIdList = lappend(prefetchedResultIdList,
+										 GenerateResultId(planId, subPlan->subPlanId));
+
+		candidateSubPlans = bms_add_member(candidateSubPlans, currentSubPlanIndex);
+	}
+
+	if (list_length(customScanList) < 2)
+	{
+		/* nothing to run concurrently with, execute the subplan as usual */
+		return prefetchedSubPlans;
+	}
+
+	char *resultId = NULL;
+	foreach_ptr(resultId, prefetchedResultIdList)
+	{
+		ereport(DEBUG1, (errmsg("running the tasks of subplan %s concurrently",
+								resultId)));
+	}
+
+	PrefetchDistributedPlanResults(customScanList);
+
+	return bms_add_members(prefetchedSubPlans, candidateSubPlans);
+}
+
+
+/*
+ * SubPlanDistributedPlan returns the distributed plan of the Citus scan in
+ * the given subplan, or NULL if the subplan does not have one.
+ */
+static DistributedPlan *
+SubPlanDistributedPlan(DistributedSubPlan *subPlan)
+{
+	CustomScan *customScan = FetchCitusCustomScanIfExists(subPlan->plan->planTree);
+	if (customScan == NULL)
+	{
+		return NULL;
+	}
+
+	return GetDistributedPlan(customScan);
+}
+
+
+/*
+ * SubPlanMayModify returns whether the given subplan might modify data, in
+ * which case the subplans after it should observe the modifications.
+ */
+static bool
+SubPlanMayModify(DistributedSubPlan *subPlan)
+{
+	PlannedStmt *plannedStmt = subPlan->plan;
+
+	if (plannedStmt->commandType != CMD_SELECT || plannedStmt->hasModifyingCTE)
+	{
+		return true;
+	}
+
+	DistributedPlan *distributedPlan = SubPlanDistributedPlan(subPlan);
+
+	return distributedPlan != NULL && distributedPlan->modLevel != ROW_MODIFY_READONLY;
+}
+
+
+/*
+ * CanPrefetchSubPlan returns whether the tasks of the given subplan can run
+ * before the subplan is executed. That is the case for read-only adaptive
+ * executor plans of which the tasks are known up front and are not executed
+ * locally.
+ */
+static bool
+CanPrefetchSubPlan(DistributedSubPlan *subPlan)
+{
+	CustomScan *customScan = FetchCitusCustomScanIfExists(subPlan->plan->planTree);
+	if (customScan == NULL || customScan->methods != &AdaptiveExecutorCustomScanMethods)
+	{
+		return false;
+	}
+
+	DistributedPlan *distributedPlan = GetDistributedPlan(customScan);
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (distributedPlan->modLevel != ROW_MODIFY_READONLY ||
+		distributedPlan->planningError != NULL ||
+		distributedPlan->subPlanList != NIL ||
+		workerJob == NULL)
+	{
+		return false;
+	}
+
+	if (workerJob->requiresMasterEvaluation || workerJob->deferredPruning ||
+		workerJob->dependentJobList != NIL || workerJob->taskList == NIL)
+	{
+		return false;
+	}
+
+	return !ShouldExecuteTasksLocally(workerJob->taskList);
+}
+
+
+/*
+ * SubPlanUsesResults returns whether the given subplan reads any of the
+ * intermediate results in resultIdList. Subplans without a Citus scan are
+ * assumed to read all of them.
+ */
+static bool
+SubPlanUsesResults(DistributedSubPlan *subPlan, List *resultIdList)
+{
+	DistributedPlan *distributedPlan = SubPlanDistributedPlan(subPlan);
+	if (distributedPlan == NULL)
+	{
+		return true;
+	}
+
+	UsedDistributedSubPlan *usedSubPlan = NULL;
+	foreach_ptr(usedSubPlan, distributedPlan->usedSubPlanNodeList)
+	{
+		char *resultId = NULL;
+		foreach_ptr(resultId, resultIdList)
+		{
+			if (strcmp(usedSubPlan->subPlanId, resultId) == 0)
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+/*
+ * SubPlanResultIsCached returns whether ExecuteSubPlans will reuse a cached
+ * result for the given subplan, in which case there is no need to run it.
+ */
+static bool
+SubPlanResultIsCached(DistributedSubPlan *subPlan)
+{
+	if (subPlan->cacheKey == NULL || !SubPlanResultCacheUsable())
+	{
+		return false;
+	}
+
+	uint64 *relationVersions = CurrentRelationVersions(subPlan->relationIdList);
+
+	return LookupCachedSubPlanResult(subPlan->cacheKey, subPlan->relationIdList,
+									 relationVersions) != NULL;
+}
@@ -0,0 +1,707 @@
+/*-------------------------------------------------------------------------
+ *
+ * subplan_result_cache.c
+ *    Reuse of subplan results across queries of a session.
+ *
+ * Queries that are issued repeatedly, such as dashboard queries, recompute
+ * and redistribute the same CTEs and subqueries on every execution. When
+ * citus.subplan_result_cache_size is set, a backend keeps the intermediate
+ * result data of the subplans it executes, and the next execution of a
+ * subplan with the same deparsed query sends the cached data to the workers
+ * instead of running the subplan again.
+ *
+ * A cached result is only valid as long as the distributed tables it reads
+ * are not modified. Every node keeps a version number for such tables in
+ * shared memory, and a backend that modified a distributed table through
+ * this node bumps its version at commit. Results are cached together with the
+ * versions of the tables they read, and are only reused if none of the
+ * versions changed.
+ *
+ * A modification is not always visible on the workers when its version is
+ * bumped: with citus.defer_commit_prepared, or when committing a prepared
+ * transaction failed, 2PC recovery commits the prepared transactions later.
+ * A subplan that runs in between may cache data without the modification
+ * under the new version, so recovery invalidates all cached results once it
+ * committed any prepared transactions.
+ *
+ * The versions only cover modifications that go through this node. Results
+ * are therefore not cached while there are workers with metadata, since
+ * those can modify distributed tables themselves, either directly or through
+ * functions that are delegated to them, and all cached results are
+ * invalidated when metadata sync to a node is stopped. Modifications made
+ * directly on the shards, bypassing Citus, are never noticed.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "access/xact.h"
+#include "distributed/citus_ruleutils.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/metadata_sync.h"
+#include "distributed/multi_partitioning_utils.h"
+#include "distributed/query_utils.h"
+#include "distributed/subplan_result_cache.h"
+#include "lib/ilist.h"
+#include "nodes/nodeFuncs.h"
+#include "optimizer/clauses.h"
+#if PG_VERSION_NUM >= 120000
+#include "optimizer/optimizer.h"
+#endif
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* maximum number of distributed tables for which we keep a version */
+#define MAX_RELATION_VERSION_ENTRIES 1024
+
+
+/*
+ * RelationVersionHashEntry holds the version of a distributed table, which
+ * changes whenever a modification of the table is committed.
+ */
+typedef struct RelationVersionHashEntry
+{
+	Oid relationId;
+	uint64 version;
+} RelationVersionHashEntry;
+
+
+/*
+ * RelationVersionControlData holds the lock that protects RelationVersionHash
+ * and the last version that was handed out. Versions are never reused, such
+ * that entries can be removed without a later entry for the same table
+ * matching an old version.
+ */
+typedef struct RelationVersionControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+	uint64 lastVersion;
+} RelationVersionControlData;
+
+
+/*
+ * CachedSubPlanResult is the result data of a subplan, together with what it
+ * depends on.
+ */
+typedef struct CachedSubPlanResult
+{
+	/* hash of the cache key, which is the key of CachedSubPlanResultHash */
+	uint32 keyHash;
+	char *cacheKey;
+
+	/* the result may depend on the user and on the output format of dates */
+	Oid userId;
+	int dateStyle;
+	int dateOrder;
+	int intervalStyle;
+
+	/* distributed tables read by the subplan, and their versions */
+	List *relationIdList;
+	uint64 *relationVersions;
+
+	StringInfo resultData;
+
+	/* position in the list of results, least recently used last */
+	dlist_node lruNode;
+} CachedSubPlanResult;
+
+
+/* GUC, maximum size in KB of the subplan results cached by a backend */
+int SubPlanResultCacheSize = 0;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static RelationVersionControlData *RelationVersionControl = NULL;
+static HTAB *RelationVersionHash = NULL;
+
+/* results cached by this backend */
+static MemoryContext SubPlanResultCacheContext = NULL;
+static HTAB *CachedSubPlanResultHash = NULL;
+static dlist_head CachedSubPlanResultList = DLIST_STATIC_INIT(CachedSubPlanResultList);
+static int64 CachedSubPlanResultBytes = 0;
+
+/* distributed tables modified by the current transaction */
+static List *ModifiedRelationList = NIL;
+
+
+static size_t RelationVersionShmemSize(void);
+static void RelationVersionShmemInit(void);
+static bool ContainsExternParamWalker(Node *node, void *context);
+static void CreateCachedSubPlanResultHash(void);
+static int64 CachedSubPlanResultSize(CachedSubPlanResult *cachedResult);
+static void RemoveCachedSubPlanResult(CachedSubPlanResult *cachedResult);
+
+
+/*
+ * InitializeSubPlanResultCache, called at server start, requests the shared
+ * memory for the versions of distributed tables.
+ */
+void
+InitializeSubPlanResultCache(void)
+{
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(RelationVersionShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = RelationVersionShmemInit;
+}
+
+
+/*
+ * RelationVersionShmemSize computes the size of the shared memory for the
+ * versions of distributed tables.
+ */
+static size_t
+RelationVersionShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(RelationVersionControlData));
+	size = add_size(size, hash_estimate_size(MAX_RELATION_VERSION_ENTRIES,
+											 sizeof(RelationVersionHashEntry)));
+
+	return size;
+}
+
+
+/*
+ * RelationVersionShmemInit initializes the shared memory for the versions of
+ * distributed tables.
+ */
+static void
+RelationVersionShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	RelationVersionControl =
+		(RelationVersionControlData *) ShmemInitStruct("Citus Relation Versions",
+													   sizeof(RelationVersionControlData),
+													   &alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		RelationVersionControl->trancheId = LWLockNewTrancheId();
+		RelationVersionControl->lockTrancheName = "Citus Relation Versions";
+		LWLockRegisterTranche(RelationVersionControl->trancheId,
+							  RelationVersionControl->lockTrancheName);
+
+		LWLockInitialize(&RelationVersionControl->lock,
+						 RelationVersionControl->trancheId);
+
+		RelationVersionControl->lastVersion = 0;
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(Oid);
+	hashInfo.entrysize = sizeof(RelationVersionHashEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	RelationVersionHash = ShmemInitHash("Citus Relation Versions Hash",
+										MAX_RELATION_VERSION_ENTRIES,
+										MAX_RELATION_VERSION_ENTRIES,
+										&hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * SubPlanResultCacheKey returns the key under which the result of the given
+ * subplan query can be cached, and sets relationIdList to the distributed
+ * tables the result depends on. It returns NULL if the result cache is
+ * disabled or the result cannot be cached, for instance because the query
+ * reads local tables, reads other intermediate results, or calls functions
+ * that may return a different value next time.
+ *
+ * The key is the deparsed query, so it should be called before the query is
+ * planned.
+ */
+char *
+SubPlanResultCacheKey(Query *subPlanQuery, List **relationIdList)
+{
+	List *rangeTableList = NIL;
+	ListCell *rangeTableCell = NULL;
+	List *dependedRelationIdList = NIL;
+
+	if (SubPlanResultCacheSize <= 0)
+	{
+		return NULL;
+	}
+
+	if (subPlanQuery->commandType != CMD_SELECT || subPlanQuery->hasModifyingCTE ||
+		subPlanQuery->rowMarks != NIL)
+	{
+		return NULL;
+	}
+
+	/* this also rejects read_intermediate_result, which is volatile */
+	if (contain_mutable_functions((Node *) subPlanQuery) ||
+		ContainsExternParamWalker((Node *) subPlanQuery, NULL))
+	{
+		return NULL;
+	}
+
+	ExtractRangeTableRelationWalker((Node *) subPlanQuery, &rangeTableList);
+
+	foreach(rangeTableCell, rangeTableList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+		Oid relationId = rangeTableEntry->relid;
+
+		/* we only learn about modifications of distributed tables */
+		if (!IsDistributedTable(relationId))
+		{
+			return NULL;
+		}
+
+		dependedRelationIdList = list_append_unique_oid(dependedRelationIdList,
+														relationId);
+
+		/* a partitioned table may also be modified through its partitions */
+		if (PartitionedTable(relationId))
+		{
+			dependedRelationIdList = list_concat_unique_oid(dependedRelationIdList,
+															PartitionList(relationId));
+		}
+		else if (PartitionTable(relationId))
+		{
+			dependedRelationIdList = list_append_unique_oid(dependedRelationIdList,
+															PartitionParentOid(
+																relationId));
+		}
+	}
+
+	StringInfo cacheKey = makeStringInfo();
+	pg_get_query_def(subPlanQuery, cacheKey);
+
+	*relationIdList = dependedRelationIdList;
+
+	return cacheKey->data;
+}
+
+
+/*
+ * ContainsExternParamWalker returns whether the given query or expression
+ * contains parameters, which are not part of the deparsed query.
+ */
+static bool
+ContainsExternParamWalker(Node *node, void *context)
+{
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, Param))
+	{
+		Param *param = (Param *) node;
+
+		return param->paramkind == PARAM_EXTERN;
+	}
+	else if (IsA(node, Query))
+	{
+		return query_tree_walker((Query *) node, ContainsExternParamWalker, context,
+								 0);
+	}
+
+	return expression_tree_walker(node, ContainsExternParamWalker, context);
+}
+
+
+/*
+ * SubPlanResultCacheUsable returns whether cached subplan results may be used
+ * and stored by the current query. Transactions that see a fixed snapshot, or
+ * that modified distributed tables themselves, see different data than other
+ * queries and do not use the cache. Neither do queries in clusters with
+ * workers with metadata, whose modifications this node does not learn about.
+ */
+bool
+SubPlanResultCacheUsable(void)
+{
+	if (SubPlanResultCacheSize <= 0 || RelationVersionHash == NULL)
+	{
+		return false;
+	}
+
+	if (IsolationUsesXactSnapshot() || ModifiedRelationList != NIL)
+	{
+		return false;
+	}
+
+	if (ClusterHasKnownMetadataWorkers())
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * CurrentRelationVersions returns the current versions of the given
+ * distributed tables. The versions should be obtained before the subplan is
+ * executed, such that a modification that is committed in the meantime makes
+ * the result outdated rather than the other way around.
+ *
+ * Tables normally already have a version, which we look up under a shared
+ * lock. Only when a table does not have one yet, we assign it under an
+ * exclusive lock.
+ */
+uint64 *
+CurrentRelationVersions(List *relationIdList)
+{
+	uint64 *relationVersions = palloc0(Max(list_length(relationIdList), 1) *
+									   sizeof(uint64));
+	ListCell *relationIdCell = NULL;
+	int relationIndex = 0;
+	bool allFound = true;
+
+	LWLockAcquire(&RelationVersionControl->lock, LW_SHARED);
+
+	foreach(relationIdCell, relationIdList)
+	{
+		Oid relationId = lfirst_oid(relationIdCell);
+		bool found = false;
+
+		RelationVersionHashEntry *entry =
+			(RelationVersionHashEntry *) hash_search(RelationVersionHash, &relationId,
+													 HASH_FIND, &found);
+		if (!found)
+		{
+			allFound = false;
+			break;
+		}
+
+		relationVersions[relationIndex++] = entry->version;
+	}
+
+	LWLockRelease(&RelationVersionControl->lock);
+
+	if (allFound)
+	{
+		return relationVersions;
+	}
+
+	relationIndex = 0;
+
+	LWLockAcquire(&RelationVersionControl->lock, LW_EXCLUSIVE);
+
+	foreach(relationIdCell, relationIdList)
+	{
+		Oid relationId = lfirst_oid(relationIdCell);
+		bool found = false;
+
+		RelationVersionHashEntry *entry =
+			(RelationVersionHashEntry *) hash_search(RelationVersionHash, &relationId,
+													 HASH_ENTER_NULL, &found);
+		if (entry == NULL)
+		{
+			HASH_SEQ_STATUS status;
+			RelationVersionHashEntry *oldEntry = NULL;
+
+			/* start over when the hash is full, versions are not reused */
+			hash_seq_init(&status, RelationVersionHash);
+			while ((oldEntry = hash_seq_search(&status)) != NULL)
+			{
+				hash_search(RelationVersionHash, &oldEntry->relationId, HASH_REMOVE,
+							NULL);
+			}
+
+			entry = (RelationVersionHashEntry *) hash_search(RelationVersionHash,
+															 &relationId, HASH_ENTER,
+															 &found);
+		}
+
+		if (!found)
+		{
+			entry->version = ++RelationVersionControl->lastVersion;
+		}
+
+		relationVersions[relationIndex++] = entry->version;
+	}
+
+	LWLockRelease(&RelationVersionControl->lock);
+
+	return relationVersions;
+}
+
+
+/*
+ * LookupCachedSubPlanResult returns the cached result data for the given key
+ * if it was computed for the same versions of the given distributed tables,
+ * or NULL otherwise.
+ */
+StringInfo
+LookupCachedSubPlanResult(char *cacheKey, List *relationIdList,
+						  uint64 *relationVersions)
+{
+	bool found = false;
+
+	if (CachedSubPlanResultHash == NULL)
+	{
+		return NULL;
+	}
+
+	uint32 keyHash = string_hash(cacheKey, strlen(cacheKey) + 1);
+
+	CachedSubPlanResult *cachedResult =
+		(CachedSubPlanResult *) hash_search(CachedSubPlanResultHash, &keyHash,
+											HASH_FIND, &found);
+	if (!found || strcmp(cachedResult->cacheKey, cacheKey) != 0)
+	{
+		return NULL;
+	}
+
+	if (cachedResult->userId != GetUserId() ||
+		cachedResult->dateStyle != DateStyle ||
+		cachedResult->dateOrder != DateOrder ||
+		cachedResult->intervalStyle != IntervalStyle ||
+		!equal(cachedResult->relationIdList, relationIdList))
+	{
+		return NULL;
+	}
+
+	int relationCount = list_length(relationIdList);
+	if (memcmp(cachedResult->relationVersions, relationVersions,
+			   relationCount * sizeof(uint64)) != 0)
+	{
+		/* one of the tables was modified, the result is of no use anymore */
+		ereport(DEBUG1, (errmsg("discarding a cached subplan result, since a table "
+								"it reads was modified")));
+
+		RemoveCachedSubPlanResult(cachedResult);
+		return NULL;
+	}
+
+	/* mark the result as most recently used */
+	dlist_move_head(&CachedSubPlanResultList, &cachedResult->lruNode);
+
+	return cachedResult->resultData;
+}
+
+
+/*
+ * StoreCachedSubPlanResult adds the given result data to the cache, removing
+ * the least recently used results if the cache becomes too large.
+ */
+void
+StoreCachedSubPlanResult(char *cacheKey, List *relationIdList,
+						 uint64 *relationVersions, StringInfo resultData)
+{
+	bool found = false;
+	int64 maxCacheSize = SubPlanResultCacheSize * 1024L;
+
+	if (CachedSubPlanResultHash == NULL)
+	{
+		CreateCachedSubPlanResultHash();
+	}
+
+	uint32 keyHash = string_hash(cacheKey, strlen(cacheKey) + 1);
+
+	CachedSubPlanResult *cachedResult =
+		(CachedSubPlanResult *) hash_search(CachedSubPlanResultHash, &keyHash,
+											HASH_FIND, &found);
+	if (found)
+	{
+		/* replace an older result, or a result with a colliding key */
+		RemoveCachedSubPlanResult(cachedResult);
+	}
+
+	MemoryContext oldContext = MemoryContextSwitchTo(SubPlanResultCacheContext);
+
+	cachedResult = (CachedSubPlanResult *) hash_search(CachedSubPlanResultHash,
+													   &keyHash, HASH_ENTER, &found);
+	cachedResult->cacheKey = pstrdup(cacheKey);
+	cachedResult->userId = GetUserId();
+	cachedResult->dateStyle = DateStyle;
+	cachedResult->dateOrder = DateOrder;
+	cachedResult->intervalStyle = IntervalStyle;
+	cachedResult->relationIdList = list_copy(relationIdList);
+	cachedResult->relationVersions =
+		palloc(Max(list_length(relationIdList), 1) * sizeof(uint64));
+	memcpy(cachedResult->relationVersions, relationVersions,
+		   list_length(relationIdList) * sizeof(uint64));
+
+	cachedResult->resultData = makeStringInfo();
+	appendBinaryStringInfo(cachedResult->resultData, resultData->data,
+						   resultData->len);
+
+	MemoryContextSwitchTo(oldContext);
+
+	dlist_push_head(&CachedSubPlanResultList, &cachedResult->lruNode);
+	CachedSubPlanResultBytes += CachedSubPlanResultSize(cachedResult);
+
+	while (CachedSubPlanResultBytes > maxCacheSize &&
+		   !dlist_is_empty(&CachedSubPlanResultList))
+	{
+		CachedSubPlanResult *leastRecentlyUsed =
+			dlist_tail_element(CachedSubPlanResult, lruNode, &CachedSubPlanResultList);
+
+		RemoveCachedSubPlanResult(leastRecentlyUsed);
+	}
+}
+
+
+/*
+ * CreateCachedSubPlanResultHash creates the hash and the memory context for
+ * the subplan results cached by this backend.
+ */
+static void
+CreateCachedSubPlanResultHash(void)
+{
+	HASHCTL hashInfo;
+
+	SubPlanResultCacheContext = AllocSetContextCreate(TopMemoryContext,
+													  "Citus Subplan Result Cache",
+													  ALLOCSET_DEFAULT_SIZES);
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(uint32);
+	hashInfo.entrysize = sizeof(CachedSubPlanResult);
+	hashInfo.hcxt = SubPlanResultCacheContext;
+	int hashFlags = (HASH_ELEM | HASH_CONTEXT | HASH_BLOBS);
+
+	CachedSubPlanResultHash = hash_create("Citus Subplan Result Cache Hash", 32,
+										  &hashInfo, hashFlags);
+}
+
+
+/*
+ * CachedSubPlanResultSize returns the number of bytes a cached result counts
+ * for towards citus.subplan_result_cache_size.
+ */
+static int64
+CachedSubPlanResultSize(CachedSubPlanResult *cachedResult)
+{
+	return (int64) cachedResult->resultData->len + strlen(cachedResult->cacheKey);
+}
+
+
+/*
+ * RemoveCachedSubPlanResult removes the given result from the cache and frees
+ * its memory.
+ */
+static void
+RemoveCachedSubPlanResult(CachedSubPlanResult *cachedResult)
+{
+	CachedSubPlanResultBytes -= CachedSubPlanResultSize(cachedResult);
+	dlist_delete(&cachedResult->lruNode);
+
+	pfree(cachedResult->resultData->data);
+	pfree(cachedResult->resultData);
+	pfree(cachedResult->relationVersions);
+	list_free(cachedResult->relationIdList);
+	pfree(cachedResult->cacheKey);
+
+	hash_search(CachedSubPlanResultHash, &cachedResult->keyHash, HASH_REMOVE, NULL);
+}
+
+
+/*
+ * InvalidateSubPlanResultsOnCommit records that the current transaction
+ * modifies the given distributed table, such that cached results that read
+ * the table are no longer used once the transaction commits.
+ */
+void
+InvalidateSubPlanResultsOnCommit(Oid relationId)
+{
+	MemoryContext oldContext = MemoryContextSwitchTo(TopMemoryContext);
+
+	ModifiedRelationList = list_append_unique_oid(ModifiedRelationList, relationId);
+
+	MemoryContextSwitchTo(oldContext);
+}
+
+
+/*
+ * InvalidateAllSubPlanResults makes all subplan results that are cached on
+ * this node outdated, by removing the versions of all distributed tables.
+ * Since versions are never reused, the tables get versions that no cached
+ * result was computed for.
+ */
+void
+InvalidateAllSubPlanResults(void)
+{
+	HASH_SEQ_STATUS status;
+	RelationVersionHashEntry *entry = NULL;
+
+	if (RelationVersionHash == NULL)
+	{
+		return;
+	}
+
+	LWLockAcquire(&RelationVersionControl->lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, RelationVersionHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		hash_search(RelationVersionHash, &entry->relationId, HASH_REMOVE, NULL);
+	}
+
+	LWLockRelease(&RelationVersionControl->lock);
+}
+
+
+/*
+ * ResetSubPlanResultCacheTransactionState is called at the end of the
+ * transaction. On commit, it bumps the versions of the distributed tables that
+ * were modified. Prepared transactions whose commit is deferred, or failed,
+ * are not yet committed on the workers at this point, which is why 2PC
+ * recovery calls InvalidateAllSubPlanResults after committing them.
+ */
+void
+ResetSubPlanResultCacheTransactionState(bool committed)
+{
+	ListCell *relationIdCell = NULL;
+
+	if (ModifiedRelationList == NIL)
+	{
+		return;
+	}
+
+	if (committed && RelationVersionHash != NULL)
+	{
+		LWLockAcquire(&RelationVersionControl->lock, LW_EXCLUSIVE);
+
+		foreach(relationIdCell, ModifiedRelationList)
+		{
+			Oid relationId = lfirst_oid(relationIdCell);
+			bool found = false;
+
+			/* tables without a version were not read by any cached result */
+			RelationVersionHashEntry *entry =
+				(RelationVersionHashEntry *) hash_search(RelationVersionHash,
+														 &relationId, HASH_FIND,
+														 &found);
+			if (found)
+			{
+				entry->version = ++RelationVersionControl->lastVersion;
+			}
+		}
+
+		LWLockRelease(&RelationVersionControl->lock);
+	}
+
+	list_free(ModifiedRelationList);
+	ModifiedRelationList = NIL;
+}
@@ -0,0 +1,223 @@
+/*
+ * task_bundling.c
+ *
+ * A multi-shard SELECT has a task per shard, which means that a table with
+ * many shards per worker either needs many connections or many round-trips
+ * per connection, and every task is parsed and planned separately on the
+ * worker. When the coordinator only concatenates or combines the results of
+ * the tasks, the tasks of a worker node can instead be sent as a single
+ * UNION ALL query, such that the number of round-trips and worker-side
+ * planning overhead scales with the number of nodes rather than the number
+ * of shards.
+ *
+ * The trade-off is that the tasks of a node are executed over a single
+ * connection, so parallelism on the worker relies on PostgreSQL choosing a
+ * Parallel Append for the combined query. Bundling is therefore opt-in.
+ *
+ * Copyright (c) Citus Data, Inc.
+ */
+
+#include "postgres.h"
+
+#include "distributed/citus_nodefuncs.h"
+#include "distributed/deparse_shard_query.h"
+#include "distributed/listutils.h"
+#include "distributed/metadata_cache.h"
+#include "distributed/task_bundling.h"
+#include "distributed/transaction_management.h"
+#include "lib/stringinfo.h"
+
+
+/* GUC, determining whether the tasks of a SELECT are bundled per worker node */
+bool EnableTaskBundling = false;
+
+
+static bool TaskCanBeBundled(Task *task);
+static Task * BundleTasks(List *taskList);
+
+
+/*
+ * ShouldBundleTasksPerNode returns true if the tasks of the worker job of the
+ * given distributed plan can be combined into one query per worker node.
+ *
+ * We only bundle read-only queries that do not depend on the results of the
+ * individual tasks being separate, and only outside of multi-statement
+ * transactions, since in that case earlier statements may have accessed the
+ * shards of a node over different connections.
+ */
+bool
+ShouldBundleTasksPerNode(DistributedPlan *distributedPlan)
+{
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (!EnableTaskBundling)
+	{
+		return false;
+	}
+
+	if (workerJob == NULL || distributedPlan->modLevel != ROW_MODIFY_READONLY)
+	{
+		return false;
+	}
+
+	if (workerJob->dependentJobList != NIL || list_length(workerJob->taskList) < 2)
+	{
+		return false;
+	}
+
+	if (distributedPlan->mergeSortClauseList != NIL)
+	{
+		/* the coordinator relies on the results of each task being sorted */
+		return false;
+	}
+
+	if (IsMultiStatementTransaction() || InCoordinatedTransaction())
+	{
+		return false;
+	}
+
+	Task *task = NULL;
+	foreach_ptr(task, workerJob->taskList)
+	{
+		if (!TaskCanBeBundled(task))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * TaskCanBeBundled returns whether the task is a SELECT task with a single
+ * placement and a single query string that can be used as a UNION ALL branch.
+ */
+static bool
+TaskCanBeBundled(Task *task)
+{
+	if (task->taskType != SELECT_TASK)
+	{
+		return false;
+	}
+
+	if (list_length(task->taskPlacementList) != 1 ||
+		task->perPlacementQueryStrings != NIL)
+	{
+		return false;
+	}
+
+	/* FOR UPDATE/SHARE is not allowed in combination with UNION */
+	if (task->relationRowLockList != NIL)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * BundleTasksPerNode returns a new task list in which the tasks that have
+ * their placement on the same worker node are replaced by a single task that
+ * runs the queries of those tasks as a UNION ALL. Tasks on the local node are
+ * kept as they are, such that they can still use local execution.
+ */
+List *
+BundleTasksPerNode(List *taskList)
+{
+	List *groupIdList = NIL;
+	List *groupTaskLists = NIL;
+	List *bundledTaskList = NIL;
+	int32 localGroupId = GetLocalGroupId();
+
+	Task *task = NULL;
+	foreach_ptr(task, taskList)
+	{
+		ShardPlacement *taskPlacement = linitial(task->taskPlacementList);
+		int32 groupId = taskPlacement->groupId;
+
+		if (groupId == localGroupId)
+		{
+			bundledTaskList = lappend(bundledTaskList, task);
+			continue;
+		}
+
+		/* find the tasks of the node of this task so far, if any */
+		ListCell *groupIdCell = NULL;
+		ListCell *groupTaskListCell = NULL;
+		bool foundGroup = false;
+
+		forboth(groupIdCell, groupIdList, groupTaskListCell, groupTaskLists)
+		{
+			if (lfirst_int(groupIdCell) == groupId)
+			{
+				lfirst(groupTaskListCell) = lappend(lfirst(groupTaskListCell), task);
+				foundGroup = true;
+				break;
+			}
+		}
+
+		if (!foundGroup)
+		{
+			groupIdList = lappend_int(groupIdList, groupId);
+			groupTaskLists = lappend(groupTaskLists, list_make1(task));
+		}
+	}
+
+	List *groupTaskList = NIL;
+	foreach_ptr(groupTaskList, groupTaskLists)
+	{
+		bundledTaskList = lappend(bundledTaskList, BundleTasks(groupTaskList));
+	}
+
+	return bundledTaskList;
+}
+
+
+/*
+ * BundleTasks returns a task that runs the queries of all the given tasks as
+ * a UNION ALL on the (shared) placement of the tasks. The relation shards of
+ * the bundled task are those of all tasks, such that shard locks and relation
+ * accesses are recorded as before.
+ */
+static Task *
+BundleTasks(List *taskList)
+{
+	Task *firstTask = (Task *) linitial(taskList);
+
+	if (list_length(taskList) == 1)
+	{
+		return firstTask;
+	}
+
+	StringInfo queryString = makeStringInfo();
+	List *relationShardList = NIL;
+
+	Task *task = NULL;
+	foreach_ptr(task, taskList)
+	{
+		if (queryString->len > 0)
+		{
+			appendStringInfoString(queryString, " UNION ALL ");
+		}
+
+		appendStringInfo(queryString, "(%s)", TaskQueryString(task));
+
+		relationShardList = list_concat(relationShardList,
+										list_copy(task->relationShardList));
+	}
+
+	Task *bundledTask = CitusMakeNode(Task);
+	bundledTask->taskType = firstTask->taskType;
+	bundledTask->jobId = firstTask->jobId;
+	bundledTask->taskId = firstTask->taskId;
+	bundledTask->anchorShardId = firstTask->anchorShardId;
+	bundledTask->taskPlacementList = firstTask->taskPlacementList;
+	bundledTask->replicationModel = firstTask->replicationModel;
+	bundledTask->relationShardList = relationShardList;
+
+	SetTaskQueryString(bundledTask, queryString->data);
+
+	return bundledTask;
+}
@@ -0,0 +1,276 @@
+/*-------------------------------------------------------------------------
+ *
+ * worker_latency.c
+ *    Observed task durations and connection establishment times per worker.
+ *
+ * The adaptive executor measures how long tasks take on each worker and how
+ * long it takes to establish a connection to it, and uses these to decide
+ * whether opening more connections to a worker shortens the execution (see
+ * ManageWorkerPool). Since a single execution often only runs a few tasks per
+ * worker, the averages of each execution are also folded into a decaying
+ * history in shared memory, which the next executions of any backend start
+ * from.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "distributed/worker_latency.h"
+#include "distributed/worker_manager.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+
+/* maximum number of workers for which we keep a history */
+#define MAX_WORKER_LATENCY_ENTRIES 1024
+
+/* weight of the latest execution in the history of a worker */
+#define WORKER_LATENCY_DECAY_WEIGHT 0.25
+
+
+/*
+ * WorkerLatencyHashKey identifies a worker in WorkerLatencyHash.
+ */
+typedef struct WorkerLatencyHashKey
+{
+	char nodeName[WORKER_LENGTH];
+	int32 nodePort;
+} WorkerLatencyHashKey;
+
+
+/*
+ * WorkerLatencyHashEntry holds the decayed latency history of a worker.
+ */
+typedef struct WorkerLatencyHashEntry
+{
+	WorkerLatencyHashKey key;
+	WorkerLatency latency;
+} WorkerLatencyHashEntry;
+
+
+/*
+ * WorkerLatencyControlData holds the lock that protects WorkerLatencyHash.
+ */
+typedef struct WorkerLatencyControlData
+{
+	int trancheId;
+	char *lockTrancheName;
+	LWLock lock;
+} WorkerLatencyControlData;
+
+
+/* GUC, determining whether worker pools are sized based on observed latencies */
+bool EnableLatencyAwarePoolSizing = false;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+static WorkerLatencyControlData *WorkerLatencyControl = NULL;
+static HTAB *WorkerLatencyHash = NULL;
+
+
+static size_t WorkerLatencyShmemSize(void);
+static void WorkerLatencyShmemInit(void);
+static void BuildWorkerLatencyHashKey(WorkerLatencyHashKey *key, char *nodeName,
+									  int nodePort);
+static double DecayedLatency(double history, double observation);
+
+
+/*
+ * InitializeWorkerLatency, called at server start, requests the shared memory
+ * for the latency history.
+ */
+void
+InitializeWorkerLatency(void)
+{
+	if (!IsUnderPostmaster)
+	{
+		RequestAddinShmemSpace(WorkerLatencyShmemSize());
+	}
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = WorkerLatencyShmemInit;
+}
+
+
+/*
+ * WorkerLatencyShmemSize computes the size of the shared memory for the
+ * latency history.
+ */
+static size_t
+WorkerLatencyShmemSize(void)
+{
+	Size size = 0;
+
+	size = add_size(size, sizeof(WorkerLatencyControlData));
+	size = add_size(size, hash_estimate_size(MAX_WORKER_LATENCY_ENTRIES,
+											 sizeof(WorkerLatencyHashEntry)));
+
+	return size;
+}
+
+
+/*
+ * WorkerLatencyShmemInit initializes the shared memory for the latency
+ * history.
+ */
+static void
+WorkerLatencyShmemInit(void)
+{
+	bool alreadyInitialized = false;
+	HASHCTL hashInfo;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	WorkerLatencyControl =
+		(WorkerLatencyControlData *) ShmemInitStruct("Citus Worker Latency",
+													 sizeof(WorkerLatencyControlData),
+													 &alreadyInitialized);
+
+	if (!alreadyInitialized)
+	{
+		WorkerLatencyControl->trancheId = LWLockNewTrancheId();
+		WorkerLatencyControl->lockTrancheName = "Citus Worker Latency";
+		LWLockRegisterTranche(WorkerLatencyControl->trancheId,
+							  WorkerLatencyControl->lockTrancheName);
+
+		LWLockInitialize(&WorkerLatencyControl->lock,
+						 WorkerLatencyControl->trancheId);
+	}
+
+	memset(&hashInfo, 0, sizeof(hashInfo));
+	hashInfo.keysize = sizeof(WorkerLatencyHashKey);
+	hashInfo.entrysize = sizeof(WorkerLatencyHashEntry);
+	hashInfo.hash = tag_hash;
+	int hashFlags = (HASH_ELEM | HASH_FUNCTION);
+
+	WorkerLatencyHash = ShmemInitHash("Citus Worker Latency Hash",
+									  MAX_WORKER_LATENCY_ENTRIES,
+									  MAX_WORKER_LATENCY_ENTRIES,
+									  &hashInfo, hashFlags);
+
+	LWLockRelease(AddinShmemInitLock);
+
+	if (prev_shmem_startup_hook != NULL)
+	{
+		prev_shmem_startup_hook();
+	}
+}
+
+
+/*
+ * GetWorkerLatency returns the latency history of the given worker. The fields
+ * are below 0 if there is no history.
+ */
+WorkerLatency
+GetWorkerLatency(char *nodeName, int nodePort)
+{
+	WorkerLatency latency = { -1.0, -1.0 };
+	WorkerLatencyHashKey key;
+	bool found = false;
+
+	if (WorkerLatencyHash == NULL)
+	{
+		return latency;
+	}
+
+	BuildWorkerLatencyHashKey(&key, nodeName, nodePort);
+
+	LWLockAcquire(&WorkerLatencyControl->lock, LW_SHARED);
+
+	WorkerLatencyHashEntry *entry =
+		(WorkerLatencyHashEntry *) hash_search(WorkerLatencyHash, &key, HASH_FIND,
+											   &found);
+	if (found)
+	{
+		latency = entry->latency;
+	}
+
+	LWLockRelease(&WorkerLatencyControl->lock);
+
+	return latency;
+}
+
+
+/*
+ * RecordWorkerLatency folds the latencies observed by an execution into the
+ * history of the given worker. Fields below 0 are not observed and leave the
+ * history as is.
+ */
+void
+RecordWorkerLatency(char *nodeName, int nodePort, WorkerLatency latency)
+{
+	WorkerLatencyHashKey key;
+	bool found = false;
+
+	if (WorkerLatencyHash == NULL)
+	{
+		return;
+	}
+
+	BuildWorkerLatencyHashKey(&key, nodeName, nodePort);
+
+	LWLockAcquire(&WorkerLatencyControl->lock, LW_EXCLUSIVE);
+
+	WorkerLatencyHashEntry *entry =
+		(WorkerLatencyHashEntry *) hash_search(WorkerLatencyHash, &key,
+											   HASH_ENTER_NULL, &found);
+	if (entry == NULL)
+	{
+		/* no space left for new workers, we only lose the history */
+		LWLockRelease(&WorkerLatencyControl->lock);
+		return;
+	}
+
+	if (!found)
+	{
+		entry->latency.taskDurationUs = -1.0;
+		entry->latency.connectionTimeUs = -1.0;
+	}
+
+	entry->latency.taskDurationUs =
+		DecayedLatency(entry->latency.taskDurationUs, latency.taskDurationUs);
+	entry->latency.connectionTimeUs =
+		DecayedLatency(entry->latency.connectionTimeUs, latency.connectionTimeUs);
+
+	LWLockRelease(&WorkerLatencyControl->lock);
+}
+
+
+/*
+ * BuildWorkerLatencyHashKey fills the hash key for the given worker.
+ */
+static void
+BuildWorkerLatencyHashKey(WorkerLatencyHashKey *key, char *nodeName, int nodePort)
+{
+	/* the key is hashed as a whole, so also clear the bytes after the name */
+	memset(key, 0, sizeof(WorkerLatencyHashKey));
+	strlcpy(key->nodeName, nodeName, WORKER_LENGTH);
+	key->nodePort = nodePort;
+}
+
+
+/*
+ * DecayedLatency returns the history of a latency after adding an
+ * observation, where either may be below 0 when unknown.
+ */
+static double
+DecayedLatency(double history, double observation)
+{
+	if (observation < 0)
+	{
+		return history;
+	}
+
+	if (history < 0)
+	{
+		return observation;
+	}
+
+	return (1.0 - WORKER_LATENCY_DECAY_WEIGHT) * history +
+		   WORKER_LATENCY_DECAY_WEIGHT * observation;
+}
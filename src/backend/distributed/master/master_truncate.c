@@ -23,6 +23,7 @@
 #include "distributed/multi_join_order.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/resource_lock.h"
+#include "distributed/subplan_result_cache.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 #include "utils/rel.h"
@@ -58,6 +59,8 @@ citus_truncate_trigger(PG_FUNCTION_ARGS)
 		PG_RETURN_DATUM(PointerGetDatum(NULL));
 	}
 
+	InvalidateSubPlanResultsOnCommit(relationId);
+
 	if (partitionMethod == DISTRIBUTE_BY_APPEND)
 	{
 		Oid schemaId = get_rel_namespace(relationId);
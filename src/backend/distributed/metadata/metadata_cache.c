@@ -3567,6 +3567,9 @@ InvalidateNodeRelationCacheCallback(Datum argument, Oid relationId)
 	if (relationId == InvalidOid || relationId == MetadataCache.distNodeRelationId)
 	{
 		workerNodeHashValid = false;
+
+		/* establish connections to new workers ahead of use, if desired */
+		RequestConnectionPrewarming();
 	}
 }
 
@@ -40,6 +40,7 @@
 #include "distributed/multi_partitioning_utils.h"
 #include "distributed/pg_dist_node.h"
 #include "distributed/remote_commands.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_transaction.h"
 #include "distributed/version_compat.h"
@@ -184,6 +185,12 @@ stop_metadata_sync_to_node(PG_FUNCTION_ARGS)
 	MarkNodeHasMetadata(nodeNameString, nodePort, false);
 	MarkNodeMetadataSynced(nodeNameString, nodePort, false);
 
+	/*
+	 * Results cached before metadata sync started do not reflect the
+	 * modifications the node made since.
+	 */
+	InvalidateAllSubPlanResults();
+
 	PG_RETURN_VOID();
 }
 
@@ -17,8 +17,10 @@
 #include "catalog/pg_class.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
+#include "distributed/adaptive_executor.h"
 #include "distributed/citus_nodefuncs.h"
 #include "distributed/citus_nodes.h"
+#include "distributed/connection_management.h"
 #include "distributed/cte_inline.h"
 #include "distributed/function_call_delegation.h"
 #include "distributed/insert_select_planner.h"
@@ -154,6 +156,9 @@ distributed_planner(Query *parse, int cursorOptions, ParamListInfo boundParams)
 	}
 	else if (CitusHasBeenLoaded())
 	{
+		/* start or progress establishing connections ahead of use, if desired */
+		PrewarmConnections();
+
 		if (IsLocalReferenceTableJoin(parse, rangeTableList))
 		{
 			/*
@@ -1381,7 +1386,19 @@ FinalizePlan(PlannedStmt *localPlan, DistributedPlan *distributedPlan)
 	Node *distributedPlanData = (Node *) distributedPlan;
 
 	customScan->custom_private = list_make1(distributedPlanData);
-	customScan->flags = CUSTOMPATH_SUPPORT_BACKWARD_SCAN;
+
+	/*
+	 * Streamed results are discarded once read, hence we only claim support
+	 * for backward scans when results are not going to be streamed. That
+	 * way, cursors that are not explicitly declared as SCROLL can stream.
+	 * The executor materializes the results when a backward scan is requested
+	 * nevertheless.
+	 */
+	if (!(EnableResultStreaming && executorType == MULTI_EXECUTOR_ADAPTIVE &&
+		  distributedPlan->modLevel == ROW_MODIFY_READONLY))
+	{
+		customScan->flags = CUSTOMPATH_SUPPORT_BACKWARD_SCAN;
+	}
 
 	if (distributedPlan->masterQuery)
 	{
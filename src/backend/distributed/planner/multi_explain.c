@@ -39,6 +39,7 @@
 #include "distributed/remote_commands.h"
 #include "distributed/recursive_planning.h"
 #include "distributed/placement_connection.h"
+#include "distributed/task_bundling.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/version_compat.h"
 #include "lib/stringinfo.h"
@@ -122,7 +123,36 @@ CitusExplainScan(CustomScanState *node, List *ancestors, struct ExplainState *es
 		ExplainSubPlans(distributedPlan, es);
 	}
 
-	ExplainJob(distributedPlan->workerJob, es);
+	if (distributedPlan->mergeSortClauseList != NIL)
+	{
+		/* the scan returns the rows in order, there is no Sort node above it */
+		ExplainPropertyBool("Sorted Merge", true, es);
+	}
+
+	Job *workerJob = distributedPlan->workerJob;
+
+	if (ShouldBundleTasksPerNode(distributedPlan))
+	{
+		/*
+		 * The tasks are sent to the workers as one UNION ALL query per node,
+		 * so explain the bundled tasks, which are what actually runs.
+		 */
+		List *taskList = workerJob->taskList;
+		List *bundledTaskList = BundleTasksPerNode(taskList);
+		StringInfo bundlingText = makeStringInfo();
+
+		appendStringInfo(bundlingText, "%d shard tasks in %d queries",
+						 list_length(taskList), list_length(bundledTaskList));
+		ExplainPropertyText("Task Bundling", bundlingText->data, es);
+
+		Job *bundledJob = (Job *) palloc(sizeof(Job));
+		*bundledJob = *workerJob;
+		bundledJob->taskList = bundledTaskList;
+
+		workerJob = bundledJob;
+	}
+
+	ExplainJob(workerJob, es);
 
 	ExplainCloseGroup("Distributed Query", "Distributed Query", true, es);
 }
@@ -15,6 +15,7 @@
 
 #include "catalog/pg_type.h"
 #include "commands/extension.h"
+#include "distributed/citus_custom_scan.h"
 #include "distributed/citus_ruleutils.h"
 #include "distributed/function_utils.h"
 #include "distributed/listutils.h"
@@ -46,9 +47,21 @@
 #include "utils/lsyscache.h"
 
 
+/* GUC, determining whether the sorted results of tasks are merged on the master */
+bool EnableSortedMerge = false;
+
+/* GUC, determining whether results are streamed into the master aggregate */
+bool EnableStreamingAggregation = false;
+
+
 static List * MasterTargetList(List *workerTargetList);
 static PlannedStmt * BuildSelectStatement(Query *masterQuery, List *masterTargetList,
-										  CustomScan *remoteScan);
+										  CustomScan *remoteScan,
+										  DistributedPlan *distributedPlan);
+static bool CanMergeSortedTaskResults(Query *masterQuery, List *sortClauseList,
+									  Job *workerJob, CustomScan *remoteScan);
+static AttrNumber WorkerColumnNumber(List *workerTargetList, TargetEntry *targetEntry);
+static uint64 ScanRowLimit(Query *masterQuery);
 static Agg * BuildAggregatePlan(PlannerInfo *root, Query *masterQuery, Plan *subPlan);
 static bool HasDistinctOrOrderByAggregate(Query *masterQuery);
 static bool UseGroupAggregateWithHLL(Query *masterQuery);
@@ -77,7 +90,7 @@ MasterNodeSelectPlan(DistributedPlan *distributedPlan, CustomScan *remoteScan)
 	List *masterTargetList = MasterTargetList(workerTargetList);
 
 	PlannedStmt *masterSelectPlan = BuildSelectStatement(masterQuery, masterTargetList,
-														 remoteScan);
+														 remoteScan, distributedPlan);
 
 	return masterSelectPlan;
 }
@@ -136,9 +149,14 @@ MasterTargetList(List *workerTargetList)
  * node, before returning results to the user. The function first gets the custom
  * scan node for all results fetched to the master, and layers aggregation, sort
  * and limit plans on top of the scan statement if necessary.
+ *
+ * When the scan can return the rows in the right order by merging the sorted
+ * task results, the function records that in the distributed plan instead of
+ * adding a sort plan.
  */
 static PlannedStmt *
-BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *remoteScan)
+BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *remoteScan,
+					 DistributedPlan *distributedPlan)
 {
 	/* top level select query should have only one range table entry */
 	Assert(list_length(masterQuery->rtable) == 1);
@@ -174,6 +192,17 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 		aggregationPlan = BuildAggregatePlan(root, masterQuery, &remoteScan->scan.plan);
 		topLevelPlan = (Plan *) aggregationPlan;
 		selectStatement->planTree = topLevelPlan;
+
+		/*
+		 * Without a sort in between, the aggregate combines the rows as the
+		 * scan returns them, so there is no need to receive all task results
+		 * into the tuple store first.
+		 */
+		if (EnableStreamingAggregation &&
+			outerPlan(aggregationPlan) == &remoteScan->scan.plan)
+		{
+			distributedPlan->streamIntoAggregate = true;
+		}
 	}
 	else
 	{
@@ -230,7 +259,15 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 	}
 
 	/* (4) add a sorting plan if needed */
-	if (sortClauseList)
+	if (sortClauseList && topLevelPlan == &remoteScan->scan.plan &&
+		!masterQuery->hasDistinctOn &&
+		CanMergeSortedTaskResults(masterQuery, sortClauseList,
+								  distributedPlan->workerJob, remoteScan))
+	{
+		/* the scan merges the sorted task results, no need to sort again */
+		distributedPlan->mergeSortClauseList = sortClauseList;
+	}
+	else if (sortClauseList)
 	{
 		Sort *sortPlan = make_sort_from_sortclauses(sortClauseList, topLevelPlan);
 
@@ -260,6 +297,14 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 	{
 		Node *limitCount = masterQuery->limitCount;
 		Node *limitOffset = masterQuery->limitOffset;
+
+		if (topLevelPlan == &remoteScan->scan.plan &&
+			distributedPlan->mergeSortClauseList == NIL)
+		{
+			/* any rows satisfy the limit, the executor can stop once it has enough */
+			distributedPlan->scanRowLimit = ScanRowLimit(masterQuery);
+		}
+
 		Limit *limitPlan = make_limit(topLevelPlan, limitOffset, limitCount);
 		topLevelPlan = (Plan *) limitPlan;
 	}
@@ -285,6 +330,150 @@ BuildSelectStatement(Query *masterQuery, List *masterTargetList, CustomScan *rem
 }
 
 
+/*
+ * CanMergeSortedTaskResults returns true if the worker query sorts its results
+ * in the order of the given sort clauses of the master query, in which case the
+ * adaptive executor can merge the task results instead of sorting all rows.
+ * The worker query only sorts when the ORDER BY is pushed down along with the
+ * LIMIT (see WorkerSortClauseList()).
+ */
+static bool
+CanMergeSortedTaskResults(Query *masterQuery, List *sortClauseList, Job *workerJob,
+						  CustomScan *remoteScan)
+{
+	Query *workerQuery = workerJob->jobQuery;
+	List *workerSortClauseList = workerQuery->sortClause;
+	ListCell *sortClauseCell = NULL;
+	ListCell *workerSortClauseCell = NULL;
+
+	if (!EnableSortedMerge)
+	{
+		return false;
+	}
+
+	/* other executors have no support for merging */
+	if (remoteScan->methods != &AdaptiveExecutorCustomScanMethods)
+	{
+		return false;
+	}
+
+	if (list_length(workerSortClauseList) < list_length(sortClauseList))
+	{
+		return false;
+	}
+
+	forboth(sortClauseCell, sortClauseList, workerSortClauseCell, workerSortClauseList)
+	{
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		SortGroupClause *workerSortClause =
+			(SortGroupClause *) lfirst(workerSortClauseCell);
+		TargetEntry *targetEntry = get_sortgroupclause_tle(sortClause,
+														   masterQuery->targetList);
+		TargetEntry *workerTargetEntry =
+			get_sortgroupclause_tle(workerSortClause, workerQuery->targetList);
+
+		if (sortClause->sortop != workerSortClause->sortop ||
+			sortClause->nulls_first != workerSortClause->nulls_first)
+		{
+			return false;
+		}
+
+		/* the master should sort on the column that the worker sorted on */
+		if (!IsA(targetEntry->expr, Var))
+		{
+			return false;
+		}
+
+		Var *column = (Var *) targetEntry->expr;
+		if (column->varattno != WorkerColumnNumber(workerQuery->targetList,
+												   workerTargetEntry))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * WorkerColumnNumber returns the column number of the given worker target
+ * entry in the results that the master receives, which skip the resjunk
+ * entries (see MasterTargetList()). The function returns InvalidAttrNumber
+ * for resjunk entries.
+ */
+static AttrNumber
+WorkerColumnNumber(List *workerTargetList, TargetEntry *targetEntry)
+{
+	AttrNumber columnNumber = 1;
+
+	if (targetEntry->resjunk)
+	{
+		return InvalidAttrNumber;
+	}
+
+	TargetEntry *workerTargetEntry = NULL;
+	foreach_ptr(workerTargetEntry, workerTargetList)
+	{
+		if (workerTargetEntry == targetEntry)
+		{
+			return columnNumber;
+		}
+
+		if (!workerTargetEntry->resjunk)
+		{
+			columnNumber++;
+		}
+	}
+
+	return InvalidAttrNumber;
+}
+
+
+/*
+ * ScanRowLimit returns the number of rows that the limit and offset of the
+ * master query need from the scan below them, or 0 if the limit is not a
+ * constant.
+ */
+static uint64
+ScanRowLimit(Query *masterQuery)
+{
+	Const *limitCount = (Const *) masterQuery->limitCount;
+	Const *limitOffset = (Const *) masterQuery->limitOffset;
+	uint64 rowLimit = 0;
+
+	/* LIMIT ALL or a parameter, we need all rows */
+	if (limitCount == NULL || !IsA(limitCount, Const) || limitCount->constisnull)
+	{
+		return 0;
+	}
+
+	int64 limitCountValue = DatumGetInt64(limitCount->constvalue);
+	if (limitCountValue <= 0)
+	{
+		/* the Limit node does not read from the scan at all */
+		return 0;
+	}
+
+	rowLimit = (uint64) limitCountValue;
+
+	if (limitOffset != NULL)
+	{
+		if (!IsA(limitOffset, Const))
+		{
+			return 0;
+		}
+
+		if (!limitOffset->constisnull && DatumGetInt64(limitOffset->constvalue) > 0)
+		{
+			rowLimit += (uint64) DatumGetInt64(limitOffset->constvalue);
+		}
+	}
+
+	return rowLimit;
+}
+
+
 /*
  * FinalizeStatement sets some necessary fields on the final statement and its
  * plan to make it work with the regular postgres executor. This code is copied
@@ -4956,8 +4956,10 @@ AssignAnchorShardTaskList(List *taskList)
 	{
 		assignedTaskList = GreedyAssignTaskList(taskList);
 	}
-	else if (TaskAssignmentPolicy == TASK_ASSIGNMENT_FIRST_REPLICA)
+	else if (TaskAssignmentPolicy == TASK_ASSIGNMENT_FIRST_REPLICA ||
+			 TaskAssignmentPolicy == TASK_ASSIGNMENT_LEAST_LATENCY)
 	{
+		/* least-latency reorders placements in the executor at execution time */
 		assignedTaskList = FirstReplicaAssignTaskList(taskList);
 	}
 	else if (TaskAssignmentPolicy == TASK_ASSIGNMENT_ROUND_ROBIN)
@@ -69,6 +69,7 @@
 #include "distributed/query_pushdown_planning.h"
 #include "distributed/recursive_planning.h"
 #include "distributed/relation_restriction_equivalence.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/log_utils.h"
 #include "distributed/version_compat.h"
 #include "lib/stringinfo.h"
@@ -1170,6 +1171,10 @@ CreateDistributedSubPlan(uint32 subPlanId, Query *subPlanQuery)
 	}
 
 	DistributedSubPlan *subPlan = CitusMakeNode(DistributedSubPlan);
+
+	/* deparse the query for the result cache before the planner scribbles on it */
+	subPlan->cacheKey = SubPlanResultCacheKey(subPlanQuery, &subPlan->relationIdList);
+
 	subPlan->plan = planner(subPlanQuery, cursorOptions, NULL);
 	subPlan->subPlanId = subPlanId;
 
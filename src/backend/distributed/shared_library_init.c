@@ -33,6 +33,7 @@
 #include "distributed/cte_inline.h"
 #include "distributed/distributed_deadlock_detection.h"
 #include "distributed/insert_select_executor.h"
+#include "distributed/intermediate_result_compression.h"
 #include "distributed/intermediate_result_pruning.h"
 #include "distributed/local_executor.h"
 #include "distributed/maintenanced.h"
@@ -44,9 +45,11 @@
 #include "distributed/multi_explain.h"
 #include "distributed/multi_join_order.h"
 #include "distributed/multi_logical_optimizer.h"
+#include "distributed/multi_master_planner.h"
 #include "distributed/distributed_planner.h"
 #include "distributed/multi_router_planner.h"
 #include "distributed/multi_server_executor.h"
+#include "distributed/node_health.h"
 #include "distributed/pg_dist_partition.h"
 #include "distributed/placement_connection.h"
 #include "distributed/relation_access_tracking.h"
@@ -55,17 +58,24 @@
 #include "distributed/time_constants.h"
 #include "distributed/query_stats.h"
 #include "distributed/remote_commands.h"
+#include "distributed/remote_transaction.h"
+#include "distributed/shared_connection_stats.h"
+#include "distributed/shared_intermediate_results.h"
 #include "distributed/shared_library_init.h"
 #include "distributed/statistics_collection.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/subplan_result_cache.h"
+#include "distributed/task_bundling.h"
 #include "distributed/task_tracker.h"
 #include "distributed/transaction_management.h"
 #include "distributed/transaction_recovery.h"
+#include "distributed/worker_latency.h"
 #include "distributed/worker_manager.h"
 #include "distributed/worker_protocol.h"
 #include "distributed/worker_shard_visibility.h"
 #include "distributed/adaptive_executor.h"
 #include "port/atomics.h"
+#include "postmaster/bgworker_internals.h"
 #include "postmaster/postmaster.h"
 #include "optimizer/planner.h"
 #include "optimizer/paths.h"
@@ -92,6 +102,7 @@ static bool ErrorIfNotASuitableDeadlockFactor(double *newval, void **extra,
 static bool WarnIfDeprecatedExecutorUsed(int *newval, void **extra, GucSource source);
 static bool NodeConninfoGucCheckHook(char **newval, void **extra, GucSource source);
 static void NodeConninfoGucAssignHook(const char *newval, void *extra);
+static void PrewarmConnectionsGucAssignHook(int newval, void *extra);
 static bool StatisticsCollectionGucCheckHook(bool *newval, void **extra, GucSource
 											 source);
 
@@ -113,6 +124,7 @@ static const struct config_enum_entry task_assignment_policy_options[] = {
 	{ "greedy", TASK_ASSIGNMENT_GREEDY, false },
 	{ "first-replica", TASK_ASSIGNMENT_FIRST_REPLICA, false },
 	{ "round-robin", TASK_ASSIGNMENT_ROUND_ROBIN, false },
+	{ "least-latency", TASK_ASSIGNMENT_LEAST_LATENCY, false },
 	{ NULL, 0, false }
 };
 
@@ -170,6 +182,18 @@ static const struct config_enum_entry multi_shard_modify_connection_options[] =
 	{ NULL, 0, false }
 };
 
+static const struct config_enum_entry intermediate_result_compression_options[] = {
+	{ "none", RESULT_COMPRESSION_NONE, false },
+	{ "pglz", RESULT_COMPRESSION_PGLZ, false },
+#ifdef HAVE_LIBLZ4
+	{ "lz4", RESULT_COMPRESSION_LZ4, false },
+#endif
+#ifdef HAVE_LIBZSTD
+	{ "zstd", RESULT_COMPRESSION_ZSTD, false },
+#endif
+	{ NULL, 0, false }
+};
+
 /* *INDENT-ON* */
 
 
@@ -255,8 +279,13 @@ _PG_init(void)
 	InitializeTransactionManagement();
 	InitializeBackendManagement();
 	InitializeConnectionManagement();
+	InitializeSharedConnectionStats();
 	InitPlacementConnectionManagement();
 	InitializeCitusQueryStats();
+	InitializeWorkerLatency();
+	InitializeNodeHealth();
+	InitializeSharedIntermediateResults();
+	InitializeSubPlanResultCache();
 
 	/* enable modification of pg_catalog tables during pg_upgrade */
 	if (IsBinaryUpgrade)
@@ -346,6 +375,7 @@ StartupCitusBackend(void)
 {
 	InitializeMaintenanceDaemonBackend();
 	InitializeBackendData();
+	RequestConnectionPrewarming();
 }
 
 
@@ -385,13 +415,41 @@ RegisterCitusConfigVariables(void)
 	DefineCustomIntVariable(
 		"citus.node_connection_timeout",
 		gettext_noop("Sets the maximum duration to connect to worker nodes."),
-		NULL,
+		gettext_noop("This also bounds the time spent waiting for a slot in "
+					 "citus.max_shared_pool_size, after which the query errors "
+					 "out."),
 		&NodeConnectionTimeout,
 		5 * MS_PER_SECOND, 10 * MS, MS_PER_HOUR,
 		PGC_USERSET,
 		GUC_UNIT_MS | GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.node_failure_backoff",
+		gettext_noop("Sets the time during which reads avoid a worker after it "
+					 "could not be reached."),
+		gettext_noop("When a worker cannot be reached, read-only queries try "
+					 "placements on other workers first for this long, after "
+					 "which a single query probes the worker again. The time "
+					 "doubles with every consecutive failure, up to "
+					 "citus.max_node_failure_backoff. Use 0 to disable."),
+		&NodeFailureBackoff,
+		0, 0, MS_PER_HOUR,
+		PGC_SIGHUP,
+		GUC_UNIT_MS | GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_node_failure_backoff",
+		gettext_noop("Sets the maximum time during which reads avoid a worker "
+					 "after it could not be reached."),
+		NULL,
+		&MaxNodeFailureBackoff,
+		60 * MS_PER_SECOND, 0, MS_PER_HOUR,
+		PGC_SIGHUP,
+		GUC_UNIT_MS | GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.sslmode",
 		gettext_noop("This variable has been deprecated. Use the citus.node_conninfo "
@@ -447,6 +505,22 @@ RegisterCitusConfigVariables(void)
 		GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.max_local_execution_parallel_workers",
+		gettext_noop("Sets the maximum number of parallel workers used to execute "
+					 "multiple local tasks of a query"),
+		gettext_noop("Local execution runs the tasks on shards that are local to the "
+					 "current node one at a time in the current backend. When set "
+					 "to a value higher than 0, multiple local tasks of a read-only "
+					 "query are combined into a single UNION ALL query, which "
+					 "PostgreSQL can execute using up to this number of parallel "
+					 "workers with each worker executing different tasks."),
+		&MaxLocalExecutionParallelWorkers,
+		0, 0, MAX_PARALLEL_WORKER_LIMIT,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.enable_single_hash_repartition_joins",
 		gettext_noop("Enables single hash repartitioning between hash "
@@ -616,6 +690,38 @@ RegisterCitusConfigVariables(void)
 		GUC_STANDARD,
 		ErrorIfNotASuitableDeadlockFactor, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.defer_commit_prepared",
+		gettext_noop("Leaves committing prepared transactions to the maintenance "
+					 "daemon."),
+		gettext_noop("When enabled, a distributed transaction that uses 2PC "
+					 "returns as soon as the transactions on the workers are "
+					 "prepared and recorded. The maintenance daemon then runs "
+					 "COMMIT PREPARED on the workers. Until it does, writes "
+					 "are not visible on the workers and their locks are "
+					 "still held. When citus.recover_2pc_interval disables "
+					 "automatic recovery, prepared transactions are committed "
+					 "right away."),
+		&DeferCommitPrepared,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_read_only_participant_elision",
+		gettext_noop("Leaves workers that were only read from out of 2PC."),
+		gettext_noop("When enabled, remote transactions that did not modify "
+					 "any placements are committed without being prepared. "
+					 "If at most one remote transaction modified placements "
+					 "and nothing was written locally, 2PC is skipped "
+					 "altogether."),
+		&EnableReadOnlyParticipantElision,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.recover_2pc_interval",
 		gettext_noop("Sets the time to wait between recovering 2PCs."),
@@ -717,6 +823,160 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_MS | GUC_NO_SHOW_ALL,
 		NULL, NULL, NULL);
 
+	DefineCustomBoolVariable(
+		"citus.enable_latency_aware_pool_sizing",
+		gettext_noop("Sizes the connection pools of the executor based on observed "
+					 "latencies"),
+		gettext_noop("When enabled, the adaptive executor tracks how long tasks "
+					 "and connection establishment take on each worker, both "
+					 "within an execution and across executions, and uses them "
+					 "instead of citus.executor_slow_start_interval to decide "
+					 "when to open more connections to a worker. It does not "
+					 "open connections when the existing connections finish the "
+					 "queued tasks before a new connection would be established, "
+					 "and otherwise opens them without waiting."),
+		&EnableLatencyAwarePoolSizing,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.executor_command_batch_size",
+		gettext_noop("Sets the maximum number of tasks the executor sends over a "
+					 "connection at once"),
+		gettext_noop("When a multi-shard command without results runs in a "
+					 "transaction block, such as an UPDATE, TRUNCATE or DDL "
+					 "command, the adaptive executor can send several of the "
+					 "tasks that are queued for a connection as a single "
+					 "multi-statement query. This finishes them in a single "
+					 "round-trip instead of one round-trip per task, which helps "
+					 "when the connections per worker are limited by "
+					 "citus.max_adaptive_executor_pool_size. A value of 1 "
+					 "disables batching."),
+		&ExecutorCommandBatchSize,
+		1, 1, 1000,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_piggybacked_begin",
+		gettext_noop("Sends BEGIN together with the first command on a connection"),
+		gettext_noop("In a transaction block, the adaptive executor opens a remote "
+					 "transaction block and assigns the distributed transaction id "
+					 "on each connection before sending the first task, which takes "
+					 "a separate round-trip. When enabled, these statements are "
+					 "sent in the same query as the first task instead, unless the "
+					 "task requires the extended query protocol."),
+		&EnablePiggybackedBegin,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.hedged_read_delay",
+		gettext_noop("Sets the time after which a slow read is also started on "
+					 "another placement."),
+		gettext_noop("Outside of transaction blocks, when a read-only task has "
+					 "been running on a placement for this long, the adaptive "
+					 "executor also starts it on the next placement of the "
+					 "shard, if any, and uses the results of whichever placement "
+					 "responds first. When citus.enable_latency_aware_pool_sizing "
+					 "is enabled, reads are only hedged once they also take "
+					 "several times longer than usual on the worker. Use 0 to "
+					 "disable."),
+		&HedgedReadDelay,
+		0, 0, MS_PER_HOUR,
+		PGC_USERSET,
+		GUC_UNIT_MS | GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_binary_protocol",
+		gettext_noop("Enables receiving the results of distributed SELECTs in "
+					 "binary format"),
+		gettext_noop("When enabled, the adaptive executor asks the workers to "
+					 "send the rows of SELECT queries in PostgreSQL's binary "
+					 "format and decodes them with the binary receive functions "
+					 "of the column types. This is only done when all result "
+					 "columns support it and at least one column is not a string "
+					 "type, since parsing the text representation of types such "
+					 "as numeric, timestamp and jsonb is where most time goes."),
+		&EnableBinaryProtocol,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_result_streaming",
+		gettext_noop("Enables returning the rows of distributed SELECTs as they "
+					 "arrive from the workers"),
+		gettext_noop("By default, the adaptive executor receives all rows of a "
+					 "distributed SELECT before returning the first one. When "
+					 "enabled, rows are returned as soon as they are received and "
+					 "results are only read from the workers when more rows are "
+					 "needed, which avoids buffering large results on the "
+					 "coordinator and stops early for queries with a LIMIT. Plans "
+					 "created with this setting do not support backward scans, so "
+					 "cursors need to be declared with SCROLL to move backwards."),
+		&EnableResultStreaming,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_sorted_merge",
+		gettext_noop("Enables merging sorted task results on the coordinator"),
+		gettext_noop("When the workers already sort the results of a distributed "
+					 "SELECT by its ORDER BY, which is the case when the ORDER BY "
+					 "is pushed down together with a LIMIT, the adaptive executor "
+					 "can merge the sorted results of the tasks instead of sorting "
+					 "all rows again on the coordinator. Combined with "
+					 "citus.enable_result_streaming, only a few rows of each task "
+					 "need to be received before returning the first row."),
+		&EnableSortedMerge,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_task_bundling",
+		gettext_noop("Enables sending the tasks of a SELECT as one query per worker"),
+		gettext_noop("When enabled, the adaptive executor combines the tasks of a "
+					 "read-only multi-shard query that are placed on the same "
+					 "worker node into a single UNION ALL query, such that the "
+					 "number of round-trips and the planning overhead on the "
+					 "workers depend on the number of nodes rather than the "
+					 "number of shards. The tasks of a node then run over a "
+					 "single connection. Bundling is not used in multi-statement "
+					 "transactions and for queries with FOR UPDATE."),
+		&EnableTaskBundling,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_streaming_aggregation",
+		gettext_noop("Enables combining partial aggregates as they arrive from "
+					 "the workers"),
+		gettext_noop("By default, the coordinator receives the partial aggregates "
+					 "of all shards before combining them, which requires memory "
+					 "proportional to the number of shards times the number of "
+					 "groups. When enabled, the rows are fed into the hash or plain "
+					 "aggregate on the coordinator as they are received, such that "
+					 "memory is bounded by the number of groups."),
+		&EnableStreamingAggregation,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomBoolVariable(
 		"citus.enable_deadlock_prevention",
 		gettext_noop("Avoids deadlocks by preventing concurrent multi-shard commands"),
@@ -876,6 +1136,83 @@ RegisterCitusConfigVariables(void)
 		GUC_UNIT_KB | GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomEnumVariable(
+		"citus.intermediate_result_compression",
+		gettext_noop("Sets the compression method for intermediate results."),
+		gettext_noop("Intermediate results of CTEs and complex subqueries are "
+					 "compressed with this method before they are sent to workers "
+					 "and written to disk. Compressed results are decompressed "
+					 "transparently when they are read. The lz4 and zstd methods "
+					 "are only available when Citus was built with them."),
+		&IntermediateResultCompression,
+		RESULT_COMPRESSION_NONE,
+		intermediate_result_compression_options,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_shared_memory_intermediate_result_size",
+		gettext_noop("Sets the maximum size in KB of intermediate results that are "
+					 "kept in shared memory instead of in files."),
+		gettext_noop("Intermediate results that are written on this node and are "
+					 "smaller than this size are kept in dynamic shared memory, "
+					 "such that reading them does not go through the file system. "
+					 "Larger results, and results that do not fit in the shared "
+					 "memory, are written to files. 0 disables this feature."),
+		&MaxSharedMemoryIntermediateResultSize,
+		0, 0, MAX_KILOBYTES,
+		PGC_SUSET,
+		GUC_UNIT_KB | GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_shared_memory_intermediate_results_total_size",
+		gettext_noop("Sets the maximum total size in KB of intermediate results "
+					 "that are kept in shared memory."),
+		gettext_noop("Once the intermediate results in shared memory reach this "
+					 "size, further results are written to files until results "
+					 "are released at the end of their transaction."),
+		&MaxSharedMemoryIntermediateResultsTotalSize,
+		65536, 0, MAX_KILOBYTES,
+		PGC_SIGHUP,
+		GUC_UNIT_KB | GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomIntVariable(
+		"citus.subplan_result_cache_size",
+		gettext_noop("Sets the maximum size in KB of the subplan results that a "
+					 "session keeps for reuse by later queries."),
+		gettext_noop("When enabled, the results of CTEs and subqueries that only "
+					 "read distributed tables are kept after they are computed. "
+					 "Later queries that contain the same subplan send the kept "
+					 "result to the workers instead of running the subplan again, "
+					 "as long as none of the tables it reads was modified through "
+					 "this node in the meantime. Modifications made directly on "
+					 "the workers are not detected. 0 disables this feature."),
+		&SubPlanResultCacheSize,
+		0, 0, MAX_KILOBYTES,
+		PGC_USERSET,
+		GUC_UNIT_KB | GUC_STANDARD,
+		NULL, NULL, NULL);
+
+	DefineCustomBoolVariable(
+		"citus.enable_concurrent_subplan_execution",
+		gettext_noop("Enables running the tasks of independent subplans at the "
+					 "same time"),
+		gettext_noop("By default, the CTEs and subqueries that are planned "
+					 "separately are executed one after another. When enabled, "
+					 "the tasks of read-only subplans that do not use each other's "
+					 "results run concurrently, such that a query with several "
+					 "independent CTEs takes roughly as long as the slowest one. "
+					 "The subplans share the connections of a single execution "
+					 "(see citus.max_adaptive_executor_pool_size)."),
+		&EnableConcurrentSubPlanExecution,
+		false,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_adaptive_executor_pool_size",
 		gettext_noop("Sets the maximum number of connections per worker node used by "
@@ -949,6 +1286,44 @@ RegisterCitusConfigVariables(void)
 		GUC_STANDARD,
 		NULL, NULL, NULL);
 
+	DefineCustomIntVariable(
+		"citus.prewarm_connections_per_worker",
+		gettext_noop("Sets the number of connections per worker to establish "
+					 "ahead of use."),
+		gettext_noop("When set, each backend starts establishing this many "
+					 "connections to every worker as soon as Citus is first used "
+					 "in the session, and again when the set of workers or this "
+					 "setting changes. The first multi-shard query of a session "
+					 "then finds already established connections. When a worker "
+					 "cannot be reached, prewarming backs off exponentially. TCP "
+					 "keepalive probes of the idle connections can be configured "
+					 "through the keepalives settings in citus.node_conninfo."),
+		&PrewarmConnectionsPerWorker,
+		0, 0, INT_MAX,
+		PGC_USERSET,
+		GUC_STANDARD,
+		NULL, PrewarmConnectionsGucAssignHook, NULL);
+
+	DefineCustomIntVariable(
+		"citus.max_shared_pool_size",
+		gettext_noop("Sets the maximum number of connections allowed per worker node "
+					 "across all the backends from this node. Setting to -1 disables "
+					 "connections throttling. Setting to 0 makes it auto-adjust, "
+					 "meaning equal to max_connections on the coordinator."),
+		gettext_noop("As a rule of thumb, the value should be at most equal to the "
+					 "max_connections on the remote nodes. When the limit is reached, "
+					 "the executor makes do with fewer connections per worker and "
+					 "backends that need a first connection to the worker wait "
+					 "until another backend finishes a transaction that uses "
+					 "one. Cached connections count towards the limit, but are "
+					 "closed at the end of a transaction when the limit is "
+					 "reached or other backends wait for a connection."),
+		&MaxSharedPoolSize,
+		0, -1, INT_MAX,
+		PGC_SIGHUP,
+		GUC_STANDARD,
+		NULL, NULL, NULL);
+
 	DefineCustomIntVariable(
 		"citus.max_assign_task_batch_size",
 		gettext_noop("Sets the maximum number of tasks to assign per round."),
@@ -1092,8 +1467,11 @@ RegisterCitusConfigVariables(void)
 					 "use when making these assignments. The greedy policy aims to "
 					 "evenly distribute tasks across worker nodes, first-replica just "
 					 "assigns tasks in the order shard placements were created, "
-					 "and the round-robin policy assigns tasks to worker nodes in "
-					 "a round-robin fashion."),
+					 "the round-robin policy assigns tasks to worker nodes in "
+					 "a round-robin fashion, and the least-latency policy sends "
+					 "reads to the placement whose worker has the lowest recent "
+					 "task latency weighted by the number of tasks that sessions "
+					 "using this policy currently run on it."),
 		&TaskAssignmentPolicy,
 		TASK_ASSIGNMENT_GREEDY,
 		task_assignment_policy_options,
@@ -1424,6 +1802,17 @@ NodeConninfoGucCheckHook(char **newval, void **extra, GucSource source)
 }
 
 
+/*
+ * PrewarmConnectionsGucAssignHook makes the next distributed query top up the
+ * connection cache to the new citus.prewarm_connections_per_worker.
+ */
+static void
+PrewarmConnectionsGucAssignHook(int newval, void *extra)
+{
+	RequestConnectionPrewarming();
+}
+
+
 /*
  * NodeConninfoGucAssignHook is the assignment hook for the node_conninfo GUC
  * variable. Though this GUC is a "string", we actually parse it as a non-URI
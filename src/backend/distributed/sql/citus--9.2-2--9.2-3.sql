@@ -0,0 +1,7 @@
+#include "udfs/citus_remote_connection_stats/9.2-3.sql"
+#include "udfs/recover_prepared_transactions_with_stats/9.2-3.sql"
+
+CREATE VIEW citus.citus_remote_connection_stats AS
+SELECT * FROM pg_catalog.citus_remote_connection_stats();
+ALTER VIEW citus.citus_remote_connection_stats SET SCHEMA pg_catalog;
+GRANT SELECT ON pg_catalog.citus_remote_connection_stats TO PUBLIC;
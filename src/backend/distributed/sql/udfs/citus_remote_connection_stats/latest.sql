@@ -0,0 +1,12 @@
+CREATE OR REPLACE FUNCTION pg_catalog.citus_remote_connection_stats(
+    OUT hostname text,
+    OUT port int,
+    OUT connection_count_to_node int)
+RETURNS SETOF RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$citus_remote_connection_stats$$;
+COMMENT ON FUNCTION pg_catalog.citus_remote_connection_stats(
+    OUT hostname text,
+    OUT port int,
+    OUT connection_count_to_node int)
+IS 'returns the number of connections from all backends of this node to each worker';
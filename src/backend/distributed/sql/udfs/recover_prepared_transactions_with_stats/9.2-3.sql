@@ -0,0 +1,14 @@
+CREATE OR REPLACE FUNCTION pg_catalog.recover_prepared_transactions_with_stats(
+    OUT recovered_transaction_count int,
+    OUT processed_record_count int,
+    OUT deleted_record_count int,
+    OUT duration_ms bigint)
+RETURNS RECORD
+LANGUAGE C STRICT
+AS 'MODULE_PATHNAME', $$recover_prepared_transactions_with_stats$$;
+COMMENT ON FUNCTION pg_catalog.recover_prepared_transactions_with_stats(
+    OUT recovered_transaction_count int,
+    OUT processed_record_count int,
+    OUT deleted_record_count int,
+    OUT duration_ms bigint)
+IS 'recovers any pending prepared transactions and returns the work done';
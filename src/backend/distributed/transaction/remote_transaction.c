@@ -18,6 +18,7 @@
 #include "distributed/backend_data.h"
 #include "distributed/connection_management.h"
 #include "distributed/metadata_cache.h"
+#include "distributed/placement_connection.h"
 #include "distributed/remote_commands.h"
 #include "distributed/remote_transaction.h"
 #include "distributed/transaction_identifier.h"
@@ -30,6 +31,15 @@
 
 #define PREPARED_TRANSACTION_NAME_FORMAT "citus_%u_%u_"UINT64_FORMAT "_%u"
 
+/* BEGIN and assign_distributed_transaction_id(), see below */
+#define BEGIN_AND_SET_DISTRIBUTED_TRANSACTION_ID_STATEMENT_COUNT 2
+
+/* GUC, determining whether COMMIT PREPARED is left to the maintenance daemon */
+bool DeferCommitPrepared = false;
+
+/* GUC, determining whether read-only participants are left out of 2PC */
+bool EnableReadOnlyParticipantElision = false;
+
 
 static void StartRemoteTransactionSavepointBegin(MultiConnection *connection,
 												 SubTransactionId subId);
@@ -45,6 +55,8 @@ static void FinishRemoteTransactionSavepointRollback(MultiConnection *connection
 													 SubTransactionId subId);
 
 static void Assign2PCIdentifier(MultiConnection *connection);
+static void SendRemoteTransactionPrepare(MultiConnection *connection);
+static bool RemoteTransactionIsReadOnly(MultiConnection *connection);
 static void WarnAboutLeakedPreparedTransaction(MultiConnection *connection, bool commit);
 
 
@@ -56,6 +68,37 @@ static void WarnAboutLeakedPreparedTransaction(MultiConnection *connection, bool
  */
 void
 StartRemoteTransactionBegin(struct MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+
+	int statementCount = 0;
+	StringInfo beginAndSetDistributedTransactionId =
+		StartRemoteTransactionBeginCommand(connection, &statementCount);
+
+	if (!SendRemoteCommand(connection, beginAndSetDistributedTransactionId->data))
+	{
+		const bool raiseErrors = true;
+
+		HandleRemoteTransactionConnectionError(connection, raiseErrors);
+	}
+
+	transaction->beginSent = true;
+}
+
+
+/*
+ * StartRemoteTransactionBeginCommand marks the remote transaction as starting
+ * and returns the command that opens the transaction block, assigns the
+ * distributed transaction id and restores the savepoints and SET LOCAL
+ * context of the current transaction. statementCount is set to the number of
+ * statements in the command, each of which produces a single result.
+ *
+ * The caller is responsible for sending the command, possibly followed by
+ * other statements in the same query, and for setting beginSent.
+ */
+StringInfo
+StartRemoteTransactionBeginCommand(struct MultiConnection *connection,
+								   int *statementCount)
 {
 	RemoteTransaction *transaction = &connection->remoteTransaction;
 	ListCell *subIdCell = NULL;
@@ -69,6 +112,7 @@ StartRemoteTransactionBegin(struct MultiConnection *connection)
 
 	StringInfo beginAndSetDistributedTransactionId =
 		BeginAndSetDistributedTransactionIdCommand();
+	*statementCount = BEGIN_AND_SET_DISTRIBUTED_TRANSACTION_ID_STATEMENT_COUNT;
 
 	/* append context for in-progress SAVEPOINTs for this transaction */
 	List *activeSubXacts = ActiveSubXactContexts();
@@ -83,11 +127,13 @@ StartRemoteTransactionBegin(struct MultiConnection *connection)
 		{
 			appendStringInfoString(beginAndSetDistributedTransactionId,
 								   subXactState->setLocalCmds->data);
+			*statementCount += subXactState->setLocalCmdCount;
 		}
 
 		/* ... then append SAVEPOINT to enter this subxact */
 		appendStringInfo(beginAndSetDistributedTransactionId,
 						 "SAVEPOINT savepoint_%u;", subXactState->subId);
+		(*statementCount)++;
 		transaction->lastQueuedSubXact = subXactState->subId;
 	}
 
@@ -95,16 +141,10 @@ StartRemoteTransactionBegin(struct MultiConnection *connection)
 	if (activeSetStmts != NULL)
 	{
 		appendStringInfoString(beginAndSetDistributedTransactionId, activeSetStmts->data);
+		*statementCount += activeSetStmtCount;
 	}
 
-	if (!SendRemoteCommand(connection, beginAndSetDistributedTransactionId->data))
-	{
-		const bool raiseErrors = true;
-
-		HandleRemoteTransactionConnectionError(connection, raiseErrors);
-	}
-
-	transaction->beginSent = true;
+	return beginAndSetDistributedTransactionId;
 }
 
 
@@ -485,8 +525,6 @@ void
 StartRemoteTransactionPrepare(struct MultiConnection *connection)
 {
 	RemoteTransaction *transaction = &connection->remoteTransaction;
-	StringInfoData command;
-	const bool raiseErrors = true;
 
 	/* can't prepare a nonexistant transaction */
 	Assert(transaction->transactionState != REMOTE_TRANS_NOT_STARTED);
@@ -506,6 +544,21 @@ StartRemoteTransactionPrepare(struct MultiConnection *connection)
 		LogTransactionRecord(workerNode->groupId, transaction->preparedName);
 	}
 
+	SendRemoteTransactionPrepare(connection);
+}
+
+
+/*
+ * SendRemoteTransactionPrepare sends PREPARE TRANSACTION for the 2PC
+ * identifier that was assigned to the remote transaction.
+ */
+static void
+SendRemoteTransactionPrepare(MultiConnection *connection)
+{
+	RemoteTransaction *transaction = &connection->remoteTransaction;
+	StringInfoData command;
+	const bool raiseErrors = true;
+
 	initStringInfo(&command);
 	appendStringInfo(&command, "PREPARE TRANSACTION %s",
 					 quote_literal_cstr(transaction->preparedName));
@@ -622,6 +675,12 @@ RemoteTransactionsBeginIfNecessary(List *connectionList)
 		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
 		RemoteTransaction *transaction = &connection->remoteTransaction;
 
+		/*
+		 * Commands sent outside of the executor, e.g. DDL or COPY, are not
+		 * known to be read-only.
+		 */
+		transaction->mayHaveWritten = true;
+
 		/* can't send BEGIN if a command already is in progress */
 		Assert(PQtransactionStatus(connection->pgConn) != PQTRANS_ACTIVE);
 
@@ -801,12 +860,18 @@ ResetRemoteTransaction(struct MultiConnection *connection)
 /*
  * CoordinatedRemoteTransactionsPrepare PREPAREs a 2PC transaction on all
  * non-failed transactions participating in the coordinated transaction.
+ *
+ * When citus.enable_read_only_participant_elision is enabled, transactions
+ * that only read are committed right away instead. They have nothing to
+ * roll back or forward, so they do not need to take part in the protocol.
  */
 void
 CoordinatedRemoteTransactionsPrepare(void)
 {
 	dlist_iter iter;
 	List *connectionList = NIL;
+	List *groupIdList = NIL;
+	List *transactionNameList = NIL;
 
 	/* issue PREPARE TRANSACTION; to all relevant remote nodes */
 
@@ -825,10 +890,35 @@ CoordinatedRemoteTransactionsPrepare(void)
 			continue;
 		}
 
-		StartRemoteTransactionPrepare(connection);
+		Assert(transaction->transactionState < REMOTE_TRANS_PREPARING);
+
+		if (EnableReadOnlyParticipantElision && RemoteTransactionIsReadOnly(connection))
+		{
+			StartRemoteTransactionCommit(connection);
+			connectionList = lappend(connectionList, connection);
+			continue;
+		}
+
+		Assign2PCIdentifier(connection);
+		SendRemoteTransactionPrepare(connection);
 		connectionList = lappend(connectionList, connection);
+
+		WorkerNode *workerNode = FindWorkerNode(connection->hostname, connection->port);
+		if (workerNode != NULL)
+		{
+			groupIdList = lappend_int(groupIdList, workerNode->groupId);
+			transactionNameList = lappend(transactionNameList,
+										  transaction->preparedName);
+		}
 	}
 
+	/*
+	 * Log the transactions to workers in pg_dist_transaction while the workers
+	 * prepare. The records only become visible if the local transaction commits,
+	 * so it does not matter that they are written after sending PREPARE.
+	 */
+	LogTransactionRecordList(groupIdList, transactionNameList);
+
 	bool raiseInterrupts = true;
 	WaitForAllConnections(connectionList, raiseInterrupts);
 
@@ -839,6 +929,13 @@ CoordinatedRemoteTransactionsPrepare(void)
 													  iter.cur);
 		RemoteTransaction *transaction = &connection->remoteTransaction;
 
+		if (transaction->transactionState == REMOTE_TRANS_1PC_COMMITTING)
+		{
+			/* read-only participant */
+			FinishRemoteTransactionCommit(connection);
+			continue;
+		}
+
 		if (transaction->transactionState != REMOTE_TRANS_PREPARING)
 		{
 			continue;
@@ -851,19 +948,70 @@ CoordinatedRemoteTransactionsPrepare(void)
 }
 
 
+/*
+ * CountModifyingRemoteTransactions returns the number of remote transactions
+ * participating in the coordinated transaction that may have written data.
+ */
+int
+CountModifyingRemoteTransactions(void)
+{
+	dlist_iter iter;
+	int modifyingTransactionCount = 0;
+
+	dlist_foreach(iter, &InProgressTransactions)
+	{
+		MultiConnection *connection = dlist_container(MultiConnection, transactionNode,
+													  iter.cur);
+
+		if (!RemoteTransactionIsReadOnly(connection))
+		{
+			modifyingTransactionCount++;
+		}
+	}
+
+	return modifyingTransactionCount;
+}
+
+
+/*
+ * RemoteTransactionIsReadOnly returns true if the remote transaction on the
+ * given connection is known to have only read placements, that is the
+ * connection only ran SELECT tasks without volatile functions. Delegated
+ * function calls and commands sent outside of the executor, e.g. to propagate
+ * DDL or metadata via worker_transaction.c, are conservatively considered to
+ * have written.
+ */
+static bool
+RemoteTransactionIsReadOnly(MultiConnection *connection)
+{
+	return ConnectionUsedForAnyPlacements(connection) &&
+		   !ConnectionModifiedPlacement(connection) &&
+		   !connection->remoteTransaction.mayHaveWritten;
+}
+
+
 /*
  * CoordinatedRemoteTransactionsCommit performs distributed transactions
  * handling at commit time. This will be called at XACT_EVENT_PRE_COMMIT if
  * 1PC commits are used - so shards can still be invalidated - and at
  * XACT_EVENT_COMMIT if 2PC is being used.
  *
+ * When citus.defer_commit_prepared is enabled, prepared transactions are not
+ * committed here, but left to 2PC recovery in the maintenance daemon, which
+ * commits them based on the pg_dist_transaction records. The function returns
+ * whether that was the case for any of the transactions, such that the caller
+ * can trigger recovery once the distributed transaction has ended. Since the
+ * maintenance daemon only runs recovery when citus.recover_2pc_interval
+ * enables it, we commit right away otherwise.
+ *
  * Note that this routine has to issue rollbacks for failed transactions.
  */
-void
+bool
 CoordinatedRemoteTransactionsCommit(void)
 {
 	dlist_iter iter;
 	List *connectionList = NIL;
+	bool commitPreparedDeferred = false;
 
 	/*
 	 * Issue appropriate transaction commands to remote nodes. If everything
@@ -887,6 +1035,15 @@ CoordinatedRemoteTransactionsCommit(void)
 			continue;
 		}
 
+		if (DeferCommitPrepared && Recover2PCInterval > 0 &&
+			!transaction->transactionFailed &&
+			transaction->transactionState == REMOTE_TRANS_PREPARED)
+		{
+			/* the connection is idle after PREPARE, so it can be reused as is */
+			commitPreparedDeferred = true;
+			continue;
+		}
+
 		StartRemoteTransactionCommit(connection);
 		connectionList = lappend(connectionList, connection);
 	}
@@ -912,6 +1069,8 @@ CoordinatedRemoteTransactionsCommit(void)
 
 		FinishRemoteTransactionCommit(connection);
 	}
+
+	return commitPreparedDeferred;
 }
 
 
@@ -19,16 +19,19 @@
 
 #include "access/twophase.h"
 #include "access/xact.h"
+#include "distributed/adaptive_executor.h"
 #include "distributed/backend_data.h"
 #include "distributed/connection_management.h"
 #include "distributed/distributed_planner.h"
 #include "distributed/hash_helpers.h"
 #include "distributed/intermediate_results.h"
 #include "distributed/local_executor.h"
+#include "distributed/maintenanced.h"
 #include "distributed/multi_executor.h"
 #include "distributed/transaction_management.h"
 #include "distributed/placement_connection.h"
 #include "distributed/subplan_execution.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/version_compat.h"
 #include "utils/hsearch.h"
 #include "utils/guc.h"
@@ -73,6 +76,9 @@ dlist_head InProgressTransactions = DLIST_STATIC_INIT(InProgressTransactions);
  */
 StringInfo activeSetStmts;
 
+/* number of statements in activeSetStmts */
+int activeSetStmtCount = 0;
+
 /*
  * Though a list, we treat this as a stack, pushing on subxact contexts whenever
  * e.g. a SAVEPOINT is executed (though this is actually performed by providing
@@ -108,6 +114,7 @@ static void PushSubXact(SubTransactionId subId);
 static void PopSubXact(SubTransactionId subId);
 static void SwallowErrors(void (*func)());
 static bool MaybeExecutingUDF(void);
+static bool CoordinatedTransactionRequires2PC(void);
 
 
 /*
@@ -225,6 +232,7 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 */
 			MemoryContext previousContext = CurrentMemoryContext;
 			MemoryContextSwitchTo(CommitContext);
+			bool commitPreparedDeferred = false;
 
 			/*
 			 * Call other parts of citus that need to integrate into
@@ -236,9 +244,16 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			if (CurrentCoordinatedTransactionState == COORD_TRANS_PREPARED)
 			{
 				/* handles both already prepared and open transactions */
-				CoordinatedRemoteTransactionsCommit();
+				commitPreparedDeferred = CoordinatedRemoteTransactionsCommit();
 			}
 
+			/*
+			 * Outdate cached results of modified tables. Deferred commits are
+			 * not visible on the workers yet, recovery outdates results again
+			 * once it committed them.
+			 */
+			ResetSubPlanResultCacheTransactionState(true);
+
 			/* close connections etc. */
 			if (CurrentCoordinatedTransactionState != COORD_TRANS_NONE)
 			{
@@ -252,10 +267,20 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			TransactionConnectedToLocalGroup = false;
 			dlist_init(&InProgressTransactions);
 			activeSetStmts = NULL;
+			activeSetStmtCount = 0;
 			CoordinatedTransactionUses2PC = false;
 
 			UnSetDistributedTransactionId();
 
+			if (commitPreparedDeferred)
+			{
+				/*
+				 * Let the maintenance daemon commit the prepared transactions now
+				 * that the distributed transaction is no longer in progress.
+				 */
+				TriggerTransactionRecovery(MyDatabaseId);
+			}
+
 			/* empty the CommitContext to ensure we're not leaking memory */
 			MemoryContextSwitchTo(previousContext);
 			MemoryContextReset(CommitContext);
@@ -287,6 +312,7 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				SwallowErrors(RemoveIntermediateResultsDirectory);
 			}
 			ResetShardPlacementTransactionState();
+			ResetSubPlanResultCacheTransactionState(false);
 
 			/* handles both already prepared and open transactions */
 			if (CurrentCoordinatedTransactionState > COORD_TRANS_IDLE)
@@ -307,6 +333,7 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			TransactionConnectedToLocalGroup = false;
 			dlist_init(&InProgressTransactions);
 			activeSetStmts = NULL;
+			activeSetStmtCount = 0;
 			CoordinatedTransactionUses2PC = false;
 
 			/*
@@ -359,6 +386,7 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 * ids on the worker nodes.
 			 */
 			RemoveIntermediateResultsDirectory();
+			ResetSubPlanResultCacheTransactionState(false);
 
 			UnSetDistributedTransactionId();
 			break;
@@ -381,6 +409,12 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 				break;
 			}
 
+			/*
+			 * Cursors that are still open might stream results over connections
+			 * that we need for committing, receive their remaining rows first.
+			 */
+			FinishActiveStreamingExecutions();
+
 			/*
 			 * TODO: It'd probably be a good idea to force constraints and
 			 * such to 'immediate' here. Deferred triggers might try to send
@@ -397,6 +431,12 @@ CoordinatedTransactionCallback(XactEvent event, void *arg)
 			 */
 			MarkFailedShardPlacements();
 
+			if (CoordinatedTransactionUses2PC && EnableReadOnlyParticipantElision &&
+				!CoordinatedTransactionRequires2PC())
+			{
+				CoordinatedTransactionUses2PC = false;
+			}
+
 			if (CoordinatedTransactionUses2PC)
 			{
 				CoordinatedRemoteTransactionsPrepare();
@@ -484,6 +524,9 @@ CoordinatedSubTransactionCallback(SubXactEvent event, SubTransactionId subId,
 			PushSubXact(subId);
 			if (InCoordinatedTransaction())
 			{
+				/* connections need to be idle to send SAVEPOINT */
+				FinishActiveStreamingExecutions();
+
 				CoordinatedRemoteTransactionsSavepointBegin(subId);
 			}
 			break;
@@ -561,10 +604,12 @@ PushSubXact(SubTransactionId subId)
 	SubXactContext *state = palloc(sizeof(SubXactContext));
 	state->subId = subId;
 	state->setLocalCmds = activeSetStmts;
+	state->setLocalCmdCount = activeSetStmtCount;
 
 	/* append to list and reset active set stmts for upcoming sub-xact */
 	activeSubXactContexts = lcons(state, activeSubXactContexts);
 	activeSetStmts = makeStringInfo();
+	activeSetStmtCount = 0;
 
 	MemoryContextSwitchTo(old_context);
 }
@@ -584,6 +629,7 @@ PopSubXact(SubTransactionId subId)
 	 */
 	Assert(state->subId == subId);
 	activeSetStmts = state->setLocalCmds;
+	activeSetStmtCount = state->setLocalCmdCount;
 	activeSubXactContexts = list_delete_first(activeSubXactContexts);
 
 	MemoryContextSwitchTo(old_context);
@@ -726,3 +772,23 @@ MaybeExecutingUDF(void)
 {
 	return ExecutorLevel > 1 || (ExecutorLevel == 1 && PlannerLevel > 0);
 }
+
+
+/*
+ * CoordinatedTransactionRequires2PC returns whether committing the coordinated
+ * transaction atomically requires 2PC. That is not the case when at most one
+ * remote transaction wrote data and the local transaction did not write
+ * anything, since committing the remote transactions in PRE_COMMIT then
+ * either makes all writes visible or none.
+ */
+static bool
+CoordinatedTransactionRequires2PC(void)
+{
+	if (TransactionIdIsValid(GetTopTransactionIdIfAny()))
+	{
+		/* the local transaction is a participant as well */
+		return true;
+	}
+
+	return CountModifyingRemoteTransactions() > 1;
+}
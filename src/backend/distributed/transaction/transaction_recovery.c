@@ -13,6 +13,7 @@
  */
 
 #include "postgres.h"
+#include "funcapi.h"
 #include "miscadmin.h"
 #include "libpq-fe.h"
 
@@ -29,10 +30,12 @@
 #include "catalog/indexing.h"
 #include "distributed/backend_data.h"
 #include "distributed/connection_management.h"
+#include "distributed/hash_helpers.h"
 #include "distributed/listutils.h"
 #include "distributed/metadata_cache.h"
 #include "distributed/pg_dist_transaction.h"
 #include "distributed/remote_commands.h"
+#include "distributed/subplan_result_cache.h"
 #include "distributed/transaction_recovery.h"
 #include "distributed/worker_manager.h"
 #include "distributed/version_compat.h"
@@ -43,19 +46,56 @@
 #include "utils/fmgroids.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/timestamp.h"
 
 
 /* exports for SQL callable functions */
 PG_FUNCTION_INFO_V1(recover_prepared_transactions);
+PG_FUNCTION_INFO_V1(recover_prepared_transactions_with_stats);
+
+
+/*
+ * WorkerRecoveryState tracks the progress of 2PC recovery on a single worker
+ * within a recovery round.
+ */
+typedef struct WorkerRecoveryState
+{
+	/* hash key, group ID of the worker */
+	int32 groupId;
+
+	MultiConnection *connection;
+
+	/* prepared transactions observed before and after the pg_dist_transaction scan */
+	HTAB *pendingTransactionSet;
+	HTAB *recheckTransactionSet;
+
+	/* prepared transactions to commit, and the pointers to their recovery records */
+	List *commitTransactionList;
+	List *commitRecordList;
+
+	/* prepared transactions to abort */
+	List *abortTransactionList;
+
+	/* set when recovering a transaction failed, skips the rest of the worker */
+	bool recoveryFailed;
+} WorkerRecoveryState;
 
 
 /* Local functions forward declarations */
-static int RecoverWorkerTransactions(WorkerNode *workerNode);
+static void FetchPendingWorkerTransactions(List *recoveryStateList, bool isRecheck);
 static List * PendingWorkerTransactionList(MultiConnection *connection);
 static bool IsTransactionInProgress(HTAB *activeTransactionNumberSet,
 									char *preparedTransactionName);
-static bool RecoverPreparedTransactionOnWorker(MultiConnection *connection,
-											   char *transactionName, bool shouldCommit);
+static int RecoverPreparedTransactionsOnWorkers(List *recoveryStateList,
+												bool shouldCommit,
+												Relation pgDistTransaction,
+												TransactionRecoveryStats *stats);
+static bool StartRecoverPreparedTransaction(MultiConnection *connection,
+											char *transactionName, bool shouldCommit);
+static bool FinishRecoverPreparedTransaction(MultiConnection *connection,
+											 char *transactionName, bool shouldCommit);
+static char * RecoverPreparedTransactionCommand(char *transactionName,
+												bool shouldCommit);
 
 
 /*
@@ -73,6 +113,42 @@ recover_prepared_transactions(PG_FUNCTION_ARGS)
 }
 
 
+/*
+ * recover_prepared_transactions_with_stats recovers any pending prepared
+ * transactions started by this node on other nodes, and returns the work
+ * done in the recovery round.
+ */
+Datum
+recover_prepared_transactions_with_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc tupleDescriptor = NULL;
+	TransactionRecoveryStats stats;
+	Datum values[4];
+	bool isNulls[4];
+
+	CheckCitusVersion(ERROR);
+
+	if (get_call_result_type(fcinfo, NULL, &tupleDescriptor) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "return type must be a row type");
+	}
+
+	RecoverTwoPhaseCommitsWithStats(&stats);
+
+	memset(values, 0, sizeof(values));
+	memset(isNulls, false, sizeof(isNulls));
+
+	values[0] = Int32GetDatum(stats.recoveredTransactionCount);
+	values[1] = Int32GetDatum(stats.processedRecordCount);
+	values[2] = Int32GetDatum(stats.deletedRecordCount);
+	values[3] = Int64GetDatum(stats.durationMillisecs);
+
+	HeapTuple heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heapTuple));
+}
+
+
 /*
  * LogTransactionRecord registers the fact that a transaction has been
  * prepared on a worker. The presence of this record indicates that the
@@ -80,24 +156,55 @@ recover_prepared_transactions(PG_FUNCTION_ARGS)
  */
 void
 LogTransactionRecord(int32 groupId, char *transactionName)
+{
+	LogTransactionRecordList(list_make1_int(groupId), list_make1(transactionName));
+}
+
+
+/*
+ * LogTransactionRecordList registers the transactions that have been prepared
+ * on the given groups, in order, in a single pass over pg_dist_transaction
+ * and its indexes.
+ */
+void
+LogTransactionRecordList(List *groupIdList, List *transactionNameList)
 {
 	Datum values[Natts_pg_dist_transaction];
 	bool isNulls[Natts_pg_dist_transaction];
+	ListCell *groupIdCell = NULL;
+	ListCell *transactionNameCell = NULL;
 
-	/* form new transaction tuple */
-	memset(values, 0, sizeof(values));
-	memset(isNulls, false, sizeof(isNulls));
-
-	values[Anum_pg_dist_transaction_groupid - 1] = Int32GetDatum(groupId);
-	values[Anum_pg_dist_transaction_gid - 1] = CStringGetTextDatum(transactionName);
+	if (groupIdList == NIL)
+	{
+		return;
+	}
 
-	/* open transaction relation and insert new tuple */
+	/* open transaction relation and its indexes once for all tuples */
 	Relation pgDistTransaction = heap_open(DistTransactionRelationId(), RowExclusiveLock);
+	CatalogIndexState indexState = CatalogOpenIndexes(pgDistTransaction);
 
 	TupleDesc tupleDescriptor = RelationGetDescr(pgDistTransaction);
-	HeapTuple heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
 
-	CatalogTupleInsert(pgDistTransaction, heapTuple);
+	forboth(groupIdCell, groupIdList, transactionNameCell, transactionNameList)
+	{
+		int32 groupId = lfirst_int(groupIdCell);
+		char *transactionName = (char *) lfirst(transactionNameCell);
+
+		/* form new transaction tuple */
+		memset(values, 0, sizeof(values));
+		memset(isNulls, false, sizeof(isNulls));
+
+		values[Anum_pg_dist_transaction_groupid - 1] = Int32GetDatum(groupId);
+		values[Anum_pg_dist_transaction_gid - 1] = CStringGetTextDatum(transactionName);
+
+		HeapTuple heapTuple = heap_form_tuple(tupleDescriptor, values, isNulls);
+
+		CatalogTupleInsertWithInfo(pgDistTransaction, heapTuple, indexState);
+
+		heap_freetuple(heapTuple);
+	}
+
+	CatalogCloseIndexes(indexState);
 
 	CommandCounterIncrement();
 
@@ -113,70 +220,124 @@ LogTransactionRecord(int32 groupId, char *transactionName)
 int
 RecoverTwoPhaseCommits(void)
 {
-	ListCell *workerNodeCell = NULL;
-	int recoveredTransactionCount = 0;
-
-	List *workerList = ActivePrimaryNodeList(NoLock);
-
-	foreach(workerNodeCell, workerList)
-	{
-		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+	TransactionRecoveryStats stats;
 
-		recoveredTransactionCount += RecoverWorkerTransactions(workerNode);
-	}
+	RecoverTwoPhaseCommitsWithStats(&stats);
 
-	return recoveredTransactionCount;
+	return stats.recoveredTransactionCount;
 }
 
 
 /*
- * RecoverWorkerTransactions recovers any pending prepared transactions
- * started by this node on the specified worker.
+ * RecoverTwoPhaseCommitsWithStats recovers any pending prepared transactions
+ * started by this node on other nodes, and reports the work done in stats.
+ *
+ * The prepared transactions on all workers are fetched concurrently and
+ * pg_dist_transaction is scanned only once per round, rather than once per
+ * worker. The COMMIT/ROLLBACK PREPARED commands are also sent to all workers
+ * concurrently, one transaction per worker at a time. Recovery records without
+ * a prepared transaction are deleted during the scan, and those of committed
+ * transactions once the commit succeeded.
+ *
+ * pg_dist_transaction has no column that orders its records, so every round
+ * looks at all of them.
  */
-static int
-RecoverWorkerTransactions(WorkerNode *workerNode)
+void
+RecoverTwoPhaseCommitsWithStats(TransactionRecoveryStats *stats)
 {
-	int recoveredTransactionCount = 0;
-
-	int32 groupId = workerNode->groupId;
-	char *nodeName = workerNode->workerName;
-	int nodePort = workerNode->workerPort;
-
+	ListCell *workerNodeCell = NULL;
+	List *connectionList = NIL;
+	List *recoveryStateList = NIL;
+	HASHCTL info;
 
 	ScanKeyData scanKey[1];
-	int scanKeyCount = 1;
-	bool indexOK = true;
+	int scanKeyCount = 0;
+	bool indexOK = false;
 	HeapTuple heapTuple = NULL;
 
-	HASH_SEQ_STATUS status;
+	TimestampTz startTime = GetCurrentTimestamp();
 
-	bool recoveryFailed = false;
+	memset(stats, 0, sizeof(TransactionRecoveryStats));
 
-	int connectionFlags = 0;
-	MultiConnection *connection = GetNodeConnection(connectionFlags, nodeName, nodePort);
-	if (connection->pgConn == NULL || PQstatus(connection->pgConn) != CONNECTION_OK)
+	List *workerList = ActivePrimaryNodeList(NoLock);
+	if (workerList == NIL)
 	{
-		ereport(WARNING, (errmsg("transaction recovery cannot connect to %s:%d",
-								 nodeName, nodePort)));
-
-		return 0;
+		return;
 	}
 
 	MemoryContext localContext = AllocSetContextCreateExtended(CurrentMemoryContext,
-															   "RecoverWorkerTransactions",
+															   "RecoverTwoPhaseCommits",
 															   ALLOCSET_DEFAULT_MINSIZE,
 															   ALLOCSET_DEFAULT_INITSIZE,
 															   ALLOCSET_DEFAULT_MAXSIZE);
 
 	MemoryContext oldContext = MemoryContextSwitchTo(localContext);
 
+	/* establish the connections to all workers concurrently */
+	foreach(workerNodeCell, workerList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		int connectionFlags = 0;
+
+		MultiConnection *connection = StartNodeConnection(connectionFlags,
+														  workerNode->workerName,
+														  workerNode->workerPort);
+		connectionList = lappend(connectionList, connection);
+	}
+
+	FinishConnectionListEstablishment(connectionList);
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int32);
+	info.entrysize = sizeof(WorkerRecoveryState);
+	info.hcxt = localContext;
+
+	HTAB *recoveryStateHash = hash_create("Worker Recovery State Hash",
+										  list_length(workerList), &info,
+										  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	ListCell *connectionCell = NULL;
+	forboth(workerNodeCell, workerList, connectionCell, connectionList)
+	{
+		WorkerNode *workerNode = (WorkerNode *) lfirst(workerNodeCell);
+		MultiConnection *connection = (MultiConnection *) lfirst(connectionCell);
+		bool found = false;
+
+		if (connection->pgConn == NULL || PQstatus(connection->pgConn) != CONNECTION_OK)
+		{
+			ereport(WARNING, (errmsg("transaction recovery cannot connect to %s:%d",
+									 workerNode->workerName,
+									 workerNode->workerPort)));
+			continue;
+		}
+
+		WorkerRecoveryState *recoveryState = hash_search(recoveryStateHash,
+														 &workerNode->groupId,
+														 HASH_ENTER, &found);
+		if (found)
+		{
+			/* several active primaries in the same group should not happen */
+			continue;
+		}
+
+		recoveryState->connection = connection;
+		recoveryState->pendingTransactionSet = NULL;
+		recoveryState->recheckTransactionSet = NULL;
+		recoveryState->commitTransactionList = NIL;
+		recoveryState->commitRecordList = NIL;
+		recoveryState->abortTransactionList = NIL;
+		recoveryState->recoveryFailed = false;
+
+		recoveryStateList = lappend(recoveryStateList, recoveryState);
+	}
+
 	/* take table lock first to avoid running concurrently */
 	Relation pgDistTransaction = heap_open(DistTransactionRelationId(),
 										   ShareUpdateExclusiveLock);
 	TupleDesc tupleDescriptor = RelationGetDescr(pgDistTransaction);
 
 	/*
-	 * We're going to check the list of prepared transactions on the worker,
+	 * We're going to check the list of prepared transactions on the workers,
 	 * but some of those prepared transactions might belong to ongoing
 	 * distributed transactions.
 	 *
@@ -205,32 +366,27 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 	 * We therefore observe the set of prepared transactions one more time in
 	 * step 4. The aforementioned transactions would show up in Q, but not in
 	 * P. We can skip those transactions and recover them later.
+	 *
+	 * Steps 1 and 4 are performed for all workers at once, which preserves
+	 * the order for each individual worker.
 	 */
 
-	/* find stale prepared transactions on the remote node */
-	List *pendingTransactionList = PendingWorkerTransactionList(connection);
-	HTAB *pendingTransactionSet = ListToHashSet(pendingTransactionList, NAMEDATALEN,
-												true);
+	/* find stale prepared transactions on the remote nodes */
+	FetchPendingWorkerTransactions(recoveryStateList, false);
 
 	/* find in-progress distributed transactions */
 	List *activeTransactionNumberList = ActiveDistributedTransactionNumbers();
 	HTAB *activeTransactionNumberSet = ListToHashSet(activeTransactionNumberList,
 													 sizeof(uint64), false);
 
-	/* scan through all recovery records of the current worker */
-	ScanKeyInit(&scanKey[0], Anum_pg_dist_transaction_groupid,
-				BTEqualStrategyNumber, F_INT4EQ, Int32GetDatum(groupId));
-
 	/* get a snapshot of pg_dist_transaction */
 	SysScanDesc scanDescriptor = systable_beginscan(pgDistTransaction,
 													DistTransactionGroupIndexId(),
 													indexOK,
 													NULL, scanKeyCount, scanKey);
 
-	/* find stale prepared transactions on the remote node */
-	List *recheckTransactionList = PendingWorkerTransactionList(connection);
-	HTAB *recheckTransactionSet = ListToHashSet(recheckTransactionList, NAMEDATALEN,
-												true);
+	/* find stale prepared transactions on the remote nodes */
+	FetchPendingWorkerTransactions(recoveryStateList, true);
 
 	while (HeapTupleIsValid(heapTuple = systable_getnext(scanDescriptor)))
 	{
@@ -238,6 +394,20 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 		bool foundPreparedTransactionBeforeCommit = false;
 		bool foundPreparedTransactionAfterCommit = false;
 
+		stats->processedRecordCount++;
+
+		Datum groupIdDatum = heap_getattr(heapTuple, Anum_pg_dist_transaction_groupid,
+										  tupleDescriptor, &isNull);
+		int32 groupId = DatumGetInt32(groupIdDatum);
+
+		WorkerRecoveryState *recoveryState = hash_search(recoveryStateHash, &groupId,
+														 HASH_FIND, NULL);
+		if (recoveryState == NULL)
+		{
+			/* the worker is not active or we could not connect to it */
+			continue;
+		}
+
 		Datum transactionNameDatum = heap_getattr(heapTuple,
 												  Anum_pg_dist_transaction_gid,
 												  tupleDescriptor, &isNull);
@@ -259,43 +429,30 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 		 * Remove the transaction from the pending list such that only transactions
 		 * that need to be aborted remain at the end.
 		 */
-		hash_search(pendingTransactionSet, transactionName, HASH_REMOVE,
+		hash_search(recoveryState->pendingTransactionSet, transactionName, HASH_REMOVE,
 					&foundPreparedTransactionBeforeCommit);
 
-		hash_search(recheckTransactionSet, transactionName, HASH_FIND,
+		hash_search(recoveryState->recheckTransactionSet, transactionName, HASH_FIND,
 					&foundPreparedTransactionAfterCommit);
 
 		if (foundPreparedTransactionBeforeCommit && foundPreparedTransactionAfterCommit)
 		{
 			/*
 			 * The transaction was committed, but the prepared transaction still exists
-			 * on the worker. Try committing it.
+			 * on the worker. Commit it below, and delete the recovery record if that
+			 * succeeds.
 			 *
 			 * We double check that the recovery record exists both before and after
 			 * checking ActiveDistributedTransactionNumbers(), since we may have
 			 * observed a prepared transaction that was committed immediately after.
 			 */
-			bool shouldCommit = true;
-			bool commitSucceeded = RecoverPreparedTransactionOnWorker(connection,
-																	  transactionName,
-																	  shouldCommit);
-			if (!commitSucceeded)
-			{
-				/*
-				 * Failed to commit on the current worker. Stop without throwing
-				 * an error to allow recover_prepared_transactions to continue with
-				 * other workers.
-				 */
-				recoveryFailed = true;
-				break;
-			}
-
-			recoveredTransactionCount++;
+			ItemPointer recordPointer = palloc(sizeof(ItemPointerData));
+			ItemPointerCopy(&heapTuple->t_self, recordPointer);
 
-			/*
-			 * We successfully committed the prepared transaction, safe to delete
-			 * the recovery record.
-			 */
+			recoveryState->commitTransactionList =
+				lappend(recoveryState->commitTransactionList, transactionName);
+			recoveryState->commitRecordList =
+				lappend(recoveryState->commitRecordList, recordPointer);
 		}
 		else if (foundPreparedTransactionAfterCommit)
 		{
@@ -322,8 +479,6 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 			 * transactions for the next call to recover_prepared_transactions
 			 * and skip them here.
 			 */
-
-			continue;
 		}
 		else
 		{
@@ -338,27 +493,50 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 			 * transactions that committed at an earlier time, in which case it's
 			 * safe delete the recovery record as well.
 			 */
+			simple_heap_delete(pgDistTransaction, &heapTuple->t_self);
+			stats->deletedRecordCount++;
 		}
-
-		simple_heap_delete(pgDistTransaction, &heapTuple->t_self);
 	}
 
 	systable_endscan(scanDescriptor);
-	heap_close(pgDistTransaction, NoLock);
 
-	if (!recoveryFailed)
-	{
-		char *pendingTransactionName = NULL;
-		bool abortSucceeded = true;
+	/* commit the prepared transactions that have a recovery record */
+	bool shouldCommit = true;
+	int committedTransactionCount =
+		RecoverPreparedTransactionsOnWorkers(recoveryStateList, shouldCommit,
+											 pgDistTransaction, stats);
+	stats->recoveredTransactionCount += committedTransactionCount;
 
+	if (committedTransactionCount > 0)
+	{
 		/*
-		 * All remaining prepared transactions that are not part of an in-progress
-		 * distributed transaction should be aborted since we did not find a recovery
-		 * record, which implies the disributed transaction aborted.
+		 * The modifications of the committed transactions only became visible
+		 * now, after the versions of the modified tables were bumped, so
+		 * subplan results may have been cached without them.
 		 */
-		hash_seq_init(&status, pendingTransactionSet);
+		InvalidateAllSubPlanResults();
+	}
+
+	/*
+	 * All remaining prepared transactions that are not part of an in-progress
+	 * distributed transaction should be aborted since we did not find a recovery
+	 * record, which implies the disributed transaction aborted.
+	 */
+	ListCell *recoveryStateCell = NULL;
+	foreach(recoveryStateCell, recoveryStateList)
+	{
+		WorkerRecoveryState *recoveryState = lfirst(recoveryStateCell);
+		HASH_SEQ_STATUS status;
+		char *pendingTransactionName = NULL;
+
+		if (recoveryState->recoveryFailed)
+		{
+			/* failed to commit on the worker, leave it for the next round */
+			continue;
+		}
 
-		while ((pendingTransactionName = hash_seq_search(&status)) != NULL)
+		foreach_htab(pendingTransactionName, &status,
+					 recoveryState->pendingTransactionSet)
 		{
 			bool isTransactionInProgress = IsTransactionInProgress(
 				activeTransactionNumberSet,
@@ -368,48 +546,88 @@ RecoverWorkerTransactions(WorkerNode *workerNode)
 				continue;
 			}
 
-			bool shouldCommit = false;
-			abortSucceeded = RecoverPreparedTransactionOnWorker(connection,
-																pendingTransactionName,
-																shouldCommit);
-			if (!abortSucceeded)
-			{
-				hash_seq_term(&status);
-				break;
-			}
-
-			recoveredTransactionCount++;
+			recoveryState->abortTransactionList =
+				lappend(recoveryState->abortTransactionList, pendingTransactionName);
 		}
 	}
 
+	shouldCommit = false;
+	stats->recoveredTransactionCount +=
+		RecoverPreparedTransactionsOnWorkers(recoveryStateList, shouldCommit,
+											 pgDistTransaction, stats);
+
+	heap_close(pgDistTransaction, NoLock);
+
 	MemoryContextSwitchTo(oldContext);
 	MemoryContextDelete(localContext);
 
-	return recoveredTransactionCount;
+	long durationSeconds = 0;
+	int durationMicrosecs = 0;
+	TimestampDifference(startTime, GetCurrentTimestamp(), &durationSeconds,
+						&durationMicrosecs);
+
+	stats->durationMillisecs = durationSeconds * 1000 + durationMicrosecs / 1000;
 }
 
 
 /*
- * PendingWorkerTransactionList returns a list of pending prepared
- * transactions on a remote node that were started by this node.
+ * FetchPendingWorkerTransactions fetches the pending prepared transactions
+ * that were started by this node from all workers concurrently, and stores
+ * them in the pending or the recheck set of the recovery states.
  */
-static List *
-PendingWorkerTransactionList(MultiConnection *connection)
+static void
+FetchPendingWorkerTransactions(List *recoveryStateList, bool isRecheck)
 {
+	ListCell *recoveryStateCell = NULL;
 	StringInfo command = makeStringInfo();
-	bool raiseInterrupts = true;
-	List *transactionNames = NIL;
 	int coordinatorId = GetLocalGroupId();
 
 	appendStringInfo(command, "SELECT gid FROM pg_prepared_xacts "
 							  "WHERE gid LIKE 'citus\\_%d\\_%%'",
 					 coordinatorId);
 
-	int querySent = SendRemoteCommand(connection, command->data);
-	if (querySent == 0)
+	foreach(recoveryStateCell, recoveryStateList)
 	{
-		ReportConnectionError(connection, ERROR);
+		WorkerRecoveryState *recoveryState = lfirst(recoveryStateCell);
+		MultiConnection *connection = recoveryState->connection;
+
+		int querySent = SendRemoteCommand(connection, command->data);
+		if (querySent == 0)
+		{
+			ReportConnectionError(connection, ERROR);
+		}
+	}
+
+	foreach(recoveryStateCell, recoveryStateList)
+	{
+		WorkerRecoveryState *recoveryState = lfirst(recoveryStateCell);
+		MultiConnection *connection = recoveryState->connection;
+
+		List *transactionNameList = PendingWorkerTransactionList(connection);
+		HTAB *transactionSet = ListToHashSet(transactionNameList, NAMEDATALEN, true);
+
+		if (isRecheck)
+		{
+			recoveryState->recheckTransactionSet = transactionSet;
+		}
+		else
+		{
+			recoveryState->pendingTransactionSet = transactionSet;
+		}
 	}
+}
+
+
+/*
+ * PendingWorkerTransactionList returns a list of pending prepared
+ * transactions on a remote node that were started by this node, from the
+ * result of the query sent in FetchPendingWorkerTransactions.
+ */
+static List *
+PendingWorkerTransactionList(MultiConnection *connection)
+{
+	bool raiseInterrupts = true;
+	List *transactionNames = NIL;
 
 	PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
 	if (!IsResponseOK(result))
@@ -434,6 +652,114 @@ PendingWorkerTransactionList(MultiConnection *connection)
 }
 
 
+/*
+ * RecoverPreparedTransactionsOnWorkers commits or aborts the prepared
+ * transactions in the commit or abort lists of the recovery states. The
+ * workers recover one transaction at a time, but concurrently with each other.
+ * On failure, recovery on the worker stops and recoveryFailed is set.
+ *
+ * When committing, the recovery records of the committed transactions are
+ * deleted from pg_dist_transaction and counted in stats. The function returns
+ * the number of recovered transactions.
+ */
+static int
+RecoverPreparedTransactionsOnWorkers(List *recoveryStateList, bool shouldCommit,
+									 Relation pgDistTransaction,
+									 TransactionRecoveryStats *stats)
+{
+	int recoveredTransactionCount = 0;
+
+	while (true)
+	{
+		List *connectionList = NIL;
+		List *activeStateList = NIL;
+		ListCell *recoveryStateCell = NULL;
+
+		foreach(recoveryStateCell, recoveryStateList)
+		{
+			WorkerRecoveryState *recoveryState = lfirst(recoveryStateCell);
+			List *transactionList = shouldCommit ?
+									recoveryState->commitTransactionList :
+									recoveryState->abortTransactionList;
+
+			if (recoveryState->recoveryFailed || transactionList == NIL)
+			{
+				continue;
+			}
+
+			char *transactionName = (char *) linitial(transactionList);
+			if (!StartRecoverPreparedTransaction(recoveryState->connection,
+												 transactionName, shouldCommit))
+			{
+				recoveryState->recoveryFailed = true;
+				continue;
+			}
+
+			connectionList = lappend(connectionList, recoveryState->connection);
+			activeStateList = lappend(activeStateList, recoveryState);
+		}
+
+		if (activeStateList == NIL)
+		{
+			break;
+		}
+
+		bool raiseInterrupts = true;
+		WaitForAllConnections(connectionList, raiseInterrupts);
+
+		foreach(recoveryStateCell, activeStateList)
+		{
+			WorkerRecoveryState *recoveryState = lfirst(recoveryStateCell);
+			char *transactionName = NULL;
+
+			if (shouldCommit)
+			{
+				transactionName = linitial(recoveryState->commitTransactionList);
+				recoveryState->commitTransactionList =
+					list_delete_first(recoveryState->commitTransactionList);
+			}
+			else
+			{
+				transactionName = linitial(recoveryState->abortTransactionList);
+				recoveryState->abortTransactionList =
+					list_delete_first(recoveryState->abortTransactionList);
+			}
+
+			bool recoverySucceeded =
+				FinishRecoverPreparedTransaction(recoveryState->connection,
+												 transactionName, shouldCommit);
+			if (!recoverySucceeded)
+			{
+				/*
+				 * Failed to recover on the current worker. Stop without throwing
+				 * an error to allow recovery to continue with other workers.
+				 */
+				recoveryState->recoveryFailed = true;
+				continue;
+			}
+
+			recoveredTransactionCount++;
+
+			if (shouldCommit)
+			{
+				/*
+				 * We successfully committed the prepared transaction, safe to
+				 * delete the recovery record.
+				 */
+				ItemPointer recordPointer = linitial(recoveryState->commitRecordList);
+				recoveryState->commitRecordList =
+					list_delete_first(recoveryState->commitRecordList);
+
+				simple_heap_delete(pgDistTransaction, recordPointer);
+				stats->deletedRecordCount++;
+			}
+		}
+	}
+
+	return recoveredTransactionCount;
+}
+
+
 /*
  * IsTransactionInProgress returns whether the distributed transaction to which
  * preparedTransactionName belongs is still in progress, or false if the
@@ -464,16 +790,67 @@ IsTransactionInProgress(HTAB *activeTransactionNumberSet, char *preparedTransact
 
 
 /*
- * RecoverPreparedTransactionOnWorker recovers a single prepared transaction over
- * the given connection. If shouldCommit is true we send
+ * StartRecoverPreparedTransaction sends the command to recover a single
+ * prepared transaction over the given connection. If shouldCommit is true we
+ * send COMMIT PREPARED, otherwise ROLLBACK PREPARED.
+ */
+static bool
+StartRecoverPreparedTransaction(MultiConnection *connection, char *transactionName,
+								bool shouldCommit)
+{
+	char *command = RecoverPreparedTransactionCommand(transactionName, shouldCommit);
+
+	int querySent = SendRemoteCommand(connection, command);
+	if (querySent == 0)
+	{
+		ReportConnectionError(connection, WARNING);
+		return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * FinishRecoverPreparedTransaction waits for the result of the command sent
+ * by StartRecoverPreparedTransaction and returns whether it succeeded.
  */
 static bool
-RecoverPreparedTransactionOnWorker(MultiConnection *connection, char *transactionName,
-								   bool shouldCommit)
+FinishRecoverPreparedTransaction(MultiConnection *connection, char *transactionName,
+								 bool shouldCommit)
+{
+	bool raiseInterrupts = true;
+
+	PGresult *result = GetRemoteCommandResult(connection, raiseInterrupts);
+	if (!IsResponseOK(result))
+	{
+		ReportResultError(connection, result, WARNING);
+		PQclear(result);
+		ForgetResults(connection);
+
+		return false;
+	}
+
+	PQclear(result);
+	ClearResults(connection, false);
+
+	ereport(LOG, (errmsg("recovered a prepared transaction on %s:%d",
+						 connection->hostname, connection->port),
+				  errcontext("%s", RecoverPreparedTransactionCommand(transactionName,
+																	  shouldCommit))));
+
+	return true;
+}
+
+
+/*
+ * RecoverPreparedTransactionCommand returns the command that commits or
+ * aborts the given prepared transaction.
+ */
+static char *
+RecoverPreparedTransactionCommand(char *transactionName, bool shouldCommit)
 {
 	StringInfo command = makeStringInfo();
-	PGresult *result = NULL;
-	bool raiseInterrupts = false;
 
 	if (shouldCommit)
 	{
@@ -488,22 +865,5 @@ RecoverPreparedTransactionOnWorker(MultiConnection *connection, char *transactio
 						 quote_literal_cstr(transactionName));
 	}
 
-	int executeCommand = ExecuteOptionalRemoteCommand(connection, command->data, &result);
-	if (executeCommand == QUERY_SEND_FAILED)
-	{
-		return false;
-	}
-	if (executeCommand == RESPONSE_NOT_OKAY)
-	{
-		return false;
-	}
-
-	PQclear(result);
-	ClearResults(connection, raiseInterrupts);
-
-	ereport(LOG, (errmsg("recovered a prepared transaction on %s:%d",
-						 connection->hostname, connection->port),
-				  errcontext("%s", command->data)));
-
-	return true;
+	return command->data;
 }
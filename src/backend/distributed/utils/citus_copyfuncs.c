@@ -119,6 +119,9 @@ CopyNodeDistributedPlan(COPYFUNC_ARGS)
 	COPY_NODE_FIELD(subPlanList);
 	COPY_NODE_FIELD(usedSubPlanNodeList);
 	COPY_SCALAR_FIELD(fastPathRouterPlan);
+	COPY_NODE_FIELD(mergeSortClauseList);
+	COPY_SCALAR_FIELD(scanRowLimit);
+	COPY_SCALAR_FIELD(streamIntoAggregate);
 	COPY_NODE_FIELD(planningError);
 }
 
@@ -130,6 +133,8 @@ CopyNodeDistributedSubPlan(COPYFUNC_ARGS)
 
 	COPY_SCALAR_FIELD(subPlanId);
 	COPY_NODE_FIELD(plan);
+	COPY_STRING_FIELD(cacheKey);
+	COPY_NODE_FIELD(relationIdList);
 }
 
 
@@ -196,6 +196,9 @@ OutDistributedPlan(OUTFUNC_ARGS)
 	WRITE_NODE_FIELD(subPlanList);
 	WRITE_NODE_FIELD(usedSubPlanNodeList);
 	WRITE_BOOL_FIELD(fastPathRouterPlan);
+	WRITE_NODE_FIELD(mergeSortClauseList);
+	WRITE_UINT64_FIELD(scanRowLimit);
+	WRITE_BOOL_FIELD(streamIntoAggregate);
 
 	WRITE_NODE_FIELD(planningError);
 }
@@ -210,6 +213,8 @@ OutDistributedSubPlan(OUTFUNC_ARGS)
 
 	WRITE_UINT_FIELD(subPlanId);
 	WRITE_NODE_FIELD(plan);
+	WRITE_STRING_FIELD(cacheKey);
+	WRITE_NODE_FIELD(relationIdList);
 }
 
 void
@@ -225,6 +225,9 @@ ReadDistributedPlan(READFUNC_ARGS)
 	READ_NODE_FIELD(subPlanList);
 	READ_NODE_FIELD(usedSubPlanNodeList);
 	READ_BOOL_FIELD(fastPathRouterPlan);
+	READ_NODE_FIELD(mergeSortClauseList);
+	READ_UINT64_FIELD(scanRowLimit);
+	READ_BOOL_FIELD(streamIntoAggregate);
 
 	READ_NODE_FIELD(planningError);
 
@@ -239,6 +242,8 @@ ReadDistributedSubPlan(READFUNC_ARGS)
 
 	READ_UINT_FIELD(subPlanId);
 	READ_NODE_FIELD(plan);
+	READ_STRING_FIELD(cacheKey);
+	READ_NODE_FIELD(relationIdList);
 
 	READ_DONE();
 }
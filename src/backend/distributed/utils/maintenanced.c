@@ -80,6 +80,7 @@ typedef struct MaintenanceDaemonDBData
 	bool daemonStarted;
 	pid_t workerPid;
 	bool triggerMetadataSync;
+	bool triggerTransactionRecovery;
 	Latch *latch; /* pointer to the background worker's latch */
 } MaintenanceDaemonDBData;
 
@@ -108,6 +109,7 @@ static void MaintenanceDaemonShmemInit(void);
 static void MaintenanceDaemonErrorContext(void *arg);
 static bool LockCitusExtension(void);
 static bool MetadataSyncTriggeredCheckAndReset(MaintenanceDaemonDBData *dbData);
+static bool TransactionRecoveryTriggeredCheckAndReset(MaintenanceDaemonDBData *dbData);
 
 
 /*
@@ -196,6 +198,7 @@ InitializeMaintenanceDaemonBackend(void)
 		dbData->daemonStarted = true;
 		dbData->workerPid = 0;
 		dbData->triggerMetadataSync = false;
+		dbData->triggerTransactionRecovery = false;
 		LWLockRelease(&MaintenanceDaemonControl->lock);
 
 		WaitForBackgroundWorkerStartup(handle, &pid);
@@ -416,13 +419,18 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 
 		/*
 		 * If enabled, run 2PC recovery on primary nodes (where !RecoveryInProgress()),
-		 * since we'll write to the pg_dist_transaction log.
+		 * since we'll write to the pg_dist_transaction log. Recovery is also
+		 * triggered for deferred COMMIT PREPARED, which only happens when
+		 * automatic recovery is enabled.
 		 */
-		if (Recover2PCInterval > 0 && !RecoveryInProgress() &&
-			TimestampDifferenceExceeds(lastRecoveryTime, GetCurrentTimestamp(),
-									   Recover2PCInterval))
+		if (!RecoveryInProgress() && Recover2PCInterval > 0 &&
+			(TransactionRecoveryTriggeredCheckAndReset(myDbData) ||
+			 TimestampDifferenceExceeds(lastRecoveryTime, GetCurrentTimestamp(),
+										Recover2PCInterval)))
 		{
-			int recoveredTransactionCount = 0;
+			TransactionRecoveryStats recoveryStats;
+
+			memset(&recoveryStats, 0, sizeof(recoveryStats));
 
 			InvalidateMetadataSystemCache();
 			StartTransactionCommand();
@@ -440,18 +448,29 @@ CitusMaintenanceDaemonMain(Datum main_arg)
 				 */
 				lastRecoveryTime = GetCurrentTimestamp();
 
-				recoveredTransactionCount = RecoverTwoPhaseCommits();
+				RecoverTwoPhaseCommitsWithStats(&recoveryStats);
 			}
 
 			CommitTransactionCommand();
 
-			if (recoveredTransactionCount > 0)
+			if (recoveryStats.recoveredTransactionCount > 0)
 			{
 				ereport(LOG, (errmsg("maintenance daemon recovered %d distributed "
 									 "transactions",
-									 recoveredTransactionCount)));
+									 recoveryStats.recoveredTransactionCount),
+							  errdetail("The recovery round processed %d records "
+										"and deleted %d records in %ld ms.",
+										recoveryStats.processedRecordCount,
+										recoveryStats.deletedRecordCount,
+										recoveryStats.durationMillisecs)));
 			}
 
+			ereport(DEBUG1, (errmsg("2PC recovery processed %d records and deleted "
+									"%d records in %ld ms",
+									recoveryStats.processedRecordCount,
+									recoveryStats.deletedRecordCount,
+									recoveryStats.durationMillisecs)));
+
 			/* make sure we don't wait too long */
 			timeout = Min(timeout, Recover2PCInterval);
 		}
@@ -750,6 +769,52 @@ TriggerMetadataSync(Oid databaseId)
 }
 
 
+/*
+ * TriggerTransactionRecovery triggers the maintenance daemon to recover the
+ * prepared transactions of the given database, e.g. to commit the prepared
+ * transactions of which COMMIT PREPARED was deferred.
+ */
+void
+TriggerTransactionRecovery(Oid databaseId)
+{
+	bool found = false;
+
+	LWLockAcquire(&MaintenanceDaemonControl->lock, LW_EXCLUSIVE);
+
+	MaintenanceDaemonDBData *dbData = (MaintenanceDaemonDBData *) hash_search(
+		MaintenanceDaemonDBHash,
+		&databaseId,
+		HASH_FIND, &found);
+	if (found && dbData->latch != NULL)
+	{
+		dbData->triggerTransactionRecovery = true;
+
+		/* set latch to wake-up the maintenance loop */
+		SetLatch(dbData->latch);
+	}
+
+	LWLockRelease(&MaintenanceDaemonControl->lock);
+}
+
+
+/*
+ * TransactionRecoveryTriggeredCheckAndReset checks if transaction recovery has
+ * been triggered for the given database, and resets the flag.
+ */
+static bool
+TransactionRecoveryTriggeredCheckAndReset(MaintenanceDaemonDBData *dbData)
+{
+	LWLockAcquire(&MaintenanceDaemonControl->lock, LW_EXCLUSIVE);
+
+	bool transactionRecoveryTriggered = dbData->triggerTransactionRecovery;
+	dbData->triggerTransactionRecovery = false;
+
+	LWLockRelease(&MaintenanceDaemonControl->lock);
+
+	return transactionRecoveryTriggered;
+}
+
+
 /*
  * MetadataSyncTriggeredCheckAndReset checks if metadata sync has been
  * triggered for the given database, and resets the flag.
@@ -10,10 +10,34 @@ extern int MaxAdaptiveExecutorPoolSize;
 /* GUC, number of ms to wait between opening connections to the same worker */
 extern int ExecutorSlowStartInterval;
 
+/* GUC, determining whether workers are asked to send results in binary format */
+extern bool EnableBinaryProtocol;
+
+/* GUC, determining whether SELECT results are streamed rather than materialized */
+extern bool EnableResultStreaming;
+
+/* GUC, maximum number of tasks that are sent over a session at once */
+extern int ExecutorCommandBatchSize;
+
+/* GUC, determining whether BEGIN is sent together with the first task */
+extern bool EnablePiggybackedBegin;
+
+/* GUC, time after which a slow read is also started on another placement */
+extern int HedgedReadDelay;
+
+struct DistributedExecution;
+
 extern uint64 ExecuteTaskList(RowModifyLevel modLevel, List *taskList,
 							  int targetPoolSize);
 extern uint64 ExecuteTaskListOutsideTransaction(RowModifyLevel modLevel, List *taskList,
 												int targetPoolSize, List *jobIdList);
+extern bool ContinueStreamingExecution(struct DistributedExecution *execution);
+extern bool ContinueStreamingExecutionForTask(struct DistributedExecution *execution,
+											  int taskIndex);
+extern void EndStreamingExecution(struct DistributedExecution *execution);
+extern void FinishActiveStreamingExecutions(void);
+extern void PrefetchDistributedPlanResults(List *customScanList);
+extern void DiscardPrefetchedResult(uint64 planId);
 
 
 #endif /* ADAPTIVE_EXECUTOR_H */
@@ -16,13 +16,23 @@
 #include "nodes/plannodes.h"
 
 
+struct DistributedExecution;
+struct SortedMergeState;
+
 typedef struct CitusScanState
 {
 	CustomScanState customScanState;  /* underlying custom scan node */
 	DistributedPlan *distributedPlan; /* distributed execution plan */
 	MultiExecutorType executorType;   /* distributed executor type */
+	int eflags;                       /* executor flags passed to BeginCustomScan */
 	bool finishedRemoteScan;          /* flag to check if remote scan is finished */
 	Tuplestorestate *tuplestorestate; /* tuple store to store distributed results */
+
+	/* execution that streams its results into tuplestorestate, if any */
+	struct DistributedExecution *streamingExecution;
+
+	/* merge of the sorted task results, used instead of tuplestorestate if set */
+	struct SortedMergeState *sortedMerge;
 } CitusScanState;
 
 
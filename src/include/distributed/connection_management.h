@@ -52,7 +52,13 @@ enum MultiConnectionMode
 	OUTSIDE_TRANSACTION = 1 << 4,
 
 	/* connection has not been used to access data */
-	REQUIRE_SIDECHANNEL = 1 << 5
+	REQUIRE_SIDECHANNEL = 1 << 5,
+
+	/*
+	 * Do not wait for the shared connection budget of the node, instead return
+	 * NULL if a new connection would exceed citus.max_shared_pool_size.
+	 */
+	OPTIONAL_CONNECTION = 1 << 6
 };
 
 /*
@@ -119,6 +125,15 @@ typedef struct MultiConnection
 	/* time connection establishment was started, for timeout */
 	TimestampTz connectionStart;
 
+	/* whether the connection holds a slot of the shared connection budget */
+	bool sharedCounterIncremented;
+
+	/* whether the connection is counted as running a task on its worker */
+	bool runningTaskCounted;
+
+	/* connection was opened ahead of use by PrewarmConnections */
+	bool prewarmed;
+
 	/* membership in list of list of connections in ConnectionHashEntry */
 	dlist_node connectionNode;
 
@@ -178,6 +193,9 @@ extern int NodeConnectionTimeout;
 /* maximum number of connections to cache per worker per session */
 extern int MaxCachedConnectionsPerWorker;
 
+/* number of connections per worker to establish ahead of use */
+extern int PrewarmConnectionsPerWorker;
+
 /* parameters used for outbound connections */
 extern char *NodeConninfo;
 
@@ -191,6 +209,8 @@ extern struct MemoryContextData *ConnectionContext;
 
 extern void AfterXactConnectionHandling(bool isCommit);
 extern void InitializeConnectionManagement(void);
+extern void RequestConnectionPrewarming(void);
+extern void PrewarmConnections(void);
 
 extern void InitConnParams(void);
 extern void ResetConnParams(void);
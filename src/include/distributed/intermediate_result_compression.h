@@ -0,0 +1,50 @@
+/*-------------------------------------------------------------------------
+ *
+ * intermediate_result_compression.h
+ *   Functions for compressing intermediate result files and reading them
+ *   back.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef INTERMEDIATE_RESULT_COMPRESSION_H
+#define INTERMEDIATE_RESULT_COMPRESSION_H
+
+
+#include "commands/copy.h"
+#include "lib/stringinfo.h"
+#include "nodes/pg_list.h"
+#include "utils/relcache.h"
+
+
+/* amount of COPY data that is compressed as a single block */
+#define RESULT_COMPRESSION_BLOCK_SIZE (64 * 1024)
+
+
+/* Enumeration that defines the compression methods of intermediate results */
+typedef enum ResultCompressionMethod
+{
+	RESULT_COMPRESSION_NONE = 0,
+	RESULT_COMPRESSION_PGLZ = 1,
+	RESULT_COMPRESSION_LZ4 = 2,
+	RESULT_COMPRESSION_ZSTD = 3
+} ResultCompressionMethod;
+
+
+/* GUC, compression method for intermediate results written by this node */
+extern int IntermediateResultCompression;
+
+
+extern void AppendCompressedResultHeader(StringInfo buffer,
+										 ResultCompressionMethod method);
+extern void AppendCompressedResultBlock(StringInfo buffer,
+										ResultCompressionMethod method,
+										const char *data, int dataLength);
+extern CopyState BeginCopyFromResultFile(Relation relation, char *fileName,
+										 List *copyOptions);
+extern void EndCopyFromResultFile(CopyState copyState);
+
+
+#endif /* INTERMEDIATE_RESULT_COMPRESSION_H */
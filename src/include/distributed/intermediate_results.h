@@ -52,6 +52,10 @@ typedef struct DistributedResultFragment
 extern DestReceiver * CreateRemoteFileDestReceiver(char *resultId, EState *executorState,
 												   List *initialNodeList, bool
 												   writeLocalFile);
+extern void CaptureIntermediateResultData(DestReceiver *destReceiver, int64 maxSize);
+extern StringInfo CapturedIntermediateResultData(DestReceiver *destReceiver);
+extern void WriteIntermediateResultData(char *resultId, StringInfo resultData,
+										List *initialNodeList, bool writeLocalFile);
 extern void SendQueryResultViaCopy(const char *resultId);
 extern void ReceiveQueryResultViaCopy(const char *resultId);
 extern void RemoveIntermediateResultsDirectory(void);
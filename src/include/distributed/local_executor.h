@@ -16,11 +16,14 @@
 /* enabled with GUCs*/
 extern bool EnableLocalExecution;
 extern bool LogLocalCommands;
+extern int MaxLocalExecutionParallelWorkers;
 
 extern bool TransactionAccessedLocalPlacement;
 extern bool TransactionConnectedToLocalGroup;
 
 extern uint64 ExecuteLocalTaskList(CitusScanState *scanState, List *taskList);
+extern bool ShouldExecuteLocalTasksInParallel(DistributedPlan *distributedPlan,
+											  List *taskList);
 extern void ExtractLocalAndRemoteTasks(bool readOnlyPlan, List *taskList,
 									   List **localTaskList, List **remoteTaskList);
 extern bool ShouldExecuteTasksLocally(List *taskList);
@@ -102,6 +102,9 @@ extern void ExecutePlanIntoDestReceiver(PlannedStmt *queryPlan, ParamListInfo pa
 extern void SetLocalMultiShardModifyModeToSequential(void);
 extern void SetLocalForceMaxQueryParallelization(void);
 extern void SortTupleStore(CitusScanState *scanState);
+extern void SortTupleStoreByKeys(CitusScanState *scanState, int numberOfSortKeys,
+								 AttrNumber *sortColIdx, Oid *sortOperators,
+								 Oid *collations, bool *nullsFirst);
 extern bool DistributedPlanModifiesDatabase(DistributedPlan *plan);
 extern bool ReadOnlyTask(TaskType taskType);
 extern void ExtractParametersFromParamList(ParamListInfo paramListInfo,
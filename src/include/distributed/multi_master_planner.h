@@ -19,6 +19,10 @@
 #include "nodes/plannodes.h"
 
 
+/* GUC, determining whether the sorted results of tasks are merged on the master */
+extern bool EnableSortedMerge;
+extern bool EnableStreamingAggregation;
+
 /* Function declarations for building local plans on the master node */
 struct DistributedPlan;
 struct CustomScan;
@@ -98,7 +98,8 @@ typedef enum
 	TASK_ASSIGNMENT_INVALID_FIRST = 0,
 	TASK_ASSIGNMENT_GREEDY = 1,
 	TASK_ASSIGNMENT_ROUND_ROBIN = 2,
-	TASK_ASSIGNMENT_FIRST_REPLICA = 3
+	TASK_ASSIGNMENT_FIRST_REPLICA = 3,
+	TASK_ASSIGNMENT_LEAST_LATENCY = 4
 } TaskAssignmentPolicyType;
 
 
@@ -368,6 +369,28 @@ typedef struct DistributedPlan
 	 */
 	bool fastPathRouterPlan;
 
+	/*
+	 * When the worker query returns its rows in the order of the master
+	 * query's ORDER BY, mergeSortClauseList contains the master query's sort
+	 * clauses and the custom scan merges the sorted task results rather than
+	 * having a Sort node on top of it.
+	 */
+	List *mergeSortClauseList;
+
+	/*
+	 * Number of rows after which the custom scan has returned all rows that
+	 * the plan above it needs, or 0 if it needs all rows. This is the case
+	 * for a LIMIT without ORDER BY, which is satisfied by any rows.
+	 */
+	uint64 scanRowLimit;
+
+	/*
+	 * Set when the custom scan directly feeds a hash or plain aggregate on the
+	 * coordinator, in which case the executor streams the task results into
+	 * the aggregate rather than receiving all of them first.
+	 */
+	bool streamIntoAggregate;
+
 	/*
 	 * NULL if this a valid plan, an error description otherwise. This will
 	 * e.g. be set if SQL features are present that a planner doesn't support,
@@ -389,6 +412,14 @@ typedef struct DistributedSubPlan
 
 	uint32 subPlanId;
 	PlannedStmt *plan;
+
+	/*
+	 * Key under which the result of the subplan can be cached across queries,
+	 * and the distributed tables it depends on. The key is NULL if the result
+	 * cannot be cached.
+	 */
+	char *cacheKey;
+	List *relationIdList;
 } DistributedSubPlan;
 
 
@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * node_health.h
+ *    Connection failures per worker, shared across backends.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef NODE_HEALTH_H
+#define NODE_HEALTH_H
+
+
+/* GUCs, determining how long executions avoid workers after failures */
+extern int NodeFailureBackoff;
+extern int MaxNodeFailureBackoff;
+
+
+extern void InitializeNodeHealth(void);
+extern bool ShouldAvoidNode(char *nodeName, int nodePort);
+extern void RecordNodeFailure(char *nodeName, int nodePort);
+extern void RecordNodeSuccess(char *nodeName, int nodePort);
+
+
+#endif /* NODE_HEALTH_H */
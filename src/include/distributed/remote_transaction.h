@@ -14,6 +14,7 @@
 #include "libpq-fe.h"
 #include "nodes/pg_list.h"
 #include "lib/ilist.h"
+#include "lib/stringinfo.h"
 
 
 /* forward declare, to avoid recursive includes */
@@ -86,9 +87,19 @@ typedef struct RemoteTransaction
 
 	/* set when BEGIN is sent over the connection */
 	bool beginSent;
+
+	/* set when a command that is not known to be read-only was sent */
+	bool mayHaveWritten;
 } RemoteTransaction;
 
 
+/* GUC, determining whether COMMIT PREPARED is left to the maintenance daemon */
+extern bool DeferCommitPrepared;
+
+/* GUC, determining whether read-only participants are left out of 2PC */
+extern bool EnableReadOnlyParticipantElision;
+
+
 /* utility functions for dealing with remote transactions */
 extern bool ParsePreparedTransactionName(char *preparedTransactionName, int32 *groupId,
 										 int *procId, uint64 *transactionNumber,
@@ -96,6 +107,8 @@ extern bool ParsePreparedTransactionName(char *preparedTransactionName, int32 *g
 
 /* change an individual remote transaction's state */
 extern void StartRemoteTransactionBegin(struct MultiConnection *connection);
+extern StringInfo StartRemoteTransactionBeginCommand(struct MultiConnection *connection,
+													 int *statementCount);
 extern void FinishRemoteTransactionBegin(struct MultiConnection *connection);
 extern void RemoteTransactionBegin(struct MultiConnection *connection);
 extern void RemoteTransactionListBegin(List *connectionList);
@@ -137,7 +150,8 @@ extern void ResetRemoteTransaction(struct MultiConnection *connection);
 
 /* perform handling for all in-progress transactions */
 extern void CoordinatedRemoteTransactionsPrepare(void);
-extern void CoordinatedRemoteTransactionsCommit(void);
+extern int CountModifyingRemoteTransactions(void);
+extern bool CoordinatedRemoteTransactionsCommit(void);
 extern void CoordinatedRemoteTransactionsAbort(void);
 extern void CheckRemoteTransactionsHealth(void);
 
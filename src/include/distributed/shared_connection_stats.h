@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_connection_stats.h
+ *   Central management of the connections from this node to each worker,
+ *   shared across backends.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_CONNECTION_STATS_H
+#define SHARED_CONNECTION_STATS_H
+
+#include "distributed/connection_management.h"
+
+/* GUC, maximum number of connections from this node to a single worker */
+extern int MaxSharedPoolSize;
+
+
+extern void InitializeSharedConnectionStats(void);
+extern int GetMaxSharedPoolSize(void);
+extern bool TryToIncrementSharedConnectionCounter(const char *hostname, int port,
+												  bool *counterIncremented);
+extern bool WaitLoopForSharedConnection(const char *hostname, int port,
+										bool holdsConnection);
+extern void DecrementSharedConnectionCounter(const char *hostname, int port);
+extern bool SharedConnectionBudgetExhausted(const char *hostname, int port);
+extern void StartSharedRunningTask(MultiConnection *connection);
+extern void FinishSharedRunningTask(MultiConnection *connection);
+extern int GetSharedRunningTaskCount(const char *hostname, int port);
+
+
+#endif /* SHARED_CONNECTION_STATS_H */
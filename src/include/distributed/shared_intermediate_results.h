@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * shared_intermediate_results.h
+ *   Small intermediate results that are kept in shared memory instead of
+ *   in files.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SHARED_INTERMEDIATE_RESULTS_H
+#define SHARED_INTERMEDIATE_RESULTS_H
+
+
+#include "lib/stringinfo.h"
+
+
+/* GUC, maximum size in KB of an intermediate result kept in shared memory */
+extern int MaxSharedMemoryIntermediateResultSize;
+
+/* GUC, maximum total size in KB of intermediate results kept in shared memory */
+extern int MaxSharedMemoryIntermediateResultsTotalSize;
+
+
+extern void InitializeSharedIntermediateResults(void);
+extern bool StoreSharedIntermediateResult(const char *fileName, StringInfo data);
+extern StringInfo ReadSharedIntermediateResult(const char *fileName);
+extern int64 SharedIntermediateResultSize(const char *fileName);
+extern void RemoveSharedIntermediateResult(const char *fileName);
+extern void RemoveSharedIntermediateResults(void);
+
+
+#endif /* SHARED_INTERMEDIATE_RESULTS_H */
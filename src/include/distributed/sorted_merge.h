@@ -0,0 +1,46 @@
+/*-------------------------------------------------------------------------
+ *
+ * sorted_merge.h
+ *	  Merging the sorted results of the tasks of a distributed query.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SORTED_MERGE_H
+#define SORTED_MERGE_H
+
+#include "distributed/citus_custom_scan.h"
+#include "lib/binaryheap.h"
+#include "utils/sortsupport.h"
+#include "utils/tuplestore.h"
+
+
+/*
+ * SortedMergeState holds the per-task tuple stores into which the executor
+ * receives the (sorted) task results and the state of the merge that returns
+ * them in the order of the query.
+ */
+typedef struct SortedMergeState
+{
+	int taskCount;
+	Tuplestorestate **taskTupleStores;
+
+	/* current row of each task, the heap holds the indexes of the tasks */
+	TupleTableSlot **taskSlots;
+	binaryheap *heap;
+	bool initialized;
+
+	int sortKeyCount;
+	SortSupport sortKeys;
+} SortedMergeState;
+
+
+extern SortedMergeState * BeginSortedMerge(CitusScanState *scanState, int taskCount);
+extern TupleTableSlot * ReturnTupleFromSortedMerge(CitusScanState *scanState);
+extern void EndSortedMerge(SortedMergeState *mergeState);
+extern void SortTupleStoreByMergeKeys(CitusScanState *scanState);
+
+
+#endif /* SORTED_MERGE_H */
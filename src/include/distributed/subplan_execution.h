@@ -16,6 +16,7 @@
 
 extern int MaxIntermediateResult;
 extern int SubPlanLevel;
+extern bool EnableConcurrentSubPlanExecution;
 
 extern void ExecuteSubPlans(DistributedPlan *distributedPlan);
 
@@ -0,0 +1,36 @@
+/*-------------------------------------------------------------------------
+ *
+ * subplan_result_cache.h
+ *    Reuse of subplan results across queries of a session.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef SUBPLAN_RESULT_CACHE_H
+#define SUBPLAN_RESULT_CACHE_H
+
+
+#include "lib/stringinfo.h"
+#include "nodes/parsenodes.h"
+#include "nodes/pg_list.h"
+
+
+/* GUC, maximum size in KB of the subplan results cached by a backend */
+extern int SubPlanResultCacheSize;
+
+
+extern void InitializeSubPlanResultCache(void);
+extern char * SubPlanResultCacheKey(Query *subPlanQuery, List **relationIdList);
+extern bool SubPlanResultCacheUsable(void);
+extern uint64 * CurrentRelationVersions(List *relationIdList);
+extern StringInfo LookupCachedSubPlanResult(char *cacheKey, List *relationIdList,
+											uint64 *relationVersions);
+extern void StoreCachedSubPlanResult(char *cacheKey, List *relationIdList,
+									 uint64 *relationVersions, StringInfo resultData);
+extern void InvalidateSubPlanResultsOnCommit(Oid relationId);
+extern void InvalidateAllSubPlanResults(void);
+extern void ResetSubPlanResultCacheTransactionState(bool committed);
+
+
+#endif /* SUBPLAN_RESULT_CACHE_H */
@@ -0,0 +1,25 @@
+/*-------------------------------------------------------------------------
+ *
+ * task_bundling.h
+ *	  Combining the tasks of a distributed query per worker node.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef TASK_BUNDLING_H
+#define TASK_BUNDLING_H
+
+#include "distributed/multi_physical_planner.h"
+
+
+/* GUC, determining whether the tasks of a SELECT are bundled per worker node */
+extern bool EnableTaskBundling;
+
+
+extern bool ShouldBundleTasksPerNode(DistributedPlan *distributedPlan);
+extern List * BundleTasksPerNode(List *taskList);
+
+
+#endif /* TASK_BUNDLING_H */
@@ -59,6 +59,7 @@ typedef struct SubXactContext
 {
 	SubTransactionId subId;
 	StringInfo setLocalCmds;
+	int setLocalCmdCount;
 } SubXactContext;
 
 /*
@@ -102,6 +103,7 @@ extern int DoBlockLevel;
 
 /* SET LOCAL statements active in the current (sub-)transaction. */
 extern StringInfo activeSetStmts;
+extern int activeSetStmtCount;
 
 /*
  * Coordinated transaction management.
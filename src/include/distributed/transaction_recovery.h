@@ -11,14 +11,36 @@
 #ifndef TRANSACTION_RECOVERY_H
 #define TRANSACTION_RECOVERY_H
 
+#include "nodes/pg_list.h"
 
 /* GUC to configure interval for 2PC auto-recovery */
 extern int Recover2PCInterval;
 
 
+/*
+ * TransactionRecoveryStats describes the work done in a 2PC recovery round.
+ */
+typedef struct TransactionRecoveryStats
+{
+	/* number of pg_dist_transaction records that were looked at */
+	int processedRecordCount;
+
+	/* number of pg_dist_transaction records that were deleted */
+	int deletedRecordCount;
+
+	/* number of prepared transactions that were committed or aborted */
+	int recoveredTransactionCount;
+
+	/* time spent in the recovery round */
+	long durationMillisecs;
+} TransactionRecoveryStats;
+
+
 /* Functions declarations for worker transactions */
 extern void LogTransactionRecord(int32 groupId, char *transactionName);
+extern void LogTransactionRecordList(List *groupIdList, List *transactionNameList);
 extern int RecoverTwoPhaseCommits(void);
+extern void RecoverTwoPhaseCommitsWithStats(TransactionRecoveryStats *stats);
 
 
 #endif /* TRANSACTION_RECOVERY_H */
@@ -21,6 +21,7 @@
 /* Function declarations for transmitting files between two nodes */
 extern void RedirectCopyDataToRegularFile(const char *filename);
 extern void SendRegularFile(const char *filename);
+extern void SendBufferViaCopy(StringInfo buffer);
 extern File FileOpenForTransmit(const char *filename, int fileFlags, int fileMode);
 
 /* Function declaration local to commands and worker modules */
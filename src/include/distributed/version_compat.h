@@ -25,6 +25,7 @@
 #define MakeSingleTupleTableSlotCompat MakeSingleTupleTableSlot
 #define AllocSetContextCreateExtended AllocSetContextCreateInternal
 #define NextCopyFromCompat NextCopyFrom
+#define ExecTypeFromTLCompat ExecTypeFromTL
 #define ArrayRef SubscriptingRef
 #define T_ArrayRef T_SubscriptingRef
 #define or_clause is_orclause
@@ -32,6 +33,8 @@
 #define GetSysCacheOid2Compat GetSysCacheOid2
 #define GetSysCacheOid3Compat GetSysCacheOid3
 #define GetSysCacheOid4Compat GetSysCacheOid4
+#define PglzDecompressCompat(source, slen, dest, rawsize) \
+	pglz_decompress(source, slen, dest, rawsize, true)
 
 #define fcGetArgValue(fc, n) ((fc)->args[n].value)
 #define fcGetArgNull(fc, n) ((fc)->args[n].isnull)
@@ -86,6 +89,8 @@ FileCompatFromFileStart(File fileDesc)
 	MakeSingleTupleTableSlot(tupleDesc)
 #define NextCopyFromCompat(cstate, econtext, values, nulls) \
 	NextCopyFrom(cstate, econtext, values, nulls, NULL)
+#define ExecTypeFromTLCompat(targetList) \
+	ExecTypeFromTL(targetList, false)
 
 /*
  * In PG12 GetSysCacheOid requires an oid column,
@@ -100,6 +105,10 @@ FileCompatFromFileStart(File fileDesc)
 #define GetSysCacheOid4Compat(cacheId, oidcol, key1, key2, key3, key4) \
 	GetSysCacheOid4(cacheId, key1, key2, key3, key4)
 
+/* In PG12 pglz_decompress can also check that the whole input was consumed */
+#define PglzDecompressCompat(source, slen, dest, rawsize) \
+	pglz_decompress(source, slen, dest, rawsize)
+
 #define LOCAL_FCINFO(name, nargs) \
 	FunctionCallInfoData name ## data; \
 	FunctionCallInfoData *name = &name ## data
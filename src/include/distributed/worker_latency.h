@@ -0,0 +1,35 @@
+/*-------------------------------------------------------------------------
+ *
+ * worker_latency.h
+ *    Observed task durations and connection establishment times per worker.
+ *
+ * Copyright (c) Citus Data, Inc.
+ *-------------------------------------------------------------------------
+ */
+
+#ifndef WORKER_LATENCY_H
+#define WORKER_LATENCY_H
+
+
+/*
+ * WorkerLatency holds the (average) time it takes to execute a task on a
+ * worker and to establish a connection to it, in microseconds. A value
+ * below 0 means there is no observation.
+ */
+typedef struct WorkerLatency
+{
+	double taskDurationUs;
+	double connectionTimeUs;
+} WorkerLatency;
+
+
+/* GUC, determining whether worker pools are sized based on observed latencies */
+extern bool EnableLatencyAwarePoolSizing;
+
+
+extern void InitializeWorkerLatency(void);
+extern WorkerLatency GetWorkerLatency(char *nodeName, int nodePort);
+extern void RecordWorkerLatency(char *nodeName, int nodePort, WorkerLatency latency);
+
+
+#endif /* WORKER_LATENCY_H */
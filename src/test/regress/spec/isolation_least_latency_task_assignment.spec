@@ -0,0 +1,48 @@
+// Tests that the least-latency task assignment policy sends reads away from
+// workers on which other sessions currently run tasks.
+
+setup
+{
+	SELECT citus_internal.replace_isolation_tester_func();
+	SELECT citus_internal.refresh_isolation_tester_prepared_statement();
+
+	SET citus.shard_replication_factor TO 1;
+	SET citus.shard_count TO 2;
+	CREATE TABLE latency_test (x int, y int);
+	SELECT create_distributed_table('latency_test', 'x');
+	INSERT INTO latency_test VALUES (1, 1);
+
+	CREATE TABLE latency_ref (x int);
+	SELECT create_reference_table('latency_ref');
+	INSERT INTO latency_ref VALUES (1);
+}
+
+teardown
+{
+	DROP TABLE latency_test, latency_ref;
+	SELECT citus_internal.restore_isolation_tester_func();
+}
+
+session "s1"
+
+step "s1-begin" { BEGIN; }
+step "s1-update" { UPDATE latency_test SET y = 2 WHERE x = 1; }
+step "s1-commit" { COMMIT; }
+
+session "s2"
+
+setup { SET citus.task_assignment_policy TO 'least-latency'; }
+
+step "s2-select-for-update" { SELECT * FROM latency_test WHERE x = 1 FOR UPDATE; }
+
+session "s3"
+
+step "s3-read" { SELECT current_setting('port') FROM latency_ref; }
+step "s3-least-latency" { SET citus.task_assignment_policy TO 'least-latency'; }
+
+// While s2 waits for the row lock of s1, it runs a task on the worker of the
+// shard of x = 1 (57637). Reads of the reference table start on that worker
+// by default, but go to the other worker under the least-latency policy. No
+// task finished under the policy before, so there is no latency history that
+// could prefer the other worker on its own.
+permutation "s1-begin" "s1-update" "s2-select-for-update" "s3-read" "s3-least-latency" "s3-read" "s1-commit"
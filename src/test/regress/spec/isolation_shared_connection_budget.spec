@@ -0,0 +1,47 @@
+// Tests the shared connection budget of citus.max_shared_pool_size: cached
+// connections count towards the budget and are closed at the end of a
+// transaction when it is used up, and backends waiting for a slot give up
+// after citus.node_connection_timeout.
+
+setup
+{
+	ALTER SYSTEM SET citus.max_shared_pool_size TO 2;
+}
+
+setup
+{
+	SELECT pg_reload_conf();
+	SET citus.shard_replication_factor TO 1;
+	CREATE TABLE shared_pool_test (x int, y int);
+	SELECT create_distributed_table('shared_pool_test', 'x');
+	INSERT INTO shared_pool_test VALUES (1, 1);
+}
+
+teardown
+{
+	DROP TABLE shared_pool_test;
+}
+
+session "s1"
+
+step "s1-set-timeout" { SET citus.node_connection_timeout TO 500; }
+step "s1-select" { SELECT count(*) FROM shared_pool_test WHERE x = 1; }
+step "s1-reset-pool-size" { ALTER SYSTEM RESET citus.max_shared_pool_size; }
+step "s1-reload" { SELECT pg_reload_conf(); }
+
+session "s2"
+
+step "s2-set-timeout" { SET citus.node_connection_timeout TO 500; }
+step "s2-select" { SELECT count(*) FROM shared_pool_test WHERE x = 1; }
+
+session "s3"
+
+step "s3-begin" { BEGIN; }
+step "s3-select" { SELECT count(*) FROM shared_pool_test WHERE x = 1; }
+step "s3-commit" { COMMIT; }
+
+// While s3 uses the second slot, the connection that s1 cached holds on to
+// the first one, so s2 times out waiting rather than hanging. The budget is
+// used up at the end of the transaction of s3, so it closes its connection
+// and frees the slot for s2. s1 still reuses its cached connection afterwards.
+permutation "s1-set-timeout" "s2-set-timeout" "s1-select" "s3-begin" "s3-select" "s2-select" "s3-commit" "s2-select" "s1-select" "s1-reset-pool-size" "s1-reload"
@@ -34,4 +34,148 @@ SELECT sum(result::bigint) FROM run_command_on_workers($$
 $$);
 END;
 
+-- multi-shard commands can send the tasks of a connection in a single batch
+SET citus.executor_command_batch_size TO 4;
+SET citus.max_adaptive_executor_pool_size TO 1;
+
+BEGIN;
+UPDATE test SET y = y + 1;
+SELECT sum(y) FROM test;
+CREATE INDEX test_y_idx ON test (y);
+DELETE FROM test WHERE y = 3;
+SELECT count(*) FROM test;
+COMMIT;
+
+TRUNCATE test;
+SELECT count(*) FROM test;
+RESET citus.executor_command_batch_size;
+
+-- size the pool based on the observed latencies of the workers
+SET citus.enable_latency_aware_pool_sizing TO on;
+SET citus.max_adaptive_executor_pool_size TO 4;
+INSERT INTO test VALUES (1,2), (3,2);
+SELECT count(*) FROM test a JOIN (SELECT x, pg_sleep(0.1) FROM test) b USING (x);
+SELECT count(*) FROM test a JOIN (SELECT x, pg_sleep(0.1) FROM test) b USING (x);
+RESET citus.enable_latency_aware_pool_sizing;
+
+-- connections to the workers are counted across backends
+BEGIN;
+SELECT count(*) FROM test;
+SELECT bool_and(connection_count_to_node > 0) FROM citus_remote_connection_stats
+WHERE port IN (:worker_1_port, :worker_2_port);
+COMMIT;
+
+-- connections can be established ahead of use
+SET citus.prewarm_connections_per_worker TO 2;
+TRUNCATE test;
+SELECT count(*) FROM test;
+SELECT count(*) FROM test;
+RESET citus.prewarm_connections_per_worker;
+
+-- the transaction block can be opened in the same query as the first task
+SET citus.enable_piggybacked_begin TO on;
+BEGIN;
+INSERT INTO test VALUES (1,1), (2,1);
+SELECT count(*) FROM test;
+UPDATE test SET y = y + 1;
+SELECT sum(y) FROM test;
+COMMIT;
+SELECT sum(y) FROM test;
+RESET citus.enable_piggybacked_begin;
+
+-- COMMIT PREPARED can be left to the maintenance daemon, which is triggered
+-- once the transaction ends
+TRUNCATE test;
+INSERT INTO test VALUES (1,1), (2,1);
+SET citus.defer_commit_prepared TO on;
+SET citus.multi_shard_commit_protocol TO '2pc';
+BEGIN;
+SET LOCAL citus.max_adaptive_executor_pool_size TO 1;
+UPDATE test SET y = y + 1;
+COMMIT;
+DO $$
+BEGIN
+  FOR i IN 1 .. 300 LOOP
+    EXIT WHEN NOT EXISTS (SELECT 1 FROM pg_dist_transaction
+                          WHERE split_part(gid, '_', 3) = pg_backend_pid()::text);
+    PERFORM pg_sleep(0.1);
+  END LOOP;
+END;
+$$;
+SELECT count(*) FROM pg_dist_transaction
+WHERE split_part(gid, '_', 3) = pg_backend_pid()::text;
+SELECT sum(result::int) FROM run_command_on_workers(format($$
+  SELECT count(*) FROM pg_prepared_xacts WHERE split_part(gid, '_', 3) = '%s'
+$$, pg_backend_pid()));
+SELECT sum(y) FROM test;
+
+-- without automatic recovery, prepared transactions are committed right away
+ALTER SYSTEM SET citus.recover_2pc_interval TO -1;
+SELECT pg_reload_conf();
+BEGIN;
+SET LOCAL citus.max_adaptive_executor_pool_size TO 1;
+UPDATE test SET y = y;
+COMMIT;
+SELECT sum(result::int) FROM run_command_on_workers(format($$
+  SELECT count(*) FROM pg_prepared_xacts WHERE split_part(gid, '_', 3) = '%s'
+$$, pg_backend_pid()));
+SELECT recover_prepared_transactions();
+RESET citus.defer_commit_prepared;
+
+-- connections that were only read from are committed without 2PC, the keys
+-- 1 and 6 are in different shards on the same worker
+SET citus.enable_read_only_participant_elision TO on;
+INSERT INTO test VALUES (6,1);
+BEGIN;
+SET LOCAL citus.force_max_query_parallelization TO on;
+SELECT count(*) FROM test;
+UPDATE test SET y = y + 1 WHERE x IN (1, 6);
+COMMIT;
+SELECT count(*) FROM pg_dist_transaction
+WHERE split_part(gid, '_', 3) = pg_backend_pid()::text;
+SELECT recover_prepared_transactions();
+
+-- reads with volatile functions may write, so they still use 2PC
+BEGIN;
+SET LOCAL citus.force_max_query_parallelization TO on;
+SELECT count(*) FROM test WHERE y > random();
+UPDATE test SET y = y + 1 WHERE x IN (1, 6);
+COMMIT;
+SELECT count(*) FROM pg_dist_transaction
+WHERE split_part(gid, '_', 3) = pg_backend_pid()::text;
+SELECT recover_prepared_transactions();
+
+-- reads that lock rows hold the locks until commit, so they also use 2PC,
+-- the key 2 is on the other worker than 1 and 6
+BEGIN;
+SELECT y FROM test WHERE x = 2 FOR UPDATE;
+UPDATE test SET y = y WHERE x IN (1, 6);
+COMMIT;
+SELECT count(*) FROM pg_dist_transaction
+WHERE split_part(gid, '_', 3) = pg_backend_pid()::text;
+SELECT recover_prepared_transactions();
+SELECT sum(y) FROM test;
+DELETE FROM test WHERE x = 6;
+RESET citus.enable_read_only_participant_elision;
+RESET citus.multi_shard_commit_protocol;
+ALTER SYSTEM RESET citus.recover_2pc_interval;
+SELECT pg_reload_conf();
+
+-- slow reads of replicated placements are also started on another replica
+CREATE TABLE ref (x int);
+SELECT create_reference_table('ref');
+INSERT INTO ref VALUES (1), (2), (3);
+SET citus.hedged_read_delay TO 1;
+SET client_min_messages TO DEBUG1;
+SELECT count(*) FROM (SELECT x, pg_sleep(0.1) FROM ref) s;
+RESET client_min_messages;
+RESET citus.hedged_read_delay;
+
+-- reads go to the placement with the lowest expected latency
+SET citus.task_assignment_policy TO 'least-latency';
+SELECT count(*) FROM ref;
+SELECT count(*) FROM ref;
+SELECT count(*) FROM test;
+RESET citus.task_assignment_policy;
+
 DROP SCHEMA adaptive_executor CASCADE;
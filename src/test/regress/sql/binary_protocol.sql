@@ -0,0 +1,39 @@
+CREATE SCHEMA binary_protocol;
+SET search_path TO binary_protocol;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4460000;
+
+CREATE TABLE t (key int, value numeric, ts timestamp, data jsonb, arr int[], txt text);
+SELECT create_distributed_table('t', 'key');
+
+INSERT INTO t
+SELECT i, i * 1.5, '2020-01-01'::timestamp + i * interval '1 hour',
+       jsonb_build_object('key', i), ARRAY[i, i * 2], 'row ' || i
+FROM generate_series(1, 5) i;
+INSERT INTO t VALUES (6, NULL, NULL, NULL, NULL, NULL);
+
+SET citus.enable_binary_protocol TO on;
+
+-- multi-shard SELECT with all kinds of types, including NULLs
+SELECT * FROM t ORDER BY key;
+
+-- coordinator aggregation on top of binary results
+SELECT sum(value), max(ts), count(data) FROM t;
+
+-- router query
+SELECT value, data, arr FROM t WHERE key = 3;
+
+-- parameterized query
+PREPARE binary_select(int) AS SELECT key, value FROM t WHERE key > $1 ORDER BY key;
+EXECUTE binary_select(4);
+
+-- string-only results keep using the text format
+SELECT txt FROM t WHERE txt IS NOT NULL ORDER BY txt LIMIT 2;
+
+-- the results are the same as with the text format
+SET citus.enable_binary_protocol TO off;
+SELECT * FROM t ORDER BY key;
+EXECUTE binary_select(4);
+
+DROP SCHEMA binary_protocol CASCADE;
@@ -269,4 +269,75 @@ END;
 -- results should have been deleted after transaction commit
 SELECT * FROM read_intermediate_results(ARRAY['squares_1', 'squares_2']::text[], 'binary') AS res (x int, x2 int);
 
+-- intermediate results can be compressed
+SET citus.intermediate_result_compression TO 'pglz';
+BEGIN;
+SELECT broadcast_intermediate_result('squares_1', 'SELECT s, s*s FROM generate_series(1, 5) s');
+SELECT fetch_intermediate_results(ARRAY['squares_1']::text[], 'localhost', :worker_1_port) > 0 AS fetched;
+SELECT * FROM read_intermediate_result('squares_1', 'binary') AS res (x int, x2 int);
+SELECT create_intermediate_result('squares_2', 'SELECT s, s*s FROM generate_series(1, 1000) s');
+SELECT count(*), sum(x2) FROM read_intermediate_result('squares_2', 'binary') AS res (x int, x2 int);
+END;
+RESET citus.intermediate_result_compression;
+
+-- small intermediate results can be kept in shared memory
+SET citus.max_shared_memory_intermediate_result_size TO '64kB';
+BEGIN;
+SELECT create_intermediate_result('squares_1', 'SELECT s, s*s FROM generate_series(1, 5) s');
+SELECT * FROM read_intermediate_result('squares_1', 'binary') AS res (x int, x2 int);
+SELECT create_intermediate_result('squares_2', 'SELECT s, s*s FROM generate_series(1, 10000) s');
+SELECT count(*), sum(x2) FROM read_intermediate_result('squares_2', 'binary') AS res (x int, x2 int);
+END;
+SELECT * FROM read_intermediate_result('squares_1', 'binary') AS res (x int, x2 int);
+RESET citus.max_shared_memory_intermediate_result_size;
+
+-- subplan results can be reused by later queries
+CREATE TABLE cached_subplans (a int, b int);
+SELECT create_distributed_table('cached_subplans', 'a');
+INSERT INTO cached_subplans SELECT s, s FROM generate_series(1, 10) s;
+SET citus.subplan_result_cache_size TO '1MB';
+-- keep the CTE a subplan on PG12
+SET citus.enable_cte_inlining TO false;
+SET client_min_messages TO DEBUG1;
+WITH top AS (SELECT a, b FROM cached_subplans ORDER BY b DESC LIMIT 3)
+SELECT count(*), sum(top.b) FROM top JOIN cached_subplans USING (a);
+WITH top AS (SELECT a, b FROM cached_subplans ORDER BY b DESC LIMIT 3)
+SELECT count(*), sum(top.b) FROM top JOIN cached_subplans USING (a);
+-- modifications through the coordinator make the cached result outdated
+INSERT INTO cached_subplans VALUES (11, 11);
+WITH top AS (SELECT a, b FROM cached_subplans ORDER BY b DESC LIMIT 3)
+SELECT count(*), sum(top.b) FROM top JOIN cached_subplans USING (a);
+WITH top AS (SELECT a, b FROM cached_subplans ORDER BY b DESC LIMIT 3)
+SELECT count(*), sum(top.b) FROM top JOIN cached_subplans USING (a);
+-- a transaction that modified the table does not use cached results
+BEGIN;
+DELETE FROM cached_subplans WHERE a = 11;
+WITH top AS (SELECT a, b FROM cached_subplans ORDER BY b DESC LIMIT 3)
+SELECT count(*), sum(top.b) FROM top JOIN cached_subplans USING (a);
+ROLLBACK;
+WITH top AS (SELECT a, b FROM cached_subplans ORDER BY b DESC LIMIT 3)
+SELECT count(*), sum(top.b) FROM top JOIN cached_subplans USING (a);
+RESET client_min_messages;
+RESET citus.enable_cte_inlining;
+RESET citus.subplan_result_cache_size;
+
+-- independent subplans run their tasks concurrently
+CREATE TABLE concurrent_subplans (a int, b int);
+SELECT create_distributed_table('concurrent_subplans', 'a');
+INSERT INTO concurrent_subplans SELECT s, s FROM generate_series(1, 10) s;
+SET citus.enable_concurrent_subplan_execution TO on;
+-- keep the CTEs subplans on PG12
+SET citus.enable_cte_inlining TO false;
+-- middle reads the result of low, so its tasks only run once low finished
+SET client_min_messages TO DEBUG1;
+WITH low AS (SELECT a FROM concurrent_subplans ORDER BY a LIMIT 3),
+     high AS (SELECT a FROM concurrent_subplans ORDER BY a DESC LIMIT 3),
+     middle AS (SELECT a FROM concurrent_subplans
+                WHERE a > (SELECT max(a) FROM low) ORDER BY a LIMIT 3)
+SELECT low.a, high.a, middle.a FROM low, high, middle
+WHERE high.a = 11 - low.a AND middle.a = low.a + 3 ORDER BY 1;
+RESET client_min_messages;
+RESET citus.enable_cte_inlining;
+RESET citus.enable_concurrent_subplan_execution;
+
 DROP SCHEMA intermediate_results CASCADE;
@@ -684,6 +684,23 @@ BEGIN;
 
 COMMIT;
 
+-- multiple local tasks can be executed as a single query using parallel workers
+SET citus.max_local_execution_parallel_workers TO 2;
+BEGIN;
+	DELETE FROM distributed_table WHERE key = 500;
+	SELECT count(*) FROM distributed_table;
+	SELECT count(*) FROM distributed_table WHERE key > 550;
+ROLLBACK;
+RESET citus.max_local_execution_parallel_workers;
+
+-- read-only queries run their local tasks while the remote tasks are in progress
+BEGIN;
+	DELETE FROM distributed_table WHERE key = 500;
+	SET LOCAL citus.log_local_commands TO off;
+	SELECT count(*), count(DISTINCT key) FROM distributed_table WHERE key > 550;
+	SELECT key FROM distributed_table WHERE key > 595 ORDER BY key;
+ROLLBACK;
+
 -- sanity check: local execution on partitions
 INSERT INTO collections_list (collection_id) VALUES (0) RETURNING *;
 
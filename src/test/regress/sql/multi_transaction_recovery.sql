@@ -66,6 +66,48 @@ SELECT count(*) FROM pg_tables WHERE tablename = 'should_commit';
 SELECT count(*) FROM pg_tables WHERE tablename = 'should_abort';
 SELECT count(*) FROM pg_tables WHERE tablename = 'should_commit';
 
+-- Create prepared transactions on both workers to check that a single
+-- recovery round handles all of them and reports its work
+BEGIN;
+CREATE TABLE should_commit_on_all_workers (value int);
+PREPARE TRANSACTION 'citus_0_should_commit_on_all_workers';
+
+BEGIN;
+CREATE TABLE should_abort_on_all_workers (value int);
+PREPARE TRANSACTION 'citus_0_should_abort_on_all_workers';
+
+\c - - - :worker_2_port
+
+BEGIN;
+CREATE TABLE should_commit_on_all_workers (value int);
+PREPARE TRANSACTION 'citus_0_should_commit_on_all_workers';
+
+BEGIN;
+CREATE TABLE should_abort_on_all_workers (value int);
+PREPARE TRANSACTION 'citus_0_should_abort_on_all_workers';
+
+\c - - - :master_port
+
+INSERT INTO pg_dist_transaction
+SELECT groupid, gid FROM pg_dist_node,
+  (VALUES ('citus_0_should_commit_on_all_workers'),
+          ('citus_0_should_be_forgotten_on_all_workers')) AS records (gid)
+WHERE nodeport IN (:worker_1_port, :worker_2_port);
+
+SELECT recovered_transaction_count, processed_record_count, deleted_record_count
+FROM recover_prepared_transactions_with_stats();
+SELECT count(*) FROM pg_dist_transaction;
+
+\c - - - :worker_2_port
+SELECT count(*) FROM pg_tables WHERE tablename = 'should_abort_on_all_workers';
+SELECT count(*) FROM pg_tables WHERE tablename = 'should_commit_on_all_workers';
+DROP TABLE should_commit_on_all_workers;
+
+\c - - - :worker_1_port
+SELECT count(*) FROM pg_tables WHERE tablename = 'should_abort_on_all_workers';
+SELECT count(*) FROM pg_tables WHERE tablename = 'should_commit_on_all_workers';
+DROP TABLE should_commit_on_all_workers;
+
 \c - - - :master_port
 SET citus.force_max_query_parallelization TO ON;
 SET citus.shard_replication_factor TO 2;
@@ -0,0 +1,72 @@
+CREATE SCHEMA result_streaming;
+SET search_path TO result_streaming;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4470000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i * 10 FROM generate_series(1, 100) i;
+
+SET citus.enable_result_streaming TO on;
+
+-- coordinator aggregation on top of streamed results
+SELECT count(*), sum(value) FROM t;
+SELECT key, value FROM t ORDER BY key LIMIT 3;
+
+-- the LIMIT ends the scan before all rows are received
+SELECT count(*) FROM (SELECT * FROM t LIMIT 5) s;
+
+-- connections can be used again after ending the scan early
+BEGIN;
+SELECT count(*) FROM (SELECT * FROM t LIMIT 5) s;
+SELECT count(*) FROM t;
+COMMIT;
+
+-- cursors stream results, other queries first receive the remaining rows
+BEGIN;
+DECLARE c CURSOR FOR SELECT value FROM t;
+MOVE 10 IN c;
+SELECT count(*) FROM t;
+MOVE 10 IN c;
+CLOSE c;
+COMMIT;
+
+-- cursors that are not declared as SCROLL can only move forward
+BEGIN;
+DECLARE c CURSOR FOR SELECT value FROM t;
+MOVE 10 IN c;
+FETCH BACKWARD 1 FROM c;
+ROLLBACK;
+
+-- sorting on the coordinator still allows moving backward
+BEGIN;
+DECLARE c CURSOR FOR SELECT key FROM t WHERE key IN (1, 2, 3) ORDER BY key;
+FETCH 2 FROM c;
+FETCH BACKWARD 1 FROM c;
+COMMIT;
+
+SET citus.enable_result_streaming TO off;
+SELECT count(*), sum(value) FROM t;
+
+-- a LIMIT without ORDER BY stops the remaining tasks once it is satisfied
+SET citus.max_adaptive_executor_pool_size TO 1;
+SELECT count(*) FROM (SELECT * FROM t LIMIT 5) s;
+SELECT count(*) FROM (SELECT * FROM t LIMIT 5 OFFSET 90) s;
+BEGIN;
+SELECT count(*) FROM (SELECT * FROM t LIMIT 5) s;
+SELECT count(*), sum(value) FROM t;
+COMMIT;
+RESET citus.max_adaptive_executor_pool_size;
+
+-- partial aggregates are combined as they arrive, also without result streaming
+SET citus.enable_streaming_aggregation TO on;
+SELECT value % 3 AS g, count(*), sum(key) FROM t GROUP BY 1 ORDER BY 1;
+SELECT count(*), max(value) FROM t;
+BEGIN;
+SELECT value % 3 AS g, count(*) FROM t GROUP BY 1 HAVING count(*) > 33 ORDER BY 1;
+SELECT count(*) FROM t;
+COMMIT;
+RESET citus.enable_streaming_aggregation;
+
+DROP SCHEMA result_streaming CASCADE;
@@ -0,0 +1,45 @@
+CREATE SCHEMA sorted_merge;
+SET search_path TO sorted_merge;
+SET citus.shard_count TO 4;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4480000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, (i * 37) % 100 FROM generate_series(1, 100) i;
+INSERT INTO t VALUES (101, NULL);
+
+SET citus.enable_sorted_merge TO on;
+
+-- the workers sort when the LIMIT is pushed down, the coordinator merges
+EXPLAIN (COSTS OFF) SELECT key, value FROM t ORDER BY value LIMIT 5;
+SELECT key, value FROM t ORDER BY value LIMIT 5;
+SELECT key, value FROM t ORDER BY value DESC, key LIMIT 5;
+SELECT value FROM t ORDER BY value NULLS FIRST LIMIT 3;
+
+-- without a LIMIT the workers do not sort, so the coordinator does
+EXPLAIN (COSTS OFF) SELECT key, value FROM t ORDER BY value;
+
+-- scrollable cursors sort the rows on the coordinator instead
+BEGIN;
+DECLARE c SCROLL CURSOR FOR SELECT key FROM t ORDER BY key LIMIT 50;
+FETCH 3 FROM c;
+FETCH BACKWARD 2 FROM c;
+COMMIT;
+
+-- merge streamed results
+SET citus.enable_result_streaming TO on;
+SELECT key, value FROM t ORDER BY value DESC, key LIMIT 5;
+
+-- other queries first receive the remaining rows of the cursor
+BEGIN;
+DECLARE c CURSOR FOR SELECT key FROM t ORDER BY key LIMIT 50;
+FETCH 3 FROM c;
+SELECT count(*) FROM t;
+FETCH 3 FROM c;
+CLOSE c;
+COMMIT;
+
+RESET citus.enable_result_streaming;
+RESET citus.enable_sorted_merge;
+DROP SCHEMA sorted_merge CASCADE;
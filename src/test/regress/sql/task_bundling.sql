@@ -0,0 +1,29 @@
+CREATE SCHEMA task_bundling;
+SET search_path TO task_bundling;
+SET citus.shard_count TO 8;
+SET citus.shard_replication_factor TO 1;
+SET citus.next_shard_id TO 4500000;
+
+CREATE TABLE t (key int, value int);
+SELECT create_distributed_table('t', 'key');
+INSERT INTO t SELECT i, i % 10 FROM generate_series(1, 100) i;
+
+SET citus.enable_task_bundling TO on;
+
+-- the 8 tasks are sent as one query per worker
+EXPLAIN (COSTS OFF) SELECT count(*) FROM t;
+SELECT count(*), sum(value) FROM t;
+SELECT key FROM t WHERE value = 5 ORDER BY key;
+SELECT value, count(*) FROM t GROUP BY value ORDER BY value LIMIT 3;
+
+-- router queries have a single task
+SELECT value FROM t WHERE key = 42;
+
+-- tasks are not bundled in multi-statement transactions
+BEGIN;
+EXPLAIN (COSTS OFF) SELECT count(*) FROM t;
+SELECT count(*) FROM t;
+COMMIT;
+
+SET client_min_messages TO WARNING;
+DROP SCHEMA task_bundling CASCADE;